@@ -0,0 +1,53 @@
+import struct
+
+# Datagrams sent by the server and received by the client, read from
+# either a telemetry file (Xvnc -telemetry, java -Drfb.telemetry=file) or
+# a log with the [P] lines the server and viewer printed before telemetry
+# was recorded, such as server_sample.log and client_sample.log.
+
+TAG = '[P]'
+MAGIC = b'RFBTLM1\n'
+RECORD = struct.Struct('>BBHIIIQII')
+SENT, RENDERED = 2, 5
+
+def telemetry(name, kind):
+	f = open(name, 'rb')
+	if f.read(len(MAGIC)) != MAGIC:
+		f.close()
+		return None
+	records = []
+	while True:
+		data = f.read(RECORD.size)
+		if len(data) < RECORD.size:
+			break
+		record = RECORD.unpack(data)
+		if record[0] == kind:
+			records.append(record)
+	f.close()
+	return records
+
+def sent(name):
+	# (seqNum, frameSeqNum) for each datagram the server sent.
+	records = telemetry(name, SENT)
+	if records is not None:
+		return [(r[4], r[5]) for r in records]
+	result = []
+	for line in open(name):
+		parts = line.strip().split(' ')[2:]
+		if len(parts) == 0 or parts[0] != TAG:
+			continue
+		result.append((int(parts[2]), int(parts[4])))
+	return result
+
+def received(name):
+	# (seqNum, time in ms) for each datagram the client drew.
+	records = telemetry(name, RENDERED)
+	if records is not None:
+		return [(r[4], r[6] // 1000) for r in records]
+	result = []
+	for line in open(name):
+		parts = line.strip().split(' ')
+		if parts[0] != TAG:
+			continue
+		result.append((int(parts[2]), int(parts[4])))
+	return result
@@ -1,21 +1,17 @@
 import sys
 from collections import defaultdict
+import datagrams
 
-TAG = '[P]'
-
-client_log = open(sys.argv[1])
-server_log = open(sys.argv[2])
+# Frame progress at the client: python frames.py client.log server.log,
+# or the viewer's and the server's telemetry files.  Pipe into
+# framerate.py for frame rates.
 
 frame_mapping = {}
 frame_starts = {}
 frame_ends = {}
 
 # Map sequence numbers to frames.
-for line in server_log:
-	parts = line.strip().split(' ')[2:]
-	if len(parts) == 0 or parts[0] != TAG:
-		continue
-	seqNum, frameNum = int(parts[2]), int(parts[4])
+for seqNum, frameNum in datagrams.sent(sys.argv[2]):
 	frame_mapping[seqNum] = frameNum
 	if frameNum not in frame_starts:
 		frame_starts[frameNum] = seqNum
@@ -29,11 +25,7 @@ def frame_size(frameNum):
 start_time = 0
 
 # Calculate client framerate
-for line in client_log:
-	parts = line.strip().split(' ')
-	if parts[0] != TAG:
-		continue
-	seqNum, time = int(parts[2]), int(parts[4])
+for seqNum, time in datagrams.received(sys.argv[1]):
 	# Skip anything the server has not logged.
 	if seqNum not in frame_mapping:
 		assert(seqNum == 4294967295)
@@ -46,6 +38,3 @@ for line in client_log:
 	frame_counts[frameNum] += 1
 	frameProgress = float(frame_counts[frameNum]) / frame_size(frameNum)
 	print time, frameNum, frameProgress
-
-client_log.close()
-server_log.close()
\ No newline at end of file
@@ -0,0 +1,17 @@
+import sys
+import datagrams
+
+# Datagram loss seen by the client: python loss.py client.log server.log
+# Run once with and once without -pace on a link set up by queue_start.sh,
+# e.g. "queue_start.sh 10mbit 20" for a 10 Mbit/s loopback with a 20
+# packet queue; "sudo tc qdisc del dev lo root" removes it again.
+# Telemetry files (viewer.tlm server.tlm) can be given instead of logs.
+
+sent = set(seqNum for seqNum, frameNum in datagrams.sent(sys.argv[2]))
+received = set(seqNum for seqNum, time in datagrams.received(sys.argv[1]))
+
+lost = len(sent - received)
+
+print "datagrams sent: %d" % len(sent)
+print "datagrams lost: %d" % lost
+print "     loss rate: %0.3f%%" % (100.0 * lost / max(len(sent), 1))
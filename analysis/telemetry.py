@@ -0,0 +1,141 @@
+import struct
+import sys
+from collections import defaultdict
+
+# Reads the telemetry files written by Xvnc -telemetry and by the viewer
+# (java -Drfb.telemetry=file), and prints frame rates, datagram loss and
+# input latency:
+#
+#     python telemetry.py server.tlm viewer.tlm
+#
+# Either file alone gives what can be told from its side.  For loss under
+# a shallow queue, run once with and once without -pace on a link set up
+# by queue_start.sh, e.g. "queue_start.sh 10mbit 20" for a 10 Mbit/s
+# loopback with a 20 packet queue; "sudo tc qdisc del dev lo root"
+# removes it again.  The record format is described in telemetry.c.
+#
+# With several viewers attached, the server's records are also broken
+# down by client (two_viewers.sh sets that up).  Each viewer file can only
+# be matched against the server's records of a single client, so the
+# viewer side figures are given when the server file holds just one.
+
+MAGIC = b'RFBTLM1\n'
+RECORD = struct.Struct('>BBHIIIQII')
+NONE = 0xffffffff
+
+INPUT, SENT, ACKED, INPUT_SENT, RENDERED = 1, 2, 3, 4, 5
+SERVER, VIEWER = 0, 1
+
+def read_records(name):
+	f = open(name, 'rb')
+	if f.read(len(MAGIC)) != MAGIC:
+		sys.exit('%s: not a telemetry file' % name)
+	records = []
+	while True:
+		data = f.read(RECORD.size)
+		if len(data) < RECORD.size:
+			break
+		kind, source, client, eventId, seqNum, frameSeqNum, time, nbytes, _ = \
+			RECORD.unpack(data)
+		records.append((time, kind, source, eventId, seqNum, frameSeqNum,
+				nbytes, client))
+	f.close()
+	return records
+
+def percentiles(values):
+	values = sorted(values)
+	n = len(values)
+	if n == 0:
+		return 'no samples'
+	at = lambda p: values[min(n - 1, int(round(p / 100.0 * (n - 1))))]
+	return 'n %d  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f ms' % (
+		n, at(50), at(90), at(99), values[-1])
+
+def latencies(inputs, answers):
+	# Each input is answered by the first answer echoing its eventId or a
+	# later one.  Both lists hold (time, eventId) in time order.
+	result = []
+	j = 0
+	for time, eventId in inputs:
+		while j < len(answers) and (answers[j][0] < time or answers[j][1] < eventId):
+			j += 1
+		if j == len(answers):
+			break
+		result.append((answers[j][0] - time) / 1000.0)
+	return result
+
+records = []
+for name in sys.argv[1:]:
+	records.extend(read_records(name))
+records.sort()
+
+def select(kind, source):
+	return [r for r in records if r[1] == kind and r[2] == source]
+
+sent = select(SENT, SERVER)
+acked = select(ACKED, SERVER)
+rendered = select(RENDERED, VIEWER)
+
+# Per client, as seen by the server: frames sent, and frames all of whose
+# datagrams were acked, over the time that client was being pushed to.
+clients = sorted(set(r[7] for r in sent))
+for client in clients:
+	client_sent = [r for r in sent if r[7] == client]
+	client_acked = set(r[4] for r in acked if r[7] == client)
+	seconds = max((client_sent[-1][0] - client_sent[0][0]) / 1e6, 1e-3)
+	datagrams = defaultdict(set)
+	for r in client_sent:
+		datagrams[r[5]].add(r[4])
+	full = len([f for f in datagrams if datagrams[f] <= client_acked])
+	seqNums = set(r[4] for r in client_sent)
+	print('client %d: sent %0.3f fps, acked %0.3f fps, %d datagrams, '
+	      '%0.3f%% unacked' % (client, len(datagrams) / seconds,
+				   full / seconds, len(seqNums),
+				   100.0 * len(seqNums - client_acked) / len(seqNums)))
+if len(clients) > 1:
+	# Sequence numbers and event ids are per client, so the figures
+	# below would mix clients up.
+	sys.exit(0)
+
+# Frames: a frame is fully shown once all its datagrams are drawn, and
+# partly shown once any of them is.
+frame_of = {}
+frame_size = defaultdict(int)
+for r in sent:
+	if r[4] not in frame_of:
+		frame_of[r[4]] = r[5]
+		frame_size[r[5]] += 1
+
+drawn = defaultdict(set)
+for r in rendered:
+	if r[4] in frame_of:
+		drawn[frame_of[r[4]]].add(r[4])
+
+if rendered:
+	seconds = max((rendered[-1][0] - rendered[0][0]) / 1e6, 1e-3)
+	full = len([f for f in drawn if len(drawn[f]) == frame_size[f]])
+	print('   full framerate (fps): %0.3f' % (full / seconds))
+	print('partial framerate (fps): %0.3f' % (len(drawn) / seconds))
+
+if sent:
+	seqNums = set(frame_of)
+	print('datagrams sent: %d, bytes per datagram %d' % (
+		len(seqNums), sum(r[6] for r in sent) / len(sent)))
+	if rendered:
+		lost = len(seqNums - set(r[4] for r in rendered))
+		print('datagrams lost: %d, loss rate %0.3f%%' % (
+			lost, 100.0 * lost / len(seqNums)))
+
+# Input latency.  Server and viewer clocks differ, so each end is timed
+# against its own records only.
+inputs = [(r[0], r[3]) for r in select(INPUT_SENT, VIEWER)]
+if inputs:
+	print('viewer, input to drawn:  ' +
+	      percentiles(latencies(inputs, [(r[0], r[3]) for r in rendered])))
+
+inputs = [(r[0], r[3]) for r in select(INPUT, SERVER)]
+if inputs:
+	print('server, input to sent:   ' +
+	      percentiles(latencies(inputs, [(r[0], r[3]) for r in sent])))
+	print('server, input to acked:  ' +
+	      percentiles(latencies(inputs, [(r[0], r[3]) for r in acked])))
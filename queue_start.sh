@@ -0,0 +1 @@
+sudo tc qdisc add dev lo root netem rate $1 limit $2
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs two viewers against one Xvnc, each in a network namespace of its
+# own, with netem impairing the second viewer's link only:
+#
+#     Xvnc :1 -telemetry server.tlm &
+#     two_viewers.sh tightvnc-jviewer.jar delay 50ms loss 5%
+#     python analysis/telemetry.py server.tlm
+#
+# Each viewer pushes at its own pace, so telemetry.py should show the
+# first client keeping its frame rate while the second one's drops.
+# The viewers reach the server at 10.77.1.1 and 10.77.2.1, port 5901.
+# Closing both viewers removes the namespaces again.
+
+JAR=$1
+shift
+NETEM=${*:-delay 50ms loss 5%}
+
+cleanup() {
+	for i in 1 2; do
+		sudo ip link del veth$i 2>/dev/null
+		sudo ip netns del vnc$i 2>/dev/null
+	done
+}
+trap cleanup EXIT
+
+for i in 1 2; do
+	sudo ip netns add vnc$i
+	sudo ip link add veth$i type veth peer name eth0 netns vnc$i
+	sudo ip addr add 10.77.$i.1/24 dev veth$i
+	sudo ip link set veth$i up
+	sudo ip netns exec vnc$i ip addr add 10.77.$i.2/24 dev eth0
+	sudo ip netns exec vnc$i ip link set eth0 up
+	sudo ip netns exec vnc$i ip link set lo up
+done
+sudo tc qdisc add dev veth2 root netem $NETEM
+
+for i in 1 2; do
+	sudo ip netns exec vnc$i sudo -u "$USER" \
+		java -Drfb.telemetry=viewer$i.tlm -jar "$JAR" \
+		-host=10.77.$i.1 -port=5901 &
+done
+wait
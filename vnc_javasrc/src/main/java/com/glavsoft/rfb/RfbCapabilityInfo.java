@@ -62,6 +62,12 @@ public class RfbCapabilityInfo {
 	public static final String ENCODING_RICH_CURSOR = "RCHCURSR";
 	public static final String ENCODING_CURSOR_POS = "POINTPOS";
 	public static final String ENCODING_DESKTOP_SIZE = "NEWFBSIZ";
+	public static final String ENCODING_FEC_PARITY = "FECPARIT";
+	public static final String ENCODING_TIGHT_LZ4 = "TIGHTLZ4";
+	public static final String ENCODING_SERVER_PUSH = "SRVRPUSH";
+
+	public static final String CLIENT_MESSAGE_SET_SCALE = "SETSCALE";
+	public static final String CLIENT_MESSAGE_FRAMEBUFFER_UPDATE_NACK = "PUSHNACK";
 
 	private int code;
 	private String vendorSignature;
@@ -35,6 +35,9 @@ public interface ClientToServerMessage {
 	byte POINTER_EVENT = 5;
 	byte CLIENT_CUT_TEXT = 6;
 	byte FRAMEBUFFER_UPDATE_ACK = 7;
+	byte FRAMEBUFFER_UPDATE_SACK = 8;
+	byte SET_SCALE = 9;
+	byte FRAMEBUFFER_UPDATE_NACK = 10;
 
 	void send(Writer writer) throws TransportException;
 }
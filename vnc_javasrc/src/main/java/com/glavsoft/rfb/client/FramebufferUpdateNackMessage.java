@@ -0,0 +1,63 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.rfb.client;
+
+import com.glavsoft.exceptions.TransportException;
+import com.glavsoft.transport.Writer;
+
+/**
+ * Reports pushed datagrams found missing from a gap in the received
+ * sequence numbers, so the server can resend their areas without waiting
+ * for its retransmit timeout.
+ * Bit i of the bitmap stands for datagram baseSequenceNumber + i.
+ */
+public class FramebufferUpdateNackMessage implements ClientToServerMessage {
+	public static final int BITMAP_SIZE = 32;
+
+	private final int baseSequenceNumber;
+	private final int bitmap;
+
+	public FramebufferUpdateNackMessage(int baseSequenceNumber, int bitmap) {
+		this.baseSequenceNumber = baseSequenceNumber;
+		this.bitmap = bitmap;
+	}
+
+	@Override
+	public void send(Writer writer) throws TransportException {
+		writer.write(FRAMEBUFFER_UPDATE_NACK);
+		writer.writeByte(0); // padding
+		writer.writeInt16(0); // padding
+		writer.write(baseSequenceNumber);
+		writer.write(bitmap);
+		writer.flush();
+	}
+
+	@Override
+	public String toString() {
+		return "FramebufferUpdateNackMessage: [baseSequenceNumber: " + (baseSequenceNumber & 0xffffffffL) +
+				", bitmap: " + Integer.toHexString(bitmap) + "]";
+	}
+}
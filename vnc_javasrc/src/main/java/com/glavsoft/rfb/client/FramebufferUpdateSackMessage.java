@@ -0,0 +1,69 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.rfb.client;
+
+import com.glavsoft.exceptions.TransportException;
+import com.glavsoft.transport.Writer;
+
+/**
+ * Acknowledges a batch of pushed datagrams at once.
+ * Bit i of the bitmap acknowledges datagram baseSequenceNumber + i.
+ * ackDelay is the time in ms the newest acknowledged datagram waited
+ * in the client before this message was sent, so the server can
+ * subtract it from its RTT sample. recovered is the number of acknowledged
+ * datagrams that were rebuilt from parity rather than received.
+ */
+public class FramebufferUpdateSackMessage implements ClientToServerMessage {
+	public static final int BITMAP_SIZE = 32;
+
+	private final int baseSequenceNumber;
+	private final int bitmap;
+	private final int ackDelay;
+	private final int recovered;
+
+	public FramebufferUpdateSackMessage(int baseSequenceNumber, int bitmap, int ackDelay, int recovered) {
+		this.baseSequenceNumber = baseSequenceNumber;
+		this.bitmap = bitmap;
+		this.ackDelay = Math.min(Math.max(ackDelay, 0), 0xffff);
+		this.recovered = recovered;
+	}
+
+	@Override
+	public void send(Writer writer) throws TransportException {
+		writer.write(FRAMEBUFFER_UPDATE_SACK);
+		writer.writeByte(recovered);
+		writer.writeInt16(ackDelay);
+		writer.write(baseSequenceNumber);
+		writer.write(bitmap);
+		writer.flush();
+	}
+
+	@Override
+	public String toString() {
+		return "FramebufferUpdateSackMessage: [baseSequenceNumber: " + (baseSequenceNumber & 0xffffffffL) +
+				", bitmap: " + Integer.toHexString(bitmap) + ", ackDelay: " + ackDelay + ", recovered: " + recovered + "]";
+	}
+}
@@ -74,6 +74,22 @@ public enum EncodingType {
      * client side.
      */
 	CURSOR_POS(0xFFFFFF18, "CursorPos"),
+	/**
+	 * Fec Parity pseudo encoding asks the server to follow groups of pushed
+	 * datagrams with parity datagrams, from which a lost one can be rebuilt.
+	 */
+	FEC_PARITY(0xFFFFFF30, "FecParity"),
+	/**
+	 * Tight LZ4 pseudo encoding lets the server compress tight rectangles
+	 * with LZ4 instead of zlib, which costs it much less CPU.
+	 */
+	TIGHT_LZ4(0xFFFFFF31, "TightLz4"),
+	/**
+	 * Server Push pseudo encoding tells the server that this viewer takes
+	 * pushed datagrams, so that it switches to pushing frames once the
+	 * viewer has asked for a few updates.
+	 */
+	SERVER_PUSH(0xFFFFFF32, "ServerPush"),
 
 	COMPRESS_LEVEL_0(0xFFFFFF00 + 0, "CompressionLevel0"),
 	COMPRESS_LEVEL_1(0xFFFFFF00 + 1, "CompressionLevel1"),
@@ -127,6 +143,9 @@ public enum EncodingType {
 		pseudoEncodings.add(RICH_CURSOR);
 		pseudoEncodings.add(CURSOR_POS);
 		pseudoEncodings.add(DESKTOP_SIZE);
+		pseudoEncodings.add(FEC_PARITY);
+		pseudoEncodings.add(TIGHT_LZ4);
+		pseudoEncodings.add(SERVER_PUSH);
 	}
 
 	public static LinkedHashSet<EncodingType> compressionEncodings = new LinkedHashSet<EncodingType>();
@@ -41,6 +41,7 @@ public class TightDecoder extends Decoder {
 
     private static final int FILL_TYPE = 0x08;
     private static final int JPEG_TYPE = 0x09;
+    private static final int LZ4_TYPE = 0x0A;
 
     private static final int FILTER_ID_MASK = 0x40;
     private static final int STREAM_ID_MASK = 0x30;
@@ -54,6 +55,7 @@ public class TightDecoder extends Decoder {
 	Inflater[] decoders;
 
     private int decoderId;
+    private boolean lz4;
 
     final static int tightZlibBufferSize = 512;
 
@@ -68,11 +70,12 @@ public class TightDecoder extends Decoder {
 
 		/**
 		 * bits
-		 * 7 - FILL or JPEG type
-		 * 6 - filter presence flag
+		 * 7 - FILL, JPEG or LZ4 type
+		 * 6 - filter presence flag (always present with LZ4)
 		 * 5, 4 - decoder to use when Basic type (bit 7 not set)
 		 *    or
 		 * 4 - JPEG type when set bit 7
+		 * 5 - LZ4 type when set bit 7
 		 * 3 - reset decoder #3
 		 * 2 - reset decoder #2
 		 * 1 - reset decoder #1
@@ -94,8 +97,11 @@ public class TightDecoder extends Decoder {
 			}
 			processJpegType(reader, renderer, rect);
 			break;
+		case LZ4_TYPE:
+			processBasicType(compControl, reader, renderer, rect);
+			break;
 		default:
-			if (compType > JPEG_TYPE) {
+			if (compType > LZ4_TYPE) {
 //				throw new EncodingException(
 //						"Compression control byte is incorrect!");
 			} else {
@@ -107,9 +113,10 @@ public class TightDecoder extends Decoder {
 	private void processBasicType(int compControl, Reader reader,
 			Renderer renderer, FramebufferUpdateRectangle rect) throws TransportException {
 		decoderId = (compControl & STREAM_ID_MASK) >> 4;
+		lz4 = (compControl >> 4 & 0x0F) == LZ4_TYPE;
 
 		int filterId = 0;
-		if ((compControl & FILTER_ID_MASK) > 0) { // filter byte presence
+		if (lz4 || (compControl & FILTER_ID_MASK) > 0) { // filter byte presence
 			filterId = reader.readUInt8();
 		}
 		int bytesPerCPixel = renderer.getBytesPerPixelSignificant();
@@ -218,7 +225,8 @@ public class TightDecoder extends Decoder {
 
 	/**
 	 * Reads compressed data length, then read compressed data into rawBuffer
-     * and decompress data with expected length == length
+     * and decompress data with expected length == length, with zlib or,
+     * for the LZ4 type, as a single LZ4 block
      *
      * Note: returned data contains not only decompressed data but raw data at array tail
      * which need to be ignored. Use only first expectedLength bytes.
@@ -234,20 +242,82 @@ public class TightDecoder extends Decoder {
 		byte [] buffer = ByteBuffer.getInstance().getBuffer(expectedLength + rawDataLength);
 		// read compressed (raw) data behind space allocated for decompressed data
 		reader.readBytes(buffer, expectedLength, rawDataLength);
-		if (null == decoders[decoderId]) {
-			decoders[decoderId] = new Inflater();
-		}
-		Inflater decoder = decoders[decoderId];
-		decoder.setInput(buffer, expectedLength, rawDataLength);
 		try {
-			decoder.inflate(buffer, 0, expectedLength);
+			if (lz4) {
+				lz4Decompress(buffer, expectedLength,
+						expectedLength + rawDataLength, expectedLength);
+			} else {
+				if (null == decoders[decoderId]) {
+					decoders[decoderId] = new Inflater();
+				}
+				Inflater decoder = decoders[decoderId];
+				decoder.setInput(buffer, expectedLength, rawDataLength);
+				decoder.inflate(buffer, 0, expectedLength);
+			}
 		} catch (DataFormatException e) {
 			logger.throwing("TightDecoder", "readCompressedData", e);
-			throw new TransportException("cannot inflate tight compressed data", e);
+			throw new TransportException("cannot decompress tight compressed data", e);
 		}
 		return buffer;
 	}
 
+	/**
+	 * Decompresses the LZ4 block at buf[in..inEnd) into buf[0..outEnd).
+	 * The block must lie behind the output, as readCompressedData() puts it,
+	 * and must decompress to exactly outEnd bytes.
+	 *
+	 * Each sequence is a token (literal count in the high nibble, match
+	 * length - 4 in the low one, 15 meaning that bytes of up to 255 follow),
+	 * the literals, and a two byte little-endian match offset. The last
+	 * sequence has no match.
+	 */
+	static void lz4Decompress(byte[] buf, int in, int inEnd, int outEnd)
+			throws DataFormatException {
+		int out = 0;
+		while (true) {
+			if (in >= inEnd) throw new DataFormatException("truncated LZ4 block");
+			int token = buf[in++] & 0xFF;
+			int length = token >>> 4;
+			if (15 == length) {
+				int b;
+				do {
+					if (in >= inEnd) throw new DataFormatException("truncated LZ4 block");
+					b = buf[in++] & 0xFF;
+					length += b;
+				} while (255 == b);
+			}
+			if (length > inEnd - in || length > outEnd - out)
+				throw new DataFormatException("LZ4 literals overrun");
+			System.arraycopy(buf, in, buf, out, length);
+			in += length;
+			out += length;
+			if (in == inEnd) break;
+
+			if (inEnd - in < 2) throw new DataFormatException("truncated LZ4 block");
+			int offset = (buf[in] & 0xFF) | (buf[in + 1] & 0xFF) << 8;
+			in += 2;
+			length = token & 0x0F;
+			if (15 == length) {
+				int b;
+				do {
+					if (in >= inEnd) throw new DataFormatException("truncated LZ4 block");
+					b = buf[in++] & 0xFF;
+					length += b;
+				} while (255 == b);
+			}
+			length += 4;
+			if (0 == offset || offset > out || length > outEnd - out)
+				throw new DataFormatException("bad LZ4 match");
+			// byte by byte: the match may overlap what it produces
+			for (int end = out + length; out < end; ++out) {
+				buf[out] = buf[out - offset];
+			}
+		}
+		if (out != outEnd)
+			throw new DataFormatException("LZ4 block decompressed to " + out +
+					" bytes, " + outEnd + " expected");
+	}
+
 	private void processJpegType(Reader reader, Renderer renderer,
 			FramebufferUpdateRectangle rect) throws TransportException {
 		int jpegBufferLength = readCompactSize(reader);
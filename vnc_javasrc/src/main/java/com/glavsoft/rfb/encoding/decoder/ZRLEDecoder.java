@@ -36,7 +36,10 @@ public class ZRLEDecoder extends ZlibDecoder {
 			FramebufferUpdateRectangle rect) throws TransportException {
 		int zippedLength = (int) reader.readUInt32();
 		if (0 == zippedLength) return;
-		int length = rect.width * rect.height * renderer.getBytesPerPixel();
+		// raw tiles take a subencoding byte besides their pixels
+		int length = rect.width * rect.height * renderer.getBytesPerPixel() +
+				((rect.width + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE) *
+				((rect.height + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE);
 		byte[] bytes = unzip(reader, zippedLength, length);
 		int offset = zippedLength;
 		int maxX = rect.x + rect.width;
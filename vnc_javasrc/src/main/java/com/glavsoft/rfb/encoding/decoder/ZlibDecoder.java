@@ -61,6 +61,11 @@ public class ZlibDecoder extends Decoder {
 		} catch (DataFormatException e) {
 			throw new TransportException("cannot inflate Zlib data", e);
 		}
+		// the server ends the stream after every rectangle of a pushed
+		// datagram, so that it decodes on its own; start a new one
+		if (decoder.finished()) {
+			decoder.reset();
+		}
 		return bytes;
 	}
 
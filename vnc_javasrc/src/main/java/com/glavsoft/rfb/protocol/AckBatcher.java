@@ -0,0 +1,170 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.rfb.protocol;
+
+import java.util.Timer;
+import java.util.TimerTask;
+
+import com.glavsoft.rfb.client.ClientToServerMessage;
+import com.glavsoft.rfb.client.FramebufferUpdateNackMessage;
+import com.glavsoft.rfb.client.FramebufferUpdateSackMessage;
+
+/**
+ * Collects acks for pushed datagrams and sends them in batches.
+ *
+ * Received sequence numbers are recorded in a bitmap relative to the
+ * first one of the batch. The batch is sent when a sequence number does
+ * not fit into the bitmap, or at most FLUSH_DELAY ms after its first
+ * datagram arrived, whichever comes first. Datagrams rebuilt from parity
+ * are counted along, so the server can tell real losses from FEC.
+ *
+ * Sequence numbers found missing are nacked NACK_DELAY ms later, unless
+ * they turn up in the meantime, reordered or rebuilt from parity.
+ */
+public class AckBatcher {
+	private static final long FLUSH_DELAY = 5;
+	private static final long NACK_DELAY = 5;
+
+	private final ProtocolContext context;
+	private final Timer timer = new Timer("AckBatcher", true);
+	private TimerTask flushTask;
+
+	private boolean stopped = false;
+	private boolean pending = false;
+	private long baseSequenceNumber;
+	private int bitmap;
+	private long newestSequenceNumber;
+	private long newestReceiveTime;
+	private int recovered = 0;
+
+	private TimerTask nackTask;
+	private boolean nackPending = false;
+	private long nackBaseSequenceNumber;
+	private int nackBitmap;
+
+	public AckBatcher(ProtocolContext context) {
+		this.context = context;
+	}
+
+	public synchronized void received(long sequenceNumber) {
+		if (stopped) return;
+		if (nackPending) {
+			long nackOffset = sequenceNumber - nackBaseSequenceNumber;
+			if (nackOffset >= 0 && nackOffset < FramebufferUpdateNackMessage.BITMAP_SIZE) {
+				nackBitmap &= ~(1 << (int) nackOffset);
+			}
+		}
+		long offset = sequenceNumber - baseSequenceNumber;
+		if (pending && (offset < 0 || offset >= FramebufferUpdateSackMessage.BITMAP_SIZE)) {
+			flush();
+		}
+		long now = System.currentTimeMillis();
+		if ( ! pending) {
+			pending = true;
+			baseSequenceNumber = sequenceNumber;
+			bitmap = 0;
+			newestSequenceNumber = sequenceNumber;
+			newestReceiveTime = now;
+			flushTask = new TimerTask() {
+				@Override
+				public void run() {
+					flush();
+				}
+			};
+			timer.schedule(flushTask, FLUSH_DELAY);
+		}
+		bitmap |= 1 << (int) (sequenceNumber - baseSequenceNumber);
+		if (sequenceNumber >= newestSequenceNumber) {
+			newestSequenceNumber = sequenceNumber;
+			newestReceiveTime = now;
+		}
+	}
+
+	/**
+	 * Counts a datagram rebuilt from parity, which is about to be acked.
+	 */
+	public synchronized void recovered() {
+		++recovered;
+	}
+
+	/**
+	 * Notes that count datagrams from sequenceNumber on did not arrive.
+	 * Only the first BITMAP_SIZE of a longer gap are nacked; the server's
+	 * retransmit timeout takes care of the rest.
+	 */
+	public synchronized void missing(long sequenceNumber, long count) {
+		if (stopped || ! context.getSettings().clientMessagesCapabilities.isSupported(
+				ClientToServerMessage.FRAMEBUFFER_UPDATE_NACK)) return;
+		count = Math.min(count, FramebufferUpdateNackMessage.BITMAP_SIZE);
+		long offset = sequenceNumber - nackBaseSequenceNumber;
+		if (nackPending && (offset < 0 || offset + count > FramebufferUpdateNackMessage.BITMAP_SIZE)) {
+			flushNack();
+		}
+		if ( ! nackPending) {
+			nackPending = true;
+			nackBaseSequenceNumber = sequenceNumber;
+			nackBitmap = 0;
+			nackTask = new TimerTask() {
+				@Override
+				public void run() {
+					flushNack();
+				}
+			};
+			timer.schedule(nackTask, NACK_DELAY);
+		}
+		for (long i = 0; i < count; ++i) {
+			nackBitmap |= 1 << (int) (sequenceNumber + i - nackBaseSequenceNumber);
+		}
+	}
+
+	public synchronized void flushNack() {
+		if ( ! nackPending) return;
+		nackPending = false;
+		nackTask.cancel();
+		nackTask = null;
+		if (nackBitmap != 0) {
+			context.sendMessage(new FramebufferUpdateNackMessage((int) nackBaseSequenceNumber, nackBitmap));
+		}
+	}
+
+	public synchronized void flush() {
+		if ( ! pending) return;
+		pending = false;
+		flushTask.cancel();
+		flushTask = null;
+		int reported = Math.min(recovered, 0xff);
+		recovered -= reported;
+		context.sendMessage(new FramebufferUpdateSackMessage((int) baseSequenceNumber, bitmap,
+				(int) (System.currentTimeMillis() - newestReceiveTime), reported));
+	}
+
+	public synchronized void stop() {
+		stopped = true;
+		pending = false;
+		nackPending = false;
+		timer.cancel();
+	}
+}
@@ -0,0 +1,144 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.rfb.protocol;
+
+import java.net.DatagramSocket;
+import java.nio.ByteBuffer;
+import java.util.logging.Logger;
+
+import com.glavsoft.drawing.Renderer;
+import com.glavsoft.exceptions.CommonException;
+import com.glavsoft.exceptions.TransportException;
+import com.glavsoft.rfb.ClipboardController;
+import com.glavsoft.rfb.IRepaintController;
+import com.glavsoft.rfb.encoding.decoder.DecodersContainer;
+import com.glavsoft.transport.ByteBufferInputStream;
+import com.glavsoft.transport.DatagramReceiver;
+import com.glavsoft.transport.Reader;
+
+/**
+ * Receives pushed framebuffer updates over UDP.
+ *
+ * Every datagram carries one complete FramebufferUpdate and the server
+ * resets the Tight zlib streams for each rectangle, so each datagram is
+ * parsed on its own. A datagram that is truncated or fails to decode is
+ * dropped; it is never acknowledged, so the server will resend its region,
+ * unless it can be rebuilt from a FecParity datagram first.
+ */
+public class DatagramReceiverTask implements Runnable {
+	private static final byte FRAMEBUFFER_UPDATE = 0;
+	private static final byte FEC_PARITY = (byte) 150;
+	private static final int MIN_DATAGRAM_SIZE = 12; // FramebufferUpdate header
+
+	private static Logger logger = Logger.getLogger("com.glavsoft.rfb.protocol.DatagramReceiverTask");
+	private final DatagramReceiver receiver;
+	private final ByteBufferInputStream input;
+	private final ReceiverTask receiverTask;
+	private final FecDecoder fecDecoder = new FecDecoder();
+	private final AckBatcher ackBatcher;
+	private volatile boolean isRunning = false;
+	private long datagramsReceived = 0;
+	private long datagramsDropped = 0;
+
+	public DatagramReceiverTask(DatagramSocket socket,
+			IRepaintController repaintController, ClipboardController clipboardController,
+			DecodersContainer decoders, ProtocolContext context, Renderer renderer,
+			AckBatcher ackBatcher) {
+		receiver = new DatagramReceiver(socket);
+		input = new ByteBufferInputStream();
+		this.ackBatcher = ackBatcher;
+		receiverTask = new ReceiverTask(new Reader(input), repaintController,
+				clipboardController, decoders, context, renderer, ackBatcher);
+	}
+
+	@Override
+	public void run() {
+		isRunning = true;
+		while (isRunning) {
+			ByteBuffer datagram;
+			try {
+				datagram = receiver.receive();
+			} catch (TransportException e) {
+				if (isRunning) {
+					logger.severe("Stop receiving datagrams: " + e.getMessage());
+				}
+				break;
+			}
+			++datagramsReceived;
+			try {
+				if (datagram.remaining() > 0 && datagram.get(0) == FEC_PARITY) {
+					ByteBuffer rebuilt = fecDecoder.recover(datagram);
+					if (rebuilt != null) {
+						logger.fine("Recovered datagram (" + fecDecoder.getDatagramsRecovered() + " so far)");
+						ackBatcher.recovered();
+						parse(rebuilt);
+					}
+				} else {
+					fecDecoder.received(datagram);
+					parse(datagram);
+				}
+			} finally {
+				receiver.release(datagram);
+			}
+		}
+		isRunning = false;
+	}
+
+	private void parse(ByteBuffer datagram) {
+		try {
+			if (datagram.remaining() < MIN_DATAGRAM_SIZE || datagram.get(0) != FRAMEBUFFER_UPDATE) {
+				drop("bad header, " + datagram.remaining() + " bytes");
+				return;
+			}
+			input.setBuffer(datagram);
+			datagram.position(1);
+			receiverTask.framebufferUpdateMessage();
+			if (input.available() != 0) {
+				logger.fine("Datagram has " + input.available() + " trailing bytes");
+			}
+		} catch (CommonException e) {
+			drop(e.getMessage());
+		} catch (RuntimeException e) {
+			drop(e.toString());
+		} finally {
+			input.setBuffer(null);
+		}
+	}
+
+	private void drop(String reason) {
+		++datagramsDropped;
+		logger.fine("Dropped datagram (" + datagramsDropped + " of " + datagramsReceived + "): " + reason);
+	}
+
+	public void setRenderer(Renderer renderer) {
+		receiverTask.setRenderer(renderer);
+	}
+
+	public void stopTask() {
+		isRunning = false;
+		receiver.close();
+	}
+}
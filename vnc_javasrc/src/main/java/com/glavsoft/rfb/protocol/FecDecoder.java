@@ -0,0 +1,120 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+package com.glavsoft.rfb.protocol;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Rebuilds lost pushed datagrams from FecParity datagrams.
+ *
+ * A parity datagram covers a group of consecutive sequence numbers and
+ * holds the XOR of their datagrams. Copies of the most recent datagrams
+ * are kept, so when exactly one datagram of a group is missing, it is the
+ * XOR of the parity with all the others.
+ */
+public class FecDecoder {
+	/** Datagrams kept, more than the largest group the server sends */
+	private static final int HISTORY_SIZE = 64;
+	private static final int PARITY_HEADER_SIZE = 8;
+	private static final int UPDATE_HEADER_SIZE = 12;
+	private static final int SEQUENCE_NUMBER_OFFSET = 8;
+
+	private final byte[][] history = new byte[HISTORY_SIZE][];
+	private final int[] lengths = new int[HISTORY_SIZE];
+	private final long[] sequenceNumbers = new long[HISTORY_SIZE];
+	private long datagramsRecovered = 0;
+
+	public FecDecoder() {
+		for (int i = 0; i < HISTORY_SIZE; ++i) {
+			sequenceNumbers[i] = -1;
+		}
+	}
+
+	/**
+	 * Keeps a copy of a received FramebufferUpdate datagram.
+	 * The buffer's position and limit are left alone.
+	 */
+	public void received(ByteBuffer datagram) {
+		int length = datagram.remaining();
+		if (length < UPDATE_HEADER_SIZE) return;
+		long sequenceNumber = datagram.getInt(datagram.position() + SEQUENCE_NUMBER_OFFSET) & 0xffffffffL;
+		int slot = (int) (sequenceNumber % HISTORY_SIZE);
+		if (null == history[slot] || history[slot].length < length) {
+			history[slot] = new byte[Math.max(length, 1500)];
+		}
+		datagram.duplicate().get(history[slot], 0, length);
+		lengths[slot] = length;
+		sequenceNumbers[slot] = sequenceNumber;
+	}
+
+	/**
+	 * Returns the datagram rebuilt from a FecParity datagram, or null if none
+	 * of its group is missing or more than one is.
+	 */
+	public ByteBuffer recover(ByteBuffer parity) {
+		int start = parity.position();
+		if (parity.remaining() < PARITY_HEADER_SIZE + UPDATE_HEADER_SIZE) return null;
+		int count = parity.get(start + 1) & 0xff;
+		int length = parity.getShort(start + 2) & 0xffff;
+		long firstSequenceNumber = parity.getInt(start + 4) & 0xffffffffL;
+		if (0 == count || count > HISTORY_SIZE) return null;
+
+		long missing = -1;
+		for (int i = 0; i < count; ++i) {
+			long sequenceNumber = (firstSequenceNumber + i) & 0xffffffffL;
+			if (sequenceNumbers[(int) (sequenceNumber % HISTORY_SIZE)] != sequenceNumber) {
+				if (missing != -1) return null;
+				missing = sequenceNumber;
+			}
+		}
+		if (-1 == missing) return null;
+
+		int parityLength = parity.remaining() - PARITY_HEADER_SIZE;
+		byte[] data = new byte[parityLength];
+		ByteBuffer source = parity.duplicate();
+		source.position(start + PARITY_HEADER_SIZE);
+		source.get(data);
+		for (int i = 0; i < count; ++i) {
+			long sequenceNumber = (firstSequenceNumber + i) & 0xffffffffL;
+			if (sequenceNumber == missing) continue;
+			int slot = (int) (sequenceNumber % HISTORY_SIZE);
+			byte[] other = history[slot];
+			for (int j = 0, n = Math.min(lengths[slot], parityLength); j < n; ++j) {
+				data[j] ^= other[j];
+			}
+			length ^= lengths[slot];
+		}
+		if (length < UPDATE_HEADER_SIZE || length > parityLength) return null;
+
+		++datagramsRecovered;
+		ByteBuffer rebuilt = ByteBuffer.wrap(data, 0, length);
+		received(rebuilt);
+		return rebuilt;
+	}
+
+	public long getDatagramsRecovered() {
+		return datagramsRecovered;
+	}
+}
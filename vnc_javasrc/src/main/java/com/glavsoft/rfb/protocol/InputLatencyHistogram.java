@@ -0,0 +1,68 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+package com.glavsoft.rfb.protocol;
+
+/**
+ * Input-to-photon latency of key and pointer events: the time from sending
+ * an event to drawing the first update whose eventId echoes it.
+ *
+ * Buckets hold 0, 1, 2-3, 4-7, ... ms, the last one everything larger,
+ * as in the server's statistics.
+ */
+public class InputLatencyHistogram {
+	private static final int BUCKETS = 10;
+
+	private final long[] counts = new long[BUCKETS];
+	private long events = 0;
+	private long totalMillis = 0;
+	private long maxMillis = 0;
+
+	public synchronized void record(long millis) {
+		if (millis < 0) millis = 0;
+		int bucket = 0;
+		for (long m = millis; m != 0 && bucket < BUCKETS - 1; m >>= 1) {
+			++bucket;
+		}
+		++counts[bucket];
+		++events;
+		totalMillis += millis;
+		maxMillis = Math.max(maxMillis, millis);
+	}
+
+	@Override
+	public synchronized String toString() {
+		StringBuilder sb = new StringBuilder("Input latency (ms): events ").append(events);
+		if (events != 0) {
+			sb.append(", mean ").append(totalMillis / events).append(", max ").append(maxMillis).append(';');
+			for (int i = 0; i < BUCKETS; ++i) {
+				if (0 == counts[i]) continue;
+				sb.append(' ').append(0 == i ? 0 : 1 << (i - 1));
+				if (BUCKETS - 1 == i) sb.append('+');
+				sb.append(':').append(counts[i]);
+			}
+		}
+		return sb.toString();
+	}
+}
@@ -51,7 +51,6 @@ import com.glavsoft.rfb.encoding.decoder.DecodersContainer;
 import com.glavsoft.rfb.protocol.state.HandshakeState;
 import com.glavsoft.rfb.protocol.state.ProtocolState;
 import com.glavsoft.transport.Reader;
-import com.glavsoft.transport.UDPInputStream;
 import com.glavsoft.transport.Writer;
 import com.glavsoft.viewer.RfbConnectionWorker;
 
@@ -69,8 +68,11 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 	private String remoteDesktopName;
 	private MessageQueue messageQueue;
 	private final DecodersContainer decoders;
+	private final DecodersContainer datagramDecoders;
 	private SenderTask senderTask;
 	private ReceiverTask receiverTask;
+	private AckBatcher ackBatcher;
+	private DatagramReceiverTask datagramReceiverTask;
 	private IRfbSessionListener rfbSessionListener;
 	private IRepaintController repaintController;
 	private ClipboardController clipboardController;
@@ -93,6 +95,10 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 		this.worker = worker;
 		decoders = new DecodersContainer();
 		decoders.instantiateDecodersWhenNeeded(settings.encodings);
+		// pushed datagrams get decoders of their own, so their zlib streams
+		// do not interleave with the connection's
+		datagramDecoders = new DecodersContainer();
+		datagramDecoders.instantiateDecodersWhenNeeded(settings.encodings);
 		state = new HandshakeState(this);
 	}
 
@@ -211,14 +217,12 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 
 		Renderer renderer = repaintController.createRenderer(reader, getFbWidth(), getFbHeight(), getPixelFormat());
 
-		UDPInputStream udpInputStream;
+		ackBatcher = new AckBatcher(this);
 		try {
-			udpInputStream = new UDPInputStream(new DatagramSocket(6829));
-			ReceiverTask udpReceiverTask = new ReceiverTask(
-					new Reader(udpInputStream), repaintController,
-					clipboardController,
-					decoders, this, renderer);
-			Thread udpThread = new Thread(udpReceiverTask, "UdpReceiverTask");
+			datagramReceiverTask = new DatagramReceiverTask(new DatagramSocket(6829),
+					repaintController, clipboardController,
+					datagramDecoders, this, renderer, ackBatcher);
+			Thread udpThread = new Thread(datagramReceiverTask, "UdpReceiverTask");
 			udpThread.start();
 		} catch (SocketException e) {
 			e.printStackTrace();
@@ -231,7 +235,7 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 		receiverTask = new ReceiverTask(
 				reader, repaintController,
 				clipboardController,
-				decoders, this, renderer);
+				decoders, this, renderer, ackBatcher);
 		receiverThread = new Thread(receiverTask, "RfbReceiverTask");
 		receiverThread.start();
 	}
@@ -243,6 +247,7 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 
 	private void sendSupportedEncodingsMessage(ProtocolSettings settings) {
 		decoders.instantiateDecodersWhenNeeded(settings.encodings);
+		datagramDecoders.instantiateDecodersWhenNeeded(settings.encodings);
 		SetEncodingsMessage encodingsMessage = new SetEncodingsMessage(settings.encodings);
 		sendMessage(encodingsMessage);
 		logger.fine("sent: " + encodingsMessage.toString());
@@ -289,6 +294,13 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 		logger.fine("sent: full FB Refresh");
 	}
 
+	@Override
+	public void rendererChanged(Renderer renderer) {
+		if (datagramReceiverTask != null) {
+			datagramReceiverTask.setRenderer(renderer);
+		}
+	}
+
 	@Override
 	public void cleanUpSession(String message) {
 		cleanUpSession();
@@ -296,8 +308,11 @@ public class Protocol implements ProtocolContext, IChangeSettingsListener {
 	}
 
 	public synchronized void cleanUpSession() {
+		logger.info(inputLatency.toString());
 		if (senderTask != null) { senderTask.stopTask(); }
 		if (receiverTask != null) { receiverTask.stopTask(); }
+		if (datagramReceiverTask != null) { datagramReceiverTask.stopTask(); }
+		if (ackBatcher != null) { ackBatcher.stop(); }
 		if (senderTask != null) {
 			try {
 				senderThread.join(1000);
@@ -28,6 +28,7 @@ import java.util.HashMap;
 import java.util.Map;
 import java.util.logging.Logger;
 
+import com.glavsoft.drawing.Renderer;
 import com.glavsoft.rfb.IPasswordRetriever;
 import com.glavsoft.rfb.client.ClientToServerMessage;
 import com.glavsoft.rfb.encoding.PixelFormat;
@@ -37,6 +38,7 @@ import com.glavsoft.transport.Writer;
 
 public interface ProtocolContext {
 	Map<Integer, Long> event = new HashMap<Integer, Long>();
+	InputLatencyHistogram inputLatency = new InputLatencyHistogram();
 
 	void changeStateTo(ProtocolState state);
 
@@ -65,6 +67,12 @@ public interface ProtocolContext {
 	String getRemoteDesktopName();
 
 	void sendRefreshMessage();
+
+	/**
+	 * Called when the framebuffer size changed and a new renderer replaced
+	 * the one the receiver tasks were created with.
+	 */
+	void rendererChanged(Renderer renderer);
 	
 	void cleanUpSession(String message);
 
@@ -28,6 +28,7 @@ import com.glavsoft.core.SettingsChangedEvent;
 import com.glavsoft.rfb.CapabilityContainer;
 import com.glavsoft.rfb.IChangeSettingsListener;
 import com.glavsoft.rfb.RfbCapabilityInfo;
+import com.glavsoft.rfb.client.ClientToServerMessage;
 import com.glavsoft.rfb.encoding.EncodingType;
 import com.glavsoft.rfb.protocol.auth.SecurityType;
 
@@ -99,6 +100,7 @@ public class ProtocolSettings implements Serializable {
     	ProtocolSettings settings = new ProtocolSettings();
 	    settings.initKnownAuthCapabilities(settings.authCapabilities);
 	    settings.initKnownEncodingTypesCapabilities(settings.encodingTypesCapabilities);
+	    settings.initKnownClientMessagesCapabilities(settings.clientMessagesCapabilities);
         return settings;
     }
 
@@ -183,6 +185,19 @@ public class ProtocolSettings implements Serializable {
 				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.ENCODING_CURSOR_POS);
 		cc.add(EncodingType.DESKTOP_SIZE.getId(),
 				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.ENCODING_DESKTOP_SIZE);
+		cc.add(EncodingType.FEC_PARITY.getId(),
+				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.ENCODING_FEC_PARITY);
+		cc.add(EncodingType.TIGHT_LZ4.getId(),
+				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.ENCODING_TIGHT_LZ4);
+		cc.add(EncodingType.SERVER_PUSH.getId(),
+				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.ENCODING_SERVER_PUSH);
+	}
+
+	private void initKnownClientMessagesCapabilities(CapabilityContainer cc) {
+		cc.add(ClientToServerMessage.SET_SCALE,
+				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.CLIENT_MESSAGE_SET_SCALE);
+		cc.add(ClientToServerMessage.FRAMEBUFFER_UPDATE_NACK,
+				RfbCapabilityInfo.VENDOR_TIGHT, RfbCapabilityInfo.CLIENT_MESSAGE_FRAMEBUFFER_UPDATE_NACK);
 	}
 
 	public void addListener(IChangeSettingsListener listener) {
@@ -282,6 +297,9 @@ public class ProtocolSettings implements Serializable {
 			encodings.add(EncodingType.CURSOR_POS);
 		}
 		encodings.add(EncodingType.DESKTOP_SIZE);
+		encodings.add(EncodingType.FEC_PARITY);
+		encodings.add(EncodingType.TIGHT_LZ4);
+		encodings.add(EncodingType.SERVER_PUSH);
 		if ( isEncodingsChanged(this.encodings, encodings) || isChangedEncodings()) {
 			this.encodings = encodings;
 			changedSettingsMask |= CHANGED_ENCODINGS;
@@ -26,7 +26,6 @@ package com.glavsoft.rfb.protocol;
 
 import java.io.PrintWriter;
 import java.io.StringWriter;
-import java.util.Date;
 import java.util.logging.Logger;
 
 import com.glavsoft.drawing.Renderer;
@@ -35,7 +34,6 @@ import com.glavsoft.exceptions.ProtocolException;
 import com.glavsoft.exceptions.TransportException;
 import com.glavsoft.rfb.ClipboardController;
 import com.glavsoft.rfb.IRepaintController;
-import com.glavsoft.rfb.client.FramebufferUpdateAckMessage;
 import com.glavsoft.rfb.client.FramebufferUpdateRequestMessage;
 import com.glavsoft.rfb.client.SetPixelFormatMessage;
 import com.glavsoft.rfb.encoding.EncodingType;
@@ -56,12 +54,13 @@ public class ReceiverTask implements Runnable {
 	private static Logger logger = Logger.getLogger("com.glavsoft.rfb.protocol.ReceiverTask");
 	private final Reader reader;
 	private volatile boolean isRunning = false;
-	private Renderer renderer;
+	private volatile Renderer renderer;
 	private final IRepaintController repaintController;
 	private final ClipboardController clipboardController;
 	private final DecodersContainer decoders;
-	private FramebufferUpdateRequestMessage fullscreenFbUpdateIncrementalRequest;
+	private volatile FramebufferUpdateRequestMessage fullscreenFbUpdateIncrementalRequest;
 	private final ProtocolContext context;
+	private final AckBatcher ackBatcher;
 	private PixelFormat pixelFormat;
 	private boolean needSendPixelFormat;
 	
@@ -71,8 +70,10 @@ public class ReceiverTask implements Runnable {
 
 	public ReceiverTask(Reader reader,
 	                    IRepaintController repaintController, ClipboardController clipboardController,
-	                    DecodersContainer decoders, ProtocolContext context, Renderer renderer) {
+	                    DecodersContainer decoders, ProtocolContext context, Renderer renderer,
+	                    AckBatcher ackBatcher) {
 		this.reader = reader;
+		this.ackBatcher = ackBatcher;
 		this.repaintController = repaintController;
 		this.clipboardController = clipboardController;
 		this.context = context;
@@ -163,24 +164,16 @@ public class ReceiverTask implements Runnable {
 		int numberOfRectangles = reader.readUInt16();
 		
 		int serverEventId = reader.readInt32();
-		System.out.println(serverEventId);
-		long now = System.currentTimeMillis();
-		for (int i = lastServerEventId; i <= serverEventId; i++) {
-			synchronized (ProtocolContext.event) {
-				if (ProtocolContext.event.containsKey(i)) {
-					System.out.printf("[E] eventId %d timeDiff %d\n", i, now - ProtocolContext.event.get(i));
-					ProtocolContext.event.remove(i);
-				}
-			}
-		}
-		lastServerEventId = serverEventId;
 		
 		long sequenceNumber = reader.readUInt32();
 		boolean sequenceNumberValid = (sequenceNumber < 0xffffffffL);
 		if (sequenceNumberValid) {
+			// Sequence numbers have no gaps, so the ones skipped were lost.
+			if (largestSequenceNumber >= 0 && sequenceNumber > largestSequenceNumber + 1) {
+				ackBatcher.missing(largestSequenceNumber + 1, sequenceNumber - largestSequenceNumber - 1);
+			}
 			largestSequenceNumber = Math.max(largestSequenceNumber, sequenceNumber);
 		}
-		System.out.printf("[P] seqNum %d time %d\n", sequenceNumber, new Date().getTime());
 		boolean updateValid = !(largestSequenceNumber - sequenceNumber > MAX_SEQUENCE_NUMBER_REORDERING);
 		
 		while (numberOfRectangles-- > 0) {
@@ -201,20 +194,32 @@ public class ReceiverTask implements Runnable {
 				renderer.decodeCursorPosition(rect);
 				repaintController.repaintCursor();
 			} else if (rect.getEncodingType() == EncodingType.DESKTOP_SIZE) {
-				fullscreenFbUpdateIncrementalRequest =
-					new FramebufferUpdateRequestMessage(0, 0, rect.width, rect.height, true);
 				synchronized (renderer.getLock()) {
-					renderer = repaintController.createRenderer(reader, rect.width, rect.height,
-							context.getPixelFormat());
+					setRenderer(repaintController.createRenderer(reader, rect.width, rect.height,
+							context.getPixelFormat()));
 				}
+				context.rendererChanged(renderer);
 				context.sendMessage(new FramebufferUpdateRequestMessage(0, 0, rect.width, rect.height, false));
 //				repaintController.repaintCursor();
 			} else
 				throw new CommonException("Unprocessed encoding: " + rect.toString());
 		}
 		
+		Telemetry.record(Telemetry.RENDERED, serverEventId, sequenceNumber, 0);
+		// Events up to serverEventId are answered once this update is drawn.
+		long now = System.currentTimeMillis();
+		for (int i = lastServerEventId; i <= serverEventId; i++) {
+			synchronized (ProtocolContext.event) {
+				if (ProtocolContext.event.containsKey(i)) {
+					ProtocolContext.inputLatency.record(now - ProtocolContext.event.get(i));
+					ProtocolContext.event.remove(i);
+				}
+			}
+		}
+		lastServerEventId = serverEventId;
+		
 		if (sequenceNumberValid && updateValid) {
-			context.sendMessage(new FramebufferUpdateAckMessage((int) sequenceNumber));
+			ackBatcher.received(sequenceNumber);
 		}
 		
 		synchronized (this) {
@@ -231,6 +236,15 @@ public class ReceiverTask implements Runnable {
 		}
 	}
 
+	/**
+	 * Draws into renderer from now on, which has the new framebuffer size.
+	 */
+	public void setRenderer(Renderer renderer) {
+		fullscreenFbUpdateIncrementalRequest =
+			new FramebufferUpdateRequestMessage(0, 0, renderer.getWidth(), renderer.getHeight(), true);
+		this.renderer = renderer;
+	}
+
 	public synchronized void queueUpdatePixelFormat(PixelFormat pf) {
 		pixelFormat = pf;
 		needSendPixelFormat = true;
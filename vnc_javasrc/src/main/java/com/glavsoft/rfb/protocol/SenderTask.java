@@ -73,6 +73,7 @@ public class SenderTask implements Runnable {
 						ProtocolContext.event.put(kMessage.eventId,
 								System.currentTimeMillis());
 					}
+					Telemetry.record(Telemetry.INPUT_SENT, kMessage.eventId, Telemetry.NONE, 0);
 					message = kMessage;
 					currentEventId++;
 				} else if (message instanceof PointerEventMessage) {
@@ -82,6 +83,7 @@ public class SenderTask implements Runnable {
 						ProtocolContext.event.put(pMessage.eventId,
 								System.currentTimeMillis());
 					}
+					Telemetry.record(Telemetry.INPUT_SENT, pMessage.eventId, Telemetry.NONE, 0);
 					message = pMessage;
 					currentEventId++;
 				}
@@ -0,0 +1,170 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.rfb.protocol;
+
+import java.io.BufferedOutputStream;
+import java.io.DataOutputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.util.Timer;
+import java.util.TimerTask;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.concurrent.atomic.AtomicLongArray;
+import java.util.logging.Logger;
+
+/**
+ * Timing records for input events and drawn updates, written to the file
+ * named by the rfb.telemetry system property in the server's telemetry
+ * format (see telemetry.c), for analysis/telemetry.py to read.
+ *
+ * Records go into a ring that any thread may append to without taking a
+ * lock: a producer claims a slot by advancing head, fills it, and then
+ * publishes it through the slot's sequence number. A timer thread writes
+ * out published records once a second. When the ring is full, records are
+ * dropped rather than holding up the receiving threads.
+ */
+public class Telemetry {
+	public static final int INPUT_SENT = 4;
+	public static final int RENDERED = 5;
+	public static final long NONE = 0xffffffffL;
+
+	private static final int RING_SIZE = 1 << 16;
+	private static final int MASK = RING_SIZE - 1;
+	private static final long FLUSH_INTERVAL = 1000;
+	private static final byte[] MAGIC = {'R', 'F', 'B', 'T', 'L', 'M', '1', '\n'};
+	private static final int SOURCE_VIEWER = 1;
+
+	private static Logger logger = Logger.getLogger("com.glavsoft.rfb.protocol.Telemetry");
+	private static final Telemetry instance = open(System.getProperty("rfb.telemetry"));
+
+	private final AtomicLong head = new AtomicLong();
+	private final AtomicLongArray sequences = new AtomicLongArray(RING_SIZE);
+	private final byte[] kinds = new byte[RING_SIZE];
+	private final int[] eventIds = new int[RING_SIZE];
+	private final int[] seqNums = new int[RING_SIZE];
+	private final long[] times = new long[RING_SIZE];
+	private final int[] bytes = new int[RING_SIZE];
+	private final AtomicLong dropped = new AtomicLong();
+	private final long timeBase;
+
+	private final DataOutputStream out;
+	private long tail = 0; // guarded by this, the only consumer
+
+	/**
+	 * Records an event if telemetry is on. seqNum is NONE for records
+	 * that have none.
+	 */
+	public static void record(int kind, int eventId, long seqNum, int byteCount) {
+		if (instance != null) {
+			instance.add(kind, eventId, seqNum, byteCount);
+		}
+	}
+
+	private static Telemetry open(String fileName) {
+		if (null == fileName) return null;
+		try {
+			return new Telemetry(new DataOutputStream(new BufferedOutputStream(new FileOutputStream(fileName))));
+		} catch (IOException e) {
+			logger.severe("Cannot write telemetry to " + fileName + ": " + e.getMessage());
+			return null;
+		}
+	}
+
+	private Telemetry(DataOutputStream out) throws IOException {
+		this.out = out;
+		out.write(MAGIC);
+		for (int i = 0; i < RING_SIZE; ++i) {
+			sequences.set(i, i);
+		}
+		// Microseconds since the epoch, at nanoTime resolution.
+		timeBase = System.currentTimeMillis() * 1000 - System.nanoTime() / 1000;
+
+		new Timer("Telemetry", true).schedule(new TimerTask() {
+			@Override
+			public void run() {
+				flush();
+			}
+		}, FLUSH_INTERVAL, FLUSH_INTERVAL);
+		Runtime.getRuntime().addShutdownHook(new Thread("TelemetryShutdown") {
+			@Override
+			public void run() {
+				flush();
+			}
+		});
+		logger.info("Writing telemetry to " + System.getProperty("rfb.telemetry"));
+	}
+
+	private void add(int kind, int eventId, long seqNum, int byteCount) {
+		long time = timeBase + System.nanoTime() / 1000;
+		for (;;) {
+			long position = head.get();
+			int slot = (int) (position & MASK);
+			long sequence = sequences.get(slot);
+			if (sequence == position) {
+				if (head.compareAndSet(position, position + 1)) {
+					kinds[slot] = (byte) kind;
+					eventIds[slot] = eventId;
+					seqNums[slot] = (int) seqNum;
+					times[slot] = time;
+					bytes[slot] = byteCount;
+					sequences.set(slot, position + 1);
+					return;
+				}
+			} else if (sequence < position) {
+				// Still waiting to be written out a round ago: full.
+				dropped.incrementAndGet();
+				return;
+			}
+		}
+	}
+
+	private synchronized void flush() {
+		try {
+			for (;;) {
+				int slot = (int) (tail & MASK);
+				if (sequences.get(slot) != tail + 1) break;
+				out.writeByte(kinds[slot]);
+				out.writeByte(SOURCE_VIEWER);
+				out.writeShort(0); // padding
+				out.writeInt(eventIds[slot]);
+				out.writeInt(seqNums[slot]);
+				out.writeInt((int) NONE); // frameSeqNum, known to the server only
+				out.writeLong(times[slot]);
+				out.writeInt(bytes[slot]);
+				out.writeInt(0); // padding
+				sequences.set(slot, tail + RING_SIZE);
+				++tail;
+			}
+			out.flush();
+		} catch (IOException e) {
+			logger.severe("Cannot write telemetry: " + e.getMessage());
+		}
+		long d = dropped.getAndSet(0);
+		if (d != 0) {
+			logger.warning("Telemetry: " + d + " records dropped, the writer fell behind");
+		}
+	}
+}
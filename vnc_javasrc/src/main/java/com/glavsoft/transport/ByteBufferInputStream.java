@@ -0,0 +1,69 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.transport;
+
+import java.io.InputStream;
+import java.nio.ByteBuffer;
+
+/**
+ * InputStream over a single ByteBuffer. Reading past the buffer's limit
+ * returns end of stream, so a truncated message fails with an EOF instead
+ * of consuming bytes that belong to somewhere else.
+ */
+public class ByteBufferInputStream extends InputStream {
+	private ByteBuffer buffer;
+
+	public void setBuffer(ByteBuffer buffer) {
+		this.buffer = buffer;
+	}
+
+	@Override
+	public int available() {
+		return buffer != null ? buffer.remaining() : 0;
+	}
+
+	@Override
+	public int read() {
+		if (available() == 0) return -1;
+		return buffer.get() & 0xff;
+	}
+
+	@Override
+	public int read(byte[] b, int off, int len) {
+		if (len == 0) return 0;
+		int n = Math.min(len, available());
+		if (n == 0) return -1;
+		buffer.get(b, off, n);
+		return n;
+	}
+
+	@Override
+	public long skip(long n) {
+		int skipped = (int) Math.min(Math.max(n, 0), available());
+		buffer.position(buffer.position() + skipped);
+		return skipped;
+	}
+}
@@ -0,0 +1,86 @@
+// Copyright (C) 2010, 2011, 2012, 2013 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+package com.glavsoft.transport;
+
+import java.io.IOException;
+import java.net.DatagramPacket;
+import java.net.DatagramSocket;
+import java.nio.ByteBuffer;
+import java.util.ArrayDeque;
+
+import com.glavsoft.exceptions.TransportException;
+
+/**
+ * Receives whole datagrams into a pool of reusable buffers.
+ * Each call to {@link #receive()} returns one datagram as a ByteBuffer
+ * limited to the datagram's length; hand it back with {@link #release}
+ * once it has been parsed.
+ */
+public class DatagramReceiver {
+	/** Largest UDP payload over IPv4 */
+	public static final int MAX_DATAGRAM_SIZE = 65507;
+	private static final int POOL_SIZE = 4;
+
+	private final DatagramSocket socket;
+	private final DatagramPacket packet = new DatagramPacket(new byte[0], 0);
+	private final ArrayDeque<ByteBuffer> pool = new ArrayDeque<ByteBuffer>(POOL_SIZE);
+
+	public DatagramReceiver(DatagramSocket socket) {
+		this.socket = socket;
+		for (int i = 0; i < POOL_SIZE; ++i) {
+			pool.push(ByteBuffer.allocate(MAX_DATAGRAM_SIZE));
+		}
+	}
+
+	public ByteBuffer receive() throws TransportException {
+		ByteBuffer buffer;
+		synchronized (pool) {
+			buffer = pool.isEmpty() ? ByteBuffer.allocate(MAX_DATAGRAM_SIZE) : pool.pop();
+		}
+		packet.setData(buffer.array(), 0, buffer.capacity());
+		try {
+			socket.receive(packet);
+		} catch (IOException e) {
+			release(buffer);
+			throw new TransportException("Cannot receive datagram", e);
+		}
+		buffer.clear();
+		buffer.limit(packet.getLength());
+		return buffer;
+	}
+
+	public void release(ByteBuffer buffer) {
+		synchronized (pool) {
+			if (pool.size() < POOL_SIZE) {
+				pool.push(buffer);
+			}
+		}
+	}
+
+	public void close() {
+		socket.close();
+	}
+}
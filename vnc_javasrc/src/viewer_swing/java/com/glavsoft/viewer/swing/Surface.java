@@ -28,6 +28,8 @@ import com.glavsoft.core.SettingsChangedEvent;
 import com.glavsoft.drawing.Renderer;
 import com.glavsoft.rfb.IChangeSettingsListener;
 import com.glavsoft.rfb.IRepaintController;
+import com.glavsoft.rfb.client.ClientToServerMessage;
+import com.glavsoft.rfb.client.SetScaleMessage;
 import com.glavsoft.rfb.encoding.PixelFormat;
 import com.glavsoft.rfb.encoding.decoder.FramebufferUpdateRectangle;
 import com.glavsoft.rfb.protocol.ProtocolContext;
@@ -53,6 +55,7 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 	private final ProtocolContext context;
     private SwingViewerWindow viewerWindow;
     private double scaleFactor;
+    private int serverScale = 1;
 	public Dimension oldSize;
 
 	@Override
@@ -85,7 +88,7 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 		isUserInputEnabled = enable;
 		if (enable) {
 			if (null == mouseEventListener) {
-				mouseEventListener = new MouseEventListener(this, context, scaleFactor);
+				mouseEventListener = new MouseEventListener(this, context, displayScale());
 			}
 			addMouseListener(mouseEventListener);
 			addMouseMotionListener(mouseEventListener);
@@ -116,10 +119,38 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 			cursor = renderer.getCursor();
 		}
 		init(renderer.getWidth(), renderer.getHeight());
+		if (mouseEventListener != null) {
+			mouseEventListener.setScaleFactor(displayScale());
+		}
 		updateFrameSize();
+		requestServerScale();
 		return renderer;
 	}
 
+	/**
+	 * Scale from the framebuffer the server sends to the screen. When the
+	 * server reduces the framebuffer for us, only the remainder of
+	 * scaleFactor is left to apply here.
+	 */
+	private double displayScale() {
+		return scaleFactor * context.getFbWidth() / width;
+	}
+
+	/**
+	 * When the desktop is shown at half size or less, ask the server to
+	 * reduce it by the largest whole factor that fits, so it encodes and
+	 * sends fewer pixels.
+	 */
+	private void requestServerScale() {
+		int scale = scaleFactor < 1 ? (int) Math.floor(1 / scaleFactor + 1e-6) : 1;
+		scale = Math.min(scale, SetScaleMessage.MAX_SCALE);
+		if (scale != serverScale &&
+				context.getSettings().clientMessagesCapabilities.isSupported(ClientToServerMessage.SET_SCALE)) {
+			serverScale = scale;
+			context.sendMessage(new SetScaleMessage(scale));
+		}
+	}
+
 	private void init(int width, int height) {
 		this.width = width;
 		this.height = height;
@@ -135,7 +166,8 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 	@Override
 	public void paintComponent(Graphics g) {
         if (null == renderer) return;
-		((Graphics2D)g).scale(scaleFactor, scaleFactor);
+		double scale = displayScale();
+		((Graphics2D)g).scale(scale, scale);
 		((Graphics2D) g).setRenderingHint(RenderingHints.KEY_RENDERING, RenderingHints.VALUE_RENDER_QUALITY);
 		synchronized (renderer.getLock()) {
 			Image offscreenImage = renderer.getOffscreenImage();
@@ -146,7 +178,7 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 		synchronized (cursor.getLock()) {
 			Image cursorImage = cursor.getImage();
 			if (showCursor && cursorImage != null &&
-					(scaleFactor != 1 ||
+					(scale != 1 ||
 							g.getClipBounds().intersects(cursor.rX, cursor.rY, cursor.width, cursor.height))) {
 				g.drawImage(cursorImage, cursor.rX, cursor.rY, null);
 			}
@@ -155,7 +187,8 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 
 	@Override
 	public Dimension getPreferredSize() {
-		return new Dimension((int)(this.width * scaleFactor), (int)(this.height * scaleFactor));
+		double scale = displayScale();
+		return new Dimension((int)(this.width * scale), (int)(this.height * scale));
 	}
 
 	@Override
@@ -181,17 +214,19 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
 
 	@Override
 	public void repaintBitmap(int x, int y, int width, int height) {
-		repaint((int)(x * scaleFactor), (int)(y * scaleFactor),
-                (int)Math.ceil(width * scaleFactor), (int)Math.ceil(height * scaleFactor));
+		double scale = displayScale();
+		repaint((int)(x * scale), (int)(y * scale),
+                (int)Math.ceil(width * scale), (int)Math.ceil(height * scale));
 	}
 
 	@Override
 	public void repaintCursor() {
+		double scale = displayScale();
 		synchronized (cursor.getLock()) {
-			repaint((int)(cursor.oldRX * scaleFactor), (int)(cursor.oldRY * scaleFactor),
-					(int)Math.ceil(cursor.oldWidth * scaleFactor) + 1, (int)Math.ceil(cursor.oldHeight * scaleFactor) + 1);
-			repaint((int)(cursor.rX * scaleFactor), (int)(cursor.rY * scaleFactor),
-					(int)Math.ceil(cursor.width * scaleFactor) + 1, (int)Math.ceil(cursor.height * scaleFactor) + 1);
+			repaint((int)(cursor.oldRX * scale), (int)(cursor.oldRY * scale),
+					(int)Math.ceil(cursor.oldWidth * scale) + 1, (int)Math.ceil(cursor.oldHeight * scale) + 1);
+			repaint((int)(cursor.rX * scale), (int)(cursor.rY * scale),
+					(int)Math.ceil(cursor.width * scale) + 1, (int)Math.ceil(cursor.height * scale) + 1);
 		}
 	}
 
@@ -230,8 +265,9 @@ public class Surface extends JPanel implements IRepaintController, IChangeSettin
                 setLocalCursorShape(uiSettings.getMouseCursorShape());
             }
 		}
-		mouseEventListener.setScaleFactor(scaleFactor);
+		mouseEventListener.setScaleFactor(displayScale());
 		updateFrameSize();
+		requestServerScale();
 	}
 
     public void setLocalCursorShape(LocalMouseCursorShape cursorShape) {
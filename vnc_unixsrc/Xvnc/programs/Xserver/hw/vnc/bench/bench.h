@@ -0,0 +1,48 @@
+/*
+ * bench.h
+ *
+ * Helpers shared by the programs in this directory, see stubs.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+/* Not again after one of the server's .c files has been included. */
+#ifndef MAX_ENCODINGS
+#include "rfb.h"
+#endif
+
+/* What GetTimeInMillis() returns, moved along by the program. */
+extern CARD32 benchMillis;
+
+extern double BenchSeconds(void);
+extern unsigned long long BenchCycles(void);
+extern void BenchFail(char *format, ...);
+extern int benchFailures;
+
+/* Framebuffer contents for BenchSetupScreen(). */
+#define BENCH_DESKTOP 0		/* windows, text, flat colours */
+#define BENCH_PHOTO 1		/* smooth gradients and noise */
+
+/* Bytes the encoders have passed to rfbSendUpdateBuf(). */
+extern unsigned long benchBytesSent;
+
+/* Called for each datagram pace.c sends, if set. */
+extern void (*benchDatagramSent)(rfbClientPtr cl, char *buf, Bool sent);
+
+extern void BenchSetupScreen(int width, int height, int content);
+extern rfbClientPtr BenchNewClient(void);
+extern void BenchFreeClient(rfbClientPtr cl);
+
+/* Levels of simd.c's kernels, see simdlevel.c. */
+#define BENCH_SIMD_C 0
+#define BENCH_SIMD_SSE2 1
+#define BENCH_SIMD_AVX2 2
+#define BENCH_SIMD_LEVELS 3
+
+extern char *benchSimdLevelNames[BENCH_SIMD_LEVELS];
+extern Bool BenchSimdLevel(int level);
+
+/* simd.c's C Shuffle32(), which rfbSimdInit() never installs. */
+extern void (*benchShuffle32C)(CARD8 *dst, CARD8 *src, int n,
+			       CARD8 *shuffle);
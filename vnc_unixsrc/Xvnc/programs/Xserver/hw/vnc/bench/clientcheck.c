@@ -0,0 +1,261 @@
+/*
+ * clientcheck.c
+ *
+ * Check that two push clients keep their own seqNums, unacked datagrams,
+ * RTT and ack state, running both through sendring.c side by side.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Client 0 is on a short path that loses every tenth datagram once both
+ * clients are past their first acks, client 1 on a long, clean one.
+ * Every 10ms each sends a datagram numbered from its own seqNumCounter,
+ * as pushDatagramClose() does.  Both counters
+ * start at the same value, so every seqNum is in flight for both clients
+ * at once.  Acks come back through rfbProcessSack() after each path's
+ * RTT, and retransmits are looked for every 10ms, as rfbServerPush()
+ * does.  The check is that:
+ *
+ *  - each client's seqNums run on from its own counter;
+ *  - an ack retires the acking client's datagram and leaves the other
+ *    client's datagram with the same seqNum in flight;
+ *  - each client's RTT samples, smoothed RTT, retransmit timeout and
+ *    last acked seqNum follow its own path;
+ *  - the lossy client's lost datagrams are requeued, while the clean
+ *    client has nothing requeued once its RTT is known.
+ *
+ * The rest of the ack path, reading the message and the congestion
+ * controller's response to it, is in rfbserver.c and cc.c and is not
+ * run here.
+ */
+
+#include "bench.h"
+
+#define CLIENTS 2
+#define FIRST_SEQNUM 1000
+#define SEND_INTERVAL 10	/* ms */
+#define RUN_TIME 2000		/* ms of sending */
+#define WARMUP 500		/* ms before every RTT is known and loss starts */
+#define DATAGRAM 1000
+
+typedef struct {
+    unsigned long time;
+    CARD32 seqNum;
+} PendingAck;
+
+static unsigned long pathRtt[CLIENTS] = { 20, 200 };
+static int lossEvery[CLIENTS] = { 10, 0 };
+
+static rfbClientPtr pushClients[CLIENTS];
+static PendingAck *acks[CLIENTS];
+static int ackHead[CLIENTS], ackTail[CLIENTS];
+static int ccSamples[CLIENTS];
+static CARD32 lastAcked[CLIENTS];
+static int lost[CLIENTS];	/* sent and never acked */
+
+static void CheckAck(rfbClientPtr cl, unsigned long now, double rtt,
+		     double rate);
+static void Send(int c, unsigned long now);
+static void DeliverAcks(int c, unsigned long now);
+
+static rfbCongestionControl checkCc = {
+    "check", NULL, NULL, CheckAck, NULL, NULL
+};
+
+/* For srRecRequeue; tile diffing is not in play here. */
+
+void
+rfbTileDiffInvalidate(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+}
+
+/* Neither path is a black hole; every tenth datagram lost is not one. */
+
+void
+rfbPathMtuBlackhole(cl)
+    rfbClientPtr cl;
+{
+    BenchFail("client %d: loss taken for a path MTU black hole\n", cl->sock);
+}
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    int requeuedAtWarmup[CLIENTS];
+    unsigned long now;
+    int c, sends = RUN_TIME / SEND_INTERVAL;
+
+    for (c = 0; c < CLIENTS; c++) {
+	pushClients[c] = BenchNewClient();
+	pushClients[c]->sock = c;
+	pushClients[c]->cc = &checkCc;
+	/* As rfbNewClient() starts them. */
+	pushClients[c]->retransmitTimeout = SR_INITIAL_TIMEOUT;
+	pushClients[c]->seqNumCounter = FIRST_SEQNUM;
+	REGION_INIT(pScreen, &pushClients[c]->modifiedRegion, NullBox, 0);
+	acks[c] = (PendingAck *)malloc(sends * sizeof(PendingAck));
+	ackHead[c] = ackTail[c] = 0;
+    }
+
+    for (now = 1; now < RUN_TIME + 1000; now++) {
+	benchMillis = now;
+	for (c = 0; c < CLIENTS; c++)
+	    DeliverAcks(c, now);
+	if (now % SEND_INTERVAL != 0)
+	    continue;
+	if (now == WARMUP) {
+	    for (c = 0; c < CLIENTS; c++)
+		requeuedAtWarmup[c] = pushClients[c]->pushStats.rfbPushDatagramsRequeued;
+	}
+	for (c = 0; c < CLIENTS; c++) {
+	    if (now <= RUN_TIME)
+		Send(c, now);
+	    srRecSetupRetransmit(pushClients[c]);
+	}
+    }
+
+    for (c = 0; c < CLIENTS; c++) {
+	rfbClientPtr cl = pushClients[c];
+	int requeued = cl->pushStats.rfbPushDatagramsRequeued - requeuedAtWarmup[c];
+
+	if (cl->seqNumCounter != FIRST_SEQNUM + sends)
+	    BenchFail("client %d: seqNumCounter %u after %d datagrams\n", c,
+		      (unsigned)cl->seqNumCounter, sends);
+	if (cl->srRecCount != 0)
+	    BenchFail("client %d: %u datagrams still in flight\n", c,
+		      cl->srRecCount);
+	if (ccSamples[c] == 0)
+	    BenchFail("client %d: no RTT samples\n", c);
+	if ((unsigned long)(cl->srtt + 0.5) != pathRtt[c])
+	    BenchFail("client %d: srtt %.1f on a %lums path\n", c, cl->srtt,
+		      pathRtt[c]);
+	if (cl->retransmitTimeout < pathRtt[c] ||
+	    cl->retransmitTimeout > pathRtt[c] + 50)
+	    BenchFail("client %d: retransmit timeout %lu on a %lums path\n", c,
+		      cl->retransmitTimeout, pathRtt[c]);
+	if (cl->lastAckSeqNum != lastAcked[c])
+	    BenchFail("client %d: lastAckSeqNum %u, not %u\n", c,
+		      (unsigned)cl->lastAckSeqNum, (unsigned)lastAcked[c]);
+	if (requeued != lost[c])
+	    BenchFail("client %d: %d datagrams requeued after warm-up, "
+		      "%d lost\n", c, requeued, lost[c]);
+    }
+    if (benchFailures != 0)
+	return 1;
+
+    printf("clientcheck: %d clients kept apart over %d datagrams each\n",
+	   CLIENTS, sends);
+    for (c = 0; c < CLIENTS; c++) {
+	printf("  client %d: %3lums path, srtt %5.1f, timeout %3lu, "
+	       "%d lost and requeued\n", c, pathRtt[c], pushClients[c]->srtt,
+	       pushClients[c]->retransmitTimeout, lost[c]);
+    }
+    return 0;
+}
+
+/* The congestion controller is handed each ack's RTT sample. */
+
+static void
+CheckAck(cl, now, rtt, rate)
+    rfbClientPtr cl;
+    unsigned long now;
+    double rtt;
+    double rate;
+{
+    int c = cl->sock;
+
+    if ((unsigned long)rtt != pathRtt[c])
+	BenchFail("client %d: RTT sample %.1f on a %lums path\n", c, rtt,
+		  pathRtt[c]);
+    ccSamples[c]++;
+}
+
+/*
+ * Send the client's next datagram, covering a tile picked by its seqNum,
+ * and plan its ack unless the path loses it.
+ */
+
+static void
+Send(c, now)
+    int c;
+    unsigned long now;
+{
+    rfbClientPtr cl = pushClients[c];
+    CARD32 seqNum = cl->seqNumCounter++;
+    RegionRec region;
+    BoxRec box;
+
+    box.x1 = (seqNum % 40) * 32;
+    box.y1 = (seqNum / 40 % 25) * 32;
+    box.x2 = box.x1 + 32;
+    box.y2 = box.y1 + 32;
+    REGION_INIT(pScreen, &region, NullBox, 0);
+    REGION_RESET(pScreen, &region, &box);
+    if (!srRecAdd(cl, seqNum, &region, DATAGRAM, now))
+	BenchFail("client %d: srRecAdd %u failed\n", c, (unsigned)seqNum);
+    REGION_UNINIT(pScreen, &region);
+
+    if (lossEvery[c] != 0 && now >= WARMUP && seqNum % lossEvery[c] == 0) {
+	lost[c]++;
+	return;
+    }
+    acks[c][ackTail[c]].time = now + pathRtt[c];
+    acks[c][ackTail[c]].seqNum = seqNum;
+    ackTail[c]++;
+}
+
+/*
+ * Hand the client's acks that are due to rfbProcessSack(), checking that
+ * the other client's datagrams are left as they were.
+ */
+
+static void
+DeliverAcks(c, now)
+    int c;
+    unsigned long now;
+{
+    rfbClientPtr cl = pushClients[c];
+    rfbClientPtr other = pushClients[1 - c];
+    SendRegionRec *otherRec;
+    unsigned int otherCount;
+    Bool otherLive;
+    CARD32 seqNum;
+
+    while (ackHead[c] < ackTail[c] && acks[c][ackHead[c]].time <= now) {
+	seqNum = acks[c][ackHead[c]++].seqNum;
+
+	otherRec = SR_SLOT(other, seqNum);
+	otherLive = (other->srRing != NULL && otherRec->live &&
+		     otherRec->seqNum == seqNum);
+	otherCount = other->srRecCount;
+
+	rfbProcessSack(cl, seqNum, 1, 0);
+	lastAcked[c] = seqNum;
+
+	if (other->srRecCount != otherCount ||
+	    (otherLive && !otherRec->live))
+	    BenchFail("client %d's ack of %u retired client %d's datagram\n",
+		      c, (unsigned)seqNum, 1 - c);
+    }
+}
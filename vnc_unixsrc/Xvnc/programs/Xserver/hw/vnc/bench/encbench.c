@@ -0,0 +1,155 @@
+/*
+ * encbench.c
+ *
+ * Compare ZRLE with Tight: encoding speed and size, over the connection
+ * and pushed.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Over the connection a whole 1280x800 frame is sent as one rectangle,
+ * as the first rectangle of an update (handleNewBlock).  Pushed, the
+ * frame is cut into 128 pixel wide columns, and those into tiles sized
+ * as rfbServerPush() sizes the tiles it packs in order; each tile is
+ * encoded on its own, as pushSendTile() does, so both encoders get the
+ * same tiles.  Tight is run without JPEG, as clients get it by default,
+ * and at JPEG quality 6.
+ */
+
+#include "bench.h"
+
+#define FB_WIDTH 1280
+#define FB_HEIGHT 800
+#define COLUMN 128
+#define DATAGRAM 1400
+#define MIN_SECONDS 1.0
+
+typedef struct {
+    char *name;
+    int encoding;
+    int quality;
+} Encoder;
+
+static Encoder encoders[] = {
+    { "ZRLE", rfbEncodingZRLE, -1 },
+    { "Tight", rfbEncodingTight, -1 },
+    { "Tight q6", rfbEncodingTight, 6 }
+};
+
+#define N_ENCODERS (sizeof(encoders) / sizeof(Encoder))
+
+static Bool SendRect(rfbClientPtr cl, Encoder *enc, int x, int y, int w,
+		     int h);
+static void TimeFrames(Encoder *enc, Bool pushed, double *seconds,
+		       double *bytes);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    static char *contentNames[] = { "desktop", "photo" };
+    double seconds, bytes;
+    int content, pushed, e;
+
+    rfbSimdInit();
+    printf("encbench: %dx%d frame\n", FB_WIDTH, FB_HEIGHT);
+
+    for (content = BENCH_DESKTOP; content <= BENCH_PHOTO; content++) {
+	BenchSetupScreen(FB_WIDTH, FB_HEIGHT, content);
+	for (pushed = FALSE; pushed <= TRUE; pushed++) {
+	    printf("%s, %s:\n", contentNames[content],
+		   pushed ? "pushed tiles" : "connection");
+	    for (e = 0; e < N_ENCODERS; e++) {
+		TimeFrames(&encoders[e], pushed, &seconds, &bytes);
+		printf("  %-9s %7.2f ms/frame %7.1f MPixels/s %9.0f bytes "
+		       "(%.2f bits/pixel)\n", encoders[e].name, seconds * 1e3,
+		       FB_WIDTH * FB_HEIGHT / seconds / 1e6, bytes,
+		       bytes * 8 / (FB_WIDTH * FB_HEIGHT));
+	    }
+	}
+    }
+    return benchFailures != 0;
+}
+
+static Bool
+SendRect(cl, enc, x, y, w, h)
+    rfbClientPtr cl;
+    Encoder *enc;
+    int x, y, w, h;
+{
+    if (enc->encoding == rfbEncodingZRLE)
+	return rfbSendRectEncodingZRLE(cl, x, y, w, h);
+    return rfbSendRectEncodingTight(cl, x, y, w, h);
+}
+
+/*
+ * Send frames until MIN_SECONDS have passed; *seconds gets the time per
+ * frame and *bytes the encoded size of one.
+ */
+
+static void
+TimeFrames(enc, pushed, seconds, bytes)
+    Encoder *enc;
+    Bool pushed;
+    double *seconds, *bytes;
+{
+    rfbClientPtr cl = BenchNewClient();
+    int nPixels = (int)((DATAGRAM - sz_rfbFramebufferUpdateMsg) / 2.0 / 4);
+    int frames = 0, x, y, w, rows;
+    double start, elapsed;
+    unsigned long frameBytes = 0;
+
+    cl->tightQualityLevel = enc->quality;
+    cl->packing = pushed;
+
+    start = BenchSeconds();
+    do {
+	frameBytes = 0;
+	if (!pushed) {
+	    handleNewBlock = 1;
+	    benchBytesSent = 0;
+	    if (!SendRect(cl, enc, 0, 0, FB_WIDTH, FB_HEIGHT))
+		BenchFail("%s: frame not sent\n", enc->name);
+	    rfbSendUpdateBuf(cl);
+	    frameBytes = benchBytesSent;
+	} else {
+	    for (x = 0; x < FB_WIDTH; x += COLUMN) {
+		w = (x + COLUMN <= FB_WIDTH) ? COLUMN : FB_WIDTH - x;
+		rows = (nPixels / w > 0) ? nPixels / w : 1;
+		for (y = 0; y < FB_HEIGHT; y += rows) {
+		    handleNewBlock = 1;
+		    ublen = 0;
+		    if (!SendRect(cl, enc, x, y, w,
+				  (y + rows <= FB_HEIGHT) ? rows : FB_HEIGHT - y))
+			BenchFail("%s: tile not sent\n", enc->name);
+		    frameBytes += ublen;
+		}
+	    }
+	    ublen = 0;
+	}
+	frames++;
+	elapsed = BenchSeconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    *seconds = elapsed / frames;
+    *bytes = frameBytes;
+    BenchFreeClient(cl);
+}
@@ -0,0 +1,623 @@
+/*
+ * gradcheck.c
+ *
+ * Check Tight's gradient filter and smooth-image detection, and the
+ * simd.c kernels under them, against the code they replaced, and time
+ * both on a photographic rectangle.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * tight.c is included whole to get at its static filter and detection
+ * functions.  At each kernel level BenchSimdLevel() can install:
+ *
+ *   - rfbGradientRow32 and rfbPixelDiffs32 are checked against a plain
+ *     per-byte reference, for every row length up to 130 at four start
+ *     alignments, with the colour masks the filters use.
+ *
+ *   - FilterGradient24 and DetectSmoothImage24 are checked against the
+ *     per-component versions they replaced, copied below from before the
+ *     vector kernels with only the context argument added.
+ *
+ *   - FilterGradientBytes32 and DetectSmoothImageBytes32 are checked
+ *     against FilterGradient32 and DetectSmoothImage32, which such
+ *     formats went through before and which are unchanged.
+ *
+ * The functions are run on desktop, photo, smooth and noise content, in
+ * rectangles of odd sizes, for the server and the client both little-
+ * and big-endian and colours in each byte arrangement.
+ *
+ * Then all of them are timed on a 512x128 rectangle of a photo frame.
+ */
+
+/* Before tight.c, whose X headers define max and min. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../tight.c"
+
+#include "bench.h"
+
+#define FB_WIDTH 1280
+#define FB_HEIGHT 800
+#define MAX_ROW 130
+#define TIME_WIDTH 512
+#define TIME_HEIGHT 128
+#define MIN_SECONDS 0.2
+
+/* Colour shifts of the client formats checked. */
+static int layouts[][4] = {	/* red, green, blue, depth */
+    { 16, 8, 0, 24 }, { 0, 8, 16, 24 }, { 8, 0, 16, 24 },
+    { 24, 16, 8, 32 }, { 8, 16, 24, 32 }, { 0, 24, 8, 32 }
+};
+
+static int sizes[][2] = {
+    { 1, 1 }, { 3, 2 }, { 8, 8 }, { 9, 9 }, { 15, 31 }, { 33, 17 },
+    { 64, 8 }, { 100, 37 }, { 129, 64 }, { 301, 9 }
+};
+
+#define MAX_WIDTH 301
+#define MAX_HEIGHT 64
+
+/* After BENCH_DESKTOP and BENCH_PHOTO */
+#define CONTENT_SMOOTH 2	/* see SmoothPixel() */
+#define CONTENT_NOISE 3
+#define N_CONTENTS 4
+
+static char *contentNames[] = { "desktop", "photo", "smooth", "noise" };
+
+/* What is timed */
+#define OP_FILTER24 0
+#define OP_FILTER_BYTES32 1
+#define OP_DETECT24 2
+#define OP_DETECT_BYTES32 3
+#define N_OPS 4
+
+static char *opNames[] = {
+    "FilterGradient24", "FilterGradientBytes32", "DetectSmoothImage24",
+    "DetectSmoothImageBytes32"
+};
+
+static rfbTightContextPtr ctx;
+static CARD32 *frames[N_CONTENTS];	/* FB_WIDTH x FB_HEIGHT of each content */
+static CARD32 src[MAX_WIDTH * MAX_HEIGHT];
+static CARD32 oldBuf[MAX_WIDTH * MAX_HEIGHT];
+static CARD32 newBuf[MAX_WIDTH * MAX_HEIGHT];
+static unsigned long randState = 1;
+
+static int Random(void);
+static CARD32 RandomPixel(void);
+static CARD32 SmoothPixel(CARD32 left);
+static void RefGradientRow(CARD32 *buf, CARD32 *upper, int n, CARD32 mask);
+static void CheckKernels(int level);
+static void CheckFormat(int level, rfbPixelFormat *fmt, int content);
+static void CheckRect(char *what, rfbPixelFormat *fmt, int w, int h);
+static void SetFormat(rfbPixelFormat *fmt, int layout, Bool bigEndian);
+static double TimeOp(int op, Bool old, rfbPixelFormat *fmt);
+static void OldFilterGradient24(rfbTightContextPtr ctx, char *buf,
+				rfbPixelFormat *fmt, int w, int h);
+static unsigned long OldDetectSmoothImage24(rfbTightContextPtr ctx,
+					    rfbPixelFormat *fmt, int w, int h);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    rfbPixelFormat fmt;
+    int level, content, layout, serverBig, clientBig, i;
+
+    ctx = rfbTightNewContext();
+    ctx->prevRowBuf = (int *)malloc(FB_WIDTH * 3 * sizeof(int));
+
+    for (content = 0; content < N_CONTENTS; content++) {
+	frames[content] = (CARD32 *)malloc(FB_WIDTH * FB_HEIGHT * 4);
+	BenchSetupScreen(FB_WIDTH, FB_HEIGHT,
+			 (content == BENCH_DESKTOP) ? BENCH_DESKTOP : BENCH_PHOTO);
+	for (i = 0; i < FB_WIDTH * FB_HEIGHT; i++) {
+	    if (content == CONTENT_NOISE)
+		frames[content][i] = RandomPixel();
+	    else if (content == CONTENT_SMOOTH)
+		frames[content][i] =
+		    SmoothPixel((i % FB_WIDTH == 0) ? RandomPixel()
+				: frames[content][i - 1]);
+	    else
+		frames[content][i] = ((CARD32 *)rfbScreen.pfbMemory)[i];
+	}
+    }
+
+    for (level = 0; level < BENCH_SIMD_LEVELS; level++) {
+	if (!BenchSimdLevel(level)) {
+	    printf("gradcheck: no %s on this CPU, skipped\n",
+		   benchSimdLevelNames[level]);
+	    continue;
+	}
+	CheckKernels(level);
+	for (serverBig = FALSE; serverBig <= TRUE; serverBig++) {
+	    rfbServerFormat.bigEndian = serverBig;
+	    for (layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]);
+		 layout++) {
+		for (clientBig = FALSE; clientBig <= TRUE; clientBig++) {
+		    SetFormat(&fmt, layout, clientBig);
+		    for (content = 0; content < N_CONTENTS; content++)
+			CheckFormat(level, &fmt, content);
+		}
+	    }
+	}
+    }
+    if (benchFailures != 0)
+	return 1;
+    printf("gradcheck: all kernels and filters match the old code\n");
+
+    /* The server's own format, as BenchSetupScreen() sets it. */
+    BenchSetupScreen(FB_WIDTH, FB_HEIGHT, BENCH_PHOTO);
+    printf("MPixels/s, %dx%d photo       old", TIME_WIDTH, TIME_HEIGHT);
+    for (level = 0; level < BENCH_SIMD_LEVELS; level++)
+	printf("%7s", benchSimdLevelNames[level]);
+    printf("\n");
+
+    for (i = 0; i < N_OPS; i++) {
+	/* Bytes32 is for depth 32 clients, whose colours are not packed. */
+	SetFormat(&fmt, (i == OP_FILTER_BYTES32 || i == OP_DETECT_BYTES32)
+		  ? 3 : 0, FALSE);
+	printf("  %-26s%7.0f", opNames[i], TimeOp(i, TRUE, &fmt));
+	for (level = 0; level < BENCH_SIMD_LEVELS; level++) {
+	    if (BenchSimdLevel(level))
+		printf("%7.0f", TimeOp(i, FALSE, &fmt));
+	    else
+		printf("%7s", "-");
+	}
+	printf("\n");
+    }
+    return benchFailures != 0;
+}
+
+static int
+Random()
+{
+    randState = randState * 1103515245 + 12345;
+    return (int)((randState >> 16) & 0x7fff);
+}
+
+/* Often 0 or 255 in a byte, so that the prediction gets clamped. */
+
+static CARD32
+RandomPixel()
+{
+    CARD32 pix = 0;
+    int i, r;
+
+    for (i = 0; i < 4; i++) {
+	r = Random();
+	pix = pix << 8 | ((r & 0x300) == 0 ? 0 : (r & 0x300) == 0x100 ? 0xFF :
+			  (r & 0xFF));
+    }
+    return pix;
+}
+
+/*
+ * The pixel right of left, each colour stepping a little at random, and
+ * noise in the top byte.  Rectangles of these pass for smooth in
+ * DetectSmoothImage*() in most formats, unlike the photo, so that the
+ * error they return gets compared as well as the zero.
+ */
+
+static CARD32
+SmoothPixel(left)
+    CARD32 left;
+{
+    static int steps[32] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, -1, 1, -1, 1, -1, 2, -2, 2, -2, 3, -3, 4, -4, 5, -6
+    };
+    CARD32 pix = (CARD32)(Random() & 0xFF) << 24;
+    int b, c;
+
+    for (b = 0; b < 24; b += 8) {
+	c = (int)(left >> b & 0xFF) + steps[Random() & 31];
+	pix |= (CARD32)((c < 0) ? 0 : (c > 0xFF) ? 0xFF : c) << b;
+    }
+    return pix;
+}
+
+/* The gradient filter as rfbGradientRow32() is described, byte by byte. */
+
+static void
+RefGradientRow(buf, upper, n, mask)
+    CARD32 *buf, *upper;
+    int n;
+    CARD32 mask;
+{
+    CARD32 left = 0, upperLeft = 0, here, up, diff;
+    int x, b, prediction;
+
+    for (x = 0; x < n; x++) {
+	here = buf[x];
+	up = upper[x];
+	diff = 0;
+	for (b = 0; b < 32; b += 8) {
+	    prediction = (int)(left >> b & 0xFF) + (int)(up >> b & 0xFF) -
+		(int)(upperLeft >> b & 0xFF);
+	    if (prediction < 0)
+		prediction = 0;
+	    else if (prediction > 0xFF)
+		prediction = 0xFF;
+	    diff |= (CARD32)(((int)(here >> b & 0xFF) - prediction) & 0xFF) << b;
+	}
+	buf[x] = diff & mask;
+	upper[x] = here;
+	left = here;
+	upperLeft = up;
+    }
+}
+
+static void
+CheckKernels(level)
+    int level;
+{
+    static CARD32 masks[] = {
+	0xFFFFFFFF, 0x00FFFFFF, 0xFFFFFF00, 0xFF00FFFF
+    };
+    CARD32 buf[MAX_ROW + 3], upper[MAX_ROW + 3];
+    CARD32 refBuf[MAX_ROW], refUpper[MAX_ROW];
+    CARD32 p[8], diffs[8];
+    char *name = benchSimdLevelNames[level];
+    int n, m, a, i, b, d0, d1;
+
+    for (n = 0; n <= MAX_ROW; n++) {
+	for (m = 0; m < sizeof(masks) / sizeof(CARD32); m++) {
+	    a = (n + m) % 4;
+	    for (i = 0; i < n; i++) {
+		refBuf[i] = buf[a + i] = RandomPixel();
+		refUpper[i] = upper[a + i] = (n % 3 == 0) ? 0 : RandomPixel();
+	    }
+	    RefGradientRow(refBuf, refUpper, n, masks[m]);
+	    rfbGradientRow32(buf + a, upper + a, n, masks[m]);
+	    for (i = 0; i < n; i++) {
+		if (buf[a + i] != refBuf[i] || upper[a + i] != refUpper[i]) {
+		    BenchFail("%s GradientRow32: %d pixels, mask %08x: pixel "
+			      "%d is %08x above %08x, not %08x above %08x\n",
+			      name, n, masks[m], i, buf[a + i], upper[a + i],
+			      refBuf[i], refUpper[i]);
+		    return;
+		}
+	    }
+	}
+    }
+
+    for (n = 0; n < 1000; n++) {
+	for (i = 0; i < 8; i++)
+	    p[i] = RandomPixel();
+	rfbPixelDiffs32(diffs, p);
+	for (i = 0; i < 7; i++) {
+	    for (b = 0; b < 32; b += 8) {
+		d0 = (int)(diffs[i] >> b & 0xFF);
+		d1 = abs((int)(p[i + 1] >> b & 0xFF) - (int)(p[i] >> b & 0xFF));
+		if (d0 != d1) {
+		    BenchFail("%s PixelDiffs32: %08x to %08x gave %08x\n",
+			      name, p[i], p[i + 1], diffs[i]);
+		    return;
+		}
+	    }
+	}
+    }
+}
+
+static void
+SetFormat(fmt, layout, bigEndian)
+    rfbPixelFormat *fmt;
+    int layout;
+    Bool bigEndian;
+{
+    memset(fmt, 0, sizeof(rfbPixelFormat));
+    fmt->bitsPerPixel = 32;
+    fmt->depth = layouts[layout][3];
+    fmt->bigEndian = bigEndian;
+    fmt->trueColour = TRUE;
+    fmt->redMax = fmt->greenMax = fmt->blueMax = 0xFF;
+    fmt->redShift = layouts[layout][0];
+    fmt->greenShift = layouts[layout][1];
+    fmt->blueShift = layouts[layout][2];
+}
+
+/*
+ * Check each size of rectangle, taken from a few places in the frame of
+ * the given content.
+ */
+
+static void
+CheckFormat(level, fmt, content)
+    int level;
+    rfbPixelFormat *fmt;
+    int content;
+{
+    char what[128];
+    int s, w, h, x, y, j, failures = benchFailures;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+	w = sizes[s][0];
+	h = sizes[s][1];
+	x = (s * 97) % (FB_WIDTH - w);
+	y = (s * 61) % (FB_HEIGHT - h);
+	for (j = 0; j < h; j++)
+	    memcpy(&src[j * w], &frames[content][(y + j) * FB_WIDTH + x],
+		   w * 4);
+
+	sprintf(what, "%s, %s server, %s client %d/%d/%d depth %d, "
+		"%dx%d %s", benchSimdLevelNames[level],
+		rfbServerFormat.bigEndian ? "big-endian" : "little-endian",
+		fmt->bigEndian ? "big-endian" : "little-endian",
+		fmt->redShift, fmt->greenShift, fmt->blueShift, fmt->depth,
+		w, h, contentNames[content]);
+	CheckRect(what, fmt, w, h);
+
+	/* One report per format is enough. */
+	if (benchFailures != failures)
+	    return;
+    }
+}
+
+/* Run old and new on a copy of src each and compare. */
+
+static void
+CheckRect(what, fmt, w, h)
+    char *what;
+    rfbPixelFormat *fmt;
+    int w, h;
+{
+    unsigned long oldError, newError;
+    Bool detect = (w >= DETECT_MIN_WIDTH && h >= DETECT_MIN_HEIGHT);
+
+    if (fmt->depth == 24) {
+	memcpy(oldBuf, src, w * h * 4);
+	memcpy(newBuf, src, w * h * 4);
+	OldFilterGradient24(ctx, (char *)oldBuf, fmt, w, h);
+	FilterGradient24(ctx, (char *)newBuf, fmt, w, h);
+	if (memcmp(oldBuf, newBuf, w * h * 3) != 0)
+	    BenchFail("%s: FilterGradient24 differs\n", what);
+
+	if (detect) {
+	    ctx->tightBeforeBuf = (char *)src;
+	    oldError = OldDetectSmoothImage24(ctx, fmt, w, h);
+	    newError = DetectSmoothImage24(ctx, fmt, w, h);
+	    if (oldError != newError)
+		BenchFail("%s: DetectSmoothImage24 gave %lu, not %lu\n",
+			  what, newError, oldError);
+	}
+    }
+
+    memcpy(oldBuf, src, w * h * 4);
+    memcpy(newBuf, src, w * h * 4);
+    FilterGradient32(ctx, oldBuf, fmt, w, h);
+    FilterGradientBytes32(ctx, newBuf, fmt, ByteChannelMask(fmt), w, h);
+    if (memcmp(oldBuf, newBuf, w * h * 4) != 0)
+	BenchFail("%s: FilterGradientBytes32 differs\n", what);
+
+    if (detect) {
+	ctx->tightBeforeBuf = (char *)src;
+	oldError = DetectSmoothImage32(ctx, fmt, w, h);
+	newError = DetectSmoothImageBytes32(ctx, fmt, w, h);
+	if (oldError != newError)
+	    BenchFail("%s: DetectSmoothImageBytes32 gave %lu, not %lu\n",
+		      what, newError, oldError);
+    }
+}
+
+/*
+ * MPixels/s of the rectangle at 100,100 of the screen.  The filters work
+ * in place, so the rectangle is copied in before each run, and the time
+ * of the copy alone taken off.
+ */
+
+static double
+TimeOp(op, old, fmt)
+    int op;
+    Bool old;
+    rfbPixelFormat *fmt;
+{
+    static CARD32 rect[TIME_WIDTH * TIME_HEIGHT];
+    static CARD32 buf[TIME_WIDTH * TIME_HEIGHT];
+    static double copySeconds = 0;
+    CARD32 *fb = (CARD32 *)rfbScreen.pfbMemory;
+    double start, elapsed;
+    int j, runs;
+
+    for (j = 0; j < TIME_HEIGHT; j++)
+	memcpy(&rect[j * TIME_WIDTH], &fb[(100 + j) * FB_WIDTH + 100],
+	       TIME_WIDTH * 4);
+
+    if (copySeconds == 0) {
+	runs = 0;
+	start = BenchSeconds();
+	do {
+	    memcpy(buf, rect, sizeof(buf));
+	    runs++;
+	    elapsed = BenchSeconds() - start;
+	} while (elapsed < MIN_SECONDS);
+	copySeconds = elapsed / runs;
+    }
+
+    ctx->tightBeforeBuf = (char *)buf;
+    memcpy(buf, rect, sizeof(buf));
+    runs = 0;
+    start = BenchSeconds();
+    do {
+	switch (op) {
+	case OP_FILTER24:
+	    memcpy(buf, rect, sizeof(buf));
+	    if (old)
+		OldFilterGradient24(ctx, (char *)buf, fmt, TIME_WIDTH,
+				    TIME_HEIGHT);
+	    else
+		FilterGradient24(ctx, (char *)buf, fmt, TIME_WIDTH,
+				 TIME_HEIGHT);
+	    break;
+	case OP_FILTER_BYTES32:
+	    memcpy(buf, rect, sizeof(buf));
+	    if (old)
+		FilterGradient32(ctx, buf, fmt, TIME_WIDTH, TIME_HEIGHT);
+	    else
+		FilterGradientBytes32(ctx, buf, fmt, ByteChannelMask(fmt),
+				      TIME_WIDTH, TIME_HEIGHT);
+	    break;
+	case OP_DETECT24:
+	    if (old)
+		OldDetectSmoothImage24(ctx, fmt, TIME_WIDTH, TIME_HEIGHT);
+	    else
+		DetectSmoothImage24(ctx, fmt, TIME_WIDTH, TIME_HEIGHT);
+	    break;
+	case OP_DETECT_BYTES32:
+	    if (old)
+		DetectSmoothImage32(ctx, fmt, TIME_WIDTH, TIME_HEIGHT);
+	    else
+		DetectSmoothImageBytes32(ctx, fmt, TIME_WIDTH, TIME_HEIGHT);
+	    break;
+	}
+	runs++;
+	elapsed = BenchSeconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    elapsed /= runs;
+    if (op == OP_FILTER24 || op == OP_FILTER_BYTES32)
+	elapsed -= copySeconds;
+    return TIME_WIDTH * TIME_HEIGHT / elapsed / 1e6;
+}
+
+
+/*
+ * The per-component code of tight.c before rfbGradientRow32() and
+ * rfbPixelDiffs32(), taking the context as tight.c does now.
+ */
+
+static void
+OldFilterGradient24(ctx, buf, fmt, w, h)
+    rfbTightContextPtr ctx;
+    char *buf;
+    rfbPixelFormat *fmt;
+    int w, h;
+{
+    CARD32 *buf32;
+    CARD32 pix32;
+    int *prevRowPtr;
+    int shiftBits[3];
+    int pixHere[3], pixUpper[3], pixLeft[3], pixUpperLeft[3];
+    int prediction;
+    int x, y, c;
+
+    buf32 = (CARD32 *)buf;
+    memset (ctx->prevRowBuf, 0, w * 3 * sizeof(int));
+
+    if (!rfbServerFormat.bigEndian == !fmt->bigEndian) {
+        shiftBits[0] = fmt->redShift;
+        shiftBits[1] = fmt->greenShift;
+        shiftBits[2] = fmt->blueShift;
+    } else {
+        shiftBits[0] = 24 - fmt->redShift;
+        shiftBits[1] = 24 - fmt->greenShift;
+        shiftBits[2] = 24 - fmt->blueShift;
+    }
+
+    for (y = 0; y < h; y++) {
+        for (c = 0; c < 3; c++) {
+            pixUpper[c] = 0;
+            pixHere[c] = 0;
+        }
+        prevRowPtr = ctx->prevRowBuf;
+        for (x = 0; x < w; x++) {
+            pix32 = *buf32++;
+            for (c = 0; c < 3; c++) {
+                pixUpperLeft[c] = pixUpper[c];
+                pixLeft[c] = pixHere[c];
+                pixUpper[c] = *prevRowPtr;
+                pixHere[c] = (int)(pix32 >> shiftBits[c] & 0xFF);
+                *prevRowPtr++ = pixHere[c];
+
+                prediction = pixLeft[c] + pixUpper[c] - pixUpperLeft[c];
+                if (prediction < 0) {
+                    prediction = 0;
+                } else if (prediction > 0xFF) {
+                    prediction = 0xFF;
+                }
+                *buf++ = (char)(pixHere[c] - prediction);
+            }
+        }
+    }
+}
+
+static unsigned long
+OldDetectSmoothImage24(ctx, fmt, w, h)
+    rfbTightContextPtr ctx;
+    rfbPixelFormat *fmt;
+    int w, h;
+{
+    int off;
+    int x, y, d, dx, c;
+    int diffStat[256];
+    int pixelCount = 0;
+    int pix, left[3];
+    unsigned long avgError;
+
+    /* If client is big-endian, color samples begin from the second
+       byte (offset 1) of a 32-bit pixel value. */
+    off = (fmt->bigEndian != 0);
+
+    memset(diffStat, 0, 256*sizeof(int));
+
+    y = 0, x = 0;
+    while (y < h && x < w) {
+        for (d = 0; d < h - y && d < w - x - DETECT_SUBROW_WIDTH; d++) {
+            for (c = 0; c < 3; c++) {
+                left[c] = (int)ctx->tightBeforeBuf[((y+d)*w+x+d)*4+off+c] & 0xFF;
+            }
+            for (dx = 1; dx <= DETECT_SUBROW_WIDTH; dx++) {
+                for (c = 0; c < 3; c++) {
+                    pix = (int)ctx->tightBeforeBuf[((y+d)*w+x+d+dx)*4+off+c] & 0xFF;
+                    diffStat[abs(pix - left[c])]++;
+                    left[c] = pix;
+                }
+                pixelCount++;
+            }
+        }
+        if (w > h) {
+            x += h;
+            y = 0;
+        } else {
+            x = 0;
+            y += w;
+        }
+    }
+
+    if (diffStat[0] * 33 / pixelCount >= 95)
+        return 0;
+
+    avgError = 0;
+    for (c = 1; c < 8; c++) {
+        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);
+        if (diffStat[c] == 0 || diffStat[c] > diffStat[c-1] * 2)
+            return 0;
+    }
+    for (; c < 256; c++) {
+        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);
+    }
+    avgError /= (pixelCount * 3 - diffStat[0]);
+
+    return avgError;
+}
@@ -0,0 +1,217 @@
+/*
+ * jpegbench.c
+ *
+ * Time Tight's JPEG rectangles at each quality level, against the way
+ * SendJpegRect() worked before it kept its compressor.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ *     jpegbench [tile]
+ *
+ * tight.c is included whole to get at SendJpegRect() and tightConf.  A
+ * 1024x768 photo frame, in the server's 32 bpp little-endian format (BGRX
+ * in memory), is cut into tiles of the given size (default 128) and each
+ * tile sent as a JPEG rectangle, for each of Tight's quality levels.
+ *
+ * "old" is SendJpegRect() as it was: a compressor created and destroyed
+ * for every rectangle, each row repacked into RGB by PrepareRowForJpeg(),
+ * and libjpeg's default, slow integer DCT.  "new" is SendJpegRect() now,
+ * which takes the rows straight from the framebuffer when libjpeg has
+ * JCS_EXTENSIONS, as libjpeg-turbo does.
+ */
+
+/* Before tight.c, whose X headers define max and min. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../tight.c"
+
+#include "bench.h"
+
+#define FB_WIDTH 1024
+#define FB_HEIGHT 768
+#define MIN_SECONDS 0.3
+
+static int tile = 128;
+
+static Bool OldSendJpegRect(rfbTightContextPtr ctx, rfbClientPtr cl,
+			    int x, int y, int w, int h, int quality);
+static void TimeFrames(rfbTightContextPtr ctx, rfbClientPtr cl, Bool old,
+		       double *mpixels, double *bytes);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+    double oldRate, newRate, oldBytes, newBytes;
+    int level, maxAfterSize;
+
+    if (argc > 1)
+	tile = atoi(argv[1]);
+    if (tile <= 0 || tile > FB_HEIGHT) {
+	fprintf(stderr, "usage: jpegbench [tile]\n");
+	return 1;
+    }
+
+    BenchSetupScreen(FB_WIDTH, FB_HEIGHT, BENCH_PHOTO);
+    cl = BenchNewClient();
+    ctx = rfbTightNewContext();
+
+    /* As TightEncodeRect() sizes it, for one tile. */
+    maxAfterSize = tile * tile * 4;
+    maxAfterSize += (maxAfterSize + 99) / 100 + 12;
+    ctx->tightAfterBufSize = maxAfterSize;
+    ctx->tightAfterBuf = (char *)xalloc(maxAfterSize);
+
+    printf("jpegbench: %dx%d tiles of a %dx%d photo, rows %s\n", tile, tile,
+	   FB_WIDTH, FB_HEIGHT, (JpegFramebufferColorSpace() != JCS_UNKNOWN) ?
+	   "fed straight from the framebuffer" : "repacked into RGB");
+    printf("  level jpeg    MPixels/s old   new        "
+	   "bytes/tile old   new\n");
+
+    for (level = 0; level <= 9; level++) {
+	cl->tightQualityLevel = level;
+	TightSetupRect(ctx, cl);
+	TimeFrames(ctx, cl, TRUE, &oldRate, &oldBytes);
+	TimeFrames(ctx, cl, FALSE, &newRate, &newBytes);
+	printf("  %5d %4d  %15.0f %5.0f  %5.2fx  %15.0f %5.0f\n", level,
+	       tightConf[level].jpegQuality, oldRate, newRate,
+	       newRate / oldRate, oldBytes, newBytes);
+    }
+
+    rfbTightFreeContext(ctx);
+    BenchFreeClient(cl);
+    return benchFailures != 0;
+}
+
+/*
+ * Send frames of tiles until MIN_SECONDS have passed; *mpixels gets the
+ * rate and *bytes the mean size of a tile.
+ */
+
+static void
+TimeFrames(ctx, cl, old, mpixels, bytes)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+    Bool old;
+    double *mpixels, *bytes;
+{
+    int quality = tightConf[cl->tightQualityLevel].jpegQuality;
+    int frames = 0, tiles, x, y, w, h, len, nRects;
+    double start, elapsed, pixels = 0;
+    Bool sent;
+
+    start = BenchSeconds();
+    do {
+	tiles = 0;
+	rfbTightResetOutput(ctx);
+	for (y = 0; y < FB_HEIGHT; y += tile) {
+	    h = (y + tile <= FB_HEIGHT) ? tile : FB_HEIGHT - y;
+	    for (x = 0; x < FB_WIDTH; x += tile) {
+		w = (x + tile <= FB_WIDTH) ? tile : FB_WIDTH - x;
+		if (old)
+		    sent = OldSendJpegRect(ctx, cl, x, y, w, h, quality);
+		else
+		    sent = SendJpegRect(ctx, cl, x, y, w, h, quality);
+		if (!sent || ctx->jpegError)
+		    BenchFail("%dx%d at %d,%d not sent as JPEG\n", w, h, x, y);
+		pixels += w * h;
+		tiles++;
+	    }
+	}
+	frames++;
+	elapsed = BenchSeconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    rfbTightContextOutput(ctx, &len, &nRects);
+    *mpixels = pixels / elapsed / 1e6;
+    *bytes = (double)len / tiles;
+}
+
+/*
+ * SendJpegRect() from before the compressor was kept in the context,
+ * taking the context as tight.c does now.
+ */
+
+static Bool
+OldSendJpegRect(ctx, cl, x, y, w, h, quality)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+    int x, y, w, h;
+    int quality;
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    CARD8 *srcBuf;
+    JSAMPROW rowPointer[1];
+    int dy;
+
+    if (rfbServerFormat.bitsPerPixel == 8)
+        return SendFullColorRect(ctx, cl, w, h);
+
+    srcBuf = (CARD8 *)xalloc(w * 3);
+    if (srcBuf == NULL) {
+        return SendFullColorRect(ctx, cl, w, h);
+    }
+    rowPointer[0] = srcBuf;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    JpegSetDstManager (ctx, &cinfo);
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    for (dy = 0; dy < h; dy++) {
+        PrepareRowForJpeg(ctx, srcBuf, x, y + dy, w);
+        jpeg_write_scanlines(&cinfo, rowPointer, 1);
+        if (ctx->jpegError)
+            break;
+    }
+
+    if (!ctx->jpegError)
+        jpeg_finish_compress(&cinfo);
+
+    jpeg_destroy_compress(&cinfo);
+    xfree((char *)srcBuf);
+
+    if (ctx->jpegError)
+        return SendFullColorRect(ctx, cl, w, h);
+
+    if (!TightReserve(ctx, 1))
+        return FALSE;
+
+    ctx->outBuf[ctx->outLen++] = (char)(rfbTightJpeg << 4) | compControl(ctx);
+
+    return SendCompressedData(ctx, ctx->jpegDstDataLen);
+}
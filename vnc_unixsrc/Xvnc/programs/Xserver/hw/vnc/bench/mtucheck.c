@@ -0,0 +1,208 @@
+/*
+ * mtucheck.c
+ *
+ * Check that sendring.c tells a path MTU black hole from ordinary loss
+ * and from an outage.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * A client on a 20ms path is sent a datagram every 10ms, alternately one
+ * of LARGE bytes, or of pushDatagramSize if that is smaller, and one of
+ * SMALL bytes.  Acks come back through rfbProcessSack() and retransmits
+ * are looked for every 10ms, as in clientcheck.c.  The path goes through
+ * these phases:
+ *
+ *  - lossy: every fourth large datagram is lost.  No black hole.
+ *  - black hole: every large datagram is lost.  rfbPathMtuBlackhole() must
+ *    be called once, after MTU_BLACKHOLE_LOSSES of them, and is taken to
+ *    shrink pushDatagramSize as it does in the server.
+ *  - clean: the size is put back, as rfbProbePathMtu() does later.
+ *  - outage: nothing arrives.  No black hole, since nothing smaller
+ *    arrives either.
+ */
+
+#include "bench.h"
+
+#define SEND_INTERVAL 10	/* ms */
+#define PATH_RTT 20		/* ms */
+#define LARGE 1372
+#define SMALL 300
+#define BLACKHOLE_START 600	/* ms, when each phase starts */
+#define CLEAN_START 1200
+#define OUTAGE_START 1500
+#define RUN_TIME 2100
+
+#define PHASE(now) ((now) < BLACKHOLE_START ? "lossy" :		\
+		    (now) < CLEAN_START ? "black hole" :		\
+		    (now) < OUTAGE_START ? "clean" : "outage")
+
+typedef struct {
+    unsigned long time;
+    CARD32 seqNum;
+} PendingAck;
+
+static rfbClientPtr cl;
+static PendingAck acks[RUN_TIME / SEND_INTERVAL];
+static int ackHead = 0, ackTail = 0;
+static int largeSent = 0;
+static int blackholes = 0;
+static unsigned long blackholeTime;
+
+static void Send(unsigned long now);
+static void DeliverAcks(unsigned long now);
+static void CheckAck(rfbClientPtr cl, unsigned long now, double rtt,
+		     double rate);
+
+static rfbCongestionControl checkCc = {
+    "check", NULL, NULL, CheckAck, NULL, NULL
+};
+
+/* For srRecRequeue; tile diffing is not in play here. */
+
+void
+rfbTileDiffInvalidate(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+}
+
+/* As the server does, without the log. */
+
+void
+rfbPathMtuBlackhole(cl)
+    rfbClientPtr cl;
+{
+    unsigned long now = benchMillis;
+
+    if (now < BLACKHOLE_START || now >= CLEAN_START)
+	BenchFail("black hole found at %lums, in the %s phase\n", now,
+		  PHASE(now));
+    else if (cl->mtuLargeLost != MTU_BLACKHOLE_LOSSES)
+	BenchFail("black hole found after %d losses, not %d\n",
+		  cl->mtuLargeLost, MTU_BLACKHOLE_LOSSES);
+
+    cl->pushDatagramSize = MIN_DATAGRAM_SIZE;
+    cl->mtuLargeLost = 0;
+    blackholes++;
+    blackholeTime = now;
+}
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    unsigned long now;
+
+    cl = BenchNewClient();
+    cl->cc = &checkCc;
+    cl->retransmitTimeout = SR_INITIAL_TIMEOUT;
+    cl->pushDatagramSize = LARGE;
+    REGION_INIT(pScreen, &cl->modifiedRegion, NullBox, 0);
+
+    for (now = 1; now < RUN_TIME + 1000; now++) {
+	benchMillis = now;
+	DeliverAcks(now);
+	if (now % SEND_INTERVAL != 0)
+	    continue;
+	if (now == CLEAN_START) {
+	    if (cl->pushDatagramSize != MIN_DATAGRAM_SIZE)
+		BenchFail("datagrams of %d bytes after the black hole\n",
+			  cl->pushDatagramSize);
+	    cl->pushDatagramSize = LARGE;
+	}
+	if (now < RUN_TIME)
+	    Send(now);
+	srRecSetupRetransmit(cl);
+    }
+
+    if (blackholes != 1)
+	BenchFail("%d black holes found, not 1\n", blackholes);
+    if (benchFailures != 0)
+	return 1;
+
+    printf("mtucheck: black hole found %lums into it, after %d losses\n",
+	   blackholeTime - BLACKHOLE_START, MTU_BLACKHOLE_LOSSES);
+    return 0;
+}
+
+/*
+ * Send the next datagram, and plan its ack unless the path loses it.
+ */
+
+static void
+Send(now)
+    unsigned long now;
+{
+    CARD32 seqNum = cl->seqNumCounter++;
+    RegionRec region;
+    BoxRec box;
+    int len = SMALL;
+    Bool lost = FALSE;
+
+    if (seqNum % 2 == 0) {
+	len = (cl->pushDatagramSize < LARGE) ? cl->pushDatagramSize : LARGE;
+	if (len > MIN_DATAGRAM_SIZE) {
+	    largeSent++;
+	    if (now < BLACKHOLE_START)
+		lost = (largeSent % 4 == 0);
+	    else if (now < CLEAN_START)
+		lost = TRUE;
+	}
+    }
+    if (now >= OUTAGE_START)
+	lost = TRUE;
+
+    box.x1 = (seqNum % 40) * 32;
+    box.y1 = (seqNum / 40 % 25) * 32;
+    box.x2 = box.x1 + 32;
+    box.y2 = box.y1 + 32;
+    REGION_INIT(pScreen, &region, NullBox, 0);
+    REGION_RESET(pScreen, &region, &box);
+    if (!srRecAdd(cl, seqNum, &region, len, now))
+	BenchFail("srRecAdd %u failed\n", (unsigned)seqNum);
+    REGION_UNINIT(pScreen, &region);
+
+    if (lost)
+	return;
+    acks[ackTail].time = now + PATH_RTT;
+    acks[ackTail].seqNum = seqNum;
+    ackTail++;
+}
+
+static void
+DeliverAcks(now)
+    unsigned long now;
+{
+    while (ackHead < ackTail && acks[ackHead].time <= now) {
+	rfbProcessSack(cl, acks[ackHead].seqNum, 1, 0);
+	ackHead++;
+    }
+}
+
+static void
+CheckAck(cl, now, rtt, rate)
+    rfbClientPtr cl;
+    unsigned long now;
+    double rtt;
+    double rate;
+{
+}
@@ -0,0 +1,376 @@
+/*
+ * pacebench.c
+ *
+ * Loss at a shallow bottleneck queue with and without -pace, sending
+ * pushed frames through pace.c.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ *     pacebench [fraction]
+ *     pacebench -netem mbits [fraction]
+ *
+ * Frames of 1400 byte datagrams are built in rfbPaceBuffer() and queued
+ * every 33ms, then sent by rfbPaceFrameDone() and rfbPaceSend() over a
+ * real UDP socket to a receiver on the loopback interface, waiting
+ * rfbPaceWait() between sends as rfbServerPush() does.  The datagrams are
+ * numbered, and must all leave, in order.  Each setting is run with
+ * pacing off and with -pace fraction (default 0.8), the bottleneck rate
+ * standing in for the client's measured receivingThroughput.
+ *
+ * By default the bottleneck is simulated: the time each datagram left is
+ * fed to a drop-tail queue of BOTTLENECK_RATE and of each size in
+ * queueSizes, and the datagrams it would drop are counted.  This needs no
+ * privileges, but knows nothing of the kernel's own queues and timer
+ * slack between pace.c and the wire.
+ *
+ * With -netem the bottleneck is the one queue_start.sh puts on the
+ * loopback interface, for instance "queue_start.sh 20mbit 12" for
+ * "pacebench -netem 20", and the receiver counts the datagrams that
+ * really arrive.  The queueing delay is then the time from send to the
+ * kernel's receive timestamp.  The queue size is whatever limit netem was
+ * given, so only the frame size is varied.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bench.h"
+
+#define PUSH_INTERVAL 33	/* ms */
+#define DATAGRAM 1400
+#define BOTTLENECK_RATE 2500000.0	/* bytes per second, 20 Mbit/s */
+#define RUN_FRAMES 60
+#define DRAIN_TIME 500000	/* us without a datagram that ends a run */
+
+static int recvSock = -1;
+static double bottleneckRate = BOTTLENECK_RATE;
+static Bool netem = FALSE;
+
+/* The simulated bottleneck */
+static double queueLimit;	/* bytes */
+static double backlog;		/* bytes */
+static unsigned long lastArrival;
+static unsigned long queued, arrived, dropped;
+static double delaySum;
+
+/* What came through netem */
+static double sendStart;	/* us, when pace.c was last called to send */
+static double *sentAt;		/* us, by datagram number */
+static char *seen;
+static unsigned long received;
+
+static void DatagramSent(rfbClientPtr cl, char *buf, Bool sent);
+static void Send(rfbClientPtr cl);
+static int Receive(void);
+static double Now(void);
+static rfbClientPtr NewPushClient(void);
+static void Run(int frameDatagrams, int queueBytes, double fraction,
+		double *loss, double *delay);
+
+
+/*
+ * Called as pace.c hands each datagram to the kernel.  Without netem the
+ * datagram goes through the simulated bottleneck here.
+ */
+
+static void
+DatagramSent(cl, buf, sent)
+    rfbClientPtr cl;
+    char *buf;
+    Bool sent;
+{
+    unsigned long now = rfbTimeInMicros();
+    int len = DATAGRAM;
+
+    if (*(unsigned long *)buf != arrived)
+	BenchFail("datagram %lu sent as number %lu\n", *(unsigned long *)buf,
+		  arrived);
+
+    if (netem) {
+	sentAt[arrived++] = sendStart;
+	return;
+    }
+
+    if (arrived != 0) {
+	backlog -= (now - lastArrival) * BOTTLENECK_RATE / 1e6;
+	if (backlog < 0)
+	    backlog = 0;
+    }
+    lastArrival = now;
+    arrived++;
+
+    if (backlog + len > queueLimit) {
+	dropped++;
+    } else {
+	backlog += len;
+	delaySum += backlog / BOTTLENECK_RATE;
+    }
+}
+
+/*
+ * Send what pace.c has due.  It hands the datagrams to the kernel in
+ * batches before telling DatagramSent() of them, so they are stamped with
+ * the time the batch was started, and the receiver is only read after.
+ */
+
+static void
+Send(cl)
+    rfbClientPtr cl;
+{
+    sendStart = Now();
+    rfbPaceSend(cl);
+    Receive();
+}
+
+/*
+ * Read whatever has reached the receiver, returning how many datagrams
+ * there were.  With netem, each new one is counted as received, with its
+ * time from send to the kernel's timestamp.
+ */
+
+static int
+Receive()
+{
+    char data[DATAGRAM];
+    char control[CMSG_SPACE(sizeof(struct timeval))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct timeval tv;
+    unsigned long n;
+    int count = 0;
+
+    for (;;) {
+	iov.iov_base = data;
+	iov.iov_len = sizeof(data);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(recvSock, &msg, MSG_DONTWAIT) < (int)sizeof(unsigned long))
+	    break;
+	count++;
+	if (!netem)
+	    continue;
+
+	n = *(unsigned long *)data;
+	if (n >= arrived || seen[n]) {
+	    BenchFail("datagram %lu received unsent or twice\n", n);
+	    continue;
+	}
+	seen[n] = 1;
+	received++;
+
+	gettimeofday(&tv, NULL);
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	    if (cmsg->cmsg_level == SOL_SOCKET &&
+		cmsg->cmsg_type == SO_TIMESTAMP)
+		memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+	}
+	delaySum += (tv.tv_sec * 1e6 + tv.tv_usec - sentAt[n]) / 1e6;
+    }
+    return count;
+}
+
+/* In us, by the clock the kernel timestamps datagrams with. */
+
+static double
+Now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    static int frameSizes[] = { 15, 30, 45 };
+    static int queueSizes[] = { 16384, 65536 };
+    double fraction = 0.8;
+    double loss[2], delay[2];
+    int f, q, nQueues = sizeof(queueSizes) / sizeof(int);
+
+    if (argc > 2 && strcmp(argv[1], "-netem") == 0) {
+	netem = TRUE;
+	bottleneckRate = atof(argv[2]) * 1e6 / 8;
+	nQueues = 1;
+	argc -= 2;
+	argv += 2;
+    }
+    if (argc > 1)
+	fraction = atof(argv[1]);
+    if (bottleneckRate <= 0 || fraction < 0 || fraction > 1) {
+	fprintf(stderr, "usage: pacebench [-netem mbits] [fraction]\n");
+	return 1;
+    }
+
+    benchDatagramSent = DatagramSent;
+
+    printf("pacebench: %.0f Mbit/s %s bottleneck, a frame every %dms, "
+	   "-pace %.2f\n", bottleneckRate * 8 / 1e6,
+	   netem ? "netem" : "simulated", PUSH_INTERVAL, fraction);
+    printf("  frame   queue    loss unpaced/paced   queueing ms unpaced/paced\n");
+
+    for (f = 0; f < sizeof(frameSizes) / sizeof(int); f++) {
+	for (q = 0; q < nQueues; q++) {
+	    Run(frameSizes[f], queueSizes[q], 0.0, &loss[0], &delay[0]);
+	    Run(frameSizes[f], queueSizes[q], fraction, &loss[1], &delay[1]);
+	    if (netem)
+		printf("  %3d KB   netem", frameSizes[f] * DATAGRAM / 1000);
+	    else
+		printf("  %3d KB  %3d KB", frameSizes[f] * DATAGRAM / 1000,
+		       queueSizes[q] / 1024);
+	    printf("  %7.2f%% %7.2f%%        %6.2f %6.2f\n",
+		   loss[0], loss[1], delay[0], delay[1]);
+	}
+    }
+    return benchFailures != 0;
+}
+
+/*
+ * A client whose push socket is connected to recvSock.  The receiver
+ * timestamps datagrams as they arrive, and has room for a whole run, so
+ * that what it loses is lost at the bottleneck.
+ */
+
+static rfbClientPtr
+NewPushClient()
+{
+    rfbClientPtr cl = (rfbClientPtr)calloc(1, sizeof(rfbClientRec));
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int on = 1, size = 8 * 1024 * 1024;
+
+    if (recvSock == -1) {
+	recvSock = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(recvSock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+	if (setsockopt(recvSock, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+		       sizeof(size)) < 0)
+	    setsockopt(recvSock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(recvSock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	    perror("pacebench: bind");
+	    exit(1);
+	}
+    }
+    getsockname(recvSock, (struct sockaddr *)&addr, &addrLen);
+
+    cl->udpSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (connect(cl->udpSock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	perror("pacebench: connect");
+	exit(1);
+    }
+    cl->pushSockConnected = TRUE;
+    cl->pushDatagramSize = DATAGRAM;
+    cl->serverPushInterval = PUSH_INTERVAL;
+    cl->receivingThroughput = bottleneckRate;
+    return cl;
+}
+
+/*
+ * Push RUN_FRAMES frames; *loss gets the percentage of datagrams the
+ * bottleneck dropped and *delay their mean wait in its queue, in ms.
+ * With netem, what has not arrived DRAIN_TIME after the last datagram
+ * left was dropped.
+ */
+
+static void
+Run(frameDatagrams, queueBytes, fraction, loss, delay)
+    int frameDatagrams, queueBytes;
+    double fraction;
+    double *loss, *delay;
+{
+    rfbClientPtr cl = NewPushClient();
+    char *buf;
+    unsigned long nextFrame;
+    long wait;
+    int frame, i;
+
+    rfbPaceFraction = fraction;
+    queueLimit = queueBytes;
+    backlog = 0;
+    queued = arrived = dropped = received = 0;
+    delaySum = 0;
+    if (netem) {
+	sentAt = (double *)malloc(frameDatagrams * RUN_FRAMES *
+				  sizeof(double));
+	seen = (char *)calloc(frameDatagrams * RUN_FRAMES, 1);
+    }
+
+    nextFrame = rfbTimeInMicros();
+    for (frame = 0; frame < RUN_FRAMES; frame++) {
+	for (i = 0; i < frameDatagrams; i++) {
+	    buf = rfbPaceBuffer(cl, DATAGRAM);
+	    memset(buf, 0, DATAGRAM);
+	    *(unsigned long *)buf = queued++;
+	    rfbPaceQueue(cl, buf, DATAGRAM);
+	}
+	/* Unpaced, the whole frame is sent from here. */
+	sendStart = Now();
+	rfbPaceFrameDone(cl);
+
+	nextFrame += PUSH_INTERVAL * 1000;
+	for (;;) {
+	    wait = rfbPaceWait(cl);
+	    if (wait < 0 || (long)(nextFrame - rfbTimeInMicros()) <= wait)
+		break;
+	    usleep(wait);
+	    Send(cl);
+	}
+	wait = (long)(nextFrame - rfbTimeInMicros());
+	if (wait > 0)
+	    usleep(wait);
+	Send(cl);
+    }
+    while ((wait = rfbPaceWait(cl)) >= 0) {
+	usleep(wait);
+	Send(cl);
+    }
+    if (arrived != queued)
+	BenchFail("%lu datagrams queued, %lu sent\n", queued, arrived);
+
+    if (netem) {
+	do {
+	    usleep(DRAIN_TIME);
+	} while (Receive() > 0);
+	dropped = arrived - received;
+	free(sentAt);
+	free(seen);
+    }
+
+    *loss = 100.0 * dropped / arrived;
+    *delay = (arrived > dropped) ? 1e3 * delaySum / (arrived - dropped) : 0;
+
+    rfbPaceFree(cl);
+    close(cl->udpSock);
+    free(cl);
+}
@@ -0,0 +1,181 @@
+/*
+ * poolbench.c
+ *
+ * Time pushed Tight tiles encoded through the encoder pool in encpool.c
+ * with 1 to MAX_ENCODE_THREADS threads.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * A whole 1280x800 frame is damaged, as 128 pixel wide columns, and cut
+ * into tiles the way rfbServerPush() does for 1400 byte datagrams.  The
+ * tiles are encoded as pushSendTileBatch() encodes them: one Tight
+ * context per worker, the batch handed to rfbEncoderPoolRun().  The pool
+ * is sized once per process, so each thread count runs in a child.
+ *
+ * The speedup is only meaningful up to the number of CPUs, which is
+ * printed first.
+ */
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define FB_WIDTH 1280
+#define FB_HEIGHT 800
+#define COLUMN 128
+#define DATAGRAM 1400
+#define MIN_SECONDS 2.0
+
+typedef struct {
+    int x, y, w, h;
+} Tile;
+
+static rfbClientPtr cl;
+static rfbTightContextPtr contexts[MAX_ENCODE_THREADS];
+static Tile *tiles;
+static int nTiles;
+
+static void MakeTiles(void);
+static void EncodeTile(void *arg, int worker, int job);
+static double TimeFrames(int threads, int content, double *bytesPerFrame);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    static char *contentNames[] = { "desktop", "photo" };
+    double perFrame, base = 0;
+    double results[2];
+    int fds[2];
+    int content, n;
+    pid_t pid;
+
+    printf("poolbench: %ld CPUs online, %dx%d frame\n",
+	   sysconf(_SC_NPROCESSORS_ONLN), FB_WIDTH, FB_HEIGHT);
+    MakeTiles();
+
+    for (content = BENCH_DESKTOP; content <= BENCH_PHOTO; content++) {
+	printf("%s:\n", contentNames[content]);
+	for (n = 1; n <= MAX_ENCODE_THREADS; n++) {
+	    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+		perror("poolbench");
+		return 1;
+	    }
+	    if (pid == 0) {
+		results[0] = TimeFrames(n, content, &results[1]);
+		write(fds[1], results, sizeof(results));
+		_exit(0);
+	    }
+	    close(fds[1]);
+	    if (read(fds[0], results, sizeof(results)) != sizeof(results)) {
+		fprintf(stderr, "poolbench: child failed\n");
+		return 1;
+	    }
+	    close(fds[0]);
+	    waitpid(pid, NULL, 0);
+
+	    perFrame = results[0];
+	    if (n == 1)
+		base = perFrame;
+	    printf("  %d threads: %7.2f ms/frame %7.1f MPixels/s "
+		   "%5.2fx  %d tiles, %.0f bytes\n", n, perFrame * 1e3,
+		   FB_WIDTH * FB_HEIGHT / perFrame / 1e6, base / perFrame,
+		   nTiles, results[1]);
+	}
+    }
+    return 0;
+}
+
+/* Sized as rfbServerPush() sizes batched tiles. */
+
+static void
+MakeTiles()
+{
+    int nPixels = (int)((DATAGRAM - sz_rfbFramebufferUpdateMsg) / 1.25 / 4);
+    int x, y, w, rows;
+
+    nTiles = 0;
+    tiles = (Tile *)malloc((FB_WIDTH / COLUMN + 1) * FB_HEIGHT * sizeof(Tile));
+
+    for (x = 0; x < FB_WIDTH; x += COLUMN) {
+	w = (x + COLUMN <= FB_WIDTH) ? COLUMN : FB_WIDTH - x;
+	rows = nPixels / w;
+	if (rows < 1)
+	    rows = 1;
+	for (y = 0; y < FB_HEIGHT; y += rows) {
+	    tiles[nTiles].x = x;
+	    tiles[nTiles].y = y;
+	    tiles[nTiles].w = w;
+	    tiles[nTiles].h = (y + rows <= FB_HEIGHT) ? rows : FB_HEIGHT - y;
+	    nTiles++;
+	}
+    }
+}
+
+static void
+EncodeTile(arg, worker, job)
+    void *arg;
+    int worker;
+    int job;
+{
+    Tile *t = &tiles[job];
+
+    if (!rfbTightEncodeTile(contexts[worker], cl, t->x, t->y, t->w, t->h))
+	BenchFail("tile %d,%d %dx%d did not encode\n", t->x, t->y, t->w, t->h);
+}
+
+/* Return the seconds per frame; *bytesPerFrame gets the output size. */
+
+static double
+TimeFrames(threads, content, bytesPerFrame)
+    int threads, content;
+    double *bytesPerFrame;
+{
+    double start, elapsed;
+    int frames, i, len, nRects;
+
+    rfbEncodeThreads = threads;
+    rfbSimdInit();
+    BenchSetupScreen(FB_WIDTH, FB_HEIGHT, content);
+    cl = BenchNewClient();
+    cl->packing = TRUE;
+
+    for (i = 0; i < rfbEncoderPoolSize(); i++)
+	contexts[i] = rfbTightNewContext();
+
+    frames = 0;
+    start = BenchSeconds();
+    do {
+	for (i = 0; i < rfbEncoderPoolSize(); i++)
+	    rfbTightResetOutput(contexts[i]);
+	rfbEncoderPoolRun(EncodeTile, NULL, nTiles);
+	frames++;
+	elapsed = BenchSeconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    *bytesPerFrame = 0;
+    for (i = 0; i < rfbEncoderPoolSize(); i++) {
+	rfbTightContextOutput(contexts[i], &len, &nRects);
+	*bytesPerFrame += len;
+    }
+    return elapsed / frames;
+}
@@ -0,0 +1,301 @@
+/*
+ * shufflecheck.c
+ *
+ * Check that translating by moving bytes gives the same pixels as the
+ * RGB tables it stands in for, with each level of rfbShuffle32, and time
+ * both.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * translate.c is included whole to get at rfbInitShuffleTable(),
+ * rfbTranslateShuffle32() and the RGB table functions.  For each of a
+ * few hundred random pairs of 32 bpp true colour formats, red, green and
+ * blue in whole bytes at random places and the client's byte order
+ * random, a block of random pixels is translated both ways and the
+ * results compared.  The input is the server's format, which is always in
+ * the host's byte order.  Widths run from 1 to 70 pixels, so every
+ * kernel's tail is taken, and junk in the padding byte must come out as
+ * zero.  Formats the shuffle cannot do, with a colour off a byte boundary
+ * or not 8 bits wide, must be refused.
+ *
+ * The C level has no rfbShuffle32 in the server; simd.c's C Shuffle32(),
+ * as benchShuffle32C, is checked in its place.  Then both ways are timed
+ * over 1024x768 pixels.
+ */
+
+/* Before translate.c, whose X headers define max and min. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../translate.c"
+
+#include "bench.h"
+
+#define BLOCK_HEIGHT 5
+#define MAX_WIDTH 70
+#define STRIDE_PIXELS (MAX_WIDTH + 3)
+#define FORMATS 300
+#define TIME_WIDTH 1024
+#define TIME_HEIGHT 768
+#define TIME_RUNS 3
+
+static unsigned long randState = 1;
+
+static CARD32 Random32(void);
+static void RandomFormat(rfbPixelFormat *pf, Bool bigEndian);
+static Bool CheckFormats(int level, rfbPixelFormat *in,
+			 rfbPixelFormat *out);
+static void CheckRefused(void);
+static double TimeTranslate(rfbTranslateFnType fn, char *table,
+			    rfbPixelFormat *in, rfbPixelFormat *out);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    rfbPixelFormat in, out;
+    char *rgbTable = NULL, *shuffle = NULL;
+    Bool failed[BENCH_SIMD_LEVELS];
+    double tablesRate;
+    int l, f;
+
+    for (l = 0; l < BENCH_SIMD_LEVELS; l++)
+	failed[l] = FALSE;
+
+    for (f = 0; f < FORMATS; f++) {
+	RandomFormat(&in, FALSE);
+	RandomFormat(&out, Random32() & 1);
+	for (l = 0; l < BENCH_SIMD_LEVELS; l++) {
+	    if (!BenchSimdLevel(l)) {
+		if (f == 0)
+		    printf("shufflecheck: no %s on this CPU, skipped\n",
+			   benchSimdLevelNames[l]);
+		continue;
+	    }
+	    if (rfbShuffle32 == NULL)
+		rfbShuffle32 = benchShuffle32C;
+	    if (!failed[l])
+		failed[l] = !CheckFormats(l, &in, &out);
+	}
+    }
+    CheckRefused();
+    if (benchFailures != 0)
+	return 1;
+    printf("shufflecheck: all shuffles match the RGB tables\n");
+
+    /* The server's format against a big-endian BGRX client. */
+    RandomFormat(&in, FALSE);
+    in.redShift = 16;
+    in.greenShift = 8;
+    in.blueShift = 0;
+    out = in;
+    out.bigEndian = TRUE;
+    out.redShift = 8;
+    out.greenShift = 16;
+    out.blueShift = 24;
+    rfbInitTrueColourRGBTables32(&rgbTable, &in, &out);
+    rfbInitShuffleTable(&shuffle, &in, &out);
+
+    tablesRate = TimeTranslate(rfbTranslateWithRGBTables32to32, rgbTable,
+			       &in, &out);
+    printf("MPixels/s, %dx%d    RGB tables", TIME_WIDTH, TIME_HEIGHT);
+    for (l = 0; l < BENCH_SIMD_LEVELS; l++)
+	printf("  %6s", benchSimdLevelNames[l]);
+    printf("\n  %-24s %6.0f", "XRGB to big-endian BGRX", tablesRate);
+    for (l = 0; l < BENCH_SIMD_LEVELS; l++) {
+	if (!BenchSimdLevel(l)) {
+	    printf("  %6s", "-");
+	    continue;
+	}
+	if (rfbShuffle32 == NULL)
+	    rfbShuffle32 = benchShuffle32C;
+	printf("  %6.0f", TimeTranslate(rfbTranslateShuffle32, shuffle,
+					&in, &out));
+    }
+    printf("\n");
+
+    free(rgbTable);
+    free(shuffle);
+    return benchFailures != 0;
+}
+
+static CARD32
+Random32()
+{
+    randState = randState * 1103515245 + 12345;
+    return (CARD32)(randState >> 16) ^ (CARD32)(randState << 16);
+}
+
+/*
+ * A 32 bpp depth 24 true colour format with 8-bit red, green and blue in
+ * three of the four bytes, in random order.
+ */
+
+static void
+RandomFormat(pf, bigEndian)
+    rfbPixelFormat *pf;
+    Bool bigEndian;
+{
+    int shifts[4] = { 0, 8, 16, 24 };
+    int i, j, t;
+
+    for (i = 3; i > 0; i--) {
+	j = Random32() % (i + 1);
+	t = shifts[i];
+	shifts[i] = shifts[j];
+	shifts[j] = t;
+    }
+
+    memset(pf, 0, sizeof(rfbPixelFormat));
+    pf->bitsPerPixel = 32;
+    pf->depth = 24;
+    pf->bigEndian = bigEndian;
+    pf->trueColour = TRUE;
+    pf->redMax = pf->greenMax = pf->blueMax = 255;
+    pf->redShift = shifts[0];
+    pf->greenShift = shifts[1];
+    pf->blueShift = shifts[2];
+}
+
+/*
+ * Translate blocks of every width from 1 to MAX_WIDTH both ways, from a
+ * source whose lines are further apart than they are wide, and compare.
+ * Returns FALSE at the first mismatch, after which the level is not
+ * checked again, since the rest would mostly repeat it.
+ */
+
+static Bool
+CheckFormats(level, in, out)
+    int level;
+    rfbPixelFormat *in, *out;
+{
+    static CARD32 src[STRIDE_PIXELS * BLOCK_HEIGHT];
+    static CARD32 expected[MAX_WIDTH * BLOCK_HEIGHT + 1];
+    static CARD32 got[MAX_WIDTH * BLOCK_HEIGHT + 1];
+    char *rgbTable = NULL, *shuffle = NULL;
+    int i, w, n;
+
+    rfbInitTrueColourRGBTables32(&rgbTable, in, out);
+    if (!rfbInitShuffleTable(&shuffle, in, out)) {
+	BenchFail("%s: shift %d/%d/%d to %s %d/%d/%d refused\n",
+		  benchSimdLevelNames[level], in->redShift, in->greenShift,
+		  in->blueShift,
+		  out->bigEndian ? "big-endian" : "little-endian",
+		  out->redShift, out->greenShift, out->blueShift);
+	free(rgbTable);
+	return FALSE;
+    }
+
+    for (w = 1; w <= MAX_WIDTH; w++) {
+	for (i = 0; i < STRIDE_PIXELS * BLOCK_HEIGHT; i++)
+	    src[i] = Random32();
+	n = w * BLOCK_HEIGHT;
+	expected[n] = got[n] = 0x5a5a5a5a;	/* must not be written */
+
+	rfbTranslateWithRGBTables32to32(rgbTable, in, out, (char *)src,
+					(char *)expected, STRIDE_PIXELS * 4,
+					w, BLOCK_HEIGHT);
+	rfbTranslateShuffle32(shuffle, in, out, (char *)src, (char *)got,
+			      STRIDE_PIXELS * 4, w, BLOCK_HEIGHT);
+
+	for (i = 0; i <= n && got[i] == expected[i]; i++)
+	    ;
+	if (i <= n) {
+	    BenchFail("%s: shift %d/%d/%d to %s %d/%d/%d, width %d: "
+		      "pixel %d is %08x, not %08x\n",
+		      benchSimdLevelNames[level], in->redShift, in->greenShift,
+		      in->blueShift,
+		      out->bigEndian ? "big-endian" : "little-endian",
+		      out->redShift, out->greenShift, out->blueShift, w, i,
+		      (unsigned)got[i], (unsigned)expected[i]);
+	    break;
+	}
+    }
+
+    free(rgbTable);
+    free(shuffle);
+    return w > MAX_WIDTH;
+}
+
+/*
+ * Formats that are not just bytes moved about must be left to the tables.
+ */
+
+static void
+CheckRefused()
+{
+    rfbPixelFormat in, out;
+    char *shuffle = NULL;
+
+    RandomFormat(&in, FALSE);
+    RandomFormat(&out, FALSE);
+    out.redShift = 4;
+    if (rfbInitShuffleTable(&shuffle, &in, &out))
+	BenchFail("red at shift 4 taken for a shuffle\n");
+
+    RandomFormat(&out, FALSE);
+    out.depth = 30;
+    out.redMax = out.greenMax = out.blueMax = 1023;
+    out.redShift = 20;
+    out.greenShift = 10;
+    out.blueShift = 0;
+    if (rfbInitShuffleTable(&shuffle, &in, &out))
+	BenchFail("10-bit colours taken for a shuffle\n");
+
+    RandomFormat(&out, FALSE);
+    out.bitsPerPixel = 16;
+    if (rfbInitShuffleTable(&shuffle, &in, &out))
+	BenchFail("16 bpp taken for a shuffle\n");
+
+    free(shuffle);
+}
+
+/*
+ * MPixels/s translating a TIME_WIDTH x TIME_HEIGHT frame, best of
+ * TIME_RUNS.
+ */
+
+static double
+TimeTranslate(fn, table, in, out)
+    rfbTranslateFnType fn;
+    char *table;
+    rfbPixelFormat *in, *out;
+{
+    static CARD32 src[TIME_WIDTH * TIME_HEIGHT];
+    static CARD32 dst[TIME_WIDTH * TIME_HEIGHT];
+    double start, seconds, best = 0;
+    int i, run;
+
+    for (i = 0; i < TIME_WIDTH * TIME_HEIGHT; i++)
+	src[i] = Random32();
+
+    for (run = 0; run < TIME_RUNS; run++) {
+	start = BenchSeconds();
+	(*fn)(table, in, out, (char *)src, (char *)dst, TIME_WIDTH * 4,
+	      TIME_WIDTH, TIME_HEIGHT);
+	seconds = BenchSeconds() - start;
+	if (best == 0 || seconds < best)
+	    best = seconds;
+    }
+    return TIME_WIDTH * TIME_HEIGHT / best / 1e6;
+}
@@ -0,0 +1,91 @@
+/*
+ * simdlevel.c
+ *
+ * Install the kernels of one level of simd.c, so that the programs here
+ * can compare the levels whatever the CPU would pick.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/* Included whole, for its static kernels. */
+#include "../simd.c"
+
+#include "bench.h"
+
+char *benchSimdLevelNames[BENCH_SIMD_LEVELS] = { "C", "SSE2", "AVX2" };
+
+void (*benchShuffle32C)(CARD8 *dst, CARD8 *src, int n, CARD8 *shuffle) =
+    Shuffle32;
+
+/*
+ * Point the kernel pointers at the given level's kernels, as
+ * rfbSimdInit() would on a CPU whose best is that level.  Returns FALSE,
+ * leaving them alone, if this CPU cannot run it.
+ */
+
+Bool
+BenchSimdLevel(level)
+    int level;
+{
+    switch (level) {
+    case BENCH_SIMD_C:
+	rfbSpanLength8 = SpanLength8;
+	rfbSpanLength16 = SpanLength16;
+	rfbSpanLength32 = SpanLength32;
+	rfbSpanTwoColors8 = SpanTwoColors8;
+	rfbSpanTwoColors16 = SpanTwoColors16;
+	rfbSpanTwoColors32 = SpanTwoColors32;
+	rfbShuffle32 = NULL;
+	rfbGradientRow32 = GradientRow32;
+	rfbPixelDiffs32 = PixelDiffs32;
+	return TRUE;
+
+#ifdef SIMD_X86
+    case BENCH_SIMD_SSE2:
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse2"))
+	    return FALSE;
+	rfbSpanLength8 = SpanLength8Sse2;
+	rfbSpanLength16 = SpanLength16Sse2;
+	rfbSpanLength32 = SpanLength32Sse2;
+	rfbSpanTwoColors8 = SpanTwoColors8Sse2;
+	rfbSpanTwoColors16 = SpanTwoColors16Sse2;
+	rfbSpanTwoColors32 = SpanTwoColors32Sse2;
+	rfbShuffle32 = __builtin_cpu_supports("ssse3") ? Shuffle32Ssse3 : NULL;
+	rfbGradientRow32 = GradientRow32Sse2;
+	rfbPixelDiffs32 = PixelDiffs32Sse2;
+	return TRUE;
+
+    case BENCH_SIMD_AVX2:
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("avx2"))
+	    return FALSE;
+	rfbSpanLength8 = SpanLength8Avx2;
+	rfbSpanLength16 = SpanLength16Avx2;
+	rfbSpanLength32 = SpanLength32Avx2;
+	rfbSpanTwoColors8 = SpanTwoColors8Avx2;
+	rfbSpanTwoColors16 = SpanTwoColors16Avx2;
+	rfbSpanTwoColors32 = SpanTwoColors32Avx2;
+	rfbShuffle32 = Shuffle32Avx2;
+	rfbGradientRow32 = GradientRow32Avx2;
+	rfbPixelDiffs32 = PixelDiffs32Sse2;
+	return TRUE;
+#endif
+    }
+    return FALSE;
+}
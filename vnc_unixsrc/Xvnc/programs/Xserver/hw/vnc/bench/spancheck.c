@@ -0,0 +1,255 @@
+/*
+ * spancheck.c
+ *
+ * Check the SSE2 and AVX2 span kernels in simd.c against the C ones, and
+ * time all three.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Each level of kernels is installed into the rfbSpanLength and
+ * rfbSpanTwoColors pointers in turn by BenchSimdLevel(), so that calls
+ * go the way the encoders make them.  Levels the CPU lacks are skipped.
+ *
+ * Every length up to 100 and a few around 128, 256 and 1024 is checked,
+ * with the span stopped at every position, by a pixel that differs from
+ * the colour in its lowest or in its highest byte.  Rows end right at an
+ * inaccessible page, so a kernel that reads past the end crashes, and
+ * start at every alignment as the length varies.  Colours are passed
+ * with junk above bpp bits, which the kernels must ignore.
+ *
+ * Then each kernel is timed over spans that run to the end of the row,
+ * as in a flat or two-colour area, and pixels/cycle printed.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define BUF_PIXELS 1100
+#define TIME_PIXELS 4000000
+#define TIME_RUNS 3
+
+static int extraLengths[] = { 127, 128, 129, 255, 256, 257, 1023, 1024, 1025 };
+
+static CARD8 *buffer;		/* page aligned */
+static CARD8 *guardPage;	/* right after buffer, not accessible */
+static unsigned long randState = 1;
+
+static int Random(void);
+static void Check8(int level);
+static void Check16(int level);
+static void Check32(int level);
+static double Time8(int n, Bool twoColors);
+static double Time16(int n, Bool twoColors);
+static double Time32(int n, Bool twoColors);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    static int timeLengths[] = { 8, 15, 64, 255, 1024 };
+    static int bpps[] = { 8, 16, 32 };
+    long pageSize = sysconf(_SC_PAGESIZE);
+    long size = (BUF_PIXELS * 4 + pageSize - 1) / pageSize * pageSize;
+    double pixelsPerCycle;
+    int l, b, t, twoColors;
+
+    buffer = (CARD8 *)mmap(NULL, size + pageSize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == (CARD8 *)MAP_FAILED) {
+	perror("spancheck: mmap");
+	return 1;
+    }
+    guardPage = buffer + size;
+    mprotect(guardPage, pageSize, PROT_NONE);
+
+    for (l = 0; l < BENCH_SIMD_LEVELS; l++) {
+	if (!BenchSimdLevel(l)) {
+	    printf("spancheck: no %s on this CPU, skipped\n",
+		   benchSimdLevelNames[l]);
+	    continue;
+	}
+	Check8(l);
+	Check16(l);
+	Check32(l);
+    }
+    if (benchFailures != 0)
+	return 1;
+    printf("spancheck: all kernels match C\n");
+
+    printf("%-21s", "pixels/cycle");
+    for (twoColors = FALSE; twoColors <= TRUE; twoColors++)
+	printf("  %-*s", BENCH_SIMD_LEVELS * 6,
+	       twoColors ? "SpanTwoColors" : "SpanLength");
+    printf("\n%21s", "");
+    for (twoColors = FALSE; twoColors <= TRUE; twoColors++) {
+	printf("  ");
+	for (l = 0; l < BENCH_SIMD_LEVELS; l++)
+	    printf("%6s", benchSimdLevelNames[l]);
+    }
+    printf("\n");
+
+    for (b = 0; b < sizeof(bpps) / sizeof(int); b++) {
+	for (t = 0; t < sizeof(timeLengths) / sizeof(int); t++) {
+	    printf("  %2d bpp, %4d pixels", bpps[b], timeLengths[t]);
+	    for (twoColors = FALSE; twoColors <= TRUE; twoColors++) {
+		printf("  ");
+		for (l = 0; l < BENCH_SIMD_LEVELS; l++) {
+		    if (!BenchSimdLevel(l)) {
+			printf("%6s", "-");
+			continue;
+		    }
+		    switch (bpps[b]) {
+		    case 8:
+			pixelsPerCycle = Time8(timeLengths[t], twoColors);
+			break;
+		    case 16:
+			pixelsPerCycle = Time16(timeLengths[t], twoColors);
+			break;
+		    default:
+			pixelsPerCycle = Time32(timeLengths[t], twoColors);
+			break;
+		    }
+		    printf("%6.2f", pixelsPerCycle);
+		}
+	    }
+	    printf("\n");
+	}
+    }
+    return benchFailures != 0;
+}
+
+static int
+Random()
+{
+    randState = randState * 1103515245 + 12345;
+    return (int)((randState >> 16) & 0x7fff);
+}
+
+/*
+ * Stop at the first mismatch of each kernel, since the rest would mostly
+ * repeat it.
+ */
+
+#define DEFINE_CHECK(bpp)						\
+									\
+static void								\
+Check##bpp(level)							\
+    int level;								\
+{									\
+    char *name = benchSimdLevelNames[level];				\
+    CARD32 junk = (bpp == 32) ? 0 : ~(CARD32)0 << (bpp & 31);		\
+    CARD32 c0 = 0x5a5a5a5a, c1 = 0xa5a5a5a5, other;			\
+    CARD##bpp *p;							\
+    int i, n, m, k, v, len, n0, expected0;				\
+									\
+    for (k = 0; k <= 100 + sizeof(extraLengths) / sizeof(int); k++) {	\
+	n = (k <= 100) ? k : extraLengths[k - 101];			\
+	p = (CARD##bpp *)guardPage - n;					\
+	for (m = 0; m <= n; m++) {					\
+	    for (v = 0; v < 2; v++) {					\
+		other = c0 ^ (v ? 1 : (CARD32)1 << (bpp - 1));		\
+									\
+		for (i = 0; i < n; i++)					\
+		    p[i] = (CARD##bpp)c0;				\
+		if (m < n)						\
+		    p[m] = (CARD##bpp)other;				\
+		len = rfbSpanLength##bpp(p, n, c0 ^ junk);		\
+		if (len != m) {						\
+		    BenchFail("%s SpanLength%d: %d pixels, stop at %d: "	\
+			      "got %d\n", name, bpp, n, m, len);		\
+		    return;						\
+		}							\
+									\
+		expected0 = 0;						\
+		for (i = 0; i < n; i++) {				\
+		    if (Random() & 1) {					\
+			p[i] = (CARD##bpp)c0;				\
+			if (i < m)					\
+			    expected0++;				\
+		    } else {						\
+			p[i] = (CARD##bpp)c1;				\
+		    }							\
+		}							\
+		if (m < n)						\
+		    p[m] = (CARD##bpp)other;				\
+		n0 = 3;							\
+		len = rfbSpanTwoColors##bpp(p, n, c0 ^ junk, c1 ^ junk, &n0); \
+		if (len != m || n0 != 3 + expected0) {			\
+		    BenchFail("%s SpanTwoColors%d: %d pixels, stop at %d: "	\
+			      "got %d with %d of c0, not %d\n", name, bpp,	\
+			      n, m, len, n0 - 3, expected0);		\
+		    return;						\
+		}							\
+	    }								\
+	}								\
+    }									\
+}
+
+DEFINE_CHECK(8)
+DEFINE_CHECK(16)
+DEFINE_CHECK(32)
+
+/*
+ * Pixels per cycle over a span that runs to the end of n pixels, the
+ * best of TIME_RUNS runs of about TIME_PIXELS pixels.
+ */
+
+#define DEFINE_TIME(bpp)						\
+									\
+static double								\
+Time##bpp(n, twoColors)							\
+    int n;								\
+    Bool twoColors;							\
+{									\
+    CARD##bpp *p = (CARD##bpp *)buffer;					\
+    CARD32 c0 = 0x5a5a5a5a, c1 = 0xa5a5a5a5;				\
+    unsigned long long start, cycles, best = 0;				\
+    long sum;								\
+    int i, run, reps = TIME_PIXELS / n, n0;				\
+									\
+    for (i = 0; i < n; i++)						\
+	p[i] = (CARD##bpp)((twoColors && (Random() & 1)) ? c1 : c0);	\
+									\
+    for (run = 0; run < TIME_RUNS; run++) {				\
+	sum = 0;							\
+	n0 = 0;								\
+	start = BenchCycles();						\
+	if (twoColors) {						\
+	    for (i = 0; i < reps; i++)					\
+		sum += rfbSpanTwoColors##bpp(p, n, c0, c1, &n0);	\
+	} else {							\
+	    for (i = 0; i < reps; i++)					\
+		sum += rfbSpanLength##bpp(p, n, c0);			\
+	}								\
+	cycles = BenchCycles() - start;					\
+	if (sum != (long)reps * n)					\
+	    BenchFail("%d bpp span of %d pixels cut short\n", bpp, n);	\
+	if (best == 0 || cycles < best)					\
+	    best = cycles;						\
+    }									\
+    return (double)reps * n / best;					\
+}
+
+DEFINE_TIME(8)
+DEFINE_TIME(16)
+DEFINE_TIME(32)
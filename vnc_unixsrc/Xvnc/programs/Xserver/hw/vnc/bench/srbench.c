@@ -0,0 +1,332 @@
+/*
+ * srbench.c
+ *
+ * Replay a trace of datagram sends and acks through the send ring in
+ * sendring.c and time each kind of operation.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ *     srbench [server.tlm]
+ *
+ * Without an argument two synthetic traces are replayed: 30 frames a
+ * second of 40 datagrams, each covering a few 32x32 tiles, acked after
+ * 50ms +- 10ms (so acks come back out of order), with 1% and then 20% of
+ * the datagrams never acked.  With a file written by Xvnc -telemetry the
+ * sends and acks of its first client are replayed in their recorded
+ * order instead; telemetry has no regions, so each datagram gets tiles
+ * chosen from its seqNum.
+ *
+ * As in rfbserver.c every send first subtracts its region from the
+ * datagrams still in flight (srRecSendRegion) and is then added
+ * (srRecAdd), and retransmits are looked for every 10ms.  The time of
+ * each call is taken with the cycle counter.
+ */
+
+#include "bench.h"
+
+#define FB_WIDTH 1280
+#define FB_HEIGHT 800
+#define TILE 32
+#define MAX_TILES 4
+#define REPEAT 5
+
+#define EV_SEND 0
+#define EV_ACK 1
+
+typedef struct {
+    unsigned long time;		/* ms */
+    int kind;
+    CARD32 seqNum;
+    int bytes;
+    int order;			/* tie-break for the sort */
+} TraceEvent;
+
+typedef struct {
+    char *name;
+    unsigned long long cycles;
+    unsigned long calls;
+} OpTime;
+
+enum { OP_SEND_REGION, OP_ADD, OP_ACK, OP_RETRANSMIT, N_OPS };
+
+static OpTime ops[N_OPS] = {
+    { "srRecSendRegion" }, { "srRecAdd" },
+    { "srRecDeleteSeqNum" }, { "srRecSetupRetransmit" }
+};
+
+static TraceEvent *events = NULL;
+static int nEvents = 0, eventsSize = 0;
+static unsigned long randState = 1;
+
+static unsigned long Random(void);
+static void AddEvent(unsigned long time, int kind, CARD32 seqNum, int bytes);
+static void Synthesize(double lossRate, int seconds);
+static Bool ReadTelemetry(char *path);
+static int CompareEvents(const void *a, const void *b);
+static void MakeRegion(RegionPtr region, CARD32 seqNum);
+static void Replay(char *name);
+
+/* For srRecRequeue; tile diffing and the path MTU are not in play here. */
+
+void
+rfbTileDiffInvalidate(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+}
+
+void
+rfbPathMtuBlackhole(cl)
+    rfbClientPtr cl;
+{
+}
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    if (argc > 1) {
+	if (!ReadTelemetry(argv[1]))
+	    return 1;
+	Replay(argv[1]);
+	return 0;
+    }
+
+    Synthesize(0.01, 20);
+    Replay("synthetic, 1% unacked");
+    Synthesize(0.20, 20);
+    Replay("synthetic, 20% unacked");
+    return 0;
+}
+
+static unsigned long
+Random()
+{
+    randState = randState * 1103515245 + 12345;
+    return (randState >> 16) & 0x7fff;
+}
+
+static void
+AddEvent(time, kind, seqNum, bytes)
+    unsigned long time;
+    int kind;
+    CARD32 seqNum;
+    int bytes;
+{
+    if (nEvents == eventsSize) {
+	eventsSize = eventsSize ? eventsSize * 2 : 4096;
+	events = (TraceEvent *)realloc(events, eventsSize * sizeof(TraceEvent));
+    }
+    events[nEvents].time = time;
+    events[nEvents].kind = kind;
+    events[nEvents].seqNum = seqNum;
+    events[nEvents].bytes = bytes;
+    events[nEvents].order = nEvents;
+    nEvents++;
+}
+
+static void
+Synthesize(lossRate, seconds)
+    double lossRate;
+    int seconds;
+{
+    unsigned long frameTime, sendTime;
+    CARD32 seqNum = 1000;
+    int frame, i;
+
+    nEvents = 0;
+    randState = 1;
+
+    for (frame = 0; frame < seconds * 30; frame++) {
+	frameTime = frame * 1000 / 30;
+	for (i = 0; i < 40; i++) {
+	    sendTime = frameTime + i / 8;
+	    AddEvent(sendTime, EV_SEND, seqNum, 1400);
+	    if (Random() >= lossRate * 32768)
+		AddEvent(sendTime + 40 + Random() % 21, EV_ACK, seqNum, 0);
+	    seqNum++;
+	}
+    }
+
+    qsort(events, nEvents, sizeof(TraceEvent), CompareEvents);
+}
+
+static CARD32
+Get32(p)
+    unsigned char *p;
+{
+    return ((CARD32)p[0] << 24) | ((CARD32)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static Bool
+ReadTelemetry(path)
+    char *path;
+{
+    FILE *f;
+    unsigned char rec[32];
+    char magic[8];
+    unsigned long long usec, first = 0;
+    int client = -1;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+	perror(path);
+	return FALSE;
+    }
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "RFBTLM1\n", 8) != 0) {
+	fprintf(stderr, "%s: not a telemetry file\n", path);
+	fclose(f);
+	return FALSE;
+    }
+
+    nEvents = 0;
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+	if (rec[1] != 0 || (rec[0] != TLM_SENT && rec[0] != TLM_ACKED))
+	    continue;
+	if (client == -1)
+	    client = (rec[2] << 8) | rec[3];
+	if (((rec[2] << 8) | rec[3]) != client)
+	    continue;
+
+	usec = ((unsigned long long)Get32(&rec[16]) << 32) | Get32(&rec[20]);
+	if (first == 0)
+	    first = usec;
+	AddEvent((unsigned long)((usec - first) / 1000) + 1,
+		 rec[0] == TLM_SENT ? EV_SEND : EV_ACK,
+		 Get32(&rec[8]), (int)Get32(&rec[24]));
+    }
+    fclose(f);
+
+    if (nEvents == 0) {
+	fprintf(stderr, "%s: no sends or acks from the server\n", path);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static int
+CompareEvents(a, b)
+    const void *a, *b;
+{
+    const TraceEvent *ea = a, *eb = b;
+
+    if (ea->time != eb->time)
+	return ea->time < eb->time ? -1 : 1;
+    return ea->order - eb->order;
+}
+
+/* A datagram covers one to MAX_TILES neighbouring tiles. */
+
+static void
+MakeRegion(region, seqNum)
+    RegionPtr region;
+    CARD32 seqNum;
+{
+    RegionRec tile;
+    BoxRec box;
+    CARD32 h = seqNum * 2654435761U;
+    int tilesX = FB_WIDTH / TILE, tilesY = FB_HEIGHT / TILE;
+    int x = (h >> 8) % tilesX, y = (h >> 20) % tilesY;
+    int n = 1 + (h & 0xff) % MAX_TILES, i;
+
+    REGION_INIT(pScreen, region, NullBox, 0);
+    REGION_INIT(pScreen, &tile, NullBox, 0);
+    for (i = 0; i < n; i++) {
+	box.x1 = ((x + i) % tilesX) * TILE;
+	box.y1 = y * TILE;
+	box.x2 = box.x1 + TILE;
+	box.y2 = box.y1 + TILE;
+	REGION_RESET(pScreen, &tile, &box);
+	REGION_UNION(pScreen, region, region, &tile);
+    }
+    REGION_UNINIT(pScreen, &tile);
+}
+
+#define TIMED(op, call) do {						\
+	unsigned long long t0 = BenchCycles();				\
+	call;								\
+	ops[op].cycles += BenchCycles() - t0;				\
+	ops[op].calls++;						\
+    } while (0)
+
+static void
+Replay(name)
+    char *name;
+{
+    rfbClientRec cl;
+    RegionRec region;
+    unsigned long nextScan;
+    unsigned long long c0;
+    double t0, seconds = 0, cycles = 0;
+    int requeued = 0, peak = 0;
+    int r, i;
+
+    for (i = 0; i < N_OPS; i++)
+	ops[i].cycles = ops[i].calls = 0;
+
+    for (r = 0; r < REPEAT; r++) {
+	memset(&cl, 0, sizeof(cl));
+	REGION_INIT(pScreen, &cl.modifiedRegion, NullBox, 0);
+	cl.retransmitTimeout = 200;
+	nextScan = 0;
+
+	t0 = BenchSeconds();
+	c0 = BenchCycles();
+	for (i = 0; i < nEvents; i++) {
+	    benchMillis = events[i].time;
+
+	    while (nextScan <= benchMillis) {
+		TIMED(OP_RETRANSMIT, srRecSetupRetransmit(&cl));
+		nextScan += 10;
+	    }
+
+	    if (events[i].kind == EV_ACK) {
+		TIMED(OP_ACK, srRecDeleteSeqNum(&cl, events[i].seqNum));
+		continue;
+	    }
+
+	    MakeRegion(&region, events[i].seqNum);
+	    TIMED(OP_SEND_REGION, srRecSendRegion(&cl, &region));
+	    TIMED(OP_ADD, srRecAdd(&cl, events[i].seqNum, &region,
+				   events[i].bytes, benchMillis));
+	    REGION_UNINIT(pScreen, &region);
+	    if (cl.srRecCount > peak)
+		peak = cl.srRecCount;
+	}
+	cycles += BenchCycles() - c0;
+	seconds += BenchSeconds() - t0;
+
+	requeued = cl.pushStats.rfbPushDatagramsRequeued;
+	srRecFree(&cl);
+	REGION_UNINIT(pScreen, &cl.modifiedRegion);
+    }
+
+    printf("%s: %d events, %d in flight at most, %d requeued\n",
+	   name, nEvents, peak, requeued);
+    for (i = 0; i < N_OPS; i++) {
+	printf("    %-22s %10lu calls %8.1f cycles/call\n", ops[i].name,
+	       ops[i].calls / REPEAT,
+	       ops[i].calls ? (double)ops[i].cycles / ops[i].calls : 0.0);
+    }
+    printf("    whole replay %.1f ns/event (%.2f GHz counter)\n",
+	   seconds * 1e9 / (REPEAT * nEvents), cycles / seconds / 1e9);
+}
@@ -0,0 +1,383 @@
+/*
+ * stubs.c
+ *
+ * The few pieces of the X server and of init.c that the encoders and the
+ * push code call, enough to link them into a standalone program.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#include "bench.h"
+
+Bool Must_have_memory = FALSE;
+CARD32 benchMillis = 1;
+int benchFailures = 0;
+
+rfbScreenInfo rfbScreen;
+#ifndef BENCH_TRANSLATE
+rfbPixelFormat rfbServerFormat;
+#endif
+char updateBuf[UPDATE_BUF_SIZE];
+int ublen = 0;
+int handleNewBlock = 0;
+unsigned long benchBytesSent = 0;
+void (*benchDatagramSent)(rfbClientPtr cl, char *buf, Bool sent) = NULL;
+
+unsigned long *
+Xalloc(amount)
+    unsigned long amount;
+{
+    return (unsigned long *)malloc(amount ? amount : 1);
+}
+
+unsigned long *
+Xrealloc(ptr, amount)
+    pointer ptr;
+    unsigned long amount;
+{
+    return (unsigned long *)realloc(ptr, amount ? amount : 1);
+}
+
+void
+Xfree(ptr)
+    pointer ptr;
+{
+    free(ptr);
+}
+
+CARD32
+GetTimeInMillis()
+{
+    return benchMillis;
+}
+
+void
+rfbLog(char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void
+rfbLogPerror(str)
+    char *str;
+{
+    perror(str);
+}
+
+/* pace.c hands every datagram it sends to rfbserver.c. */
+
+void
+rfbPacedDatagramSent(cl, buf, sent)
+    rfbClientPtr cl;
+    char *buf;
+    Bool sent;
+{
+    if (benchDatagramSent != NULL)
+	(*benchDatagramSent)(cl, buf, sent);
+}
+
+void
+rfbProbePathMtu(cl)
+    rfbClientPtr cl;
+{
+}
+
+/* sendring.c's ack handling records into these. */
+
+void
+rfbTelemetryRecord(client, kind, eventId, seqNum, frameSeqNum, bytes)
+    int client;
+    int kind;
+    CARD32 eventId;
+    CARD32 seqNum;
+    CARD32 frameSeqNum;
+    int bytes;
+{
+}
+
+void
+rfbRecordLog2(buckets, nBuckets, value)
+    int *buckets;
+    int nBuckets;
+    unsigned long value;
+{
+}
+
+void
+rfbCloseSock(sock)
+    int sock;
+{
+    fprintf(stderr, "client %d closed\n", sock);
+    exit(1);
+}
+
+Bool
+rfbSendUpdateBuf(cl)
+    rfbClientPtr cl;
+{
+    if (!cl->packing) {
+	benchBytesSent += ublen;
+	ublen = 0;
+    }
+    return TRUE;
+}
+
+#ifndef BENCH_TRANSLATE
+
+void
+rfbTranslateNone(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+		 char *iptr, char *optr, int bytesBetweenInputLines,
+		 int width, int height)
+{
+    int bytesPerOutputLine = width * (out->bitsPerPixel / 8);
+
+    while (height > 0) {
+	memcpy(optr, iptr, bytesPerOutputLine);
+	iptr += bytesBetweenInputLines;
+	optr += bytesPerOutputLine;
+	height--;
+    }
+}
+
+#else
+
+/* translate.c is built in, and needs these for colour maps. */
+
+rfbClientPtr rfbClientHead = NULL;
+ColormapPtr rfbInstalledColormap = NULL;
+
+int
+WriteExact(sock, buf, len)
+    int sock;
+    char *buf;
+    int len;
+{
+    return len;
+}
+
+Bool
+rfbSendSetColourMapEntries(cl, firstColour, nColours)
+    rfbClientPtr cl;
+    int firstColour;
+    int nColours;
+{
+    return TRUE;
+}
+
+#endif
+
+static unsigned long benchRandState = 1;
+
+static int
+BenchRandom()
+{
+    benchRandState = benchRandState * 1103515245 + 12345;
+    return (int)((benchRandState >> 16) & 0x7fff);
+}
+
+static void
+BenchFill(CARD32 *fb, int width, int x, int y, int w, int h, CARD32 pixel)
+{
+    int i, j;
+
+    for (j = y; j < y + h; j++)
+	for (i = x; i < x + w; i++)
+	    fb[j * width + i] = pixel;
+}
+
+/*
+ * A desktop: a grey background with overlapping windows, each with a
+ * shaded title bar and a white client area holding lines of "text".
+ */
+
+static void
+BenchDrawDesktop(CARD32 *fb, int width, int height)
+{
+    int x, y, w, h, i, j, n, cx, cy;
+
+    BenchFill(fb, width, 0, 0, width, height, 0x3a6ea5);
+
+    for (n = 0; n < 12; n++) {
+	w = width / 4 + BenchRandom() % (width / 3);
+	h = height / 4 + BenchRandom() % (height / 3);
+	x = BenchRandom() % (width - w);
+	y = BenchRandom() % (height - h);
+
+	for (j = 0; j < 20; j++)
+	    for (i = 0; i < w; i++)
+		fb[(y + j) * width + x + i] =
+		    (CARD32)(0x10 + i * 0xc0 / w) << 8 | 0x000080;
+	BenchFill(fb, width, x, y + 20, w, h - 20, 0xffffff);
+
+	/* Characters are 7x12 cells with a random pattern in 5x9. */
+	for (cy = y + 24; cy + 12 <= y + h; cy += 14) {
+	    for (cx = x + 4; cx + 7 <= x + w - 4; cx += 7) {
+		if (BenchRandom() % 8 == 0)
+		    continue;
+		for (j = 0; j < 9; j++)
+		    for (i = 0; i < 5; i++)
+			if (BenchRandom() % 3 == 0)
+			    fb[(cy + j) * width + cx + i] = 0x000000;
+	    }
+	}
+    }
+}
+
+/*
+ * Something like a photograph: a few overlapping soft shapes in varying
+ * colours, plus a little per-pixel noise.
+ */
+
+static void
+BenchDrawPhoto(CARD32 *fb, int width, int height)
+{
+    int x, y, c, v[3];
+    double fx, fy;
+
+    for (y = 0; y < height; y++) {
+	fy = (double)y / height;
+	for (x = 0; x < width; x++) {
+	    fx = (double)x / width;
+	    v[0] = (int)(120 + 80 * sin(fx * 7.1 + fy * 2.3)
+			 + 40 * cos(fx * fy * 19.0));
+	    v[1] = (int)(110 + 70 * sin(fy * 5.3 - fx * 1.7)
+			 + 30 * sin((fx + fy) * 23.0));
+	    v[2] = (int)(100 + 60 * cos(fx * 3.1 + fy * 8.9)
+			 + 50 * sin(fx * 13.0) * cos(fy * 11.0));
+	    for (c = 0; c < 3; c++) {
+		v[c] += BenchRandom() % 9 - 4;
+		v[c] = v[c] < 0 ? 0 : v[c] > 255 ? 255 : v[c];
+	    }
+	    fb[y * width + x] = (v[0] << 16) | (v[1] << 8) | v[2];
+	}
+    }
+}
+
+/*
+ * Give rfbScreen a 32 bpp little-endian framebuffer of the given size,
+ * as Xvnc has by default.
+ */
+
+void
+BenchSetupScreen(width, height, content)
+    int width, height, content;
+{
+    free(rfbScreen.pfbMemory);
+    memset(&rfbScreen, 0, sizeof(rfbScreen));
+    rfbScreen.width = width;
+    rfbScreen.height = height;
+    rfbScreen.depth = 24;
+    rfbScreen.bitsPerPixel = 32;
+    rfbScreen.paddedWidthInBytes = width * 4;
+    rfbScreen.sizeInBytes = width * height * 4;
+    rfbScreen.pfbMemory = malloc(rfbScreen.sizeInBytes);
+
+    rfbServerFormat.bitsPerPixel = 32;
+    rfbServerFormat.depth = 24;
+    rfbServerFormat.bigEndian = 0;
+    rfbServerFormat.trueColour = 1;
+    rfbServerFormat.redMax = rfbServerFormat.greenMax =
+	rfbServerFormat.blueMax = 255;
+    rfbServerFormat.redShift = 16;
+    rfbServerFormat.greenShift = 8;
+    rfbServerFormat.blueShift = 0;
+
+    benchRandState = 1;
+    if (content == BENCH_PHOTO)
+	BenchDrawPhoto((CARD32 *)rfbScreen.pfbMemory, width, height);
+    else
+	BenchDrawDesktop((CARD32 *)rfbScreen.pfbMemory, width, height);
+}
+
+/*
+ * A client that takes the server's own pixel format, with the defaults
+ * rfbNewClient() gives it.
+ */
+
+rfbClientPtr
+BenchNewClient()
+{
+    rfbClientPtr cl = (rfbClientPtr)calloc(1, sizeof(rfbClientRec));
+
+    cl->format = rfbServerFormat;
+    cl->translateFn = rfbTranslateNone;
+    cl->scale = 1;
+    cl->tightCompressLevel = TIGHT_DEFAULT_COMPRESSION;
+    cl->tightQualityLevel = -1;
+    cl->zlibCompressLevel = 5;
+    cl->enableLastRectEncoding = TRUE;
+    return cl;
+}
+
+void
+BenchFreeClient(cl)
+    rfbClientPtr cl;
+{
+    int i;
+
+    if (cl->zrleStreamInited)
+	deflateEnd(&cl->zrleStream);
+    for (i = 0; i < 4; i++) {
+	if (cl->zsActive[i])
+	    deflateEnd(&cl->zsStruct[i]);
+    }
+    free(cl);
+}
+
+/* Report a mismatch; the program's exit status comes from benchFailures. */
+
+void
+BenchFail(char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, format, args);
+    va_end(args);
+    benchFailures++;
+}
+
+double
+BenchSeconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long
+BenchCycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    return (unsigned long long)(BenchSeconds() * 1e9);
+#endif
+}
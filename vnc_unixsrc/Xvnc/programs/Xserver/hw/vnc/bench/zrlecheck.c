@@ -0,0 +1,263 @@
+/*
+ * zrlecheck.c
+ *
+ * Decode what zrle.c sends and compare it with the framebuffer, both over
+ * the connection and pushed.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Over the connection a viewer keeps a single inflater, so every
+ * rectangle of a session must continue the same zlib stream, without
+ * ever ending it, even across updates (handleNewBlock).  A pushed
+ * rectangle must decode with a fresh inflater.  Both are checked on a
+ * desktop and a photo frame, for rectangles of odd sizes and positions.
+ *
+ * The pushed rectangles are also encoded one after another into a single
+ * rfbZrleContext, as the encoder pool's workers do, and each must come
+ * out the same as through rfbSendRectEncodingZRLE().
+ */
+
+#include <zlib.h>
+#include "bench.h"
+
+#define FB_WIDTH 300
+#define FB_HEIGHT 200
+
+static z_stream inflater;
+static CARD8 *zbuf;
+static int zbufLen, zbufPos;
+
+static void Check(char *what, Bool pushed);
+static void DecodeRect(char *what, CARD8 *data, int len, int x, int y,
+		       int w, int h, Bool pushed);
+static int NextByte(void);
+static CARD32 NextCPixel(void);
+
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    BenchSetupScreen(FB_WIDTH, FB_HEIGHT, BENCH_DESKTOP);
+    Check("desktop, connection", FALSE);
+    Check("desktop, pushed", TRUE);
+    BenchSetupScreen(FB_WIDTH, FB_HEIGHT, BENCH_PHOTO);
+    Check("photo, connection", FALSE);
+    Check("photo, pushed", TRUE);
+
+    if (benchFailures == 0)
+	printf("zrlecheck: all rectangles decoded\n");
+    return benchFailures != 0;
+}
+
+/*
+ * Send a few updates of a few rectangles each to a new client and decode
+ * them as a viewer would.
+ */
+
+static void
+Check(what, pushed)
+    char *what;
+    Bool pushed;
+{
+    static int rects[][4] = {
+	{ 0, 0, FB_WIDTH, FB_HEIGHT }, { 3, 5, 61, 65 }, { 64, 64, 64, 64 },
+	{ 100, 17, 199, 1 }, { 1, 1, FB_WIDTH - 1, FB_HEIGHT - 1 },
+	{ 250, 150, 50, 50 }, { 7, 190, 130, 10 }
+    };
+    rfbClientPtr cl = BenchNewClient();
+    rfbZrleContextPtr ctx = rfbZrleNewContext();
+    rfbFramebufferUpdateRectHeader *rect;
+    char *out;
+    int i, len, outLen, nRects, offset = 0;
+
+    cl->packing = pushed;
+    memset(&inflater, 0, sizeof(inflater));
+    inflateInit(&inflater);
+
+    for (i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+	/* A new update every other rectangle, a new tile when pushed. */
+	handleNewBlock = pushed || (i % 2 == 0);
+	ublen = 0;
+	if (!rfbSendRectEncodingZRLE(cl, rects[i][0], rects[i][1],
+				     rects[i][2], rects[i][3])) {
+	    BenchFail("%s: rectangle %d not sent\n", what, i);
+	    continue;
+	}
+
+	rect = (rfbFramebufferUpdateRectHeader *)updateBuf;
+	len = Swap32IfLE(*(CARD32 *)&updateBuf[sz_rfbFramebufferUpdateRectHeader]);
+	if (Swap32IfLE(rect->encoding) != rfbEncodingZRLE ||
+	    sz_rfbFramebufferUpdateRectHeader + sz_rfbZRLEHeader + len != ublen) {
+	    BenchFail("%s: rectangle %d badly framed\n", what, i);
+	    continue;
+	}
+
+	if (pushed) {
+	    inflateReset(&inflater);
+	    if (!rfbZrleEncodeTile(ctx, cl, rects[i][0], rects[i][1],
+				   rects[i][2], rects[i][3])) {
+		BenchFail("%s: rectangle %d not encoded on a context\n",
+			  what, i);
+		continue;
+	    }
+	    out = rfbZrleContextOutput(ctx, &outLen, &nRects);
+	    if (nRects != i + 1 || outLen - offset != ublen ||
+		memcmp(&out[offset], updateBuf, ublen) != 0)
+		BenchFail("%s: rectangle %d differs on a context\n", what, i);
+	    offset = outLen;
+	}
+	DecodeRect(what,
+		   (CARD8 *)&updateBuf[sz_rfbFramebufferUpdateRectHeader +
+				       sz_rfbZRLEHeader],
+		   len, rects[i][0], rects[i][1], rects[i][2], rects[i][3],
+		   pushed);
+    }
+
+    inflateEnd(&inflater);
+    rfbZrleFreeContext(ctx);
+    BenchFreeClient(cl);
+}
+
+/*
+ * Inflate one rectangle's data and check its tiles against the
+ * framebuffer.  A pushed rectangle must end its zlib stream, and one on
+ * the connection must not.
+ */
+
+static void
+DecodeRect(what, data, len, x, y, w, h, pushed)
+    char *what;
+    CARD8 *data;
+    int len, x, y, w, h;
+    Bool pushed;
+{
+    static CARD8 out[FB_WIDTH * FB_HEIGHT * 4];
+    CARD32 *fb = (CARD32 *)rfbScreen.pfbMemory;
+    CARD32 palette[128], pix;
+    int tx, ty, tw, th, sub, palSize, bits, run, i, j, b, n, err;
+
+    inflater.next_in = data;
+    inflater.avail_in = len;
+    inflater.next_out = out;
+    inflater.avail_out = sizeof(out);
+    err = inflate(&inflater, Z_SYNC_FLUSH);
+    if (err != (pushed ? Z_STREAM_END : Z_OK) || inflater.avail_in != 0) {
+	BenchFail("%s: %dx%d at %d,%d inflated with %d\n",
+		  what, w, h, x, y, err);
+	return;
+    }
+    zbuf = out;
+    zbufLen = sizeof(out) - inflater.avail_out;
+    zbufPos = 0;
+
+    for (ty = y; ty < y + h; ty += rfbZRLETileHeight) {
+	th = (y + h - ty < rfbZRLETileHeight) ? y + h - ty : rfbZRLETileHeight;
+	for (tx = x; tx < x + w; tx += rfbZRLETileWidth) {
+	    tw = (x + w - tx < rfbZRLETileWidth) ? x + w - tx : rfbZRLETileWidth;
+
+	    sub = NextByte();
+	    palSize = (sub >= 128) ? sub - 128 : sub;
+	    for (i = 0; i < palSize && sub != 128 && sub != 0; i++)
+		palette[i] = NextCPixel();
+
+	    if (sub == 0 || sub == 1) {
+		pix = (sub == 1) ? palette[0] : 0;
+		for (j = 0; j < th; j++)
+		    for (i = 0; i < tw; i++)
+			if ((sub == 0 ? NextCPixel() : pix) !=
+			    (fb[(ty + j) * FB_WIDTH + tx + i] & 0xffffff))
+			    goto mismatch;
+
+	    } else if (sub <= 16) {
+		bits = (palSize <= 2) ? 1 : (palSize <= 4) ? 2 : 4;
+		for (j = 0; j < th; j++) {
+		    for (i = 0, b = 0, n = 0; i < tw; i++) {
+			if (n == 0) {
+			    b = NextByte();
+			    n = 8;
+			}
+			n -= bits;
+			pix = palette[(b >> n) & ((1 << bits) - 1)];
+			if (pix != (fb[(ty + j) * FB_WIDTH + tx + i] & 0xffffff))
+			    goto mismatch;
+		    }
+		}
+
+	    } else if (sub >= 128) {
+		for (i = 0; i < tw * th; i += run) {
+		    if (sub == 128) {
+			pix = NextCPixel();
+			b = 0x80;
+		    } else {
+			b = NextByte();
+			pix = palette[b & 0x7f];
+		    }
+		    run = 1;
+		    if (b & 0x80) {
+			do {
+			    b = NextByte();
+			    run += b;
+			} while (b == 255);
+		    }
+		    if (i + run > tw * th)
+			goto mismatch;
+		    for (j = i; j < i + run; j++)
+			if (pix != (fb[(ty + j / tw) * FB_WIDTH + tx + j % tw]
+				    & 0xffffff))
+			    goto mismatch;
+		}
+
+	    } else {
+		goto mismatch;
+	    }
+	    continue;
+
+	mismatch:
+	    BenchFail("%s: tile %d,%d of %dx%d at %d,%d (subencoding %d) "
+		      "differs\n", what, tx, ty, w, h, x, y, sub);
+	    return;
+	}
+    }
+
+    if (zbufPos != zbufLen)
+	BenchFail("%s: %d bytes left over in %dx%d at %d,%d\n",
+		  what, zbufLen - zbufPos, w, h, x, y);
+}
+
+static int
+NextByte()
+{
+    return (zbufPos < zbufLen) ? zbuf[zbufPos++] : -1;
+}
+
+/* 32 bpp depth 24 little-endian: the three low bytes. */
+
+static CARD32
+NextCPixel()
+{
+    CARD32 pix;
+
+    pix = NextByte();
+    pix |= NextByte() << 8;
+    pix |= NextByte() << 16;
+    return pix;
+}
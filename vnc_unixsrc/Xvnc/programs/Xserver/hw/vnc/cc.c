@@ -0,0 +1,454 @@
+/*
+ * cc.c
+ *
+ * Congestion control for pushed frames: deciding how fast, how often and
+ * at what quality a client's frames are sent.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * A controller is chosen with -cc and is called once per throughput tick
+ * and once per Sack that yields an RTT sample.  It steers the client
+ * through tightQualityLevel, serverPushInterval, ccPacingRate (used by
+ * pace.c instead of receivingThroughput when not 0) and ccFrameBudget
+ * (the bytes rfbPushFrame() may plan for one frame, the rest of the
+ * damage waiting for the next one).
+ *
+ * "ramp" is the original controller.  It compares the sending and
+ * receiving throughput and moves quality or interval by one step at most
+ * every 20 ticks.
+ *
+ * "delay" follows BBR.  It estimates the bottleneck bandwidth as the
+ * highest delivery rate seen recently, and the propagation delay as the
+ * lowest RTT of the last CC_MIN_RTT_WINDOW ms.  It paces at a multiple of
+ * that bandwidth: high while starting up, low to drain the queue that
+ * built up, then cycling slightly above and below 1 to keep probing.  A
+ * rising RTT above the minimum means a queue is building, and the
+ * controller backs off whatever the loss rate; loss without a rising RTT
+ * is taken to be random and is left to retransmission and FEC.  Quality
+ * is lowered when most frames no longer fit into their budget and raised
+ * again when none is cut.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+#define RFB_LOG(...)
+
+static Bool RampInit(rfbClientPtr cl);
+static void RampTick(rfbClientPtr cl, unsigned long now);
+static void RampAck(rfbClientPtr cl, unsigned long now, double rtt,
+		    double rate);
+static void RampPrintStats(rfbClientPtr cl);
+static void RampFree(rfbClientPtr cl);
+
+static Bool DelayInit(rfbClientPtr cl);
+static void DelayTick(rfbClientPtr cl, unsigned long now);
+static void DelayAck(rfbClientPtr cl, unsigned long now, double rtt,
+		     double rate);
+static void DelayPrintStats(rfbClientPtr cl);
+static void DelayFree(rfbClientPtr cl);
+static void DelaySetRate(rfbClientPtr cl);
+
+static rfbCongestionControl controllers[] = {
+    { "ramp", RampInit, RampTick, RampAck, RampPrintStats, RampFree },
+    { "delay", DelayInit, DelayTick, DelayAck, DelayPrintStats, DelayFree },
+};
+
+#define N_CONTROLLERS (sizeof(controllers) / sizeof(controllers[0]))
+
+/* Controller given to new clients.  Set by -cc. */
+rfbCongestionControlPtr rfbCongestionControlType = &controllers[0];
+
+
+/*
+ * Choose the controller for new clients by name.  Returns FALSE if there
+ * is none of that name.
+ */
+
+Bool
+rfbSetCongestionControl(name)
+    char *name;
+{
+    int i;
+
+    for (i = 0; i < N_CONTROLLERS; i++) {
+	if (strcmp(name, controllers[i].name) == 0) {
+	    rfbCongestionControlType = &controllers[i];
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+
+void
+rfbCcInit(cl)
+    rfbClientPtr cl;
+{
+    cl->ccPrivate = NULL;
+    cl->ccPacingRate = 0.0;
+    cl->ccFrameBudget = 0;
+    cl->ccDelivered = 0;
+    cl->ccDeliveredTime = 0;
+
+    cl->cc = rfbCongestionControlType;
+    if (!cl->cc->init(cl)) {
+	rfbLog("Using the %s congestion controller for client %s\n",
+	       controllers[0].name, cl->host);
+	cl->cc = &controllers[0];
+	cl->cc->init(cl);
+    }
+}
+
+
+void
+rfbCcFree(cl)
+    rfbClientPtr cl;
+{
+    cl->cc->free(cl);
+}
+
+
+/*
+ * The ramp controller.
+ */
+
+static Bool
+RampInit(cl)
+    rfbClientPtr cl;
+{
+    cl->lastChange = 0;
+    return TRUE;
+}
+
+static void
+RampTick(cl, now)
+    rfbClientPtr cl;
+    unsigned long now;
+{
+	/* Linearly map quality to percentage. 1 -> 0%, 5 -> 100% */
+	double qualityPercentage = (cl->tightQualityLevel - 3.0) / (3.0 - 1.0);
+	/* Linearly map interval to percentage. 1000 -> 0%, 42 -> 100% */
+	double intervalPercentage = (1000.0 - cl->serverPushInterval) / (1000.0 - 42.0);
+
+	if (cl->sendingThroughput > cl->receivingThroughput) {
+		if (now - cl->lastChange > 20 * tickInterval) {
+			if (qualityPercentage >= intervalPercentage) {
+				cl->tightQualityLevel--;
+				if (cl->tightQualityLevel < 1) {
+					cl->tightQualityLevel = 1;
+				}
+			} else {
+				cl->serverPushInterval += 5;
+				if (cl->serverPushInterval > 1000) {
+					cl->serverPushInterval = 1000;
+				}
+			}
+			RFB_LOG("RAMP DOWN: quality = %d (%f), interval = %d (%f)\n\n", cl->tightQualityLevel, qualityPercentage, cl->serverPushInterval, intervalPercentage);
+			cl->lastChange = now;
+		}
+	} else if (cl->sendingThroughput < 0.9 * cl->receivingThroughput) {
+		if (now - cl->lastChange > 20 * tickInterval) {
+			if (qualityPercentage <= intervalPercentage) {
+				cl->tightQualityLevel++;
+				if (cl->tightQualityLevel > 3) {
+					cl->tightQualityLevel = 3;
+				}
+			} else {
+				cl->serverPushInterval -= 5;
+				if (cl->serverPushInterval < 42) {
+					cl->serverPushInterval = 42;
+				}
+			}
+			RFB_LOG("RAMP UP: quality = %d (%f), interval = %d (%f)\n\n", cl->tightQualityLevel, qualityPercentage, cl->serverPushInterval, intervalPercentage);
+			cl->lastChange = now;
+		}
+	}
+}
+
+static void
+RampAck(cl, now, rtt, rate)
+    rfbClientPtr cl;
+    unsigned long now;
+    double rtt;
+    double rate;
+{
+    /* Works from receivingThroughput, updated by rfbProcessSack(). */
+}
+
+static void
+RampPrintStats(cl)
+    rfbClientPtr cl;
+{
+    rfbLog("    congestion control ramp: quality %d, interval %lu ms, "
+	   "sending %.0f bytes/s, receiving %.0f bytes/s\n",
+	   cl->tightQualityLevel, cl->serverPushInterval,
+	   cl->sendingThroughput, cl->receivingThroughput);
+}
+
+static void
+RampFree(cl)
+    rfbClientPtr cl;
+{
+}
+
+
+/*
+ * The delay controller.
+ */
+
+#define CC_BW_WINDOW 16		/* ticks the bandwidth estimate covers */
+#define CC_MIN_RTT_WINDOW 10000	/* ms the minimum RTT is trusted for */
+#define CC_STARTUP_GAIN 2.885	/* 2/ln(2), doubles the rate every RTT */
+#define CC_FULL_BW_TICKS 3	/* ticks without growth that end startup */
+#define CC_QUEUE_DELAY 5.0	/* ms of queueing that is tolerated ... */
+#define CC_QUEUE_FRACTION 0.25	/* ... or this fraction of the min RTT */
+#define CC_BACKOFF_GAIN 0.75
+#define CC_QUALITY_INTERVAL 1000	/* ms between quality changes */
+#define CC_PUSH_INTERVAL 42	/* ms, the ramp controller's fastest */
+
+enum { CC_STARTUP, CC_DRAIN, CC_PROBE_BW };
+
+static char *modeNames[] = { "startup", "drain", "probe" };
+
+static double probeGains[] = { 1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+
+#define N_PROBE_GAINS (sizeof(probeGains) / sizeof(probeGains[0]))
+
+typedef struct {
+    int mode;
+    double gain;
+    double bwMax[CC_BW_WINDOW];	/* highest delivery rate in each tick */
+    int bwSlot;
+    double btlBw;		/* bytes per second, 0 until the first sample */
+    double fullBw;
+    int fullBwTicks;
+    double minRtt;		/* ms, < 0 until the first sample */
+    unsigned long minRttTime;
+    double rtt;			/* smoothed, ms */
+    double lastTickRtt;
+    int cycle;
+    Bool queueing;
+    unsigned long lastQualityChange;
+    int framesMark, cutMark;
+    int backoffs;
+} DelayState;
+
+static Bool
+DelayInit(cl)
+    rfbClientPtr cl;
+{
+    DelayState *s;
+    int i;
+
+    s = (DelayState *)xalloc(sizeof(DelayState));
+    if (s == NULL) {
+	rfbLog("DelayInit: out of memory\n");
+	return FALSE;
+    }
+
+    s->mode = CC_STARTUP;
+    s->gain = CC_STARTUP_GAIN;
+    for (i = 0; i < CC_BW_WINDOW; i++)
+	s->bwMax[i] = 0.0;
+    s->bwSlot = 0;
+    s->btlBw = 0.0;
+    s->fullBw = 0.0;
+    s->fullBwTicks = 0;
+    s->minRtt = -1.0;
+    s->minRttTime = 0;
+    s->rtt = -1.0;
+    s->lastTickRtt = -1.0;
+    s->cycle = 0;
+    s->queueing = FALSE;
+    s->lastQualityChange = 0;
+    s->framesMark = 0;
+    s->cutMark = 0;
+    s->backoffs = 0;
+
+    cl->ccPrivate = s;
+    cl->serverPushInterval = CC_PUSH_INTERVAL;
+    DelaySetRate(cl);
+    return TRUE;
+}
+
+/*
+ * Queueing delay above which the controller backs off.
+ */
+
+static double
+DelayQueueLimit(s)
+    DelayState *s;
+{
+    double limit = CC_QUEUE_FRACTION * s->minRtt;
+
+    return (limit > CC_QUEUE_DELAY) ? limit : CC_QUEUE_DELAY;
+}
+
+static void
+DelayAck(cl, now, rtt, rate)
+    rfbClientPtr cl;
+    unsigned long now;
+    double rtt;
+    double rate;
+{
+    DelayState *s = (DelayState *)cl->ccPrivate;
+    int i;
+
+    s->rtt = (s->rtt < 0.0) ? rtt : 0.875 * s->rtt + 0.125 * rtt;
+
+    /* An old minimum may belong to a route that is gone. */
+    if (s->minRtt < 0.0 || rtt <= s->minRtt ||
+	now - s->minRttTime > CC_MIN_RTT_WINDOW) {
+	s->minRtt = rtt;
+	s->minRttTime = now;
+    }
+
+    if (rate > s->bwMax[s->bwSlot]) {
+	s->bwMax[s->bwSlot] = rate;
+	for (i = 0; i < CC_BW_WINDOW; i++) {
+	    if (s->bwMax[i] > s->btlBw)
+		s->btlBw = s->bwMax[i];
+	}
+	DelaySetRate(cl);
+    }
+}
+
+static void
+DelayTick(cl, now)
+    rfbClientPtr cl;
+    unsigned long now;
+{
+    DelayState *s = (DelayState *)cl->ccPrivate;
+    double queueDelay;
+    int i, frames, cut;
+
+    if (s->rtt < 0.0)
+	return;			/* nothing acknowledged yet */
+
+    queueDelay = s->rtt - s->minRtt;
+    s->queueing = (queueDelay > DelayQueueLimit(s) &&
+		   s->lastTickRtt >= 0.0 && s->rtt >= s->lastTickRtt);
+    s->lastTickRtt = s->rtt;
+
+    switch (s->mode) {
+    case CC_STARTUP:
+	if (s->btlBw >= 1.25 * s->fullBw) {
+	    s->fullBw = s->btlBw;
+	    s->fullBwTicks = 0;
+	} else if (++s->fullBwTicks >= CC_FULL_BW_TICKS) {
+	    s->mode = CC_DRAIN;
+	}
+	s->gain = (s->mode == CC_STARTUP) ? CC_STARTUP_GAIN
+					   : 1.0 / CC_STARTUP_GAIN;
+	break;
+    case CC_DRAIN:
+	if (queueDelay <= DelayQueueLimit(s)) {
+	    s->mode = CC_PROBE_BW;
+	    s->cycle = 0;
+	}
+	break;
+    case CC_PROBE_BW:
+	s->cycle = (s->cycle + 1) % N_PROBE_GAINS;
+	s->gain = probeGains[s->cycle];
+	if (s->queueing) {
+	    s->gain = CC_BACKOFF_GAIN;
+	    s->backoffs++;
+	}
+	break;
+    }
+
+    /* Age the bandwidth window by one tick. */
+    s->bwSlot = (s->bwSlot + 1) % CC_BW_WINDOW;
+    s->bwMax[s->bwSlot] = 0.0;
+    s->btlBw = 0.0;
+    for (i = 0; i < CC_BW_WINDOW; i++) {
+	if (s->bwMax[i] > s->btlBw)
+	    s->btlBw = s->bwMax[i];
+    }
+
+    DelaySetRate(cl);
+
+    if (now - s->lastQualityChange < CC_QUALITY_INTERVAL ||
+	cl->tightQualityLevel < 1)
+	return;
+
+    frames = cl->pushStats.rfbPushFramesSent - s->framesMark;
+    cut = cl->pushStats.rfbPushFramesCut - s->cutMark;
+    if (frames < 5)
+	return;
+
+    if (2 * cut > frames && cl->tightQualityLevel > 1) {
+	cl->tightQualityLevel--;
+	RFB_LOG("DELAY: quality = %d, %d of %d frames cut\n",
+		cl->tightQualityLevel, cut, frames);
+    } else if (cut == 0 && !s->queueing && s->mode == CC_PROBE_BW &&
+	       cl->tightQualityLevel < 3) {
+	cl->tightQualityLevel++;
+	RFB_LOG("DELAY: quality = %d\n", cl->tightQualityLevel);
+    }
+    s->lastQualityChange = now;
+    s->framesMark = cl->pushStats.rfbPushFramesSent;
+    s->cutMark = cl->pushStats.rfbPushFramesCut;
+}
+
+/*
+ * Pace at gain times the bottleneck bandwidth, and plan each frame to be
+ * sent in one push interval at that rate.
+ */
+
+static void
+DelaySetRate(cl)
+    rfbClientPtr cl;
+{
+    DelayState *s = (DelayState *)cl->ccPrivate;
+    double bw = (s->btlBw > 0.0) ? s->btlBw : cl->receivingThroughput;
+
+    cl->ccPacingRate = s->gain * bw;
+    cl->ccFrameBudget = (int)(cl->ccPacingRate * cl->serverPushInterval /
+			      1000.0);
+    if (cl->ccFrameBudget < cl->pushDatagramSize)
+	cl->ccFrameBudget = cl->pushDatagramSize;
+}
+
+static void
+DelayPrintStats(cl)
+    rfbClientPtr cl;
+{
+    DelayState *s = (DelayState *)cl->ccPrivate;
+
+    rfbLog("    congestion control delay: %s, bottleneck %.0f bytes/s, "
+	   "min RTT %.0f ms, RTT %.0f ms\n",
+	   modeNames[s->mode], s->btlBw, s->minRtt, s->rtt);
+    rfbLog("      pacing %.0f bytes/s, frame budget %d bytes, quality %d, "
+	   "backoffs on rising delay %d\n",
+	   cl->ccPacingRate, cl->ccFrameBudget, cl->tightQualityLevel,
+	   s->backoffs);
+}
+
+static void
+DelayFree(cl)
+    rfbClientPtr cl;
+{
+    if (cl->ccPrivate != NULL) {
+	xfree(cl->ccPrivate);
+	cl->ccPrivate = NULL;
+    }
+}
@@ -90,7 +90,7 @@ rfbSendSmallRectEncodingCoRRE(cl, x, y, w, h)
     rfbRREHeader hdr;
     int nSubrects;
     int i;
-    char *fbptr = (rfbScreen.pfbMemory + (rfbScreen.paddedWidthInBytes * y)
+    char *fbptr = (CLIENT_FB_MEMORY(cl) + (CLIENT_FB_STRIDE(cl) * y)
 		   + (x * (rfbScreen.bitsPerPixel / 8)));
 
     int maxRawSize = (rfbScreen.width * rfbScreen.height
@@ -114,7 +114,7 @@ rfbSendSmallRectEncodingCoRRE(cl, x, y, w, h)
 
     (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
 		       &cl->format, fbptr, rreBeforeBuf,
-		       rfbScreen.paddedWidthInBytes, w, h);
+		       CLIENT_FB_STRIDE(cl), w, h);
 
     switch (cl->format.bitsPerPixel) {
     case 8:
@@ -73,6 +73,9 @@ static int EncodeRichCursorData16 (char *buf, rfbPixelFormat *fmt,
 				   CursorPtr pCursor);
 static int EncodeRichCursorData32 (char *buf, rfbPixelFormat *fmt,
 				   CursorPtr pCursor);
+static Bool ScaleCursor (CursorPtr pCursor, int scale, CursorPtr pScaled);
+static Bool SendCursorBits (rfbClientPtr cl, CursorPtr pCursor,
+			    rfbFramebufferUpdateRectHeader *rect);
 
 
 /*
@@ -86,12 +89,6 @@ rfbSendCursorShape(cl, pScreen)
 {
     CursorPtr pCursor;
     rfbFramebufferUpdateRectHeader rect;
-    rfbXCursorColors colors;
-    int saved_ublen;
-    int bitmapRowBytes, paddedRowBytes, maskBytes, dataBytes;
-    int i, j;
-    CARD8 *bitmapData;
-    CARD8 bitmapByte;
 
     if (cl->useRichCursorEncoding) {
 	rect.encoding = Swap32IfLE(rfbEncodingRichCursor);
@@ -127,6 +124,44 @@ rfbSendCursorShape(cl, pScreen)
 	return TRUE;
     }
 
+    /*
+     * A scaled client draws the cursor over its reduced framebuffer, so
+     * it gets the cursor and its hotspot reduced by the same scale.
+     */
+
+    if (cl->scale > 1) {
+	CursorRec scaled;
+	Bool ok;
+
+	if (!ScaleCursor(pCursor, cl->scale, &scaled))
+	    return FALSE;
+	ok = SendCursorBits(cl, &scaled, &rect);
+	xfree(scaled.bits->source);
+	xfree((char *)scaled.bits);
+	return ok;
+    }
+
+    return SendCursorBits(cl, pCursor, &rect);
+}
+
+
+/*
+ * Send the shape of pCursor, with rect's encoding.
+ */
+
+static Bool
+SendCursorBits(cl, pCursor, rect)
+    rfbClientPtr cl;
+    CursorPtr pCursor;
+    rfbFramebufferUpdateRectHeader *rect;
+{
+    rfbXCursorColors colors;
+    int saved_ublen;
+    int bitmapRowBytes, paddedRowBytes, maskBytes, dataBytes;
+    int i, j;
+    CARD8 *bitmapData;
+    CARD8 bitmapByte;
+
     /* Calculate data sizes. */
 
     bitmapRowBytes = (pCursor->bits->width + 7) / 8;
@@ -153,12 +188,12 @@ rfbSendCursorShape(cl, pScreen)
 
     /* Prepare rectangle header. */
 
-    rect.r.x = Swap16IfLE(pCursor->bits->xhot);
-    rect.r.y = Swap16IfLE(pCursor->bits->yhot);
-    rect.r.w = Swap16IfLE(pCursor->bits->width);
-    rect.r.h = Swap16IfLE(pCursor->bits->height);
+    rect->r.x = Swap16IfLE(pCursor->bits->xhot);
+    rect->r.y = Swap16IfLE(pCursor->bits->yhot);
+    rect->r.w = Swap16IfLE(pCursor->bits->width);
+    rect->r.h = Swap16IfLE(pCursor->bits->height);
 
-    memcpy(&updateBuf[ublen], (char *)&rect,sz_rfbFramebufferUpdateRectHeader);
+    memcpy(&updateBuf[ublen], (char *)rect,sz_rfbFramebufferUpdateRectHeader);
     ublen += sz_rfbFramebufferUpdateRectHeader;
 
     /* Prepare actual cursor data (depends on encoding used). */
@@ -229,6 +264,87 @@ rfbSendCursorShape(cl, pScreen)
 }
 
 
+/*
+ * Make pScaled a copy of pCursor reduced by scale, with its own bits,
+ * which the caller frees.  A reduced pixel is in the mask if any pixel of
+ * its block is, so that lines one pixel wide survive, and takes its
+ * colour from the first such pixel.  The bitmaps keep the server's row
+ * padding and bit order.
+ */
+
+#define CURSOR_BIT(bits, rowBytes, x, y)				\
+    ((screenInfo.bitmapBitOrder == LSBFirst) ?				\
+     ((bits)[(y) * (rowBytes) + (x) / 8] >> ((x) % 8) & 1) :		\
+     ((bits)[(y) * (rowBytes) + (x) / 8] >> (7 - (x) % 8) & 1))
+
+#define SET_CURSOR_BIT(bits, rowBytes, x, y)				\
+    ((bits)[(y) * (rowBytes) + (x) / 8] |=				\
+     ((screenInfo.bitmapBitOrder == LSBFirst) ?				\
+      1 << ((x) % 8) : 0x80 >> ((x) % 8)))
+
+static Bool
+ScaleCursor(pCursor, scale, pScaled)
+    CursorPtr pCursor;
+    int scale;
+    CursorPtr pScaled;
+{
+    CursorBitsPtr bits = pCursor->bits;
+    CursorBitsPtr sbits;
+    int w, h, rowBytes, srowBytes;
+    int x, y, sx, sy, fromX, fromY;
+
+    w = (bits->width + scale - 1) / scale;
+    h = (bits->height + scale - 1) / scale;
+    rowBytes = PixmapBytePad(bits->width, 1);
+    srowBytes = PixmapBytePad(w, 1);
+
+    sbits = (CursorBitsPtr)xalloc(sizeof(CursorBits));
+    if (sbits == NULL) {
+	rfbLog("ScaleCursor: out of memory\n");
+	return FALSE;
+    }
+    sbits->source = (unsigned char *)xalloc(2 * srowBytes * h);
+    if (sbits->source == NULL) {
+	rfbLog("ScaleCursor: out of memory\n");
+	xfree((char *)sbits);
+	return FALSE;
+    }
+    sbits->mask = sbits->source + srowBytes * h;
+    memset(sbits->source, 0, 2 * srowBytes * h);
+    sbits->width = w;
+    sbits->height = h;
+    sbits->xhot = bits->xhot / scale;
+    sbits->yhot = bits->yhot / scale;
+    sbits->refcnt = 1;
+
+    for (sy = 0; sy < h; sy++) {
+	for (sx = 0; sx < w; sx++) {
+	    fromX = -1;
+	    for (y = sy * scale; y < (sy + 1) * scale &&
+		     y < bits->height && fromX < 0; y++) {
+		for (x = sx * scale; x < (sx + 1) * scale &&
+			 x < bits->width; x++) {
+		    if (CURSOR_BIT(bits->mask, rowBytes, x, y)) {
+			fromX = x;
+			fromY = y;
+			break;
+		    }
+		}
+	    }
+	    if (fromX < 0)
+		continue;
+	    SET_CURSOR_BIT(sbits->mask, srowBytes, sx, sy);
+	    if (CURSOR_BIT(bits->source, rowBytes, fromX, fromY))
+		SET_CURSOR_BIT(sbits->source, srowBytes, sx, sy);
+	}
+    }
+
+    *pScaled = *pCursor;
+    pScaled->bits = sbits;
+    return TRUE;
+}
+
+
 /*
  * Send cursor position (PointerPos pseudo-encoding).
  */
@@ -248,9 +364,10 @@ rfbSendCursorPos(cl, pScreen)
 
     rfbSpriteGetCursorPos(pScreen, &x, &y);
 
+    /* A scaled client gets the position in its own coordinates. */
     rect.encoding = Swap32IfLE(rfbEncodingPointerPos);
-    rect.r.x = Swap16IfLE((CARD16)x);
-    rect.r.y = Swap16IfLE((CARD16)y);
+    rect.r.x = Swap16IfLE((CARD16)(x / cl->scale));
+    rect.r.y = Swap16IfLE((CARD16)(y / cl->scale));
     rect.r.w = 0;
     rect.r.h = 0;
 
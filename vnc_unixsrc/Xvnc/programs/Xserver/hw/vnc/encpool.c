@@ -0,0 +1,196 @@
+/*
+ * encpool.c
+ *
+ * A small pool of threads used to run independent encoding jobs in
+ * parallel with the X server's dispatch thread.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include "rfb.h"
+
+/*
+ * Number of threads encoding in parallel, counting the dispatch thread.
+ * 0 means one per online CPU.  Set by -encodethreads.
+ */
+
+int rfbEncodeThreads = 0;
+
+static Bool poolStarted = FALSE;
+static int poolSize = 1;
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+
+/* The batch being run.  Protected by poolMutex. */
+static rfbEncoderJobProc batchProc;
+static void *batchArg;
+static int batchJobs;		/* number of jobs in the batch */
+static int batchNext;		/* next job to hand out */
+static int batchFinished;	/* jobs completed so far */
+static unsigned long batchGeneration;
+
+static void *EncoderThread(void *arg);
+static void RunJobs(int worker);
+
+
+/*
+ * Start the worker threads the first time they are needed.  Returns the
+ * number of threads that take part in a batch (at least 1).
+ */
+
+int
+rfbEncoderPoolSize()
+{
+    pthread_t thread;
+    sigset_t all, saved;
+    int n;
+    long ncpu;
+
+    if (poolStarted)
+	return poolSize;
+    poolStarted = TRUE;
+
+    n = rfbEncodeThreads;
+    if (n <= 0) {
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	n = (ncpu > 0) ? (int)ncpu : 1;
+    }
+    if (n > MAX_ENCODE_THREADS)
+	n = MAX_ENCODE_THREADS;
+
+    /*
+     * The workers inherit the signal mask, so block everything while they
+     * are created: SIGIO, SIGALRM and the rest must reach the dispatch
+     * thread, whose handlers are not safe to run anywhere else.
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    for (poolSize = 1; poolSize < n; poolSize++) {
+	if (pthread_create(&thread, NULL, EncoderThread,
+			   (void *)(long)poolSize) != 0) {
+	    rfbLogPerror("rfbEncoderPoolSize: pthread_create");
+	    break;
+	}
+	pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (poolSize > 1)
+	rfbLog("Encoding with %d threads\n", poolSize);
+
+    return poolSize;
+}
+
+
+/*
+ * Call proc(arg, worker, job) for every job in 0..nJobs-1 and return when
+ * all of them are done.  The calling thread works on the batch too, as
+ * worker 0; the others are numbered 1..rfbEncoderPoolSize()-1.  Jobs are
+ * handed out in order but may finish in any order.
+ */
+
+void
+rfbEncoderPoolRun(proc, arg, nJobs)
+    rfbEncoderJobProc proc;
+    void *arg;
+    int nJobs;
+{
+    int job;
+
+    if (rfbEncoderPoolSize() == 1 || nJobs == 1) {
+	for (job = 0; job < nJobs; job++)
+	    (*proc)(arg, 0, job);
+	return;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    batchProc = proc;
+    batchArg = arg;
+    batchJobs = nJobs;
+    batchNext = 0;
+    batchFinished = 0;
+    batchGeneration++;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolMutex);
+
+    RunJobs(0);
+
+    pthread_mutex_lock(&poolMutex);
+    while (batchFinished < batchJobs)
+	pthread_cond_wait(&poolDone, &poolMutex);
+    batchJobs = 0;
+    pthread_mutex_unlock(&poolMutex);
+}
+
+
+/*
+ * Take jobs from the current batch until there are none left.
+ */
+
+static void
+RunJobs(worker)
+    int worker;
+{
+    rfbEncoderJobProc proc;
+    void *arg;
+    int job;
+
+    pthread_mutex_lock(&poolMutex);
+    while (batchNext < batchJobs) {
+	job = batchNext++;
+	proc = batchProc;
+	arg = batchArg;
+	pthread_mutex_unlock(&poolMutex);
+
+	(*proc)(arg, worker, job);
+
+	pthread_mutex_lock(&poolMutex);
+	if (++batchFinished == batchJobs)
+	    pthread_cond_signal(&poolDone);
+    }
+    pthread_mutex_unlock(&poolMutex);
+}
+
+
+static void *
+EncoderThread(arg)
+    void *arg;
+{
+    int worker = (int)(long)arg;
+    unsigned long generation = 0;
+
+    for (;;) {
+	pthread_mutex_lock(&poolMutex);
+	while (batchGeneration == generation || batchNext >= batchJobs)
+	    pthread_cond_wait(&poolWork, &poolMutex);
+	generation = batchGeneration;
+	pthread_mutex_unlock(&poolMutex);
+
+	RunJobs(worker);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,196 @@
+/*
+ * fec.c
+ *
+ * Forward error correction for pushed datagrams: XOR parity datagrams
+ * from which the client can rebuild a lost datagram without waiting for
+ * the server to time it out and send its area again.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * The datagrams of a frame are sent in groups of cl->fecGroupSize, each
+ * group followed by one FecParity datagram; the last group of a frame may
+ * be shorter.  One parity datagram per group can make up for one lost
+ * datagram of the group, so the group size is chosen from the measured
+ * loss rate: parity is left out entirely while the link loses next to
+ * nothing, and sent after every second datagram when it loses a lot.
+ *
+ * Datagrams the client rebuilds are acknowledged as usual, and counted in
+ * the recovered field of the Sack, so that the loss rate measured here
+ * does not drop just because FEC is hiding the losses.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+Bool rfbFec = FALSE;
+
+#define FEC_MAX_GROUP 32	/* datagrams per parity at the lowest loss */
+#define FEC_MIN_LOSS 0.005	/* below this no parity is sent */
+#define FEC_LOSS_SAMPLE 32	/* datagrams sent between loss estimates */
+
+/*
+ * Product of group size and loss rate.  At 0.2 a group of K datagrams
+ * plus its parity loses two or more datagrams, which parity cannot make
+ * up for, in well under one frame in ten.
+ */
+#define FEC_TARGET 0.2
+
+
+/*
+ * Update the client's loss rate from the datagrams sent and lost since the
+ * last call, and choose the group size to go with it.  Called once per
+ * throughput tick.
+ */
+
+void
+rfbFecUpdateLoss(cl)
+    rfbClientPtr cl;
+{
+    int sent = cl->pushStats.rfbPushDatagramsSent - cl->lossSentMark;
+    int lost = (cl->pushStats.rfbPushDatagramsRequeued + cl->pushStats.rfbPushDatagramsRecovered
+		- cl->lossLostMark);
+    int groupSize;
+
+    if (sent < FEC_LOSS_SAMPLE)
+	return;
+    if (lost > sent)
+	lost = sent;
+
+    cl->lossRate = 0.75 * cl->lossRate + 0.25 * lost / sent;
+    cl->lossSentMark = cl->pushStats.rfbPushDatagramsSent;
+    cl->lossLostMark = (cl->pushStats.rfbPushDatagramsRequeued
+			+ cl->pushStats.rfbPushDatagramsRecovered);
+
+    if (!cl->enableFec || cl->lossRate < FEC_MIN_LOSS) {
+	groupSize = 0;
+    } else {
+	groupSize = (int)(FEC_TARGET / cl->lossRate);
+	if (groupSize < 2)
+	    groupSize = 2;
+	if (groupSize > FEC_MAX_GROUP)
+	    groupSize = FEC_MAX_GROUP;
+    }
+
+    if ((groupSize == 0) != (cl->fecGroupSize == 0))
+	rfbLog("FEC %s for client %s, loss rate %.1f%%\n",
+	       groupSize ? "on" : "off", cl->host, 100.0 * cl->lossRate);
+    cl->fecGroupSize = groupSize;
+}
+
+
+/*
+ * Add a datagram which has just been queued to the current group, and send
+ * the group's parity once the group is full.  Datagrams must be added in
+ * seqNum order.
+ */
+
+Bool
+rfbFecAdd(cl, seqNum, buf, len)
+    rfbClientPtr cl;
+    CARD32 seqNum;
+    char *buf;
+    int len;
+{
+    char *parity;
+    int i;
+
+    if (cl->fecGroupSize == 0)
+	return TRUE;
+
+    if (cl->fecParity == NULL) {
+	cl->fecParity = (char *)xalloc(sz_rfbFecParityMsg +
+				       rfbMaxDatagramSize);
+	if (cl->fecParity == NULL) {
+	    rfbLog("rfbFecAdd: out of memory\n");
+	    cl->fecGroupSize = 0;
+	    return TRUE;
+	}
+    }
+
+    if (cl->fecCount != 0 && seqNum != cl->fecFirstSeqNum + cl->fecCount) {
+	if (!rfbFecFlush(cl))
+	    return FALSE;
+    }
+
+    if (cl->fecCount == 0) {
+	cl->fecFirstSeqNum = seqNum;
+	cl->fecMaxLength = 0;
+	cl->fecLengthXor = 0;
+    }
+
+    parity = &cl->fecParity[sz_rfbFecParityMsg];
+    if (len > cl->fecMaxLength) {
+	memset(&parity[cl->fecMaxLength], 0, len - cl->fecMaxLength);
+	cl->fecMaxLength = len;
+    }
+    for (i = 0; i < len; i++)
+	parity[i] ^= buf[i];
+
+    cl->fecLengthXor ^= len;
+    cl->fecCount++;
+
+    if (cl->fecCount >= cl->fecGroupSize)
+	return rfbFecFlush(cl);
+    return TRUE;
+}
+
+
+/*
+ * Send the parity of the current group, if it has any datagrams.  Called
+ * when the group is full, at the end of every frame, and before a gap in
+ * seqNums.
+ */
+
+Bool
+rfbFecFlush(cl)
+    rfbClientPtr cl;
+{
+    rfbFecParityMsg *fp = (rfbFecParityMsg *)cl->fecParity;
+    int len;
+
+    if (cl->fecCount == 0)
+	return TRUE;
+
+    fp->type = rfbFecParity;
+    fp->count = cl->fecCount;
+    fp->lengthXor = Swap16IfLE(cl->fecLengthXor);
+    fp->firstSeqNum = Swap32IfLE(cl->fecFirstSeqNum);
+    len = sz_rfbFecParityMsg + cl->fecMaxLength;
+    cl->fecCount = 0;
+
+    if (!rfbSendDatagram(cl, cl->fecParity, len))
+	return FALSE;
+
+    cl->tickSentBytes += len;
+    cl->pushStats.rfbPushParitySent++;
+    cl->pushStats.rfbPushParityBytesSent += len;
+    return TRUE;
+}
+
+
+void
+rfbFecFree(cl)
+    rfbClientPtr cl;
+{
+    if (cl->fecParity != NULL) {
+	xfree(cl->fecParity);
+	cl->fecParity = NULL;
+    }
+}
@@ -125,12 +125,12 @@ sendHextiles##bpp(cl, rx, ry, rw, rh)					      \
 		    return FALSE;					      \
 	    }								      \
 									      \
-	    fbptr = (rfbScreen.pfbMemory + (rfbScreen.paddedWidthInBytes * y) \
+	    fbptr = (CLIENT_FB_MEMORY(cl) + (CLIENT_FB_STRIDE(cl) * y)	      \
 		     + (x * (rfbScreen.bitsPerPixel / 8)));		      \
 									      \
 	    (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,    \
 			       &cl->format, fbptr, (char *)clientPixelData,   \
-			       rfbScreen.paddedWidthInBytes, w, h);	      \
+			       CLIENT_FB_STRIDE(cl), w, h);		      \
 									      \
 	    startUblen = ublen;						      \
 	    updateBuf[startUblen] = 0;					      \
@@ -174,7 +174,7 @@ sendHextiles##bpp(cl, rx, ry, rw, rh)					      \
 		(*cl->translateFn)(cl->translateLookupTable,		      \
 				   &rfbServerFormat, &cl->format, fbptr,      \
 				   (char *)clientPixelData,		      \
-				   rfbScreen.paddedWidthInBytes, w, h);	      \
+				   CLIENT_FB_STRIDE(cl), w, h);		      \
 									      \
 		memcpy(&updateBuf[ublen], (char *)clientPixelData,	      \
 		       w * h * (bpp/8));				      \
@@ -52,6 +52,9 @@
 
 #define OK_STR "HTTP/1.0 200 OK\r\n\r\n"
 
+#define METRICS_STR "HTTP/1.0 200 OK\r\n" \
+    "Content-Type: text/plain; version=0.0.4\r\n\r\n"
+
 static void httpProcessInput();
 static Bool compareAndSkip(char **ptr, const char *str);
 static Bool parseParams(const char *request, char *result, int max_bytes);
@@ -266,6 +269,15 @@ httpProcessInput()
 	return;
     }
 
+    /* Live counters of all clients, see rfbSendMetrics().  There is no
+       authentication, so they are only served with -metrics. */
+    if (rfbMetrics && strcmp(fname, "/metrics") == 0) {
+	WriteExact(httpSock, METRICS_STR, strlen(METRICS_STR));
+	rfbSendMetrics(httpSock);
+	httpCloseSock();
+	return;
+    }
+
     if (fname[0] != '/') {
 	rfbLog("httpd: filename didn't begin with '/'\n");
 	WriteExact(httpSock, NOT_FOUND_STR, strlen(NOT_FOUND_STR));
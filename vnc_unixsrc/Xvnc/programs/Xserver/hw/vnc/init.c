@@ -54,6 +54,7 @@ from the X Consortium.
 /* Use ``#define CORBA'' to enable CORBA control interface */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <sys/types.h>
@@ -262,6 +263,11 @@ ddxProcessArgument (argc, argv, i)
 	return 2;
     }
 
+    if (strcmp(argv[i], "-metrics") == 0) {
+	rfbMetrics = TRUE;
+	return 1;
+    }
+
     if (strcmp(argv[i], "-deferupdate") == 0) {	/* -deferupdate ms */
 	if (i + 1 >= argc) UseMsg();
 	rfbDeferUpdateTime = atoi(argv[i+1]);
@@ -278,6 +284,74 @@ ddxProcessArgument (argc, argv, i)
 	return 1;
     }
 
+    if (strcmp(argv[i], "-nosimd") == 0) {
+	rfbSimdDisable = TRUE;
+	return 1;
+    }
+
+    if (strcmp(argv[i], "-encodethreads") == 0) { /* -encodethreads n */
+	if (i + 1 >= argc) UseMsg();
+	rfbEncodeThreads = atoi(argv[i+1]);
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-tilediff") == 0) {
+	rfbTileDiff = TRUE;
+	return 1;
+    }
+
+    if (strcmp(argv[i], "-maxdatagram") == 0) { /* -maxdatagram bytes */
+	if (i + 1 >= argc) UseMsg();
+	rfbMaxDatagramSize = atoi(argv[i+1]);
+	if (rfbMaxDatagramSize < MIN_DATAGRAM_SIZE)
+	    rfbMaxDatagramSize = MIN_DATAGRAM_SIZE;
+	if (rfbMaxDatagramSize > MAX_DATAGRAM_SIZE)
+	    rfbMaxDatagramSize = MAX_DATAGRAM_SIZE;
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-fec") == 0) {
+	rfbFec = TRUE;
+	return 1;
+    }
+
+    if (strcmp(argv[i], "-pace") == 0) {	/* -pace fraction */
+	if (i + 1 >= argc) UseMsg();
+	rfbPaceFraction = atof(argv[i+1]);
+	if (rfbPaceFraction < 0.0 || rfbPaceFraction > 1.0)
+	    UseMsg();
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-cc") == 0) {	/* -cc ramp|delay */
+	if (i + 1 >= argc) UseMsg();
+	if (!rfbSetCongestionControl(argv[i+1]))
+	    UseMsg();
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-inputpush") == 0) {	/* -inputpush ms */
+	if (i + 1 >= argc) UseMsg();
+	rfbInputPushQuiet = atoi(argv[i+1]);
+	if (rfbInputPushQuiet < 0)
+	    UseMsg();
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-inputbudget") == 0) {	/* -inputbudget ms */
+	if (i + 1 >= argc) UseMsg();
+	rfbInputPushBudget = atoi(argv[i+1]);
+	if (rfbInputPushBudget <= 0)
+	    UseMsg();
+	return 2;
+    }
+
+    if (strcmp(argv[i], "-telemetry") == 0) {	/* -telemetry file */
+	if (i + 1 >= argc) UseMsg();
+	rfbTelemetryFile = argv[i+1];
+	return 2;
+    }
+
     if (strcmp(argv[i], "-desktop") == 0) {	/* -desktop desktop-name */
 	if (i + 1 >= argc) UseMsg();
 	desktopName = argv[i+1];
@@ -413,6 +487,7 @@ InitOutput(screenInfo, argc, argv)
 				  strlen("VNC_LAST_CLIENT_ID"), TRUE);
     VNC_CONNECT = MakeAtom("VNC_CONNECT", strlen("VNC_CONNECT"), TRUE);
     rfbInitSockets();
+    rfbSimdInit();
     if (inetdSock == -1)
 	httpInitSockets();
    
@@ -856,6 +931,7 @@ rfbClientStateChange(cbl, myData, clt)
 void
 ddxGiveUp()
 {
+    rfbTelemetryClose();
     Xfree(rfbScreen.pfbMemory);
     if (initOutputCalled) {
 	char unixSocketName[32];
@@ -907,11 +983,45 @@ ddxUseMsg()
     ErrorF("-rfbauth passwd-file   use authentication on RFB protocol\n");
     ErrorF("-httpd dir             serve files via HTTP from here\n");
     ErrorF("-httpport port         port for HTTP\n");
+    ErrorF("-metrics               also serve live counters of all clients "
+							"via HTTP as\n"
+	   "                       /metrics, to anyone who can reach the "
+							"HTTP port\n");
     ErrorF("-deferupdate time      time in ms to defer updates "
 							     "(default 40)\n");
     ErrorF("-economictranslate     less memory-hungry translation\n");
     ErrorF("-lazytight             disable \"gradient\" filter in tight "
 								"encoding\n");
+    ErrorF("-nosimd                scan and convert pixels without "
+						   "SSE2/SSSE3/AVX2,\n"
+	   "                       for comparison\n");
+    ErrorF("-encodethreads n       threads encoding pushed frames "
+						     "(default: one per CPU)\n");
+    ErrorF("-tilediff              skip damaged tiles whose pixels did not "
+								"change\n");
+    ErrorF("-maxdatagram bytes     largest pushed datagram, if the path MTU "
+						     "allows (default 2900)\n");
+    ErrorF("-fec                   send parity datagrams to viewers that "
+							"support them,\n"
+	   "                       as many as the measured loss calls for\n");
+    ErrorF("-pace fraction         spread each pushed frame over this "
+					"fraction of the push\n"
+	   "                       interval, or more at the bottleneck rate "
+							"(default 0, off)\n");
+    ErrorF("-cc ramp|delay         congestion control for pushed frames: "
+							"throughput\n"
+	   "                       ramp, or BBR-style on delay and delivery "
+							"rate (default ramp)\n");
+    ErrorF("-inputpush ms          after input, push small damage once "
+						"drawing has been quiet\n"
+	   "                       this long, 0 to wait for the push "
+						       "interval (default 4)\n");
+    ErrorF("-inputbudget ms        push the answer to input at most this "
+							"long after it\n"
+	   "                       (default 50)\n");
+    ErrorF("-telemetry file        write input and datagram timing records "
+							"to file,\n"
+	   "                       see analysis/telemetry.py\n");
     ErrorF("-desktop name          VNC desktop name (default x11)\n");
     ErrorF("-alwaysshared          always treat new clients as shared\n");
     ErrorF("-nevershared           never treat new clients as shared\n");
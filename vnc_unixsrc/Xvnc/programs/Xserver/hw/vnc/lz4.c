@@ -0,0 +1,161 @@
+/*
+ * lz4.c
+ *
+ * A compressor for the LZ4 block format, which tight.c uses in place of
+ * zlib for clients that accept it.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * An LZ4 block has no stream behind it, so there is nothing to set up or
+ * reset and any block can be decoded on its own.  That suits pushed tiles,
+ * which cannot use zlib's history anyway, and it runs several times faster
+ * than deflate at its lowest level.
+ *
+ * This is the format's plain greedy compressor: a hash of the next four
+ * bytes finds the last place they were seen, and a match there is grown
+ * both ways.  Past incompressible data it looks at fewer and fewer
+ * positions.  The blocks are standard ones, so any LZ4 decoder reads
+ * them.
+ *
+ * A block is a series of sequences, each a token byte (literal count in
+ * the high four bits, match length less 4 in the low four, 15 meaning
+ * more bytes of 255 follow), the literals, and a two-byte little-endian
+ * match offset.  The last sequence has literals only.  As the format
+ * requires, the last five bytes are literals and no match starts in the
+ * last twelve.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_BITS 12	/* RFB_LZ4_HASH_SIZE is 1 << this */
+
+#define LZ4_HASH(v) ((int)(((v) * 2654435761U) >> (32 - LZ4_HASH_BITS)))
+
+static CARD32 Lz4Read32(unsigned char *p);
+static unsigned char *Lz4PutLength(unsigned char *op, int len);
+static unsigned char *Lz4PutSequence(unsigned char *op, unsigned char *lit,
+				     int litLen, int offset, int matchLen);
+
+
+/*
+ * Compress srcLen bytes from src into dst, which must have room for
+ * RFB_LZ4_BOUND(srcLen) bytes, and return the length of the block.
+ * hashTable has RFB_LZ4_HASH_SIZE entries and needs no setting up.
+ */
+
+int
+rfbLz4Compress(src, srcLen, dst, hashTable)
+    char *src;
+    int srcLen;
+    char *dst;
+    int *hashTable;
+{
+    unsigned char *in = (unsigned char *)src;
+    unsigned char *op = (unsigned char *)dst;
+    int ip = 0, anchor = 0;
+    int ref, end, h, i;
+    CARD32 seq;
+
+    for (i = 0; i < RFB_LZ4_HASH_SIZE; i++)
+	hashTable[i] = -LZ4_MAX_DISTANCE - 1;
+
+    while (ip < srcLen - LZ4_MF_LIMIT) {
+	seq = Lz4Read32(&in[ip]);
+	h = LZ4_HASH(seq);
+	ref = hashTable[h];
+	hashTable[h] = ip;
+
+	if (ip - ref > LZ4_MAX_DISTANCE || Lz4Read32(&in[ref]) != seq) {
+	    ip += 1 + ((ip - anchor) >> 6);
+	    continue;
+	}
+
+	while (ip > anchor && ref > 0 && in[ip-1] == in[ref-1]) {
+	    ip--;
+	    ref--;
+	}
+	end = ip + LZ4_MIN_MATCH;
+	while (end < srcLen - LZ4_LAST_LITERALS && in[end] == in[ref+end-ip])
+	    end++;
+
+	op = Lz4PutSequence(op, &in[anchor], ip - anchor, ip - ref, end - ip);
+	ip = anchor = end;
+    }
+
+    op = Lz4PutSequence(op, &in[anchor], srcLen - anchor, 0, 0);
+    return op - (unsigned char *)dst;
+}
+
+static CARD32
+Lz4Read32(p)
+    unsigned char *p;
+{
+    CARD32 v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned char *
+Lz4PutLength(op, len)
+    unsigned char *op;
+    int len;
+{
+    while (len >= 255) {
+	*op++ = 255;
+	len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* A matchLen of 0 makes the last sequence, with no match. */
+
+static unsigned char *
+Lz4PutSequence(op, lit, litLen, offset, matchLen)
+    unsigned char *op;
+    unsigned char *lit;
+    int litLen, offset, matchLen;
+{
+    unsigned char *token = op++;
+    int len;
+
+    *token = (unsigned char)((litLen < 15 ? litLen : 15) << 4);
+    if (litLen >= 15)
+	op = Lz4PutLength(op, litLen - 15);
+    memcpy(op, lit, litLen);
+    op += litLen;
+
+    if (matchLen == 0)
+	return op;
+
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    len = matchLen - LZ4_MIN_MATCH;
+    *token |= (unsigned char)(len < 15 ? len : 15);
+    if (len >= 15)
+	op = Lz4PutLength(op, len - 15);
+    return op;
+}
@@ -0,0 +1,499 @@
+/*
+ * pace.c
+ *
+ * Sending the datagrams of a pushed frame: in batches, one system call
+ * for many datagrams, and optionally spread out in time instead of back
+ * to back.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * A frame is encoded in one go, so without pacing all of its datagrams
+ * reach the bottleneck router together and a shallow queue there drops
+ * the tail of the frame.  With pacing, datagrams are queued per client
+ * and sent at a steady rate: the estimated bottleneck bandwidth
+ * (receivingThroughput), or faster if that would not get the frame out
+ * within rfbPaceFraction of serverPushInterval.  A congestion controller
+ * that sets its own pacing rate (cc.c) overrides both, and turns pacing
+ * on even without -pace.  rfbServerPush() sends
+ * whatever is due and sets the push timer for the next datagram.
+ *
+ * Without pacing the queue holds one frame, and is emptied as soon as the
+ * frame is encoded.  Either way the due datagrams go out through
+ * sendmmsg() where there is one, so that a frame of fifty datagrams costs
+ * one or two system calls rather than fifty sendto()s.  The client's
+ * socket is connected to its push address (rfbConnectPushSock()), which
+ * also saves the kernel looking up the route for every datagram.
+ *
+ * The queue is a list of slabs, each holding datagrams back to back, and
+ * a slab is kept for the next frame once it is sent.  Batched tiles are
+ * packed straight into the slab by pushSendTileBatch(), through
+ * rfbPaceBuffer(), and the iovecs handed to sendmmsg() point into it, so
+ * a datagram costs no allocation and no copy on its way to the kernel.
+ */
+
+#ifdef linux
+#define _GNU_SOURCE		/* for sendmmsg() */
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include "rfb.h"
+
+#if !defined(USE_SENDMMSG) && defined(linux) && defined(MSG_WAITFORONE)
+#define USE_SENDMMSG 1		/* glibc 2.14 and later */
+#endif
+
+/* Fraction of the push interval a frame may take to send, 0 for no
+   pacing.  Set by -pace. */
+double rfbPaceFraction = 0.0;
+
+#define PACE_MAX_BURST 1000	/* us of sending a late pacer may catch up */
+#define PACE_MIN_RATE 10000.0	/* bytes per second */
+#define SEND_BATCH 64		/* datagrams per system call */
+#define SLAB_SIZE 65536		/* bytes of datagrams per slab */
+
+typedef struct PacedDatagram {
+    int len;
+    char data[4];		/* actually len bytes */
+} PacedDatagram;
+
+/* Bytes a datagram of len bytes takes up in a slab, keeping the next one
+   aligned. */
+#define PACED_SIZE(len) \
+    ((offsetof(PacedDatagram, data) + (len) + 3) & ~3)
+
+typedef struct PaceSlab {
+    struct PaceSlab *next;
+    int size;			/* bytes of data */
+    int head;			/* offset of the first datagram still queued */
+    int tail;			/* offset of the free space */
+    int data[1];		/* actually size bytes of PacedDatagrams */
+} PaceSlab;
+
+#define SLAB_DATAGRAM(slab, offset) \
+    ((PacedDatagram *)((char *)(slab)->data + (offset)))
+
+static PacedDatagram *PaceReserve(rfbClientPtr cl, int len);
+static void PaceDequeue(rfbClientPtr cl, int len);
+static void PaceDropSlab(rfbClientPtr cl);
+static Bool SendBatch(rfbClientPtr cl, PacedDatagram **batch, int n);
+static void BatchSent(rfbClientPtr cl, PacedDatagram *pd, Bool sent);
+
+
+/*
+ * Current time in microseconds, from a clock that is not set back.
+ */
+
+unsigned long
+rfbTimeInMicros()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+}
+
+
+/*
+ * Space for a datagram of up to len bytes at the end of the client's
+ * queue, for the caller to build the datagram in and then queue with
+ * rfbPaceQueue() without it being copied.  The space stays valid until
+ * the next datagram is queued.  Returns NULL, having closed the client,
+ * if out of memory.
+ */
+
+char *
+rfbPaceBuffer(cl, len)
+    rfbClientPtr cl;
+    int len;
+{
+    PacedDatagram *pd = PaceReserve(cl, len);
+
+    return (pd != NULL) ? pd->data : NULL;
+}
+
+
+/*
+ * Queue a datagram to be sent by rfbPaceSend().  Called by
+ * rfbSendDatagram() for every datagram of a pushed frame.  A datagram
+ * built in the space rfbPaceBuffer() gave is already in place; any other
+ * is copied to the end of the queue.
+ */
+
+Bool
+rfbPaceQueue(cl, buf, len)
+    rfbClientPtr cl;
+    char *buf;
+    int len;
+{
+    PacedDatagram *pd = PaceReserve(cl, len);
+    PaceSlab *slab;
+
+    if (pd == NULL)
+	return FALSE;
+    if (buf != pd->data)
+	memcpy(pd->data, buf, len);
+    pd->len = len;
+
+    slab = (PaceSlab *)cl->paceTail;
+    slab->tail += PACED_SIZE(len);
+    if (cl->paceCount++ == 0)
+	cl->paceNext = rfbTimeInMicros();
+    cl->paceBytes += len;
+    return TRUE;
+}
+
+
+/*
+ * The place for a datagram of len bytes at the end of the queue.  A new
+ * slab is only started when the last one is full, so the same len gives
+ * the same place until the datagram there is queued, and a datagram never
+ * moves once it is queued.
+ */
+
+static PacedDatagram *
+PaceReserve(cl, len)
+    rfbClientPtr cl;
+    int len;
+{
+    PaceSlab *slab = (PaceSlab *)cl->paceTail;
+    int size = PACED_SIZE(len);
+
+    if (slab != NULL && slab->tail + size <= slab->size)
+	return SLAB_DATAGRAM(slab, slab->tail);
+
+    slab = (PaceSlab *)cl->paceSpare;
+    if (slab != NULL && slab->size >= size) {
+	cl->paceSpare = NULL;
+    } else {
+	if (size < SLAB_SIZE)
+	    size = SLAB_SIZE;
+	slab = (PaceSlab *)xalloc(offsetof(PaceSlab, data) + size);
+	if (slab == NULL) {
+	    rfbLog("rfbPaceQueue: out of memory\n");
+	    rfbCloseSock(cl->sock);
+	    return NULL;
+	}
+	slab->size = size;
+    }
+    slab->next = NULL;
+    slab->head = slab->tail = 0;
+
+    if (cl->paceHead == NULL)
+	cl->paceHead = slab;
+    else
+	((PaceSlab *)cl->paceTail)->next = slab;
+    cl->paceTail = slab;
+    return SLAB_DATAGRAM(slab, 0);
+}
+
+
+/*
+ * Take the first datagram, of len bytes, off the queue once it is sent.
+ */
+
+static void
+PaceDequeue(cl, len)
+    rfbClientPtr cl;
+    int len;
+{
+    PaceSlab *slab = (PaceSlab *)cl->paceHead;
+
+    while (slab->head == slab->tail) {
+	PaceDropSlab(cl);
+	slab = (PaceSlab *)cl->paceHead;
+    }
+    slab->head += PACED_SIZE(len);
+    cl->paceBytes -= len;
+    if (--cl->paceCount == 0) {
+	/* Start again at the front of the last slab. */
+	while (cl->paceHead != cl->paceTail)
+	    PaceDropSlab(cl);
+	slab = (PaceSlab *)cl->paceHead;
+	slab->head = slab->tail = 0;
+    }
+}
+
+
+/*
+ * Drop the first slab, keeping one of the usual size for the next time a
+ * slab fills up.
+ */
+
+static void
+PaceDropSlab(cl)
+    rfbClientPtr cl;
+{
+    PaceSlab *slab = (PaceSlab *)cl->paceHead;
+
+    cl->paceHead = slab->next;
+    if (cl->paceHead == NULL)
+	cl->paceTail = NULL;
+
+    if (cl->paceSpare == NULL && slab->size == SLAB_SIZE)
+	cl->paceSpare = slab;
+    else
+	xfree(slab);
+}
+
+
+/*
+ * Called once all datagrams of a frame are queued: choose the rate at
+ * which they are sent, and send the first ones, or all of them if pacing
+ * is off.
+ */
+
+Bool
+rfbPaceFrameDone(cl)
+    rfbClientPtr cl;
+{
+    double rate = cl->receivingThroughput;	/* bytes per second */
+    double window = rfbPaceFraction * cl->serverPushInterval / 1000.0;
+
+    if (cl->paceCount == 0)
+	return TRUE;
+
+    if (rfbPaceFraction <= 0.0 && cl->ccPacingRate <= 0.0) {
+	cl->paceRate = 0.0;
+	return rfbPaceSend(cl);
+    }
+
+    if (cl->ccPacingRate > 0.0)
+	rate = cl->ccPacingRate;
+    else if (window > 0.0 && cl->paceBytes / window > rate)
+	rate = cl->paceBytes / window;
+    if (rate < PACE_MIN_RATE)
+	rate = PACE_MIN_RATE;
+    cl->paceRate = rate;
+
+    return rfbPaceSend(cl);
+}
+
+
+/*
+ * Send the queued datagrams that are due, up to SEND_BATCH at a time.
+ * Returns FALSE if the client was closed.
+ */
+
+Bool
+rfbPaceSend(cl)
+    rfbClientPtr cl;
+{
+    PacedDatagram *batch[SEND_BATCH];
+    PacedDatagram *pd;
+    PaceSlab *slab;
+    unsigned long now = rfbTimeInMicros();
+    int i, n, offset, queued;
+
+    for (;;) {
+	n = 0;
+	slab = (PaceSlab *)cl->paceHead;
+	offset = (slab != NULL) ? slab->head : 0;
+	for (queued = cl->paceCount;
+	     queued > 0 && n < SEND_BATCH && (long)(cl->paceNext - now) <= 0;
+	     queued--) {
+	    while (offset == slab->tail) {
+		slab = slab->next;
+		offset = slab->head;
+	    }
+	    pd = SLAB_DATAGRAM(slab, offset);
+	    offset += PACED_SIZE(pd->len);
+	    batch[n++] = pd;
+	    if (cl->paceRate > 0.0) {
+		if ((long)(now - cl->paceNext) > PACE_MAX_BURST)
+		    cl->paceNext = now - PACE_MAX_BURST;
+		cl->paceNext += (unsigned long)(pd->len * 1000000.0 /
+						cl->paceRate);
+	    }
+	}
+	if (n == 0)
+	    break;
+
+	/* The batch stays on the queue until it is sent, so that closing
+	   the client frees it. */
+	if (!SendBatch(cl, batch, n))
+	    return FALSE;
+
+	for (i = 0; i < n; i++)
+	    PaceDequeue(cl, batch[i]->len);
+	if (cl->paceRate > 0.0)
+	    cl->pushStats.rfbPacedDatagramsSent += n;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Send n datagrams with as few system calls as the platform allows.  A
+ * datagram refused as too big for the path is dropped, and its area sent
+ * again later; a datagram the kernel could not deliver is left to time
+ * out like one lost in the network.  Returns FALSE if the client was
+ * closed.
+ */
+
+static Bool
+SendBatch(cl, batch, n)
+    rfbClientPtr cl;
+    PacedDatagram **batch;
+    int n;
+{
+    struct sockaddr_in addr;
+    struct sockaddr *to = NULL;
+    int tolen = 0;
+    int i = 0, k, r;
+#if USE_SENDMMSG
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+#endif
+
+    if (!cl->pushSockConnected) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(cl->host);
+	addr.sin_port = htons(PUSH_PORT);
+	to = (struct sockaddr *)&addr;
+	tolen = sizeof(addr);
+    }
+
+#if USE_SENDMMSG
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (k = 0; k < n; k++) {
+	iov[k].iov_base = batch[k]->data;
+	iov[k].iov_len = batch[k]->len;
+	msgs[k].msg_hdr.msg_name = to;
+	msgs[k].msg_hdr.msg_namelen = tolen;
+	msgs[k].msg_hdr.msg_iov = &iov[k];
+	msgs[k].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+
+    while (i < n) {
+#if USE_SENDMMSG
+	r = sendmmsg(cl->udpSock, &msgs[i], n - i, 0);
+#else
+	r = sendto(cl->udpSock, batch[i]->data, batch[i]->len, 0, to, tolen);
+	if (r >= 0)
+	    r = 1;
+#endif
+	cl->pushStats.rfbPushSendCalls++;
+
+	if (r > 0) {
+	    for (k = i; k < i + r; k++)
+		BatchSent(cl, batch[k], TRUE);
+	    i += r;
+	    continue;
+	}
+
+	/* batch[i] failed. */
+	if (r < 0 && errno == EINTR)
+	    continue;
+
+	if (r < 0 && errno == EMSGSIZE) {
+	    /* The path MTU went down, probably on an ICMP "fragmentation
+	       needed". */
+	    cl->pushStats.rfbPushMtuDrops++;
+	    rfbProbePathMtu(cl);
+	    if (cl->pushDatagramSize >= batch[i]->len)
+		cl->pushDatagramSize = MIN_DATAGRAM_SIZE -
+		    (cl->enableFec ? sz_rfbFecParityMsg : 0);
+	    BatchSent(cl, batch[i], FALSE);
+	    i++;
+	    continue;
+	}
+
+	if (r == 0 || errno == ECONNREFUSED || errno == ENOBUFS ||
+	    errno == EAGAIN) {
+	    /* An ICMP "port unreachable" for an earlier datagram, reported
+	       on the connected socket, or a full send queue. */
+	    BatchSent(cl, batch[i], TRUE);
+	    i++;
+	    continue;
+	}
+
+	rfbLogPerror("SendBatch: send");
+	rfbCloseSock(cl->sock);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void
+BatchSent(cl, pd, sent)
+    rfbClientPtr cl;
+    PacedDatagram *pd;
+    Bool sent;
+{
+    if (sent && cl->pathMtu != 0 && pd->len > DATAGRAM_SIZE(cl->pathMtu))
+	cl->pushStats.rfbPushDatagramsFragmented++;
+    rfbPacedDatagramSent(cl, pd->data, sent);
+}
+
+
+/*
+ * Microseconds until the next queued datagram is due, or -1 if there is
+ * none.
+ */
+
+long
+rfbPaceWait(cl)
+    rfbClientPtr cl;
+{
+    long wait;
+
+    if (cl->paceCount == 0)
+	return -1;
+
+    wait = (long)(cl->paceNext - rfbTimeInMicros());
+    return (wait > 0) ? wait : 0;
+}
+
+
+void
+rfbPaceFree(cl)
+    rfbClientPtr cl;
+{
+    while (cl->paceHead != NULL)
+	PaceDropSlab(cl);
+    if (cl->paceSpare != NULL) {
+	xfree(cl->paceSpare);
+	cl->paceSpare = NULL;
+    }
+    cl->paceCount = 0;
+    cl->paceBytes = 0;
+}
@@ -33,11 +33,20 @@
 #include <stdarg.h>
 
 /* It's a good idea to keep these values a bit greater than required. */
-#define MAX_ENCODINGS 10
+#define MAX_ENCODINGS 17
 #define MAX_SECURITY_TYPES 4
 #define MAX_TUNNELING_CAPS 16
 #define MAX_AUTH_CAPS 16
 
+/* Push lateness histogram: 0, 1, 2-3, 4-7, ... , 64 or more ms */
+#define PUSH_LATENESS_BUCKETS 8
+#define INPUT_LATENCY_BUCKETS 10
+
+/* Compressors behind tight encoding's basic rectangles, for statistics */
+#define TIGHT_CODEC_ZLIB 0
+#define TIGHT_CODEC_LZ4 1
+#define TIGHT_CODECS 2
+
 extern char *display;
 
 
@@ -117,6 +126,46 @@ typedef struct
  */
 
 struct rfbClientRec;
+
+/*
+ * Counters the push path updates for every datagram, tile or frame, kept
+ * together so that pushing touches few cache lines of the client record.
+ * The ones updated for every datagram or tile come first, in 56 bytes.
+ * See stats.c.
+ */
+
+typedef struct rfbPushStats {
+    /* every datagram */
+    unsigned long rfbPushBytesSent;
+    int rfbPushDatagramsSent;
+    int rfbPushSendCalls;
+    int rfbPacedDatagramsSent;
+    int rfbPushDatagramsFragmented;
+    int rfbAckMessagesRcvd;
+    int rfbDatagramsAcked;
+    unsigned long rfbPushParityBytesSent;
+    int rfbPushParitySent;
+
+    /* every tile */
+    int rfbPushTilesParallel;
+    unsigned long rfbPushPixelsEncoded;
+
+    /* every frame, or less often */
+    unsigned long rfbPushEncodeMicros;	/* in rfbPushFrame(), not sending */
+    unsigned long rfbPushPixelsDamaged;
+    unsigned long rfbTileDiffPixelsSaved;
+    unsigned long rfbScalePixelsSaved;
+    int rfbPushFramesSent;
+    int rfbPushFramesCut;	/* frames that left damage for the next one */
+    int rfbInputPushes;		/* frames pushed early to answer input */
+    int rfbPushDatagramsRequeued;
+    int rfbNackMessagesRcvd;
+    int rfbPushDatagramsNacked;
+    int rfbNackPushes;		/* frames pushed early for a NACK */
+    int rfbPushMtuDrops;
+    int rfbPushMtuBlackholes;
+    int rfbPushDatagramsRecovered;
+} rfbPushStats;
 typedef void (*rfbTranslateFnType)(char *table, rfbPixelFormat *in,
 				   rfbPixelFormat *out,
 				   char *iptr, char *optr,
@@ -131,10 +180,96 @@ typedef void (*rfbTranslateFnType)(char *table, rfbPixelFormat *in,
 typedef struct rfbClientRec {
 
     /* CUSTOM FIELDS */
-    Bool measuring;
-    int udpSock;
+    Bool packing;		/* encoding into the push datagram packer */
+    double pushBytesPerPixel;	/* recent encoded size, used to size tiles */
+    int udpSock;		/* connected to the push address if */
+    Bool pushSockConnected;	/* this is set, else shared */
     Bool useUdp;
-    Bool isOctopus;
+    Bool isOctopus;		/* client listed ServerPush */
+
+    /* Server push state, see rfbServerPushClient() */
+    Bool pushStarted;		/* client asked for push mode */
+    int nUpdateRequests;	/* FramebufferUpdateRequests seen so far */
+    unsigned long serverPushInterval;	/* ms between pushed frames */
+    unsigned long lastPushTime;
+    unsigned long pushDueTime;	/* when the pending frame should go, or 0 */
+    int pathMtu;		/* to the push address, 0 if unknown */
+    int pushDatagramSize;	/* largest datagram sent to this client */
+    unsigned long lastMtuProbe;
+    int mtuLargeLost;		/* datagrams over MIN_DATAGRAM_SIZE lost in */
+    unsigned long mtuLostSince;	/* a row, and when the first was sent */
+    unsigned long mtuSmallAcked;	/* when the last smaller acked one was sent */
+    unsigned long retransmitTimeout;	/* ms before an unacked region is resent */
+    double srtt;
+    double rttvar;
+
+    /* Throughput estimates, in bytes per second */
+    int tickSentBytes;
+    unsigned long lastTickTime;
+    double sendingThroughput;
+    double receivingThroughput;
+    unsigned long lastChange;	/* last quality/interval adjustment */
+
+    /* Congestion control, see cc.c */
+    struct rfbCongestionControlRec *cc;
+    void *ccPrivate;		/* the controller's own state */
+    double ccPacingRate;	/* bytes per second, 0 for receivingThroughput */
+    int ccFrameBudget;		/* bytes per pushed frame, 0 for no limit */
+    unsigned long ccDelivered;	/* bytes acknowledged so far */
+    unsigned long ccDeliveredTime;	/* when ccDelivered last grew */
+
+    CARD32 seqNumCounter;
+    CARD32 frameSeqNumCounter;
+    CARD32 lastAckSeqNum;
+    unsigned long lastAckTime;
+    CARD32 lastEventId;		/* echoed back so the viewer can time input */
+    unsigned long lastInputTime;	/* when lastEventId came in */
+
+    /* Input-reactive push, see rfbPushDueTime() */
+    Bool inputPending;		/* input not yet answered by a frame */
+    unsigned long inputPendingTime;	/* first such input */
+    unsigned long lastDamageTime;	/* when the damage last changed */
+    unsigned long damagePixels;	/* the damage then */
+    BoxRec damageExtents;
+    Bool latencyAckPending;	/* waiting for the answer to be acked */
+    unsigned long latencyInputTime;
+    CARD32 latencySeqNum;	/* first datagram of the answer */
+
+    /* Datagrams sent but not yet acknowledged, indexed by seqNum */
+    struct SendRegionRec *srRing;
+    CARD32 srRingFirst;		/* oldest seqNum that may still be live */
+    CARD32 srRingNext;		/* one past the newest seqNum added */
+    unsigned int srRecCount;
+
+    CARD32 *tileHash;		/* see tilediff.c */
+
+    /* Reduced framebuffer sent to the client, see scale.c */
+    int scale;			/* 1 means full size */
+    char *scaledFb;
+    int scaledFbStride;
+    int scaledWidth, scaledHeight;
+    Bool enableNewFBSize;	/* client supports NewFBSize */
+    Bool newFBSizePending;	/* NewFBSize rectangle should be sent */
+
+    /* Parity datagrams, see fec.c */
+    Bool enableFec;		/* client supports FecParity */
+    Bool enableTightLz4;	/* client supports TightLz4, see tight.c */
+    int fecGroupSize;		/* datagrams per parity, 0 while off */
+    int fecCount;		/* datagrams in the current group */
+    CARD32 fecFirstSeqNum;
+    int fecMaxLength;
+    int fecLengthXor;
+    char *fecParity;		/* FecParity message being built */
+    double lossRate;		/* recent fraction of datagrams lost */
+    int lossSentMark, lossLostMark;
+
+    /* Datagrams waiting to be sent, see pace.c */
+    void *paceHead, *paceTail;	/* slabs holding them */
+    void *paceSpare;		/* an empty slab kept for reuse */
+    int paceCount;
+    int paceBytes;
+    unsigned long paceNext;	/* when the first one is due, in us */
+    double paceRate;		/* bytes per second */
     /* END CUSTOM FIELDS */
 
     int sock;
@@ -254,6 +389,13 @@ typedef struct rfbClientRec {
     int rfbRawBytesEquivalent;
     int rfbKeyEventsRcvd;
     int rfbPointerEventsRcvd;
+    rfbPushStats pushStats;
+    int rfbPushLateness[PUSH_LATENESS_BUCKETS];
+    int rfbInputToPush[INPUT_LATENCY_BUCKETS];	/* ms, input to frame */
+    int rfbInputToAck[INPUT_LATENCY_BUCKETS];	/* ms, input to its ack */
+    unsigned long rfbTightCodecBytesIn[TIGHT_CODECS];
+    unsigned long rfbTightCodecBytesOut[TIGHT_CODECS];
+    double rfbTightCodecSeconds[TIGHT_CODECS];	/* thread CPU time */
 
     /* zlib encoding -- necessary compression state info per client */
 
@@ -262,6 +404,12 @@ typedef struct rfbClientRec {
 
     CARD32 zlibCompressLevel;
 
+    /* zrle encoding -- one zlib stream for updates over the connection;
+       pushed rectangles use the encoding context's, see zrle.c */
+
+    struct z_stream_s zrleStream;
+    Bool zrleStreamInited;
+
     /* tight encoding -- preserve zlib streams' state for each client */
 
     z_stream zsStruct[4];
@@ -283,6 +431,20 @@ typedef struct rfbClientRec {
 
 } rfbClientRec, *rfbClientPtr;
 
+/*
+ * A congestion controller, see cc.c.
+ */
+
+typedef struct rfbCongestionControlRec {
+    char *name;
+    Bool (*init)(rfbClientPtr cl);
+    void (*tick)(rfbClientPtr cl, unsigned long now);
+    /* rtt in ms; rate is the delivery rate in bytes per second, or 0 */
+    void (*ack)(rfbClientPtr cl, unsigned long now, double rtt, double rate);
+    void (*printStats)(rfbClientPtr cl);
+    void (*free)(rfbClientPtr cl);
+} rfbCongestionControl, *rfbCongestionControlPtr;
+
 
 /*
  * This macro is used to test whether there is a framebuffer update needing to
@@ -296,6 +458,17 @@ typedef struct rfbClientRec {
      REGION_NOTEMPTY((pScreen),&(cl)->copyRegion) ||                    \
      REGION_NOTEMPTY((pScreen),&(cl)->modifiedRegion))
 
+/*
+ * The framebuffer the encoders read for a client: the screen itself, or
+ * the reduced copy of it kept by scale.c.  Rectangles passed to the
+ * encoders are in the coordinates of this framebuffer.
+ */
+
+#define CLIENT_FB_MEMORY(cl)                                            \
+    ((cl)->scale > 1 ? (cl)->scaledFb : rfbScreen.pfbMemory)
+#define CLIENT_FB_STRIDE(cl)                                            \
+    ((cl)->scale > 1 ? (cl)->scaledFbStride : rfbScreen.paddedWidthInBytes)
+
 /*
  * This macro creates an empty region (ie. a region with no areas) if it is
  * given a rectangle with a width or height of zero. It appears that 
@@ -395,6 +568,7 @@ extern void rfbInitSockets();
 extern void rfbDisconnectUDPSock();
 extern void rfbCloseSock();
 extern void rfbCheckFds();
+extern void rfbSetPushTimer(long delay);
 extern void rfbWaitForClient(int sock);
 extern int rfbConnect(char *host, int port);
 
@@ -403,6 +577,8 @@ extern int WriteExact(int sock, char *buf, int len);
 extern int ListenOnTCPPort(int port);
 extern int ListenOnUDPPort(int port);
 extern int ConnectToTcpAddr(char *host, int port);
+extern int rfbConnectPushSock(char *host, int port);
+extern int rfbSocketMtu(int sock);
 
 
 /* cmap.c */
@@ -463,6 +639,18 @@ extern void KbdReleaseAllKeys();
 
 #define UPDATE_BUF_SIZE 3000000 /* ORIGINAL SIZE IS 30000 */
 extern char updateBuf[UPDATE_BUF_SIZE];
+
+/* UDP port the viewer receives pushed datagrams on */
+#define PUSH_PORT 6829
+
+/* Largest payload of a datagram, IP and UDP headers taken off the MTU */
+#define DATAGRAM_SIZE(mtu) ((mtu) - 28)
+#define MIN_DATAGRAM_SIZE DATAGRAM_SIZE(576)
+#define MAX_DATAGRAM_SIZE 65507
+
+/* Losses in a row that point to a path MTU black hole */
+#define MTU_BLACKHOLE_LOSSES 16
+
 extern int ublen;
 extern int handleNewBlock;
 
@@ -473,6 +661,9 @@ extern Bool rfbAlwaysShared;
 extern Bool rfbNeverShared;
 extern Bool rfbDontDisconnect;
 extern Bool rfbViewOnly; /* run server in view-only mode - Ehud Karni SW */
+extern int rfbMaxDatagramSize;
+extern int rfbInputPushQuiet;
+extern int rfbInputPushBudget;
 
 extern void rfbNewClientConnection(int sock, int udpSock);
 extern rfbClientPtr rfbReverseConnection(char *host, int port);
@@ -483,12 +674,49 @@ extern void rfbProcessUDPInput(int sock);
 extern Bool rfbSendFramebufferUpdate(rfbClientPtr cl, RegionRec * theRegionPtr, CARD32 seqNum);
 extern Bool rfbSendRectEncodingRaw(rfbClientPtr cl, int x,int y,int w,int h);
 extern Bool rfbSendUpdateBuf(rfbClientPtr cl);
+extern Bool rfbSendDatagram(rfbClientPtr cl, char *buf, int len);
+extern unsigned long rfbRegionArea(RegionPtr region);
+extern void rfbPacedDatagramSent(rfbClientPtr cl, char *buf, Bool sent);
 extern Bool rfbSendSetColourMapEntries(rfbClientPtr cl, int firstColour,
 				       int nColours);
 extern void rfbSendBell();
 extern void rfbSendServerCutText(char *str, int len);
 /* NEW */
 extern void rfbServerPush();
+extern const unsigned long tickInterval;
+extern void rfbProbePathMtu(rfbClientPtr cl);
+extern void rfbPathMtuBlackhole(rfbClientPtr cl);
+extern void rfbRecordLog2(int *buckets, int nBuckets, unsigned long value);
+
+
+/* sendring.c */
+
+#define SR_RING_SIZE 4096	/* must be a power of two */
+#define SR_INITIAL_TIMEOUT 1000	/* ms to wait for an ack before any RTT
+				   sample, as RFC 6298 */
+#define SR_SLOT(cl, seq) (&(cl)->srRing[(seq) & (SR_RING_SIZE - 1)])
+
+typedef struct SendRegionRec {
+    Bool live;
+    CARD32 seqNum;
+    unsigned long time;
+    int numBytes;
+    CARD32 eventId;		/* cl->lastEventId when sent */
+    CARD32 frameSeqNum;
+    unsigned long delivered;	/* cl->ccDelivered when sent */
+    unsigned long deliveredTime;
+    RegionRec region;
+} SendRegionRec;
+
+extern void srRecFree(rfbClientPtr cl);
+extern void srRecRequeue(rfbClientPtr cl, SendRegionRec *srRec);
+extern Bool srRecAdd(rfbClientPtr cl, CARD32 seqNum, RegionPtr regionPtr,
+		     int numBytes, unsigned long time);
+extern SendRegionRec *srRecDeleteSeqNum(rfbClientPtr cl, CARD32 seqNum);
+extern void srRecSetupRetransmit(rfbClientPtr cl);
+extern void srRecSendRegion(rfbClientPtr cl, RegionPtr regionPtr);
+extern void rfbProcessSack(rfbClientPtr cl, CARD32 baseSeqNum, CARD32 bitmap,
+			   unsigned int ackDelay);
 
 
 /* translate.c */
@@ -571,6 +799,22 @@ extern Bool rfbSendRectEncodingZlib(rfbClientPtr cl, int x, int y, int w,
 				    int h);
 
 
+/* zrle.c */
+
+extern Bool rfbSendRectEncodingZRLE(rfbClientPtr cl, int x, int y, int w,
+				    int h);
+
+typedef struct rfbZrleContext *rfbZrleContextPtr;
+
+extern rfbZrleContextPtr rfbZrleNewContext(void);
+extern void rfbZrleFreeContext(rfbZrleContextPtr ctx);
+extern Bool rfbZrleEncodeTile(rfbZrleContextPtr ctx, rfbClientPtr cl,
+			      int x, int y, int w, int h);
+extern char *rfbZrleContextOutput(rfbZrleContextPtr ctx, int *len,
+				  int *nRects);
+extern void rfbZrleResetOutput(rfbZrleContextPtr ctx);
+
+
 /* tight.c */
 
 #define TIGHT_DEFAULT_COMPRESSION  6
@@ -580,6 +824,126 @@ extern Bool rfbTightDisableGradient;
 extern int rfbNumCodedRectsTight(rfbClientPtr cl, int x,int y,int w,int h);
 extern Bool rfbSendRectEncodingTight(rfbClientPtr cl, int x,int y,int w,int h);
 
+typedef struct rfbTightContext *rfbTightContextPtr;
+
+extern rfbTightContextPtr rfbTightNewContext(void);
+extern void rfbTightFreeContext(rfbTightContextPtr ctx);
+extern Bool rfbTightEncodeTile(rfbTightContextPtr ctx, rfbClientPtr cl,
+			       int x, int y, int w, int h);
+extern char *rfbTightContextOutput(rfbTightContextPtr ctx, int *len,
+				   int *nRects);
+extern void rfbTightResetOutput(rfbTightContextPtr ctx);
+extern void rfbTightAddCodecStats(rfbTightContextPtr ctx, rfbClientPtr cl);
+
+
+/* encpool.c */
+
+#define MAX_ENCODE_THREADS 8
+
+typedef void (*rfbEncoderJobProc)(void *arg, int worker, int job);
+
+extern int rfbEncodeThreads;
+
+extern int rfbEncoderPoolSize(void);
+extern void rfbEncoderPoolRun(rfbEncoderJobProc proc, void *arg, int nJobs);
+
+
+/* tilediff.c */
+
+#define TILEDIFF_SIZE 32
+
+extern Bool rfbTileDiff;
+
+extern void rfbTileDiffSubtract(rfbClientPtr cl, RegionPtr region);
+extern void rfbTileDiffInvalidate(rfbClientPtr cl, RegionPtr region);
+extern void rfbTileDiffFree(rfbClientPtr cl);
+
+
+/* scale.c */
+
+extern void rfbSetClientScale(rfbClientPtr cl, int scale);
+extern void rfbScaleRegion(rfbClientPtr cl, RegionPtr region);
+extern void rfbUnscaleRegion(rfbClientPtr cl, RegionPtr region);
+extern Bool rfbSendNewFBSize(rfbClientPtr cl);
+extern void rfbScaleFree(rfbClientPtr cl);
+
+
+/* fec.c */
+
+extern Bool rfbFec;
+
+extern void rfbFecUpdateLoss(rfbClientPtr cl);
+extern Bool rfbFecAdd(rfbClientPtr cl, CARD32 seqNum, char *buf, int len);
+extern Bool rfbFecFlush(rfbClientPtr cl);
+extern void rfbFecFree(rfbClientPtr cl);
+
+
+/* cc.c */
+
+extern rfbCongestionControlPtr rfbCongestionControlType;
+
+extern Bool rfbSetCongestionControl(char *name);
+extern void rfbCcInit(rfbClientPtr cl);
+extern void rfbCcFree(rfbClientPtr cl);
+
+
+/* pace.c */
+
+extern double rfbPaceFraction;
+
+extern unsigned long rfbTimeInMicros();
+extern char *rfbPaceBuffer(rfbClientPtr cl, int len);
+extern Bool rfbPaceQueue(rfbClientPtr cl, char *buf, int len);
+extern Bool rfbPaceFrameDone(rfbClientPtr cl);
+extern Bool rfbPaceSend(rfbClientPtr cl);
+extern long rfbPaceWait(rfbClientPtr cl);
+extern void rfbPaceFree(rfbClientPtr cl);
+
+
+/* telemetry.c */
+
+#define TLM_INPUT 1		/* server: input event received */
+#define TLM_SENT 2		/* server: datagram sent */
+#define TLM_ACKED 3		/* server: datagram acknowledged */
+#define TLM_INPUT_SENT 4	/* viewer: input event sent */
+#define TLM_RENDERED 5		/* viewer: datagram drawn */
+#define TLM_NONE 0xffffffff	/* no seqNum or frameSeqNum */
+
+extern char *rfbTelemetryFile;
+
+extern void rfbTelemetryRecord(int client, int kind, CARD32 eventId,
+			       CARD32 seqNum, CARD32 frameSeqNum, int bytes);
+extern void rfbTelemetryClose(void);
+
+
+/* simd.c */
+
+extern Bool rfbSimdDisable;
+
+extern int (*rfbSpanLength8)(CARD8 *p, int n, CARD32 color);
+extern int (*rfbSpanLength16)(CARD16 *p, int n, CARD32 color);
+extern int (*rfbSpanLength32)(CARD32 *p, int n, CARD32 color);
+extern int (*rfbSpanTwoColors8)(CARD8 *p, int n, CARD32 c0, CARD32 c1,
+				int *n0Ptr);
+extern int (*rfbSpanTwoColors16)(CARD16 *p, int n, CARD32 c0, CARD32 c1,
+				 int *n0Ptr);
+extern int (*rfbSpanTwoColors32)(CARD32 *p, int n, CARD32 c0, CARD32 c1,
+				 int *n0Ptr);
+extern void (*rfbShuffle32)(CARD8 *dst, CARD8 *src, int n, CARD8 *shuffle);
+extern void (*rfbGradientRow32)(CARD32 *buf, CARD32 *upper, int n,
+				CARD32 mask);
+extern void (*rfbPixelDiffs32)(CARD32 *diffs, CARD32 *p);
+
+extern void rfbSimdInit(void);
+
+
+/* lz4.c */
+
+#define RFB_LZ4_HASH_SIZE 4096
+#define RFB_LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+extern int rfbLz4Compress(char *src, int srcLen, char *dst, int *hashTable);
+
 
 /* cursor.c */
 
@@ -589,5 +953,8 @@ extern Bool rfbSendCursorPos(rfbClientPtr cl, ScreenPtr pScreen);
 
 /* stats.c */
 
+extern Bool rfbMetrics;
+
 extern void rfbResetStats(rfbClientPtr cl);
 extern void rfbPrintStats(rfbClientPtr cl);
+extern void rfbSendMetrics(int sock);
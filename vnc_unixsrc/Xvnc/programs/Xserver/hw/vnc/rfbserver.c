@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <time.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -57,6 +58,13 @@ Bool rfbNeverShared = FALSE;
 Bool rfbDontDisconnect = FALSE;
 Bool rfbViewOnly = FALSE; /* run server in view only mode - Ehud Karni SW */
 
+/* Input-reactive push, see rfbPushDueTime().  Set by -inputpush and
+   -inputbudget; a quiet period of 0 turns it off. */
+int rfbInputPushQuiet = 4;		/* ms */
+int rfbInputPushBudget = 50;		/* ms */
+
+#define INPUT_PUSH_MAX_PIXELS (256 * 256)	/* "small" damage */
+
 static rfbClientPtr rfbNewClient(int sock, int udpSock);
 static void rfbProcessClientProtocolVersion(rfbClientPtr cl);
 static void rfbProcessClientInitMessage(rfbClientPtr cl);
@@ -64,26 +72,15 @@ static void rfbSendInteractionCaps(rfbClientPtr cl);
 static void rfbProcessClientNormalMessage(rfbClientPtr cl);
 static Bool rfbSendCopyRegion(rfbClientPtr cl, RegionPtr reg, int dx, int dy);
 static Bool rfbSendLastRectMarker(rfbClientPtr cl);
+static Bool rfbSendRectEncoding(rfbClientPtr cl, int x, int y, int w, int h);
+static void rfbInputReceived(rfbClientPtr cl, CARD32 eventId);
+static void rfbTrackDamage(rfbClientPtr cl, unsigned long now);
+static unsigned long rfbPushDueTime(rfbClientPtr cl);
 
-/* Timing variables */
-unsigned long serverPushInterval = 66; /* initial: 15 fps */
-unsigned long retransmitTimeout = 25;
-double srtt = 0.0;
-double rttvar = 0.0;
-/* Throughout variables */
+/* Throughput sampling period */
 const unsigned long tickInterval = 66;
-int tickSentBytes = 0;
-double sendingThroughput = 0.0;
-double receivingThroughput = 100000.0;
-unsigned long lastChange = 0;
-/* Sequence number variables */
-CARD32 seqNumCounter = 0;
-CARD32 lastAckSeqNum = 0;
-unsigned long lastAckTime = 0;
 /* Reset compressor variables */
 int handleNewBlock = 0;
-CARD32 frameSeqNumCounter = 0;
-CARD32 lastEventId = 0;
 
 /* Size constants */
 #define MAX_UPDATE_SIZE (2 * (1500) - 100)
@@ -92,149 +89,12 @@ CARD32 lastEventId = 0;
 #define SCREEN_YMIN (0)
 #define SCREEN_YMAX (668)
 
-typedef struct SendRegionRec {
-	CARD32 seqNum;
-	unsigned long time;
-	int numBytes;
-	RegionRec region;
-
-	struct SendRegionRec * prev;
-	struct SendRegionRec * next;
-} SendRegionRec;
-
-/* srRec (unacked queue) variables */
-SendRegionRec * srRecFirst = NULL;
-SendRegionRec * srRecLast = NULL;
-unsigned int srRecCount = 0;
-
-void srRecFree()
-{
-	SendRegionRec * cur = srRecFirst;
-	SendRegionRec * next;
-
-	while (cur != NULL) {
-		next = cur->next;
-
-		REGION_UNINIT(pScreen, &(cur->region));
-		xfree(cur);
-
-		cur = next;
-	}
-
-	srRecFirst = NULL;
-	srRecLast = NULL;
-	srRecCount = 0;
-}
-
-void srRecAdd(srRec)
-	SendRegionRec * srRec;
-{
-	if (srRecLast != NULL) {
-		srRecLast->next = srRec;
-		srRec->prev = srRecLast;
-		srRecLast = srRec;
-	} else {
-		srRecFirst = srRec;
-		srRecLast = srRec;
-	}
-	srRecCount++;
-}
-
-void srRecDelete(srRec)
-	SendRegionRec * srRec;
-{
-	SendRegionRec * prev = srRec->prev;
-	SendRegionRec * next = srRec->next;
-
-	if (prev != NULL) {
-		if (next != NULL) {
-			prev->next = next;
-			next->prev = prev;
-		} else {
-			prev->next = NULL;
-			srRecLast = prev;
-		}
-	} else {
-		if (next != NULL) {
-			next->prev = NULL;
-			srRecFirst = next;
-		} else {
-			srRecFirst = NULL;
-			srRecLast = NULL;
-		}
-	}
-
-	REGION_UNINIT(pScreen, &(srRec->region));
-	xfree(srRec);
-
-	srRecCount--;
-}
-
-unsigned long srRecDeleteSeqNum(seqNum, numBytes)
-	CARD32 seqNum;
-	int * numBytes;
-{
-	SendRegionRec * cur = srRecFirst;
-	SendRegionRec * next;
-
-	while (cur != NULL) {
-		next = cur->next;
-
-		if (cur->seqNum == seqNum) {
-			unsigned long time = cur->time;
-			*numBytes = cur->numBytes;
-			srRecDelete(cur);
-			return time;
-		}
-
-		cur = next;
-	}
-
-	*numBytes = 0;
-	return (unsigned long) 0;
-}
-
-void srRecSetupRetransmit(cl)
-	rfbClientPtr cl;
-{
-	SendRegionRec * cur = srRecFirst;
-	SendRegionRec * next;
-
-	unsigned long now = GetTimeInMillis();
-
-	while (cur != NULL) {
-		next = cur->next;
-
-		if (now - cur->time > retransmitTimeout) {
-			REGION_UNION(pScreen, &(cl->modifiedRegion),
-						 &(cl->modifiedRegion), &(cur->region));
+/* Ceiling on the size of pushed datagrams, whatever the path MTU.  Set by
+   -maxdatagram. */
+int rfbMaxDatagramSize = MAX_UPDATE_SIZE;
 
-			srRecDelete(cur);
-		} else {
-			break;
-		}
-
-		cur = next;
-	}
-}
-
-void srRecSendRegion(regionPtr)
-	RegionRec * regionPtr;
-{
-	SendRegionRec * cur = srRecFirst;
-	SendRegionRec * next;
-
-	while (cur != NULL) {
-		next = cur->next;
-
-		REGION_SUBTRACT(pScreen, &(cur->region), &(cur->region), regionPtr);
-		if (!REGION_NOTEMPTY(pScreen, &(cur->region))) {
-			srRecDelete(cur);
-		}
-
-		cur = next;
-	}
-}
+#define MTU_PROBE_INTERVAL 30000	/* ms between path MTU lookups */
+#define NACK_INPUT_WINDOW 250	/* ms after input a lost datagram is urgent */
 
 /*
  * rfbNewClientConnection is called from sockets.c when a new connection
@@ -293,11 +153,6 @@ rfbNewClient(sock, udpSock)
     int sock;
     int udpSock;
 {
-    /* srRecFree();
-     * seqNumCounter = 0; // Reset sequence number for new client */
-
-    static int clientNumber = 0;
-
     rfbProtocolVersionMsg pv;
     rfbClientPtr cl;
     BoxRec box;
@@ -318,20 +173,79 @@ rfbNewClient(sock, udpSock)
 
     cl = (rfbClientPtr)xalloc(sizeof(rfbClientRec));
 
-    if (clientNumber == 0) {
-    	cl->isOctopus = TRUE;
-    } else {
-    	cl->isOctopus = FALSE;
-    }
-    clientNumber++;
+    cl->isOctopus = FALSE;
 
-    cl->measuring = FALSE;
+    cl->packing = FALSE;
+    cl->pushBytesPerPixel = 0.5;
     cl->udpSock = udpSock;
     cl->useUdp = FALSE;
 
+    cl->pushStarted = FALSE;
+    cl->nUpdateRequests = 0;
+    cl->serverPushInterval = 66; /* initial: 15 fps */
+    cl->lastPushTime = 0;
+    cl->pushDueTime = 0;
+    cl->pathMtu = 0;
+    cl->pushDatagramSize = 0;
+    cl->mtuLargeLost = 0;
+    cl->mtuLostSince = 0;
+    cl->mtuSmallAcked = 0;
+    cl->retransmitTimeout = SR_INITIAL_TIMEOUT;
+    cl->srtt = 0.0;
+    cl->rttvar = 0.0;
+    cl->tickSentBytes = 0;
+    cl->lastTickTime = 0;
+    cl->sendingThroughput = 0.0;
+    cl->receivingThroughput = 100000.0;
+    cl->lastChange = 0;
+    cl->seqNumCounter = 0;
+    cl->frameSeqNumCounter = 0;
+    cl->lastAckSeqNum = 0;
+    cl->lastAckTime = 0;
+    cl->lastEventId = 0;
+    cl->lastInputTime = 0;
+    cl->inputPending = FALSE;
+    cl->inputPendingTime = 0;
+    cl->lastDamageTime = 0;
+    cl->damagePixels = 0;
+    cl->damageExtents.x1 = cl->damageExtents.y1 = 0;
+    cl->damageExtents.x2 = cl->damageExtents.y2 = 0;
+    cl->latencyAckPending = FALSE;
+    cl->latencyInputTime = 0;
+    cl->latencySeqNum = 0;
+    cl->srRing = NULL;
+    cl->srRingFirst = 0;
+    cl->srRingNext = 0;
+    cl->srRecCount = 0;
+    cl->tileHash = NULL;
+    cl->scale = 1;
+    cl->scaledFb = NULL;
+    cl->enableNewFBSize = FALSE;
+    cl->newFBSizePending = FALSE;
+    cl->enableFec = FALSE;
+    cl->enableTightLz4 = FALSE;
+    cl->fecGroupSize = 0;
+    cl->fecCount = 0;
+    cl->fecParity = NULL;
+    cl->lossRate = 0.0;
+    cl->lossSentMark = 0;
+    cl->lossLostMark = 0;
+    cl->paceHead = NULL;
+    cl->paceTail = NULL;
+    cl->paceSpare = NULL;
+    cl->paceCount = 0;
+    cl->paceBytes = 0;
+    cl->paceRate = cl->receivingThroughput;
+
     cl->sock = sock;
     getpeername(sock, (struct sockaddr *)&addr, &addrlen);
     cl->host = strdup(inet_ntoa(addr.sin_addr));
+    cl->udpSock = rfbConnectPushSock(cl->host, PUSH_PORT);
+    cl->pushSockConnected = (cl->udpSock >= 0);
+    if (!cl->pushSockConnected)
+	cl->udpSock = udpSock;
+    rfbProbePathMtu(cl);
+    rfbCcInit(cl);
     cl->login = NULL;
 
     /* Dispatch client input to rfbProcessClientProtocolVersion(). */
@@ -386,6 +300,8 @@ rfbNewClient(sock, udpSock)
 
     cl->zlibCompressLevel = 5;
 
+    cl->zrleStreamInited = FALSE;
+
     sprintf(pv, rfbProtocolVersionFormat, 3, 8);
 
     if (WriteExact(sock, pv, sz_rfbProtocolVersionMsg) < 0) {
@@ -397,8 +313,6 @@ rfbNewClient(sock, udpSock)
     return cl;
 }
 
-static Bool canSend = FALSE;
-
 /*
  * rfbClientConnectionGone is called from sockets.c just after a connection
  * has gone away.
@@ -429,13 +343,22 @@ rfbClientConnectionGone(sock)
     }
     free(cl->host);
 
-    canSend = FALSE;
+    srRecFree(cl);
+    rfbTileDiffFree(cl);
+    rfbScaleFree(cl);
+    rfbFecFree(cl);
+    rfbPaceFree(cl);
+    if (cl->pushSockConnected)
+	close(cl->udpSock);
 
     /* Release the compression state structures if any. */
     if ( cl->compStreamInited == TRUE ) {
 	deflateEnd( &(cl->compStream) );
     }
 
+    if (cl->zrleStreamInited)
+	deflateEnd(&cl->zrleStream);
+
     for (i = 0; i < 4; i++) {
 	if (cl->zsActive[i])
 	    deflateEnd(&cl->zsStruct[i]);
@@ -458,263 +381,988 @@ rfbClientConnectionGone(sock)
     TimerFree(cl->deferredUpdateTimer);
 
     rfbPrintStats(cl);
+    rfbCcFree(cl);
 
     if (cl->translateLookupTable) free(cl->translateLookupTable);
 
     xfree(cl);
 }
 
-int
-measureRegion(cl, x_low, y_low, x_high, y_high)
+/*
+ * Datagram packer for server push.  Every tile of the pushed region is
+ * encoded exactly once, straight into updateBuf behind the header of the
+ * datagram being built.  Each tile starts with fresh zlib streams
+ * (handleNewBlock), so its bytes can be decoded on their own: when a tile
+ * would grow the datagram past cl->pushDatagramSize, the datagram is closed
+ * in front of it and the tile's bytes are moved into the next datagram.
+ * Only a tile that does not fit even into an empty datagram is split and
+ * encoded again.
+ */
+
+static int dgNumRects;		/* rectangles in the datagram being built */
+static RegionRec dgRegion;	/* area covered by the datagram being built */
+
+static void pushTileAdded(rfbClientPtr cl, int x, int y, int w, int h,
+			  int tileLen, int nRects);
+
+static int
+rfbRectsSent(cl)
     rfbClientPtr cl;
-	int x_low;
-    int y_low;
-    int x_high;
-    int y_high;
 {
-    RegionRec tmpRegion;
+    int i, n = 0;
+
+    for (i = 0; i < MAX_ENCODINGS; i++)
+	n += cl->rfbRectanglesSent[i];
+
+    return n;
+}
+
+static void
+pushDatagramBegin(cl)
+    rfbClientPtr cl;
+{
+    dgNumRects = 0;
+    REGION_INIT(pScreen, &dgRegion, NullBox, 0);
+    ublen = sz_rfbFramebufferUpdateMsg;
+}
+
+static void
+pushDatagramEnd(cl)
+    rfbClientPtr cl;
+{
+    REGION_UNINIT(pScreen, &dgRegion);
+    ublen = 0;
+}
+
+/*
+ * Send the first len bytes of buf, updateBuf or space from rfbPaceBuffer(),
+ * as one datagram and remember its region until the client acknowledges
+ * it.
+ */
+
+static Bool
+pushDatagramClose(cl, buf, len)
+    rfbClientPtr cl;
+    char *buf;
+    int len;
+{
+    rfbFramebufferUpdateMsg *fu = (rfbFramebufferUpdateMsg *)buf;
+    CARD32 seqNum;
+
+    if (dgNumRects == 0)
+	return TRUE;
+
+    seqNum = cl->seqNumCounter++;
+
+    fu->type = rfbFramebufferUpdate;
+    fu->pad = 0;
+    fu->nRects = Swap16IfLE(dgNumRects);
+    fu->eventId = cl->lastEventId;
+    fu->seqNum = Swap32IfLE(seqNum);
+
+    if (!rfbSendDatagram(cl, buf, len))
+	return FALSE;
+
+    rfbUnscaleRegion(cl, &dgRegion);
+    if (!srRecAdd(cl, seqNum, &dgRegion, len, 0))
+	return FALSE;
+
+    cl->tickSentBytes += len;
+    cl->rfbFramebufferUpdateMessagesSent++;
+    cl->pushStats.rfbPushDatagramsSent++;
+    cl->pushStats.rfbPushBytesSent += len;
+
+    dgNumRects = 0;
+    REGION_EMPTY(pScreen, &dgRegion);
+    return rfbFecAdd(cl, seqNum, buf, len);
+}
+
+static Bool
+pushSendTile(cl, x, y, w, h)
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    int tileStart = ublen;
+    int nRects = rfbRectsSent(cl);
+    int nBytes = cl->rfbBytesSent[cl->preferredEncoding];
+    int tileLen;
+
+    handleNewBlock = 1;
+    if (!rfbSendRectEncoding(cl, x, y, w, h))
+	return FALSE;
+    handleNewBlock = 0;
+    cl->pushStats.rfbPushPixelsEncoded += w * h;
+
+    tileLen = ublen - tileStart;
+
+    if (ublen > cl->pushDatagramSize) {
+	if (tileStart > sz_rfbFramebufferUpdateMsg) {
+	    /* Close the datagram in front of this tile and move the tile
+	       into the next one. */
+	    if (!pushDatagramClose(cl, updateBuf, tileStart))
+		return FALSE;
+	    memmove(&updateBuf[sz_rfbFramebufferUpdateMsg],
+		    &updateBuf[tileStart], tileLen);
+	    ublen = sz_rfbFramebufferUpdateMsg + tileLen;
+	}
+
+	if (ublen > cl->pushDatagramSize) {
+	    /* Too big for any datagram: drop it and encode two halves. */
+	    ublen = sz_rfbFramebufferUpdateMsg;
+	    cl->rfbRectanglesSent[cl->preferredEncoding] -=
+		rfbRectsSent(cl) - nRects;
+	    cl->rfbBytesSent[cl->preferredEncoding] = nBytes;
+
+	    if (w <= 1 && h <= 1) {
+		rfbLog("pushSendTile: %d bytes for a single pixel\n", tileLen);
+		rfbCloseSock(cl->sock);
+		return FALSE;
+	    }
+	    if (w > h) {
+		return (pushSendTile(cl, x, y, w / 2, h) &&
+			pushSendTile(cl, x + w / 2, y, w - w / 2, h));
+	    }
+	    return (pushSendTile(cl, x, y, w, h / 2) &&
+		    pushSendTile(cl, x, y + h / 2, w, h - h / 2));
+	}
+    }
+
+    pushTileAdded(cl, x, y, w, h, tileLen, rfbRectsSent(cl) - nRects);
+    return TRUE;
+}
+
+/*
+ * Account for a tile of tileLen bytes and nRects rectangles which has just
+ * been added to the datagram being built.
+ */
+
+static void
+pushTileAdded(cl, x, y, w, h, tileLen, nRects)
+    rfbClientPtr cl;
+    int x, y, w, h;
+    int tileLen, nRects;
+{
     BoxRec box;
-    int measured_size;
+    RegionRec tileRegion;
+
+    cl->pushBytesPerPixel = (0.875 * cl->pushBytesPerPixel +
+			     0.125 * tileLen / (w * h));
+    cl->rfbRawBytesEquivalent += (sz_rfbFramebufferUpdateRectHeader
+				  + w * (cl->format.bitsPerPixel / 8) * h);
+
+    dgNumRects += nRects;
+    box.x1 = x;
+    box.y1 = y;
+    box.x2 = x + w;
+    box.y2 = y + h;
+    REGION_INIT(pScreen, &tileRegion, &box, 0);
+    REGION_UNION(pScreen, &dgRegion, &dgRegion, &tileRegion);
+    REGION_UNINIT(pScreen, &tileRegion);
+}
+
+/*
+ * Batched Tight or ZRLE encoding of pushed tiles.  Each worker thread of
+ * the encoder pool owns a context of each encoder, with its own zlib
+ * streams and output buffer.  The tiles of a frame are encoded as a batch, on the pool if it
+ * has more than one thread, then packed into datagrams by the dispatch
+ * thread.  The dispatch thread waits for the batch to finish, so the
+ * framebuffer cannot change while workers read it and needs no separate
+ * snapshot.
+ *
+ * Since every tile's size is known before any datagram is built, tiles
+ * are packed first-fit in order of decreasing size rather than in region
+ * order.  Small rectangles from all over the screen, such as typed
+ * characters and a blinking cursor, then share datagrams instead of each
+ * closing one early.
+ */
+
+typedef struct {
+    short x, y, w, h;
+    Bool ok;
+    int worker;			/* whose context holds the output */
+    int offset, len;		/* position in that context's output */
+    int nRects;
+    int bin;			/* datagram the tile is packed into */
+} PushTile;
+
+typedef struct {
+    rfbClientPtr cl;
+    PushTile *tiles;
+} PushBatch;
+
+static rfbTightContextPtr pushContexts[MAX_ENCODE_THREADS];
+static rfbZrleContextPtr pushZrleContexts[MAX_ENCODE_THREADS];
+static PushTile *pushTiles = NULL;
+static int *pushBinFree = NULL;	/* bytes left in each datagram */
+static int pushTilesSize = 0;
+
+static Bool
+pushGrowTiles()
+{
+    int newSize = (pushTilesSize != 0) ? pushTilesSize * 2 : 256;
+    PushTile *newTiles;
+    int *newBinFree;
+
+    if (pushTiles == NULL)
+	newTiles = (PushTile *)xalloc(newSize * sizeof(PushTile));
+    else
+	newTiles = (PushTile *)xrealloc(pushTiles, newSize * sizeof(PushTile));
+    if (newTiles == NULL) {
+	rfbLog("pushGrowTiles: out of memory\n");
+	return FALSE;
+    }
+    pushTiles = newTiles;
+
+    if (pushBinFree == NULL)
+	newBinFree = (int *)xalloc(newSize * sizeof(int));
+    else
+	newBinFree = (int *)xrealloc(pushBinFree, newSize * sizeof(int));
+    if (newBinFree == NULL) {
+	rfbLog("pushGrowTiles: out of memory\n");
+	return FALSE;
+    }
+    pushBinFree = newBinFree;
+
+    pushTilesSize = newSize;
+    return TRUE;
+}
+
+/* qsort() order for packing: largest tile first. */
+
+static int
+pushTileCompare(a, b)
+    const void *a;
+    const void *b;
+{
+    return ((const PushTile *)b)->len - ((const PushTile *)a)->len;
+}
+
+/* Output so far of a worker's context for the client's encoding. */
+
+static char *
+pushContextOutput(cl, worker, len, nRects)
+    rfbClientPtr cl;
+    int worker;
+    int *len;
+    int *nRects;
+{
+    if (cl->preferredEncoding == rfbEncodingZRLE)
+	return rfbZrleContextOutput(pushZrleContexts[worker], len, nRects);
+    return rfbTightContextOutput(pushContexts[worker], len, nRects);
+}
+
+static void
+pushEncodeTile(arg, worker, job)
+    void *arg;
+    int worker;
+    int job;
+{
+    PushBatch *batch = (PushBatch *)arg;
+    PushTile *t = &batch->tiles[job];
+    rfbClientPtr cl = batch->cl;
+    int len, nRects;
+
+    t->worker = worker;
+    pushContextOutput(cl, worker, &t->offset, &t->nRects);
+    if (cl->preferredEncoding == rfbEncodingZRLE)
+	t->ok = rfbZrleEncodeTile(pushZrleContexts[worker], cl,
+				  t->x, t->y, t->w, t->h);
+    else
+	t->ok = rfbTightEncodeTile(pushContexts[worker], cl,
+				   t->x, t->y, t->w, t->h);
+    pushContextOutput(cl, worker, &len, &nRects);
+    t->len = len - t->offset;
+    t->nRects = nRects - t->nRects;
+}
+
+/*
+ * Encode nTiles tiles of pushTiles and pack them into datagrams.  A tile
+ * that failed to encode, or that is too large for a datagram of its own,
+ * goes through pushSendTile() instead.
+ */
+
+static Bool
+pushSendTileBatch(cl, nTiles)
+    rfbClientPtr cl;
+    int nTiles;
+{
+    PushBatch batch;
+    PushTile *t;
+    char *buf, *dg;
+    int budget = cl->pushDatagramSize - sz_rfbFramebufferUpdateMsg;
+    int i, b, nBins, len, nRects, dgLen;
+
+    for (i = 0; i < rfbEncoderPoolSize(); i++) {
+	if (cl->preferredEncoding == rfbEncodingZRLE) {
+	    if (pushZrleContexts[i] == NULL) {
+		pushZrleContexts[i] = rfbZrleNewContext();
+		if (pushZrleContexts[i] == NULL)
+		    return FALSE;
+	    }
+	    rfbZrleResetOutput(pushZrleContexts[i]);
+	} else {
+	    if (pushContexts[i] == NULL) {
+		pushContexts[i] = rfbTightNewContext();
+		if (pushContexts[i] == NULL)
+		    return FALSE;
+	    }
+	    rfbTightResetOutput(pushContexts[i]);
+	}
+    }
+
+    batch.cl = cl;
+    batch.tiles = pushTiles;
+    rfbEncoderPoolRun(pushEncodeTile, &batch, nTiles);
+
+    if (cl->preferredEncoding == rfbEncodingTight) {
+	for (i = 0; i < rfbEncoderPoolSize(); i++)
+	    rfbTightAddCodecStats(pushContexts[i], cl);
+    }
+
+    /* Anything already in updateBuf goes out on its own. */
+    if (!pushDatagramClose(cl, updateBuf, ublen))
+	return FALSE;
+    ublen = sz_rfbFramebufferUpdateMsg;
+
+    qsort(pushTiles, nTiles, sizeof(PushTile), pushTileCompare);
+
+    nBins = 0;
+    for (i = 0; i < nTiles; i++) {
+	t = &pushTiles[i];
+	if (!t->ok || t->len > budget) {
+	    t->bin = -1;
+	    continue;
+	}
+	for (b = 0; b < nBins && pushBinFree[b] < t->len; b++)
+	    ;
+	if (b == nBins)
+	    pushBinFree[nBins++] = budget;
+	pushBinFree[b] -= t->len;
+	t->bin = b;
+    }
+
+    /* Each datagram is built where pace.c queues it. */
+    for (b = 0; b < nBins; b++) {
+	dg = rfbPaceBuffer(cl, cl->pushDatagramSize);
+	if (dg == NULL)
+	    return FALSE;
+	dgLen = sz_rfbFramebufferUpdateMsg;
+
+	for (i = 0; i < nTiles; i++) {
+	    t = &pushTiles[i];
+	    if (t->bin != b)
+		continue;
+
+	    buf = pushContextOutput(cl, t->worker, &len, &nRects);
+	    memcpy(&dg[dgLen], &buf[t->offset], t->len);
+	    dgLen += t->len;
+
+	    cl->rfbRectanglesSent[cl->preferredEncoding] += t->nRects;
+	    cl->rfbBytesSent[cl->preferredEncoding] += t->len;
+	    cl->pushStats.rfbPushPixelsEncoded += t->w * t->h;
+	    if (rfbEncoderPoolSize() > 1)
+		cl->pushStats.rfbPushTilesParallel++;
+	    pushTileAdded(cl, t->x, t->y, t->w, t->h, t->len, t->nRects);
+	}
+
+	if (!pushDatagramClose(cl, dg, dgLen))
+	    return FALSE;
+    }
+
+    for (i = 0; i < nTiles; i++) {
+	t = &pushTiles[i];
+	if (t->bin == -1 && !pushSendTile(cl, t->x, t->y, t->w, t->h))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
 
-    box.x1 = x_low;
-    box.y1 = y_low;
-    box.x2 = x_high;
-    box.y2 = y_high;
-    SAFE_REGION_INIT(pScreen,&tmpRegion,&box,0);
+/*
+ * rfbPushFrame sends the whole pending update of a push client as a
+ * sequence of self-contained datagrams.  Cursor shape and position go
+ * over TCP since they must not be lost and may not fit into a datagram.
+ */
 
-    REGION_UNION(pScreen, &cl->requestedRegion, &cl->requestedRegion,
-                 &tmpRegion);
+static Bool
+rfbPushFrame(cl)
+    rfbClientPtr cl;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    rfbFramebufferUpdateMsg *fu = (rfbFramebufferUpdateMsg *)updateBuf;
+    RegionRec updateRegion, deferRegion, tileRegion;
+    BoxPtr pbox;
+    BoxRec box;
+    Bool sendCursorShape = FALSE;
+    Bool sendCursorPos = FALSE;
+    Bool sendNewFBSize = cl->newFBSizePending;
+    int i, nPixels, tileRows, nTiles;
+    int x, y, w, h, dy, th;
+    double planned = 0.0;	/* estimated bytes of the tiles so far */
+    Bool batched;
+    unsigned long encodeStart = rfbTimeInMicros();
 
     if (!cl->readyForSetColourMapEntries) {
-        /* client hasn't sent a SetPixelFormat so is using server's */
-        cl->readyForSetColourMapEntries = TRUE;
-        if (!cl->format.trueColour) {
-            if (!rfbSetClientColourMap(cl, 0, 0)) {
-                REGION_UNINIT(pScreen,&tmpRegion);
+	/* client hasn't sent a SetPixelFormat so is using server's */
+	cl->readyForSetColourMapEntries = TRUE;
+	if (!cl->format.trueColour) {
+	    if (!rfbSetClientColourMap(cl, 0, 0))
+		return FALSE;
+	}
+    }
+
+    if (cl->enableCursorShapeUpdates) {
+	if (rfbScreen.cursorIsDrawn)
+	    rfbSpriteRemoveCursor(pScreen);
+	if (!rfbScreen.cursorIsDrawn && cl->cursorWasChanged)
+	    sendCursorShape = TRUE;
+    } else {
+	if (!rfbScreen.cursorIsDrawn)
+	    rfbSpriteRestoreCursor(pScreen);
+    }
+
+    if (cl->enableCursorPosUpdates && cl->cursorWasMoved)
+	sendCursorPos = TRUE;
+
+    if (sendCursorShape || sendCursorPos || sendNewFBSize) {
+	fu->type = rfbFramebufferUpdate;
+	fu->nRects = Swap16IfLE(!!sendCursorShape + !!sendCursorPos +
+				!!sendNewFBSize);
+	fu->eventId = cl->lastEventId;
+	fu->seqNum = Swap32IfLE(0xFFFFFFFF);
+	ublen = sz_rfbFramebufferUpdateMsg;
+
+	/* The new size goes first, so that the client resizes before it
+	   gets the cursor position or any datagram of this frame. */
+	if (sendNewFBSize && !rfbSendNewFBSize(cl))
+	    return FALSE;
+
+	if (sendCursorShape) {
+	    cl->cursorWasChanged = FALSE;
+	    if (!rfbSendCursorShape(cl, pScreen))
+		return FALSE;
+	}
+	if (sendCursorPos) {
+	    cl->cursorWasMoved = FALSE;
+	    if (!rfbSendCursorPos(cl, pScreen))
+		return FALSE;
+	}
+	if (!rfbSendUpdateBuf(cl))
+	    return FALSE;
+    }
+
+    /* A CopyRect whose source was in a lost datagram would corrupt the
+       client's framebuffer, so copies are pushed as ordinary pixels. */
+
+    REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		 &cl->copyRegion);
+    REGION_EMPTY(pScreen, &cl->copyRegion);
+    cl->copyDX = 0;
+    cl->copyDY = 0;
+
+    REGION_INIT(pScreen, &updateRegion, NullBox, 0);
+    REGION_COPY(pScreen, &updateRegion, &cl->modifiedRegion);
+    REGION_EMPTY(pScreen, &cl->modifiedRegion);
+
+    rfbScaleRegion(cl, &updateRegion);
+
+    if (!REGION_NOTEMPTY(pScreen, &updateRegion)) {
+	REGION_UNINIT(pScreen, &updateRegion);
+	return TRUE;
+    }
+
+    /*
+     * A rectangle is only cut into tiles if, going by the recent encoded
+     * size per pixel, it would not fit into a datagram.  Batched tiles are
+     * packed by size, so they may come close to filling a datagram; the
+     * rest are packed in order, so they are sized for about two of them
+     * to fill one.  A tile that still turns out too large is split again
+     * by pushSendTile().
+     */
+
+    batched = (cl->preferredEncoding == rfbEncodingTight ||
+	       cl->preferredEncoding == rfbEncodingZRLE);
+
+    nPixels = (int)((cl->pushDatagramSize - sz_rfbFramebufferUpdateMsg) /
+		    (batched ? 1.25 : 2.0) / cl->pushBytesPerPixel);
+    nTiles = 0;
+
+    /*
+     * Tiles beyond the congestion controller's budget for the frame are
+     * left for the next one.  At least one tile is always sent.
+     */
+    REGION_INIT(pScreen, &deferRegion, NullBox, 0);
+
+    cl->packing = TRUE;
+    cl->useUdp = TRUE;
+    pushDatagramBegin(cl);
+
+    for (i = 0; i < REGION_NUM_RECTS(&updateRegion); i++) {
+	pbox = &REGION_RECTS(&updateRegion)[i];
+	x = pbox->x1;
+	y = pbox->y1;
+	w = pbox->x2 - x;
+	h = pbox->y2 - y;
+
+	cl->pushStats.rfbPushPixelsDamaged += w * h;
+
+	tileRows = nPixels / w;
+	if (tileRows < 1)
+	    tileRows = 1;
+
+	for (dy = 0; dy < h; dy += tileRows) {
+	    th = (dy + tileRows < h) ? tileRows : h - dy;
+	    if (cl->ccFrameBudget > 0 && planned > 0.0 &&
+		planned + w * th * cl->pushBytesPerPixel > cl->ccFrameBudget) {
+		box.x1 = x;
+		box.y1 = y + dy;
+		box.x2 = x + w;
+		box.y2 = y + h;
+		REGION_INIT(pScreen, &tileRegion, &box, 0);
+		REGION_UNION(pScreen, &deferRegion, &deferRegion, &tileRegion);
+		REGION_UNINIT(pScreen, &tileRegion);
+		break;
+	    }
+	    planned += w * th * cl->pushBytesPerPixel;
+
+	    if (batched) {
+		if (nTiles == pushTilesSize && !pushGrowTiles()) {
+		    /* Encode the rest one by one, in order. */
+		    batched = FALSE;
+		} else {
+		    pushTiles[nTiles].x = x;
+		    pushTiles[nTiles].y = y + dy;
+		    pushTiles[nTiles].w = w;
+		    pushTiles[nTiles].h = th;
+		    nTiles++;
+		    continue;
+		}
+	    }
+	    if (!pushSendTile(cl, x, y + dy, w, th)) {
+		REGION_UNINIT(pScreen, &updateRegion);
+		REGION_UNINIT(pScreen, &deferRegion);
+		pushDatagramEnd(cl);
+		return FALSE;
+	    }
+	}
+    }
+
+    REGION_UNINIT(pScreen, &updateRegion);
+
+    if (REGION_NOTEMPTY(pScreen, &deferRegion)) {
+	/* Tile diffing already took these tiles as sent. */
+	rfbUnscaleRegion(cl, &deferRegion);
+	rfbTileDiffInvalidate(cl, &deferRegion);
+	REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		     &deferRegion);
+	cl->pushStats.rfbPushFramesCut++;
+    }
+    REGION_UNINIT(pScreen, &deferRegion);
+
+    if (nTiles != 0 && !pushSendTileBatch(cl, nTiles)) {
+	pushDatagramEnd(cl);
+	return FALSE;
+    }
+
+    if (!pushDatagramClose(cl, updateBuf, ublen) || !rfbFecFlush(cl)) {
+	pushDatagramEnd(cl);
+	return FALSE;
+    }
+    pushDatagramEnd(cl);
+
+    cl->packing = FALSE;
+    cl->useUdp = FALSE;
+    cl->pushStats.rfbPushFramesSent++;
+    cl->pushStats.rfbPushEncodeMicros += rfbTimeInMicros() - encodeStart;
+
+    return rfbPaceFrameDone(cl);
+}
+
+void
+rfbServerPushClient(cl)
+    rfbClientPtr cl;
+{
+	unsigned long now = GetTimeInMillis();
+	if (now - cl->lastTickTime > tickInterval) {
+		double t = 1000.0 * cl->tickSentBytes / (now - cl->lastTickTime);
+
+		if (cl->sendingThroughput == 0.0) {
+			cl->sendingThroughput = t;
+		} else {
+			cl->sendingThroughput = 0.75 * cl->sendingThroughput + 0.25 * t;
+		}
+
+		cl->lastTickTime = now;
+		cl->tickSentBytes = 0;
+
+		rfbFecUpdateLoss(cl);
+
+		cl->cc->tick(cl, now);
+	}
+
+    rfbTrackDamage(cl, now);
+
+    if (FB_UPDATE_PENDING(cl)) {
+
+        if ((long)(now - rfbPushDueTime(cl)) >= 0) {
+        	if (!cl->pushStarted) {
                 return;
             }
+            RFB_LOG("vvvv\n");
+            RFB_LOG("rfbServerPush to client %s\n", cl->host);
+
+            /* The kernel forgets learned path MTUs after a while. */
+            if (now - cl->lastMtuProbe > MTU_PROBE_INTERVAL)
+                rfbProbePathMtu(cl);
+
+            srRecSetupRetransmit(cl);
+
+            /* Copies are pushed as pixels, see rfbPushFrame(). */
+            rfbTileDiffSubtract(cl, &(cl->modifiedRegion));
+            rfbTileDiffInvalidate(cl, &(cl->copyRegion));
+
+            srRecSendRegion(cl, &(cl->modifiedRegion));
+
+            /* The first frame drawn after an input event answers it. */
+            if (cl->inputPending &&
+                (long)(cl->lastDamageTime - cl->inputPendingTime) >= 0) {
+                if (now - cl->lastPushTime < cl->serverPushInterval)
+                    cl->pushStats.rfbInputPushes++;
+                rfbRecordLog2(cl->rfbInputToPush, INPUT_LATENCY_BUCKETS,
+                              now - cl->inputPendingTime);
+                cl->inputPending = FALSE;
+                cl->latencyAckPending = TRUE;
+                cl->latencyInputTime = cl->inputPendingTime;
+                cl->latencySeqNum = cl->seqNumCounter;
+            }
+
+            /* seqNums run on across frames, so that any gap the client
+               sees is a lost datagram. */
+            cl->frameSeqNumCounter++;
+            if (!rfbPushFrame(cl))
+                return;
+
+            cl->lastPushTime = now;
+            cl->damagePixels = 0;	/* the same damage again is new */
+            if (cl->pushDueTime != 0) {
+                rfbRecordLog2(cl->rfbPushLateness, PUSH_LATENESS_BUCKETS,
+                              now - cl->pushDueTime);
+                cl->pushDueTime = 0;
+            }
+            RFB_LOG("^^^^\n");
+
+			if (cl->sendingThroughput > 0.1) {
+				RFB_LOG("-> sendingThroughput = %f\n", cl->sendingThroughput);
+			}
         }
     }
+}
 
-    RFB_LOG("GOING TO SEND TO CLIENT\n");
-    /* RFB_LOG("  client has %d regions\n", cl->modifiedRegion.data->size); */
-    RFB_LOG("MEASURING:\n");
-    cl->measuring = TRUE;
-    rfbSendFramebufferUpdate(cl, NULL, 0xFFFFFFFF);
-    cl->measuring = FALSE;
-    measured_size = ublen;
-    ublen = 0;
+/*
+ * Size the client's datagrams to the path MTU, so that the IP layer never
+ * fragments them: losing any one fragment would lose the whole datagram.
+ * The kernel learns the path MTU from ICMP "fragmentation needed"; a path
+ * that drops big datagrams without one is caught by rfbPathMtuBlackhole().
+ */
 
-    REGION_EMPTY(pScreen, &cl->requestedRegion);
-    REGION_UNINIT(pScreen,&tmpRegion);
+void
+rfbProbePathMtu(cl)
+    rfbClientPtr cl;
+{
+    int mtu = cl->pushSockConnected ? rfbSocketMtu(cl->udpSock) : 0;
+    int size = rfbMaxDatagramSize;
+
+    cl->lastMtuProbe = GetTimeInMillis();
 
-    return measured_size;
+    if (mtu > 0) {
+	cl->pathMtu = mtu;
+	if (size > DATAGRAM_SIZE(mtu))
+	    size = DATAGRAM_SIZE(mtu);
+    }
+    if (size < MIN_DATAGRAM_SIZE)
+	size = MIN_DATAGRAM_SIZE;
+    if (cl->enableFec)
+	size -= sz_rfbFecParityMsg;	/* parity is this much longer */
+
+    if (cl->pushDatagramSize != size)
+	rfbLog("Pushing datagrams of up to %d bytes to %s (path MTU %d)\n",
+	       size, cl->host, mtu);
+    cl->pushDatagramSize = size;
 }
 
+/*
+ * Called from sendring.c when MTU_BLACKHOLE_LOSSES datagrams larger than
+ * MIN_DATAGRAM_SIZE have been lost in a row while smaller ones sent since
+ * the first of them were acked: something on the path drops what is too
+ * big for it without the ICMP that would lower the kernel's path MTU.
+ * Datagrams are made small enough for any path until the next
+ * rfbProbePathMtu() tries the kernel's path MTU again.
+ *
+ * There are no padded probe datagrams for the client to ack, as RFC 4821
+ * would use, since the protocol has no message for them.  So a black hole
+ * is only found by losing MTU_BLACKHOLE_LOSSES datagrams to it, and one
+ * that stays costs as many again every MTU_PROBE_INTERVAL.
+ */
+
 void
-sendRegion(cl, x_low, y_low, x_high, y_high)
+rfbPathMtuBlackhole(cl)
     rfbClientPtr cl;
-	int x_low;
-    int y_low;
-    int x_high;
-    int y_high;
 {
-    static sent_count = 0;
-    sent_count++;
-    RegionRec tmpRegion;
-    BoxRec box;
+    int size = MIN_DATAGRAM_SIZE;
+
+    if (cl->enableFec)
+	size -= sz_rfbFecParityMsg;
+
+    rfbLog("Lost %d datagrams of over %d bytes to %s in a row, but not "
+	   "smaller ones; pushing datagrams of up to %d bytes\n",
+	   cl->mtuLargeLost, MIN_DATAGRAM_SIZE, cl->host, size);
+    cl->pushDatagramSize = size;
+    cl->lastMtuProbe = GetTimeInMillis();
+    cl->mtuLargeLost = 0;
+    cl->pushStats.rfbPushMtuBlackholes++;
+}
 
-    box.x1 = x_low;
-    box.y1 = y_low;
-    box.x2 = x_high;
-    box.y2 = y_high;
-    SAFE_REGION_INIT(pScreen,&tmpRegion,&box,0);
+/*
+ * Count value in a histogram whose buckets hold 0, 1, 2-3, 4-7, ..., the
+ * last one everything larger.
+ */
 
-    REGION_UNION(pScreen, &cl->requestedRegion, &cl->requestedRegion,
-                 &tmpRegion);
+void
+rfbRecordLog2(buckets, nBuckets, value)
+    int *buckets;
+    int nBuckets;
+    unsigned long value;
+{
+    int bucket = 0;
 
-    if (!cl->readyForSetColourMapEntries) {
-        /* client hasn't sent a SetPixelFormat so is using server's */
-        cl->readyForSetColourMapEntries = TRUE;
-        if (!cl->format.trueColour) {
-            if (!rfbSetClientColourMap(cl, 0, 0)) {
-                REGION_UNINIT(pScreen,&tmpRegion);
-                return;
-            }
-        }
+    while (value != 0 && bucket < nBuckets - 1) {
+	value >>= 1;
+	bucket++;
     }
+    buckets[bucket]++;
+}
 
-    SendRegionRec * srRec = (SendRegionRec *) xalloc(sizeof(SendRegionRec));
+/*
+ * Called for every key and pointer event.  The event waits for the frame
+ * that answers it, see rfbPushDueTime(); a burst of events is timed from
+ * the first one.
+ */
 
-    REGION_INIT(pScreen, &(srRec->region), NullBox, 0);
-    srRec->seqNum = seqNumCounter; seqNumCounter++;
+static void
+rfbInputReceived(cl, eventId)
+    rfbClientPtr cl;
+    CARD32 eventId;
+{
+    cl->lastEventId = eventId;
+    cl->lastInputTime = GetTimeInMillis();
+    rfbTelemetryRecord(cl->sock, TLM_INPUT, Swap32IfLE(eventId), TLM_NONE,
+		       TLM_NONE, 0);
+    if (!cl->inputPending) {
+	cl->inputPending = TRUE;
+	cl->inputPendingTime = cl->lastInputTime;
+    }
+}
 
-    RFB_LOG("Sending to client region %d -> %d, sent_count=%d\n", y_low, y_high, sent_count);
-    cl->useUdp = TRUE;
-    rfbSendFramebufferUpdate_numBytes(cl, &(srRec->region), srRec->seqNum, &(srRec->numBytes));
-    cl->useUdp = FALSE;
+/*
+ * Number of pixels in a region.
+ */
 
-    srRec->time = GetTimeInMillis();
-    srRec->prev = NULL;
-    srRec->next = NULL;
-    RFB_LOG("srRec->time = %lu / srRec->seqNum = %lu, srRec->numBytes = %d\n", srRec->time, srRec->seqNum, srRec->numBytes);
-    rfbLog("[P] seqNum %lu frameSeqNum %lu time %lu\n", srRec->seqNum, frameSeqNumCounter, srRec->time);
+unsigned long
+rfbRegionArea(region)
+    RegionPtr region;
+{
+    BoxPtr pbox;
+    unsigned long area = 0;
+    int i;
 
-    srRecAdd(srRec);
+    for (i = 0; i < REGION_NUM_RECTS(region); i++) {
+	pbox = &REGION_RECTS(region)[i];
+	area += (unsigned long)(pbox->x2 - pbox->x1) * (pbox->y2 - pbox->y1);
+    }
 
-    REGION_UNINIT(pScreen,&tmpRegion);
+    return area;
 }
 
-void recursiveSend(cl, x_low, y_low, x_high, y_high)
-	rfbClientPtr cl;
-	int x_low;
-	int y_low;
-	int x_high;
-	int y_high;
+/*
+ * Note when the client's damage last changed.  Drawing is only seen
+ * between requests from X clients, so lastDamageTime is when the change
+ * was noticed, which is late rather than early.  An input event nothing is
+ * drawn for within rfbInputPushBudget is given up on.
+ */
+
+static void
+rfbTrackDamage(cl, now)
+    rfbClientPtr cl;
+    unsigned long now;
 {
-    int measured_size = measureRegion(cl, x_low, y_low, x_high, y_high);
-    RFB_LOG("RECURSIVE SEND (%d,%d)(%d,%d) -> %d\n", x_low, y_low, x_high, y_high, measured_size);
-    if (measured_size < MAX_UPDATE_SIZE) {
-        RFB_LOG("  recursiveSend: %d < %d for (%d,%d)(%d,%d)\n",
-            measured_size, MAX_UPDATE_SIZE, x_low, y_low, x_high, y_high);
-        tickSentBytes += measured_size;
-        sendRegion(cl, x_low, y_low, x_high, y_high);
-        return;
-    }
-    int region_count = (measured_size / MAX_UPDATE_SIZE) + 1;
-    RFB_LOG("  ================\n");
-    RFB_LOG("  recursiveSend: %d > %d for (%d,%d)(%d,%d) region_count=%d\n",
-        measured_size, MAX_UPDATE_SIZE, x_low, y_low, x_high, y_high, region_count);
+    RegionPtr regs[2];
+    BoxRec extents;
+    BoxPtr box;
+    unsigned long pixels = 0;
+    Bool haveExtents = FALSE;
+    int i;
 
-    if (region_count > 8) {
-    	region_count = 8;
+    regs[0] = &cl->modifiedRegion;
+    regs[1] = &cl->copyRegion;
+    extents.x1 = extents.y1 = extents.x2 = extents.y2 = 0;
+
+    for (i = 0; i < 2; i++) {
+	pixels += rfbRegionArea(regs[i]);
+	if (REGION_NOTEMPTY(pScreen, regs[i])) {
+	    box = REGION_EXTENTS(pScreen, regs[i]);
+	    if (!haveExtents) {
+		extents = *box;
+		haveExtents = TRUE;
+	    } else {
+		if (box->x1 < extents.x1) extents.x1 = box->x1;
+		if (box->y1 < extents.y1) extents.y1 = box->y1;
+		if (box->x2 > extents.x2) extents.x2 = box->x2;
+		if (box->y2 > extents.y2) extents.y2 = box->y2;
+	    }
+	}
     }
 
-    /* Split on longer edge. */
-    int i;
-    if ((x_high - x_low) > (y_high - y_low)) {
-    	/* Split on x. */
-    	int x_width = (x_high - x_low) / region_count;
-    	for (i = 0; i < region_count; i++) {
-    		recursiveSend(cl, x_low + (i*x_width),
-    				y_low, x_low + ((i + 1)*x_width), y_high);
-    	}
-    } else {
-    	/* Split on y. */
-        int y_width = (y_high - y_low) / region_count;
-        for (i = 0; i < region_count; i++) {
-            recursiveSend(cl, x_low, y_low + (i*y_width),
-            		x_high, y_low + ((i + 1)*y_width));
-        }
+    if (pixels != cl->damagePixels ||
+	memcmp(&extents, &cl->damageExtents, sizeof(BoxRec)) != 0) {
+	cl->damagePixels = pixels;
+	cl->damageExtents = extents;
+	if (pixels != 0)
+	    cl->lastDamageTime = now;
     }
+
+    if (cl->inputPending &&
+	(long)(cl->lastDamageTime - cl->inputPendingTime) < 0 &&
+	now - cl->inputPendingTime > rfbInputPushBudget)
+	cl->inputPending = FALSE;
 }
 
-void
-rfbServerPushClient(cl)
+/*
+ * When the client's next frame is due: serverPushInterval after the last
+ * one, which may be up to a second with a slow link.  After an input
+ * event, small damage (an echoed character, a menu highlight) goes as
+ * soon as drawing has been quiet for rfbInputPushQuiet ms, and at the
+ * latest rfbInputPushBudget ms after the event, whatever the interval.
+ */
+
+static unsigned long
+rfbPushDueTime(cl)
     rfbClientPtr cl;
 {
-	unsigned long now = GetTimeInMillis();
-	static unsigned long last_check;
-	if (now - last_check > tickInterval) {
-		double t = 1000.0 * tickSentBytes / (now - last_check);
+    unsigned long due = cl->lastPushTime + cl->serverPushInterval;
+    unsigned long inputDue;
 
-		if (sendingThroughput == 0.0) {
-			sendingThroughput = t;
-		} else {
-			sendingThroughput = 0.75 * sendingThroughput + 0.25 * t;
-		}
+    if (rfbInputPushQuiet == 0 || !cl->inputPending ||
+	(long)(cl->lastDamageTime - cl->inputPendingTime) < 0 ||
+	cl->damagePixels > INPUT_PUSH_MAX_PIXELS)
+	return due;
 
-		last_check = now;
-		tickSentBytes = 0;
-
-		/* Linearly map quality to percentage. 1 -> 0%, 5 -> 100% */
-		double qualityPercentage = (cl->tightQualityLevel - 3.0) / (3.0 - 1.0);
-		/* Linearly map interval to percentage. 1000 -> 0%, 42 -> 100% */
-		double intervalPercentage = (1000.0 - serverPushInterval) / (1000.0 - 42.0);
-
-		if (sendingThroughput > receivingThroughput) {
-			if (now - lastChange > 20 * tickInterval) {
-				if (qualityPercentage >= intervalPercentage) {
-					cl->tightQualityLevel--;
-					if (cl->tightQualityLevel < 1) {
-						cl->tightQualityLevel = 1;
-					}
-				} else {
-					serverPushInterval += 5;
-					if (serverPushInterval > 1000) {
-						serverPushInterval = 1000;
-					}
-				}
-				RFB_LOG("RAMP DOWN: quality = %d (%f), interval = %d (%f)\n\n", cl->tightQualityLevel, qualityPercentage, serverPushInterval, intervalPercentage);
-				lastChange = now;
-			}
-		} else if (sendingThroughput < 0.9 * receivingThroughput) {
-			if (now - lastChange > 20 * tickInterval) {
-				if (qualityPercentage <= intervalPercentage) {
-					cl->tightQualityLevel++;
-					if (cl->tightQualityLevel > 3) {
-						cl->tightQualityLevel = 3;
-					}
-				} else {
-					serverPushInterval -= 5;
-					if (serverPushInterval < 42) {
-						serverPushInterval = 42;
-					}
-				}
-				RFB_LOG("RAMP UP: quality = %d (%f), interval = %d (%f)\n\n", cl->tightQualityLevel, qualityPercentage, serverPushInterval, intervalPercentage);
-				lastChange = now;
-			}
-		}
-	}
+    inputDue = cl->lastDamageTime + rfbInputPushQuiet;
+    if ((long)(inputDue - (cl->inputPendingTime + rfbInputPushBudget)) > 0)
+	inputDue = cl->inputPendingTime + rfbInputPushBudget;
 
-    if (FB_UPDATE_PENDING(cl)) {
+    return ((long)(inputDue - due) < 0) ? inputDue : due;
+}
 
-        static unsigned long last_update;
-        if (now - last_update > serverPushInterval) {
-        	if (canSend == FALSE) {
-                return;
-            }
-            RFB_LOG("vvvv\n");
-            RFB_LOG("rfbServerPush to client %s\n", cl->host);
+/*
+ * rfbServerPush is called to push data to all clients.  Afterwards the push
+ * timer is set for the earliest frame still waiting for its interval to
+ * pass, or paced datagram waiting for its turn, so that the server wakes up
+ * for it even if nothing else happens.
+ */
+void
+rfbServerPush()
+{
+    /* Go through all clients. */
+    rfbClientPtr cl, nextCl;
+    unsigned long now;
+    unsigned long due;
+    long wait, minWait = -1;
 
-            srRecSetupRetransmit(cl);
+    for (cl = rfbClientHead; cl; cl = nextCl) {
+	nextCl = cl->next;
+    	if (cl->isOctopus == TRUE) {
+		if (!rfbPaceSend(cl))
+		    continue;
+    		rfbServerPushClient(cl);
+    	}
+    }
 
-            /* Get bounding heights. */
-            int x_low = cl->modifiedRegion.extents.x1;
-            int y_low = cl->modifiedRegion.extents.y1;
-            int x_high = cl->modifiedRegion.extents.x2;
-            int y_high = cl->modifiedRegion.extents.y2;
-            RFB_LOG("Bounding box is (%d,%d) -> (%d,%d)\n", x_low, y_low, x_high, y_high);
+    /* Clients closed above are off the list by now. */
+    now = GetTimeInMillis();
+    for (cl = rfbClientHead; cl; cl = cl->next) {
+	if (cl->isOctopus != TRUE)
+	    continue;
 
-            srRecSendRegion(&(cl->modifiedRegion));
+	wait = rfbPaceWait(cl);
+	if (wait >= 0 && (minWait < 0 || wait < minWait))
+	    minWait = wait;
 
-            seqNumCounter++; /* increment for new frame */
-            frameSeqNumCounter++;
-            recursiveSend(cl, x_low, y_low, x_high, y_high);
+	/* Look for drawing in answer to input every quiet period, even
+	   with nothing to push yet. */
+	if (cl->pushStarted && cl->inputPending && rfbInputPushQuiet != 0) {
+	    wait = rfbInputPushQuiet * 1000;
+	    if (minWait < 0 || wait < minWait)
+		minWait = wait;
+	}
 
-            last_update = now;
-            RFB_LOG("^^^^\n");
+	if (!cl->pushStarted || !FB_UPDATE_PENDING(cl))
+	    continue;
 
-			if (sendingThroughput > 0.1) {
-				RFB_LOG("-> sendingThroughput = %f\n", sendingThroughput);
-			}
-        }
+	/* An input push can make the frame due earlier than first thought. */
+	due = rfbPushDueTime(cl);
+	if ((long)(due - now) < 0)
+	    due = now;
+	if (cl->pushDueTime == 0 || (long)(due - cl->pushDueTime) < 0)
+	    cl->pushDueTime = due;
+
+	wait = (long)(due - now);
+	if (wait < 0)
+	    wait = 0;
+	wait *= 1000;
+	if (minWait < 0 || wait < minWait)
+	    minWait = wait;
     }
+
+    rfbSetPushTimer(minWait);
 }
 
 /*
- * rfbServerPush is called to push data to all clients.
+ * Called from pace.c once a datagram queued by rfbSendDatagram() has
+ * really been sent, or refused as too big for the path.  The datagram's
+ * retransmit timeout only starts now.
  */
+
 void
-rfbServerPush()
-{
-    /* Go through all clients. */
+rfbPacedDatagramSent(cl, buf, sent)
     rfbClientPtr cl;
-    for (cl = rfbClientHead; cl; cl = cl->next) {
-    	if (cl->isOctopus == TRUE) {
-    		rfbServerPushClient(cl);
-    	}
+    char *buf;
+    Bool sent;
+{
+    rfbFramebufferUpdateMsg *fu = (rfbFramebufferUpdateMsg *)buf;
+    SendRegionRec *srRec;
+    CARD32 seqNum;
+
+    if (fu->type != rfbFramebufferUpdate || cl->srRing == NULL)
+	return;
+
+    seqNum = Swap32IfLE(fu->seqNum);
+    srRec = SR_SLOT(cl, seqNum);
+    if (!srRec->live || srRec->seqNum != seqNum)
+	return;
+
+    if (!sent) {
+	srRecRequeue(cl, srRec);
+	return;
     }
+
+    srRec->time = GetTimeInMillis();
+    rfbTelemetryRecord(cl->sock, TLM_SENT, Swap32IfLE(srRec->eventId), seqNum,
+		       srRec->frameSeqNum, srRec->numBytes);
+    /* After an idle spell the delivery rate is measured from now. */
+    if (srRec->time - cl->ccDeliveredTime > cl->retransmitTimeout)
+	cl->ccDeliveredTime = srRec->time;
+    srRec->delivered = cl->ccDelivered;
+    srRec->deliveredTime = cl->ccDeliveredTime;
 }
 
 /*
@@ -922,14 +1570,15 @@ rfbProcessClientInitMessage(cl)
 
 /* Update these constants on changing capability lists below! */
 #define N_SMSG_CAPS  0
-#define N_CMSG_CAPS  0
-#define N_ENC_CAPS  12
+#define N_CMSG_CAPS  2
+#define N_ENC_CAPS  16
 
 void
 rfbSendInteractionCaps(cl)
     rfbClientPtr cl;
 {
     rfbInteractionCapsMsg intr_caps;
+    rfbCapabilityInfo cmsg_list[N_CMSG_CAPS];
     rfbCapabilityInfo enc_list[N_ENC_CAPS];
     int i;
 
@@ -954,6 +1603,15 @@ rfbSendInteractionCaps(cl)
     */
 
     /* Supported client->server message types. */
+    i = 0;
+    SetCapInfo(&cmsg_list[i++], rfbSetScale,               rfbTightVncVendor);
+    SetCapInfo(&cmsg_list[i++], rfbFramebufferUpdateNack,  rfbTightVncVendor);
+    if (i != N_CMSG_CAPS) {
+	RFB_LOG("rfbSendInteractionCaps: assertion failed, i != N_CMSG_CAPS\n");
+	rfbCloseSock(cl->sock);
+	return;
+    }
+
     /* For future file transfer support:
     i = 0;
     SetCapInfo(&cmsg_list[i++], rfbFileListRequest,        rfbTightVncVendor);
@@ -976,6 +1634,7 @@ rfbSendInteractionCaps(cl)
     SetCapInfo(&enc_list[i++],  rfbEncodingCoRRE,          rfbStandardVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingHextile,        rfbStandardVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingZlib,           rfbTridiaVncVendor);
+    SetCapInfo(&enc_list[i++],  rfbEncodingZRLE,           rfbTridiaVncVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingTight,          rfbTightVncVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingCompressLevel0, rfbTightVncVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingQualityLevel0,  rfbTightVncVendor);
@@ -983,6 +1642,9 @@ rfbSendInteractionCaps(cl)
     SetCapInfo(&enc_list[i++],  rfbEncodingRichCursor,     rfbTightVncVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingPointerPos,     rfbTightVncVendor);
     SetCapInfo(&enc_list[i++],  rfbEncodingLastRect,       rfbTightVncVendor);
+    SetCapInfo(&enc_list[i++],  rfbEncodingNewFBSize,      rfbTightVncVendor);
+    SetCapInfo(&enc_list[i++],  rfbEncodingTightLz4,       rfbTightVncVendor);
+    SetCapInfo(&enc_list[i++],  rfbEncodingServerPush,     rfbTightVncVendor);
     if (i != N_ENC_CAPS) {
 	RFB_LOG("rfbSendInteractionCaps: assertion failed, i != N_ENC_CAPS\n");
 	rfbCloseSock(cl->sock);
@@ -992,6 +1654,8 @@ rfbSendInteractionCaps(cl)
     /* Send header and capability lists */
     if (WriteExact(cl->sock, (char *)&intr_caps,
 		   sz_rfbInteractionCapsMsg) < 0 ||
+	WriteExact(cl->sock, (char *)&cmsg_list[0],
+		   sz_rfbCapabilityInfo * N_CMSG_CAPS) < 0 ||
 	WriteExact(cl->sock, (char *)&enc_list[0],
 		   sz_rfbCapabilityInfo * N_ENC_CAPS) < 0) {
 	rfbLogPerror("rfbSendInteractionCaps: write");
@@ -1004,6 +1668,58 @@ rfbSendInteractionCaps(cl)
 }
 
 
+/*
+ * Handle a FramebufferUpdateNack: the client saw a gap in the seqNums, so
+ * the datagrams in it are given up on now rather than at their retransmit
+ * timeout, and their areas go into the next frame.  If a lost datagram
+ * went out soon after the latest input event, it probably carried the
+ * response to it, and the next frame is pushed at once instead of at the
+ * end of the push interval.
+ */
+
+static void
+rfbProcessNack(cl, baseSeqNum, bitmap)
+    rfbClientPtr cl;
+    CARD32 baseSeqNum;
+    CARD32 bitmap;
+{
+    unsigned long now = GetTimeInMillis();
+    SendRegionRec *srRec;
+    CARD32 seqNum;
+    Bool urgent = FALSE;
+    int i;
+
+    cl->pushStats.rfbNackMessagesRcvd++;
+
+    if (cl->srRing == NULL)
+	return;
+
+    for (i = 0; i < 32; i++) {
+	if (!(bitmap & ((CARD32)1 << i)))
+	    continue;
+
+	seqNum = baseSeqNum + i;
+	srRec = SR_SLOT(cl, seqNum);
+	if (!srRec->live || srRec->seqNum != seqNum || srRec->time == 0)
+	    continue;		/* acked, requeued or not sent yet */
+
+	if (srRec->eventId == cl->lastEventId && cl->lastInputTime != 0 &&
+	    srRec->time - cl->lastInputTime <= NACK_INPUT_WINDOW)
+	    urgent = TRUE;
+
+	srRecRequeue(cl, srRec);
+	cl->pushStats.rfbPushDatagramsNacked++;
+    }
+
+    if (urgent && cl->pushStarted &&
+	now - cl->lastPushTime < cl->serverPushInterval) {
+	cl->lastPushTime = now - cl->serverPushInterval;
+	cl->pushStats.rfbNackPushes++;
+	rfbSetPushTimer(0);
+    }
+}
+
+
 /*
  * rfbProcessClientNormalMessage is called when the client has sent a normal
  * protocol message.
@@ -1087,6 +1803,8 @@ rfbProcessClientNormalMessage(cl)
 	cl->enableCursorShapeUpdates = FALSE;
 	cl->enableCursorPosUpdates = FALSE;
 	cl->enableLastRectEncoding = FALSE;
+	cl->enableNewFBSize = FALSE;
+	cl->enableTightLz4 = FALSE;
 	cl->tightCompressLevel = TIGHT_DEFAULT_COMPRESSION;
 	cl->tightQualityLevel = -1;
 
@@ -1146,6 +1864,13 @@ rfbProcessClientNormalMessage(cl)
 			   cl->host);
 		}
 		break;
+	    case rfbEncodingZRLE:
+		if (cl->preferredEncoding == -1) {
+		    cl->preferredEncoding = enc;
+		    RFB_LOG("Using ZRLE encoding for client %s\n",
+			   cl->host);
+		}
+		break;
 	    case rfbEncodingXCursor:
 		RFB_LOG("Enabling X-style cursor updates for client %s\n",
 		       cl->host);
@@ -1179,6 +1904,38 @@ rfbProcessClientNormalMessage(cl)
 		    cl->enableLastRectEncoding = TRUE;
 		}
 		break;
+	    case rfbEncodingNewFBSize:
+		if (!cl->enableNewFBSize) {
+		    RFB_LOG("Enabling NewFBSize protocol extension for client "
+			   "%s\n", cl->host);
+		    cl->enableNewFBSize = TRUE;
+		}
+		break;
+	    case rfbEncodingServerPush:
+		/* Like FecParity, push stays on once asked for: the client
+		   may already be switched over. */
+		if (!cl->isOctopus) {
+		    RFB_LOG("Enabling ServerPush protocol extension for client "
+			   "%s\n", cl->host);
+		    cl->isOctopus = TRUE;
+		}
+		break;
+	    case rfbEncodingTightLz4:
+		if (!cl->enableTightLz4) {
+		    RFB_LOG("Enabling TightLz4 protocol extension for client "
+			   "%s\n", cl->host);
+		    cl->enableTightLz4 = TRUE;
+		}
+		break;
+	    case rfbEncodingFecParity:
+		if (rfbFec && !cl->enableFec) {
+		    rfbLog("Enabling FecParity protocol extension for client "
+			   "%s\n", cl->host);
+		    cl->enableFec = TRUE;
+		    /* Leave room for the parity header. */
+		    rfbProbePathMtu(cl);
+		}
+		break;
 	    default:
 		if ( enc >= (CARD32)rfbEncodingCompressLevel0 &&
 		     enc <= (CARD32)rfbEncodingCompressLevel9 ) {
@@ -1229,15 +1986,14 @@ rfbProcessClientNormalMessage(cl)
 	    return;
 	}
 
-        static int send_count = 0;
         if (cl->isOctopus) {
-        	send_count++;
-        	if (send_count > 10) {
-				canSend = TRUE;
+        	cl->nUpdateRequests++;
+        	if (cl->nUpdateRequests > 10) {
+				cl->pushStarted = TRUE;
 				/* Switch to server push mode */
 				return;
 			}
-        	RFB_LOG("vv Sending from here, count=%d\n", send_count);
+        	RFB_LOG("vv Sending from here, count=%d\n", cl->nUpdateRequests);
         }
 
 	box.x1 = Swap16IfLE(msg.fur.x);
@@ -1245,6 +2001,7 @@ rfbProcessClientNormalMessage(cl)
 	box.x2 = box.x1 + Swap16IfLE(msg.fur.w);
 	box.y2 = box.y1 + Swap16IfLE(msg.fur.h);
 	SAFE_REGION_INIT(pScreen,&tmpRegion,&box,0);
+	rfbUnscaleRegion(cl, &tmpRegion);
 
 	REGION_UNION(pScreen, &cl->requestedRegion, &cl->requestedRegion,
 		     &tmpRegion);
@@ -1261,6 +2018,7 @@ rfbProcessClientNormalMessage(cl)
 	}
 
 	if (!msg.fur.incremental) {
+	    rfbTileDiffInvalidate(cl, &tmpRegion);
 	    REGION_UNION(pScreen,&cl->modifiedRegion,&cl->modifiedRegion,
 			 &tmpRegion);
 	    REGION_SUBTRACT(pScreen,&cl->copyRegion,&cl->copyRegion,
@@ -1295,7 +2053,7 @@ rfbProcessClientNormalMessage(cl)
 	    return;
 #endif
 
-	lastEventId = msg.ke.eventId;
+	rfbInputReceived(cl, msg.ke.eventId);
 
 	if (!rfbViewOnly && !cl->viewOnly) {
 	    KbdAddEvent(msg.ke.down, (KeySym)Swap32IfLE(msg.ke.key), cl);
@@ -1325,7 +2083,7 @@ rfbProcessClientNormalMessage(cl)
 	if (pointerClient && (pointerClient != cl))
 	    return;
 
-	lastEventId = msg.pe.eventId;
+	rfbInputReceived(cl, msg.pe.eventId);
 
 	if (msg.pe.buttonMask == 0)
 	    pointerClient = NULL;
@@ -1333,8 +2091,12 @@ rfbProcessClientNormalMessage(cl)
 	    pointerClient = cl;
 
 	if (!rfbViewOnly && !cl->viewOnly) {
-	    cl->cursorX = (int)Swap16IfLE(msg.pe.x);
-            cl->cursorY = (int)Swap16IfLE(msg.pe.y);
+	    cl->cursorX = (int)Swap16IfLE(msg.pe.x) * cl->scale;
+            cl->cursorY = (int)Swap16IfLE(msg.pe.y) * cl->scale;
+	    if (cl->cursorX >= rfbScreen.width)
+		cl->cursorX = rfbScreen.width - 1;
+	    if (cl->cursorY >= rfbScreen.height)
+		cl->cursorY = rfbScreen.height - 1;
 	    PtrAddEvent(msg.pe.buttonMask, cl->cursorX, cl->cursorY, cl);
 	}
 	return;
@@ -1379,51 +2141,52 @@ rfbProcessClientNormalMessage(cl)
     	    return;
     	}
 
-    	CARD32 seqNum = Swap32IfLE(msg.fua.seqNum);
-    	int numBytes;
-    	unsigned long timeSent = srRecDeleteSeqNum(seqNum, &numBytes);
-    	if (timeSent != 0) {
-    		unsigned long timeCurrent = GetTimeInMillis();
-
-    		double r = (double) timeCurrent - timeSent;
-    		if (srtt == 0.0) {
-    			srtt = r;
-    			rttvar = r / 2.0;
-    		} else {
-    			double diff = srtt - r;
-    			if (diff < 0) {
-    				diff = -diff;
-    			}
-
-    			rttvar = 0.75 * rttvar + 0.25 * diff;
-    			srtt = 0.875 * srtt + 0.125 * r;
-    		}
-
-    		retransmitTimeout = (unsigned long) (srtt + 2 * rttvar);
-    		if (retransmitTimeout < 50) {
-    			retransmitTimeout = 50;
-    		}
-
-    		if (lastAckSeqNum + 1 == seqNum) {
-    			unsigned long diff = timeCurrent - lastAckTime;
-    			if (diff < 1) diff = 1;
-    			double t = 1000.0 * numBytes / diff;
-
-    			if (receivingThroughput == 0.0) {
-    				receivingThroughput = t;
-    			} else {
-    				receivingThroughput = 0.875 * receivingThroughput + 0.125 * t;
-    			}
-
-    			RFB_LOG("-> receivingThroughput = %f, numBytes = %d, time-diff = %lu\n", receivingThroughput, numBytes, diff);
-    		}
-
-    		lastAckSeqNum = seqNum;
-    		lastAckTime = timeCurrent;
+    	rfbProcessSack(cl, Swap32IfLE(msg.fua.seqNum), 1, 0);
+    	return;
+
+    case rfbFramebufferUpdateSack:
+
+    	if ((n = ReadExact(cl->sock, ((char *)&msg) + 1,
+    			   sz_rfbFramebufferUpdateSackMsg - 1)) <= 0) {
+    	    if (n != 0)
+    		rfbLogPerror("rfbProcessClientNormalMessage: read");
+    	    rfbCloseSock(cl->sock);
+    	    return;
     	}
 
+    	cl->pushStats.rfbPushDatagramsRecovered += msg.fusa.recovered;
+    	rfbProcessSack(cl, Swap32IfLE(msg.fusa.baseSeqNum),
+    		       Swap32IfLE(msg.fusa.bitmap),
+    		       Swap16IfLE(msg.fusa.ackDelay));
     	return;
 
+    case rfbFramebufferUpdateNack:
+
+	if ((n = ReadExact(cl->sock, ((char *)&msg) + 1,
+			   sz_rfbFramebufferUpdateNackMsg - 1)) <= 0) {
+	    if (n != 0)
+		rfbLogPerror("rfbProcessClientNormalMessage: read");
+	    rfbCloseSock(cl->sock);
+	    return;
+	}
+
+	rfbProcessNack(cl, Swap32IfLE(msg.funa.baseSeqNum),
+		       Swap32IfLE(msg.funa.bitmap));
+	return;
+
+    case rfbSetScale:
+
+	if ((n = ReadExact(cl->sock, ((char *)&msg) + 1,
+			   sz_rfbSetScaleMsg - 1)) <= 0) {
+	    if (n != 0)
+		rfbLogPerror("rfbProcessClientNormalMessage: read");
+	    rfbCloseSock(cl->sock);
+	    return;
+	}
+
+	rfbSetClientScale(cl, msg.ss.scale);
+	return;
+
     default:
 
 	RFB_LOG("rfbProcessClientNormalMessage: unknown message type %d\n",
@@ -1466,6 +2229,7 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
     int dx, dy;
     Bool sendCursorShape = FALSE;
     Bool sendCursorPos = FALSE;
+    Bool sendNewFBSize;
 
     /*
      * If this client understands cursor shape updates, cursor should be
@@ -1498,6 +2262,23 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
     REGION_SUBTRACT(pScreen, &cl->copyRegion, &cl->copyRegion,
 		    &cl->modifiedRegion);
 
+    /*
+     * A copy cannot be sent to a scaled client, since it would move pixels
+     * by a fraction of the scale.  Send the copied area as pixels instead.
+     */
+
+    if (cl->scale > 1) {
+	REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		     &cl->copyRegion);
+	REGION_EMPTY(pScreen, &cl->copyRegion);
+    }
+
+    /*
+     * Drop the tiles whose pixels the client already has.
+     */
+
+    rfbTileDiffSubtract(cl, &cl->modifiedRegion);
+
     /*
      * The client is interested in the region requestedRegion.  The region
      * which should be updated now is the intersection of requestedRegion
@@ -1514,7 +2295,7 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
     if (theRegionPtr != NULL) REGION_COPY(pScreen, theRegionPtr, &updateRegion);
 
     if ( !REGION_NOTEMPTY(pScreen,&updateRegion) &&
-	 !sendCursorShape && !sendCursorPos ) {
+	 !sendCursorShape && !sendCursorPos && !cl->newFBSizePending ) {
 	REGION_UNINIT(pScreen,&updateRegion);
         RFB_LOG("Region is empty, so I'm not sending\n");
 	return TRUE;
@@ -1553,28 +2334,35 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
      * carry over a copyRegion for a future update.
      */
 
-    if (!cl->measuring) {
-        REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
-                     &cl->copyRegion);
+    REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		 &cl->copyRegion);
 
-        REGION_SUBTRACT(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
-                        &updateRegion);
-        REGION_SUBTRACT(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
-                        &updateCopyRegion);
+    REGION_SUBTRACT(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		    &updateRegion);
+    REGION_SUBTRACT(pScreen, &cl->modifiedRegion, &cl->modifiedRegion,
+		    &updateCopyRegion);
 
-        REGION_EMPTY(pScreen, &cl->requestedRegion);
-        REGION_EMPTY(pScreen, &cl->copyRegion);
-        cl->copyDX = 0;
-        cl->copyDY = 0;
-    }
+    rfbTileDiffInvalidate(cl, &cl->modifiedRegion);
+    rfbTileDiffInvalidate(cl, &updateCopyRegion);
+
+    REGION_EMPTY(pScreen, &cl->requestedRegion);
+    REGION_EMPTY(pScreen, &cl->copyRegion);
+    cl->copyDX = 0;
+    cl->copyDY = 0;
+
+    /*
+     * From here on updateRegion is in the coordinates of the framebuffer
+     * the client gets, which differ from the screen's if it is scaled.
+     */
+
+    rfbScaleRegion(cl, &updateRegion);
+    sendNewFBSize = cl->newFBSizePending;
 
     /*
      * Now send the update.
      */
 
-    if (!cl->measuring) {
-        cl->rfbFramebufferUpdateMessagesSent++;
-    }
+    cl->rfbFramebufferUpdateMessagesSent++;
 
     if (cl->preferredEncoding == rfbEncodingCoRRE) {
 	nUpdateRegionRects = 0;
@@ -1618,18 +2406,22 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
 
     fu->type = rfbFramebufferUpdate;
 
-    fu->eventId = lastEventId;
+    fu->eventId = cl->lastEventId;
     fu->seqNum = Swap32IfLE(seqNum);
 
     if (nUpdateRegionRects != 0xFFFF) {
 	fu->nRects = Swap16IfLE(REGION_NUM_RECTS(&updateCopyRegion) +
 				nUpdateRegionRects +
-				!!sendCursorShape + !!sendCursorPos);
+				!!sendCursorShape + !!sendCursorPos +
+				!!sendNewFBSize);
     } else {
 	fu->nRects = 0xFFFF;
     }
     ublen = sz_rfbFramebufferUpdateMsg;
 
+    if (sendNewFBSize && !rfbSendNewFBSize(cl))
+	return FALSE;
+
     if (sendCursorShape) {
         RFB_LOG("Sending cursor shape \n");
 	cl->cursorWasChanged = FALSE;
@@ -1666,43 +2458,9 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
 	cl->rfbRawBytesEquivalent += (sz_rfbFramebufferUpdateRectHeader
 				      + w * (cl->format.bitsPerPixel / 8) * h);
 
-	switch (cl->preferredEncoding) {
-	case rfbEncodingRaw:
-	    if (!rfbSendRectEncodingRaw(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
-	case rfbEncodingRRE:
-	    if (!rfbSendRectEncodingRRE(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
-	case rfbEncodingCoRRE:
-	    if (!rfbSendRectEncodingCoRRE(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
-	case rfbEncodingHextile:
-	    if (!rfbSendRectEncodingHextile(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
-	case rfbEncodingZlib:
-	    if (!rfbSendRectEncodingZlib(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
-	case rfbEncodingTight:
-	    if (!rfbSendRectEncodingTight(cl, x, y, w, h)) {
-		REGION_UNINIT(pScreen,&updateRegion);
-		return FALSE;
-	    }
-	    break;
+	if (!rfbSendRectEncoding(cl, x, y, w, h)) {
+	    REGION_UNINIT(pScreen,&updateRegion);
+	    return FALSE;
 	}
     }
     handleNewBlock = 0;
@@ -1723,6 +2481,35 @@ rfbSendFramebufferUpdate_numBytes(cl, theRegionPtr, seqNum, numBytes)
 
 
 
+/*
+ * Send a single rectangle in the client's preferred encoding.
+ */
+
+static Bool
+rfbSendRectEncoding(cl, x, y, w, h)
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    switch (cl->preferredEncoding) {
+    case rfbEncodingRaw:
+	return rfbSendRectEncodingRaw(cl, x, y, w, h);
+    case rfbEncodingRRE:
+	return rfbSendRectEncodingRRE(cl, x, y, w, h);
+    case rfbEncodingCoRRE:
+	return rfbSendRectEncodingCoRRE(cl, x, y, w, h);
+    case rfbEncodingHextile:
+	return rfbSendRectEncodingHextile(cl, x, y, w, h);
+    case rfbEncodingZlib:
+	return rfbSendRectEncodingZlib(cl, x, y, w, h);
+    case rfbEncodingTight:
+	return rfbSendRectEncodingTight(cl, x, y, w, h);
+    case rfbEncodingZRLE:
+	return rfbSendRectEncodingZRLE(cl, x, y, w, h);
+    }
+    return TRUE;
+}
+
+
 /*
  * Send the copy region as a string of CopyRect encoded rectangles.
  * The only slightly tricky thing is that we should send the messages in
@@ -1831,7 +2618,7 @@ rfbSendRectEncodingRaw(cl, x, y, w, h)
     rfbFramebufferUpdateRectHeader rect;
     int nlines;
     int bytesPerLine = w * (cl->format.bitsPerPixel / 8);
-    char *fbptr = (rfbScreen.pfbMemory + (rfbScreen.paddedWidthInBytes * y)
+    char *fbptr = (CLIENT_FB_MEMORY(cl) + (CLIENT_FB_STRIDE(cl) * y)
 		   + (x * (rfbScreen.bitsPerPixel / 8)));
 
     /* Flush the buffer to guarantee correct alignment for translateFn(). */
@@ -1861,7 +2648,7 @@ rfbSendRectEncodingRaw(cl, x, y, w, h)
 
 	(*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
 			   &cl->format, fbptr, &updateBuf[ublen],
-			   rfbScreen.paddedWidthInBytes, w, nlines);
+			   CLIENT_FB_STRIDE(cl), w, nlines);
 
 	ublen += nlines * bytesPerLine;
 	h -= nlines;
@@ -1874,7 +2661,7 @@ rfbSendRectEncodingRaw(cl, x, y, w, h)
 	if (!rfbSendUpdateBuf(cl))
 	    return FALSE;
 
-	fbptr += (rfbScreen.paddedWidthInBytes * nlines);
+	fbptr += (CLIENT_FB_STRIDE(cl) * nlines);
 
 	nlines = (UPDATE_BUF_SIZE - ublen) / bytesPerLine;
 	if (nlines == 0) {
@@ -1930,51 +2717,14 @@ Bool
 rfbSendUpdateBuf(cl)
     rfbClientPtr cl;
 {
-    if (cl->measuring) {
-        RFB_LOG("Measured %d bytes (not in sending mode)\n", ublen);
+    if (cl->packing) {
+        /* The push datagram packer decides when to send. */
         return TRUE;
     }
 
-    /*
-    int i;
-    for (i = 0; i < ublen; i++) {
-        if (i % 10 == 0) {
-            fprintf(stderr,"\n");
-        }
-	fprintf(stderr,"%02x ",((unsigned char *)updateBuf)[i]);
-    }
-    fprintf(stderr,"\n");
-    */
-
     if (cl->useUdp) {
-        if (ublen > MAX_UPDATE_SIZE) {
-            RFB_LOG("Tried to send %d bytes over UDP, but too large! Killing the client. MaxUpdateSize=%d\n", ublen, MAX_UPDATE_SIZE);
-            rfbCloseSock(cl->sock);
-            return FALSE;
-        }
-
-        /* Create the sock_addr */
-        struct sockaddr_in client_addr;
-        memset(&client_addr, 0, sizeof(client_addr));
-        client_addr.sin_family = AF_INET;
-        client_addr.sin_addr.s_addr = inet_addr(cl->host);
-        client_addr.sin_port = htons(6829);
-
-        int sent_size = sendto(cl->udpSock, updateBuf, ublen, 0,
-            (struct sockaddr *)&client_addr, sizeof client_addr);
-
-        if (sent_size == -1) {
-            RFB_LOG("Error sending UDP message to %s\n", cl->host);
-            rfbCloseSock(cl->sock);
+        if (!rfbSendDatagram(cl, updateBuf, ublen))
             return FALSE;
-        }
-        if (sent_size != ublen) {
-            RFB_LOG("rfbSendUpdateBuf sent %d bytes, supposed to send %d\n", sent_size, ublen);
-            rfbCloseSock(cl->sock);
-            return FALSE;
-        }
-
-        RFB_LOG("Sent %d bytes over UDP, ublen=%d\n", sent_size, ublen);
         ublen = 0;
         return TRUE;
     }
@@ -1992,6 +2742,32 @@ rfbSendUpdateBuf(cl)
 }
 
 
+/*
+ * Queue len bytes from buf to be sent to the client's push address as one
+ * datagram.  The queue is sent when the frame is done, see pace.c.
+ */
+
+Bool
+rfbSendDatagram(cl, buf, len)
+    rfbClientPtr cl;
+    char *buf;
+    int len;
+{
+    int maxLen = cl->pushDatagramSize;
+
+    /* FEC parity is a header longer than the datagrams it covers. */
+    if (cl->enableFec)
+        maxLen += sz_rfbFecParityMsg;
+
+    if (len > maxLen) {
+        RFB_LOG("Tried to send %d bytes over UDP, but too large! Killing the client. MaxUpdateSize=%d\n", len, maxLen);
+        rfbCloseSock(cl->sock);
+        return FALSE;
+    }
+
+    return rfbPaceQueue(cl, buf, len);
+}
+
 
 /*
  * rfbSendSetColourMapEntries sends a SetColourMapEntries message to the
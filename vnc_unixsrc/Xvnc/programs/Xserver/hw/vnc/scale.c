@@ -0,0 +1,357 @@
+/*
+ * scale.c
+ *
+ * Sending a client the framebuffer reduced by an integer factor, for
+ * viewers that display the desktop at a fraction of its size.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * A scaled client gets its own copy of the framebuffer, reduced by
+ * cl->scale in both directions by averaging each scale x scale block of
+ * pixels.  The copy is kept in the server's pixel format, so the encoders
+ * and translation functions work on it unchanged; they find it through
+ * CLIENT_FB_MEMORY() and CLIENT_FB_STRIDE().
+ *
+ * Damage, retransmission and tile diffing all keep working in screen
+ * coordinates.  Only the region about to be encoded is mapped to reduced
+ * coordinates, by rfbScaleRegion(), which also refreshes that part of the
+ * copy.  Whatever comes back from the client (requested regions, pointer
+ * positions) and what is remembered about sent datagrams is mapped back
+ * with rfbUnscaleRegion() or by multiplying.  Cursor shapes and
+ * positions are sent reduced too, by cursor.c.  The right and bottom edges
+ * left over when the screen size is not a multiple of the scale are never
+ * sent.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+static void ScaleRect(rfbClientPtr cl, int x1, int y1, int x2, int y2);
+static void ScaleRect8(rfbClientPtr cl, int x1, int y1, int x2, int y2);
+static void ScaleRect16(rfbClientPtr cl, int x1, int y1, int x2, int y2);
+static void ScaleRect32(rfbClientPtr cl, int x1, int y1, int x2, int y2);
+
+
+/*
+ * Handle a SetScale message.  Scaling needs a true colour screen, to
+ * average pixels, and a client which accepts NewFBSize, to learn the new
+ * size; other requests are ignored.  The whole screen is sent again.
+ */
+
+void
+rfbSetClientScale(cl, scale)
+    rfbClientPtr cl;
+    int scale;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    RegionRec whole;
+    BoxRec box;
+    char *fb = NULL;
+    int w, h, stride = 0;
+
+    if (scale < 1)
+	scale = 1;
+    if (scale > rfbMaxScale)
+	scale = rfbMaxScale;
+    if (scale == cl->scale)
+	return;
+
+    if (scale > 1) {
+	if (!cl->enableNewFBSize || !rfbServerFormat.trueColour) {
+	    rfbLog("Client %s asked for scale %d but cannot be scaled\n",
+		   cl->host, scale);
+	    return;
+	}
+
+	w = rfbScreen.width / scale;
+	h = rfbScreen.height / scale;
+	if (w < 1 || h < 1)
+	    return;
+
+	stride = (w * (rfbScreen.bitsPerPixel / 8) + 3) & ~3;
+	fb = (char *)xalloc(stride * h);
+	if (fb == NULL) {
+	    rfbLog("rfbSetClientScale: out of memory\n");
+	    return;
+	}
+    }
+
+    rfbScaleFree(cl);
+
+    cl->scale = scale;
+    if (scale > 1) {
+	cl->scaledFb = fb;
+	cl->scaledFbStride = stride;
+	cl->scaledWidth = rfbScreen.width / scale;
+	cl->scaledHeight = rfbScreen.height / scale;
+    }
+    cl->newFBSizePending = TRUE;
+    /* The cursor shape is sent reduced by the scale too. */
+    if (cl->enableCursorShapeUpdates)
+	cl->cursorWasChanged = TRUE;
+
+    rfbLog("Sending client %s the screen reduced by %d\n", cl->host, scale);
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = rfbScreen.width;
+    box.y2 = rfbScreen.height;
+    REGION_INIT(pScreen, &whole, &box, 0);
+    REGION_UNION(pScreen, &cl->modifiedRegion, &cl->modifiedRegion, &whole);
+    REGION_EMPTY(pScreen, &cl->copyRegion);
+    cl->copyDX = 0;
+    cl->copyDY = 0;
+    rfbTileDiffInvalidate(cl, &whole);
+    REGION_UNINIT(pScreen, &whole);
+}
+
+
+/*
+ * Map region, in screen coordinates, to the reduced framebuffer of the
+ * client, and bring that part of the reduced framebuffer up to date.
+ * A reduced pixel is included if any of its source pixels is.
+ */
+
+void
+rfbScaleRegion(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    RegionPtr scaled;
+    BoxPtr pbox;
+    xRectangle *rects;
+    int s = cl->scale;
+    int i, n, x1, y1, x2, y2;
+    unsigned long area;
+
+    if (s <= 1 || !REGION_NOTEMPTY(pScreen, region))
+	return;
+
+    rects = (xRectangle *)xalloc(REGION_NUM_RECTS(region) *
+				 sizeof(xRectangle));
+    if (rects == NULL) {
+	rfbLog("rfbScaleRegion: out of memory\n");
+	REGION_EMPTY(pScreen, region);
+	return;
+    }
+
+    n = 0;
+    for (i = 0; i < REGION_NUM_RECTS(region); i++) {
+	pbox = &REGION_RECTS(region)[i];
+	x1 = pbox->x1 / s;
+	y1 = pbox->y1 / s;
+	x2 = (pbox->x2 + s - 1) / s;
+	y2 = (pbox->y2 + s - 1) / s;
+	if (x2 > cl->scaledWidth)
+	    x2 = cl->scaledWidth;
+	if (y2 > cl->scaledHeight)
+	    y2 = cl->scaledHeight;
+	if (x1 >= x2 || y1 >= y2)
+	    continue;
+
+	rects[n].x = x1;
+	rects[n].y = y1;
+	rects[n].width = x2 - x1;
+	rects[n].height = y2 - y1;
+	n++;
+    }
+
+    area = rfbRegionArea(region);
+
+    if (n == 0) {
+	REGION_EMPTY(pScreen, region);
+    } else {
+	scaled = RECTS_TO_REGION(pScreen, n, rects, CT_NONE);
+	REGION_COPY(pScreen, region, scaled);
+	REGION_DESTROY(pScreen, scaled);
+    }
+    xfree((char *)rects);
+
+    cl->pushStats.rfbScalePixelsSaved += area - rfbRegionArea(region);
+
+    for (i = 0; i < REGION_NUM_RECTS(region); i++) {
+	pbox = &REGION_RECTS(region)[i];
+	ScaleRect(cl, pbox->x1, pbox->y1, pbox->x2, pbox->y2);
+    }
+}
+
+
+/*
+ * Map region, in the client's reduced coordinates, back to the screen.
+ * Boxes reaching the right or bottom edge are extended over the pixels
+ * that the reduced framebuffer leaves out.
+ */
+
+void
+rfbUnscaleRegion(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    RegionRec tmpRegion, boxRegion;
+    BoxPtr pbox;
+    BoxRec box;
+    int s = cl->scale;
+    int i;
+
+    if (s <= 1 || !REGION_NOTEMPTY(pScreen, region))
+	return;
+
+    REGION_INIT(pScreen, &tmpRegion, NullBox, 0);
+    for (i = 0; i < REGION_NUM_RECTS(region); i++) {
+	pbox = &REGION_RECTS(region)[i];
+	box.x1 = pbox->x1 * s;
+	box.y1 = pbox->y1 * s;
+	box.x2 = (pbox->x2 >= cl->scaledWidth) ?
+	    rfbScreen.width : pbox->x2 * s;
+	box.y2 = (pbox->y2 >= cl->scaledHeight) ?
+	    rfbScreen.height : pbox->y2 * s;
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+	    continue;
+	REGION_INIT(pScreen, &boxRegion, &box, 0);
+	REGION_UNION(pScreen, &tmpRegion, &tmpRegion, &boxRegion);
+	REGION_UNINIT(pScreen, &boxRegion);
+    }
+    REGION_COPY(pScreen, region, &tmpRegion);
+    REGION_UNINIT(pScreen, &tmpRegion);
+}
+
+
+/*
+ * Send a NewFBSize rectangle giving the size of the framebuffer the
+ * client gets from now on.
+ */
+
+Bool
+rfbSendNewFBSize(cl)
+    rfbClientPtr cl;
+{
+    rfbFramebufferUpdateRectHeader rect;
+
+    if (ublen + sz_rfbFramebufferUpdateRectHeader > UPDATE_BUF_SIZE) {
+	if (!rfbSendUpdateBuf(cl))
+	    return FALSE;
+    }
+
+    rect.encoding = Swap32IfLE(rfbEncodingNewFBSize);
+    rect.r.x = 0;
+    rect.r.y = 0;
+    if (cl->scale > 1) {
+	rect.r.w = Swap16IfLE(cl->scaledWidth);
+	rect.r.h = Swap16IfLE(cl->scaledHeight);
+    } else {
+	rect.r.w = Swap16IfLE(rfbScreen.width);
+	rect.r.h = Swap16IfLE(rfbScreen.height);
+    }
+
+    memcpy(&updateBuf[ublen], (char *)&rect,
+	   sz_rfbFramebufferUpdateRectHeader);
+    ublen += sz_rfbFramebufferUpdateRectHeader;
+
+    cl->newFBSizePending = FALSE;
+    return TRUE;
+}
+
+
+void
+rfbScaleFree(cl)
+    rfbClientPtr cl;
+{
+    if (cl->scaledFb != NULL) {
+	xfree(cl->scaledFb);
+	cl->scaledFb = NULL;
+    }
+    cl->scale = 1;
+}
+
+
+/*
+ * Fill the reduced pixels x1 <= x < x2, y1 <= y < y2 of the client's
+ * framebuffer with the average of the screen pixels they cover.
+ */
+
+static void
+ScaleRect(cl, x1, y1, x2, y2)
+    rfbClientPtr cl;
+    int x1, y1, x2, y2;
+{
+    switch (rfbScreen.bitsPerPixel) {
+    case 8:
+	ScaleRect8(cl, x1, y1, x2, y2);
+	break;
+    case 16:
+	ScaleRect16(cl, x1, y1, x2, y2);
+	break;
+    case 32:
+	ScaleRect32(cl, x1, y1, x2, y2);
+	break;
+    }
+}
+
+#define DEFINE_SCALE_RECT(bpp)                                          \
+                                                                        \
+static void                                                             \
+ScaleRect##bpp(cl, x1, y1, x2, y2)                                      \
+    rfbClientPtr cl;                                                    \
+    int x1, y1, x2, y2;                                                 \
+{                                                                       \
+    int s = cl->scale;                                                  \
+    int n = s * s;                                                      \
+    int stride = rfbScreen.paddedWidthInBytes;                          \
+    int rShift = rfbServerFormat.redShift;                              \
+    int gShift = rfbServerFormat.greenShift;                            \
+    int bShift = rfbServerFormat.blueShift;                             \
+    CARD32 rMax = rfbServerFormat.redMax;                               \
+    CARD32 gMax = rfbServerFormat.greenMax;                             \
+    CARD32 bMax = rfbServerFormat.blueMax;                              \
+    CARD##bpp *dst, *src, pix;                                          \
+    CARD8 *block;                                                       \
+    CARD32 r, g, b;                                                     \
+    int x, y, dx, dy;                                                   \
+                                                                        \
+    for (y = y1; y < y2; y++) {                                         \
+        dst = (CARD##bpp *)(cl->scaledFb + y * cl->scaledFbStride) +    \
+            x1;                                                         \
+        block = (CARD8 *)rfbScreen.pfbMemory + y * s * stride +         \
+            x1 * s * (bpp / 8);                                         \
+                                                                        \
+        for (x = x1; x < x2; x++) {                                     \
+            r = g = b = 0;                                              \
+            for (dy = 0; dy < s; dy++) {                                \
+                src = (CARD##bpp *)(block + dy * stride);               \
+                for (dx = 0; dx < s; dx++) {                            \
+                    pix = src[dx];                                      \
+                    r += (pix >> rShift) & rMax;                        \
+                    g += (pix >> gShift) & gMax;                        \
+                    b += (pix >> bShift) & bMax;                        \
+                }                                                       \
+            }                                                           \
+            *dst++ = (CARD##bpp)(((r / n) << rShift) |                  \
+                                 ((g / n) << gShift) |                  \
+                                 ((b / n) << bShift));                  \
+            block += s * (bpp / 8);                                     \
+        }                                                               \
+    }                                                                   \
+}
+
+DEFINE_SCALE_RECT(8)
+DEFINE_SCALE_RECT(16)
+DEFINE_SCALE_RECT(32)
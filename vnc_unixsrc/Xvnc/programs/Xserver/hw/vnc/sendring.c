@@ -0,0 +1,360 @@
+/*
+ * sendring.c
+ *
+ * The per-client record of pushed datagrams that are waiting for an ack.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Datagrams that have been sent but not acknowledged live in a per-client
+ * ring indexed by seqNum modulo SR_RING_SIZE. Sequence numbers only grow,
+ * so the live entries always lie in [srRingFirst, srRingNext) and an ack
+ * finds its entry in one probe. Slots keep their RegionRec between uses
+ * so the region data is reallocated only when a datagram covers more
+ * rectangles than the slot has held before.
+ *
+ * Acks are handled here too, by rfbProcessSack(), which also keeps the
+ * client's RTT and throughput estimates.
+ *
+ * bench/srbench.c replays an ack trace through these functions,
+ * bench/clientcheck.c runs two clients through them side by side, and
+ * bench/mtucheck.c runs a path that turns into a path MTU black hole.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+static void srRecDelete(rfbClientPtr cl, SendRegionRec *srRec);
+
+
+void srRecFree(cl)
+	rfbClientPtr cl;
+{
+	int i;
+
+	if (cl->srRing == NULL)
+		return;
+
+	for (i = 0; i < SR_RING_SIZE; i++) {
+		REGION_UNINIT(pScreen, &(cl->srRing[i].region));
+	}
+	xfree(cl->srRing);
+
+	cl->srRing = NULL;
+	cl->srRecCount = 0;
+}
+
+static void srRecDelete(cl, srRec)
+	rfbClientPtr cl;
+	SendRegionRec * srRec;
+{
+	srRec->live = FALSE;
+	cl->srRecCount--;
+}
+
+/*
+ * Give up on the oldest entry: its region goes back into modifiedRegion
+ * and will be encoded again with the next frame.
+ */
+
+void srRecRequeue(cl, srRec)
+	rfbClientPtr cl;
+	SendRegionRec * srRec;
+{
+	rfbTileDiffInvalidate(cl, &(srRec->region));
+	REGION_UNION(pScreen, &(cl->modifiedRegion),
+				 &(cl->modifiedRegion), &(srRec->region));
+	srRecDelete(cl, srRec);
+	cl->pushStats.rfbPushDatagramsRequeued++;
+
+	/* Any path carries MIN_DATAGRAM_SIZE, see rfbPathMtuBlackhole(). */
+	if (srRec->time != 0 && srRec->numBytes > MIN_DATAGRAM_SIZE) {
+		if (cl->mtuLargeLost++ == 0)
+			cl->mtuLostSince = srRec->time;
+		if (cl->mtuLargeLost >= MTU_BLACKHOLE_LOSSES &&
+		    (long)(cl->mtuSmallAcked - cl->mtuLostSince) > 0)
+			rfbPathMtuBlackhole(cl);
+	}
+}
+
+Bool srRecAdd(cl, seqNum, regionPtr, numBytes, time)
+	rfbClientPtr cl;
+	CARD32 seqNum;
+	RegionRec * regionPtr;
+	int numBytes;
+	unsigned long time;
+{
+	SendRegionRec * srRec;
+	int i;
+
+	if (cl->srRing == NULL) {
+		cl->srRing = (SendRegionRec *)
+			xalloc(SR_RING_SIZE * sizeof(SendRegionRec));
+		if (cl->srRing == NULL) {
+			rfbLog("srRecAdd: out of memory\n");
+			return FALSE;
+		}
+		for (i = 0; i < SR_RING_SIZE; i++) {
+			cl->srRing[i].live = FALSE;
+			REGION_INIT(pScreen, &(cl->srRing[i].region), NullBox, 0);
+		}
+		cl->srRingFirst = cl->srRingNext = seqNum;
+		cl->srRecCount = 0;
+	}
+
+	/* Make room if the window would wrap onto a live slot. */
+	while (seqNum - cl->srRingFirst >= SR_RING_SIZE) {
+		srRec = SR_SLOT(cl, cl->srRingFirst);
+		if (srRec->live)
+			srRecRequeue(cl, srRec);
+		cl->srRingFirst++;
+	}
+
+	srRec = SR_SLOT(cl, seqNum);
+	srRec->live = TRUE;
+	srRec->seqNum = seqNum;
+	srRec->time = time;
+	srRec->numBytes = numBytes;
+	srRec->eventId = cl->lastEventId;
+	srRec->frameSeqNum = cl->frameSeqNumCounter;
+	REGION_COPY(pScreen, &(srRec->region), regionPtr);
+
+	cl->srRingNext = seqNum + 1;
+	cl->srRecCount++;
+	return TRUE;
+}
+
+/*
+ * Delete the entry for seqNum and return it, or NULL if it is not live.
+ * The entry stays readable until the slot is reused.
+ */
+
+SendRegionRec * srRecDeleteSeqNum(cl, seqNum)
+	rfbClientPtr cl;
+	CARD32 seqNum;
+{
+	SendRegionRec * srRec;
+
+	if (cl->srRing == NULL)
+		return NULL;
+
+	srRec = SR_SLOT(cl, seqNum);
+	if (srRec->live && srRec->seqNum == seqNum) {
+		srRecDelete(cl, srRec);
+		return srRec;
+	}
+
+	return NULL;
+}
+
+void srRecSetupRetransmit(cl)
+	rfbClientPtr cl;
+{
+	SendRegionRec * srRec;
+	unsigned long now = GetTimeInMillis();
+
+	if (cl->srRing == NULL)
+		return;
+
+	/* Entries are in send order, so stop at the first one still in time. */
+	while (cl->srRingFirst != cl->srRingNext) {
+		srRec = SR_SLOT(cl, cl->srRingFirst);
+
+		if (srRec->live) {
+			/* Time 0: still waiting in the send queue. */
+			if (srRec->time == 0 ||
+			    now - srRec->time <= cl->retransmitTimeout)
+				break;
+			srRecRequeue(cl, srRec);
+		}
+
+		cl->srRingFirst++;
+	}
+}
+
+void srRecSendRegion(cl, regionPtr)
+	rfbClientPtr cl;
+	RegionRec * regionPtr;
+{
+	SendRegionRec * srRec;
+	BoxPtr ext = REGION_EXTENTS(pScreen, regionPtr);
+	BoxPtr recExt;
+	CARD32 seq;
+
+	if (cl->srRing == NULL || !REGION_NOTEMPTY(pScreen, regionPtr))
+		return;
+
+	for (seq = cl->srRingFirst; seq != cl->srRingNext; seq++) {
+		srRec = SR_SLOT(cl, seq);
+		if (!srRec->live)
+			continue;
+
+		/* Skip the subtraction when the bounding boxes are disjoint. */
+		recExt = REGION_EXTENTS(pScreen, &(srRec->region));
+		if (recExt->x2 <= ext->x1 || ext->x2 <= recExt->x1 ||
+		    recExt->y2 <= ext->y1 || ext->y2 <= recExt->y1)
+			continue;
+
+		REGION_SUBTRACT(pScreen, &(srRec->region), &(srRec->region), regionPtr);
+		if (!REGION_NOTEMPTY(pScreen, &(srRec->region))) {
+			srRecDelete(cl, srRec);
+		}
+	}
+}
+
+/*
+ * Fold one round-trip sample into the smoothed RTT and derive the
+ * retransmit timeout from it.
+ */
+
+static void srRecUpdateRtt(cl, r)
+	rfbClientPtr cl;
+	double r;
+{
+	double diff;
+
+	if (cl->srtt == 0.0) {
+		cl->srtt = r;
+		cl->rttvar = r / 2.0;
+	} else {
+		diff = cl->srtt - r;
+		if (diff < 0) {
+			diff = -diff;
+		}
+
+		cl->rttvar = 0.75 * cl->rttvar + 0.25 * diff;
+		cl->srtt = 0.875 * cl->srtt + 0.125 * r;
+	}
+
+	cl->retransmitTimeout = (unsigned long) (cl->srtt + 2 * cl->rttvar);
+	if (cl->retransmitTimeout < 50) {
+		cl->retransmitTimeout = 50;
+	}
+}
+
+/*
+ * Update the receiving throughput estimate with numBytes acknowledged at
+ * time now. Only acks that continue the previous one are used, so idle
+ * gaps between frames do not count as slow delivery.
+ */
+
+static void srRecUpdateReceivingThroughput(cl, firstSeqNum, lastSeqNum,
+					   numBytes, now)
+	rfbClientPtr cl;
+	CARD32 firstSeqNum;
+	CARD32 lastSeqNum;
+	int numBytes;
+	unsigned long now;
+{
+	unsigned long diff;
+	double t;
+
+	if (cl->lastAckSeqNum + 1 == firstSeqNum) {
+		diff = now - cl->lastAckTime;
+		if (diff < 1) diff = 1;
+		t = 1000.0 * numBytes / diff;
+
+		if (cl->receivingThroughput == 0.0) {
+			cl->receivingThroughput = t;
+		} else {
+			cl->receivingThroughput =
+				0.875 * cl->receivingThroughput + 0.125 * t;
+		}
+	}
+
+	cl->lastAckSeqNum = lastSeqNum;
+	cl->lastAckTime = now;
+}
+
+/*
+ * Handle a FramebufferUpdateSack: retire every acknowledged datagram and
+ * take one RTT sample from the newest of them, less the time the client
+ * held the ack back.  The delivery rate is the data acknowledged between
+ * sending that datagram and now, over the time in between.
+ */
+
+void rfbProcessSack(cl, baseSeqNum, bitmap, ackDelay)
+	rfbClientPtr cl;
+	CARD32 baseSeqNum;
+	CARD32 bitmap;
+	unsigned int ackDelay;
+{
+	unsigned long now = GetTimeInMillis();
+	unsigned long newestSent = 0;
+	unsigned long delivered = 0, deliveredTime = 0;
+	SendRegionRec * srRec;
+	CARD32 seqNum, firstSeqNum = 0, lastSeqNum = 0;
+	int i, numBytes = 0;
+	double r, rate = 0.0;
+
+	cl->pushStats.rfbAckMessagesRcvd++;
+
+	for (i = 0; i < 32; i++) {
+		if (!(bitmap & ((CARD32)1 << i)))
+			continue;
+
+		seqNum = baseSeqNum + i;
+		srRec = srRecDeleteSeqNum(cl, seqNum);
+		if (srRec == NULL || srRec->time == 0)
+			continue;
+		if (srRec->numBytes > MIN_DATAGRAM_SIZE)
+			cl->mtuLargeLost = 0;
+		else
+			cl->mtuSmallAcked = srRec->time;
+		rfbTelemetryRecord(cl->sock, TLM_ACKED,
+				   Swap32IfLE(srRec->eventId), seqNum,
+				   srRec->frameSeqNum, srRec->numBytes);
+
+		/* The client has drawn the frame that answered an input
+		   event. */
+		if (cl->latencyAckPending &&
+		    (int)(seqNum - cl->latencySeqNum) >= 0) {
+			rfbRecordLog2(cl->rfbInputToAck, INPUT_LATENCY_BUCKETS,
+				      now - cl->latencyInputTime);
+			cl->latencyAckPending = FALSE;
+		}
+
+		if (newestSent == 0)
+			firstSeqNum = seqNum;
+		lastSeqNum = seqNum;
+		newestSent = srRec->time;
+		delivered = srRec->delivered;
+		deliveredTime = srRec->deliveredTime;
+		numBytes += srRec->numBytes;
+		cl->pushStats.rfbDatagramsAcked++;
+	}
+
+	if (newestSent == 0)
+		return;
+
+	r = (double) (now - newestSent) - (double) ackDelay;
+	if (r < 0.0)
+		r = 0.0;
+	srRecUpdateRtt(cl, r);
+
+	srRecUpdateReceivingThroughput(cl, firstSeqNum, lastSeqNum, numBytes,
+				       now);
+
+	cl->ccDelivered += numBytes;
+	if (now > deliveredTime)
+		rate = 1000.0 * (cl->ccDelivered - delivered) /
+			(now - deliveredTime);
+	cl->ccDeliveredTime = now;
+	cl->cc->ack(cl, now, r, rate);
+}
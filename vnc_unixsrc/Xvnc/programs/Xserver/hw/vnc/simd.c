@@ -0,0 +1,465 @@
+/*
+ * simd.c
+ *
+ * Vector versions of the pixel scans and conversions the encoders spend
+ * most of their time in, chosen at startup for the CPU the server runs
+ * on.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * Every kernel is called through a pointer which starts out at a plain C
+ * version, and rfbSimdInit() points it at an SSE2 or AVX2 version when
+ * the CPU has one.  The vector versions are compiled with GCC's target
+ * attribute, so the rest of the server needs no special flags and still
+ * runs on CPUs without them.  They give exactly the results of the C
+ * versions, which -nosimd keeps in use.
+ *
+ * rfbSpanLength returns how many pixels from the start of a row equal
+ * the given colour.  rfbSpanTwoColors returns how many pixels from the
+ * start are one of two colours, and adds the number of them that are the
+ * first colour to *n0Ptr.
+ *
+ * rfbShuffle32 rearranges the bytes of each of n 32-bit pixels.  shuffle
+ * holds 16 byte indices, the pattern for four pixels as _mm_shuffle_epi8
+ * takes it: byte i of the output is byte shuffle[i] of the input, or zero
+ * when shuffle[i] has its top bit set.  It is NULL when the CPU has no
+ * byte shuffle, since in C the translation tables do better.
+ *
+ * rfbGradientRow32 applies Tight's gradient filter to each byte of a row
+ * of n 32-bit pixels: a byte becomes itself minus its left neighbour plus
+ * its upper-left neighbour minus its upper neighbour, with that
+ * prediction clamped to 0..255.  upper holds the unfiltered row above,
+ * or zeros for the first row, and is left holding this row unfiltered.
+ * Results are ANDed with mask.
+ *
+ * rfbPixelDiffs32 sets diffs[i] for i < 7 to the byte-wise absolute
+ * difference between p[i+1] and p[i].  diffs must have room for 8.
+ */
+
+#include <stdio.h>
+
+/* Before rfb.h, whose X headers define max and min. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SIMD_X86
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#include "rfb.h"
+
+/* Set by -nosimd. */
+Bool rfbSimdDisable = FALSE;
+
+static int SpanLength8(CARD8 *p, int n, CARD32 color);
+static int SpanLength16(CARD16 *p, int n, CARD32 color);
+static int SpanLength32(CARD32 *p, int n, CARD32 color);
+static int SpanTwoColors8(CARD8 *p, int n, CARD32 c0, CARD32 c1,
+			  int *n0Ptr);
+static int SpanTwoColors16(CARD16 *p, int n, CARD32 c0, CARD32 c1,
+			   int *n0Ptr);
+static int SpanTwoColors32(CARD32 *p, int n, CARD32 c0, CARD32 c1,
+			   int *n0Ptr);
+static void GradientRow32(CARD32 *buf, CARD32 *upper, int n, CARD32 mask);
+static void PixelDiffs32(CARD32 *diffs, CARD32 *p);
+
+int (*rfbSpanLength8)(CARD8 *p, int n, CARD32 color) = SpanLength8;
+int (*rfbSpanLength16)(CARD16 *p, int n, CARD32 color) = SpanLength16;
+int (*rfbSpanLength32)(CARD32 *p, int n, CARD32 color) = SpanLength32;
+int (*rfbSpanTwoColors8)(CARD8 *p, int n, CARD32 c0, CARD32 c1,
+			 int *n0Ptr) = SpanTwoColors8;
+int (*rfbSpanTwoColors16)(CARD16 *p, int n, CARD32 c0, CARD32 c1,
+			  int *n0Ptr) = SpanTwoColors16;
+int (*rfbSpanTwoColors32)(CARD32 *p, int n, CARD32 c0, CARD32 c1,
+			  int *n0Ptr) = SpanTwoColors32;
+void (*rfbShuffle32)(CARD8 *dst, CARD8 *src, int n, CARD8 *shuffle) = NULL;
+void (*rfbGradientRow32)(CARD32 *buf, CARD32 *upper, int n,
+			 CARD32 mask) = GradientRow32;
+void (*rfbPixelDiffs32)(CARD32 *diffs, CARD32 *p) = PixelDiffs32;
+
+
+/*
+ * Plain C versions, also used for the tail of a row shorter than a
+ * vector.
+ */
+
+#define DEFINE_SPAN_FUNCTIONS(bpp)					\
+									\
+static int								\
+SpanLength##bpp(p, n, color)						\
+    CARD##bpp *p;							\
+    int n;								\
+    CARD32 color;							\
+{									\
+    int i;								\
+									\
+    for (i = 0; i < n && p[i] == (CARD##bpp)color; i++);		\
+    return i;								\
+}									\
+									\
+static int								\
+SpanTwoColors##bpp(p, n, c0, c1, n0Ptr)					\
+    CARD##bpp *p;							\
+    int n;								\
+    CARD32 c0, c1;							\
+    int *n0Ptr;								\
+{									\
+    int i, n0 = 0;							\
+									\
+    for (i = 0; i < n; i++) {						\
+	if (p[i] == (CARD##bpp)c0)					\
+	    n0++;							\
+	else if (p[i] != (CARD##bpp)c1)					\
+	    break;							\
+    }									\
+    *n0Ptr += n0;							\
+    return i;								\
+}
+
+DEFINE_SPAN_FUNCTIONS(8)
+DEFINE_SPAN_FUNCTIONS(16)
+DEFINE_SPAN_FUNCTIONS(32)
+
+/* left and upperLeft are the unfiltered pixels before buf[0] and upper[0]. */
+
+#define GRADIENT_BYTE(b)						\
+    prediction = (int)(left >> b & 0xFF) + (int)(up >> b & 0xFF) -	\
+	(int)(upperLeft >> b & 0xFF);					\
+    if (prediction < 0) {						\
+	prediction = 0;							\
+    } else if (prediction > 0xFF) {					\
+	prediction = 0xFF;						\
+    }									\
+    diff |= (((here >> b) - prediction) & 0xFF) << b
+
+static void
+GradientTail32(buf, upper, n, mask, left, upperLeft)
+    CARD32 *buf, *upper;
+    int n;
+    CARD32 mask, left, upperLeft;
+{
+    CARD32 here, up, diff;
+    int x, prediction;
+
+    for (x = 0; x < n; x++) {
+	here = buf[x];
+	up = upper[x];
+	diff = 0;
+	GRADIENT_BYTE(0);
+	GRADIENT_BYTE(8);
+	GRADIENT_BYTE(16);
+	GRADIENT_BYTE(24);
+	buf[x] = diff & mask;
+	upper[x] = here;
+	left = here;
+	upperLeft = up;
+    }
+}
+
+static void
+GradientRow32(buf, upper, n, mask)
+    CARD32 *buf, *upper;
+    int n;
+    CARD32 mask;
+{
+    GradientTail32(buf, upper, n, mask, 0, 0);
+}
+
+/* Byte by byte, since each byte stands alone. */
+
+static void
+PixelDiffs32(diffs, p)
+    CARD32 *diffs, *p;
+{
+    CARD8 *dst = (CARD8 *)diffs, *src = (CARD8 *)p;
+    int i;
+
+    for (i = 0; i < 7 * 4; i++)
+	dst[i] = (src[i+4] > src[i]) ? src[i+4] - src[i] : src[i] - src[i+4];
+}
+
+#ifdef SIMD_X86
+
+/*
+ * The vector versions compare a vector of pixels at a time and hand the
+ * first vector that does not match, and whatever is left over at the end
+ * of the row, to the C versions.  movemask gives a bit per byte, so a
+ * pixel of bpp bits counts bpp/8 bits in the mask.
+ */
+
+#define DEFINE_VECTOR_SPAN_FUNCTIONS(bpp, isa, target, vec, width, pfx)	\
+									\
+static int target							\
+SpanLength##bpp##isa(p, n, color)					\
+    CARD##bpp *p;							\
+    int n;								\
+    CARD32 color;							\
+{									\
+    vec c = pfx##_set1_epi##bpp((CARD##bpp)color);			\
+    unsigned int mask;							\
+    int i;								\
+									\
+    for (i = 0; i + width / bpp <= n; i += width / bpp) {		\
+	mask = (unsigned int)pfx##_movemask_epi8(			\
+	    pfx##_cmpeq_epi##bpp(pfx##_loadu_si##width((vec *)(p + i)), c)); \
+	if (mask != (unsigned int)((1ULL << (width / 8)) - 1))		\
+	    return i + __builtin_ctz(~mask) / (bpp / 8);		\
+    }									\
+    return i + SpanLength##bpp(p + i, n - i, color);			\
+}									\
+									\
+static int target							\
+SpanTwoColors##bpp##isa(p, n, c0, c1, n0Ptr)				\
+    CARD##bpp *p;							\
+    int n;								\
+    CARD32 c0, c1;							\
+    int *n0Ptr;								\
+{									\
+    vec v0 = pfx##_set1_epi##bpp((CARD##bpp)c0);			\
+    vec v1 = pfx##_set1_epi##bpp((CARD##bpp)c1);			\
+    vec v, e0;								\
+    unsigned int mask;							\
+    int i, n0 = 0;							\
+									\
+    for (i = 0; i + width / bpp <= n; i += width / bpp) {		\
+	v = pfx##_loadu_si##width((vec *)(p + i));			\
+	e0 = pfx##_cmpeq_epi##bpp(v, v0);				\
+	mask = (unsigned int)pfx##_movemask_epi8(			\
+	    pfx##_or_si##width(e0, pfx##_cmpeq_epi##bpp(v, v1)));	\
+	if (mask != (unsigned int)((1ULL << (width / 8)) - 1))		\
+	    break;							\
+	n0 += __builtin_popcount((unsigned int)pfx##_movemask_epi8(e0))	\
+	    / (bpp / 8);						\
+    }									\
+    *n0Ptr += n0;							\
+    return i + SpanTwoColors##bpp(p + i, n - i, c0, c1, n0Ptr);	\
+}
+
+DEFINE_VECTOR_SPAN_FUNCTIONS(8, Sse2, SSE2_TARGET, __m128i, 128, _mm)
+DEFINE_VECTOR_SPAN_FUNCTIONS(16, Sse2, SSE2_TARGET, __m128i, 128, _mm)
+DEFINE_VECTOR_SPAN_FUNCTIONS(32, Sse2, SSE2_TARGET, __m128i, 128, _mm)
+DEFINE_VECTOR_SPAN_FUNCTIONS(8, Avx2, AVX2_TARGET, __m256i, 256, _mm256)
+DEFINE_VECTOR_SPAN_FUNCTIONS(16, Avx2, AVX2_TARGET, __m256i, 256, _mm256)
+DEFINE_VECTOR_SPAN_FUNCTIONS(32, Avx2, AVX2_TARGET, __m256i, 256, _mm256)
+
+/* Only for the pixels left over at the end of a row. */
+
+static void
+Shuffle32(dst, src, n, shuffle)
+    CARD8 *dst, *src;
+    int n;
+    CARD8 *shuffle;
+{
+    int i, b;
+
+    for (i = 0; i < n; i++, src += 4, dst += 4) {
+	for (b = 0; b < 4; b++)
+	    dst[b] = (shuffle[b] & 0x80) ? 0 : src[shuffle[b]];
+    }
+}
+
+/*
+ * The four-pixel pattern repeats, so the same shuffle serves every
+ * 128-bit lane.
+ */
+
+static void SSSE3_TARGET
+Shuffle32Ssse3(dst, src, n, shuffle)
+    CARD8 *dst, *src;
+    int n;
+    CARD8 *shuffle;
+{
+    __m128i m = _mm_loadu_si128((__m128i *)shuffle);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+	_mm_storeu_si128((__m128i *)(dst + 4 * i),
+			 _mm_shuffle_epi8(
+			     _mm_loadu_si128((__m128i *)(src + 4 * i)), m));
+    }
+    Shuffle32(dst + 4 * i, src + 4 * i, n - i, shuffle);
+}
+
+static void AVX2_TARGET
+Shuffle32Avx2(dst, src, n, shuffle)
+    CARD8 *dst, *src;
+    int n;
+    CARD8 *shuffle;
+{
+    __m256i m = _mm256_broadcastsi128_si256(
+	_mm_loadu_si128((__m128i *)shuffle));
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+	_mm256_storeu_si256((__m256i *)(dst + 4 * i),
+			    _mm256_shuffle_epi8(
+				_mm256_loadu_si256((__m256i *)(src + 4 * i)),
+				m));
+    }
+    Shuffle32(dst + 4 * i, src + 4 * i, n - i, shuffle);
+}
+
+/*
+ * The gradient kernels shift the previous vector's last pixel in to get
+ * the left and upper-left neighbours, and work in 16 bits so that the
+ * unsigned saturation of packus does the clamping.
+ */
+
+static void SSE2_TARGET
+GradientRow32Sse2(buf, upper, n, mask)
+    CARD32 *buf, *upper;
+    int n;
+    CARD32 mask;
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i m = _mm_set1_epi32((int)mask);
+    __m128i v, u, l, ul, lo, hi;
+    __m128i prevV = zero, prevU = zero;
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+	v = _mm_loadu_si128((__m128i *)(buf + i));
+	u = _mm_loadu_si128((__m128i *)(upper + i));
+	l = _mm_or_si128(_mm_slli_si128(v, 4), _mm_srli_si128(prevV, 12));
+	ul = _mm_or_si128(_mm_slli_si128(u, 4), _mm_srli_si128(prevU, 12));
+	lo = _mm_sub_epi16(_mm_add_epi16(_mm_unpacklo_epi8(l, zero),
+					 _mm_unpacklo_epi8(u, zero)),
+			   _mm_unpacklo_epi8(ul, zero));
+	hi = _mm_sub_epi16(_mm_add_epi16(_mm_unpackhi_epi8(l, zero),
+					 _mm_unpackhi_epi8(u, zero)),
+			   _mm_unpackhi_epi8(ul, zero));
+	_mm_storeu_si128((__m128i *)(buf + i),
+			 _mm_and_si128(_mm_sub_epi8(v, _mm_packus_epi16(lo, hi)),
+				       m));
+	_mm_storeu_si128((__m128i *)(upper + i), v);
+	prevV = v;
+	prevU = u;
+    }
+    GradientTail32(buf + i, upper + i, n - i, mask,
+		   (CARD32)_mm_cvtsi128_si32(_mm_srli_si128(prevV, 12)),
+		   (CARD32)_mm_cvtsi128_si32(_mm_srli_si128(prevU, 12)));
+}
+
+/* unpack and packus work within 128-bit lanes, so they pair up again. */
+
+static void AVX2_TARGET
+GradientRow32Avx2(buf, upper, n, mask)
+    CARD32 *buf, *upper;
+    int n;
+    CARD32 mask;
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i m = _mm256_set1_epi32((int)mask);
+    __m256i v, u, l, ul, lo, hi;
+    __m256i prevV = zero, prevU = zero;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+	v = _mm256_loadu_si256((__m256i *)(buf + i));
+	u = _mm256_loadu_si256((__m256i *)(upper + i));
+	l = _mm256_alignr_epi8(v, _mm256_permute2x128_si256(prevV, v, 0x21),
+			       12);
+	ul = _mm256_alignr_epi8(u, _mm256_permute2x128_si256(prevU, u, 0x21),
+				12);
+	lo = _mm256_sub_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(l, zero),
+					       _mm256_unpacklo_epi8(u, zero)),
+			      _mm256_unpacklo_epi8(ul, zero));
+	hi = _mm256_sub_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(l, zero),
+					       _mm256_unpackhi_epi8(u, zero)),
+			      _mm256_unpackhi_epi8(ul, zero));
+	_mm256_storeu_si256((__m256i *)(buf + i),
+			    _mm256_and_si256(
+				_mm256_sub_epi8(v, _mm256_packus_epi16(lo, hi)),
+				m));
+	_mm256_storeu_si256((__m256i *)(upper + i), v);
+	prevV = v;
+	prevU = u;
+    }
+    GradientTail32(buf + i, upper + i, n - i, mask,
+		   (CARD32)_mm256_extract_epi32(prevV, 7),
+		   (CARD32)_mm256_extract_epi32(prevU, 7));
+}
+
+/* Absolute difference of unsigned bytes: one of the two is zero. */
+
+static void SSE2_TARGET
+PixelDiffs32Sse2(diffs, p)
+    CARD32 *diffs, *p;
+{
+    __m128i a = _mm_loadu_si128((__m128i *)p);
+    __m128i b = _mm_loadu_si128((__m128i *)(p + 4));
+    __m128i a1 = _mm_or_si128(_mm_srli_si128(a, 4), _mm_slli_si128(b, 12));
+    __m128i b1 = _mm_srli_si128(b, 4);
+
+    _mm_storeu_si128((__m128i *)diffs,
+		     _mm_or_si128(_mm_subs_epu8(a1, a), _mm_subs_epu8(a, a1)));
+    _mm_storeu_si128((__m128i *)(diffs + 4),
+		     _mm_or_si128(_mm_subs_epu8(b1, b), _mm_subs_epu8(b, b1)));
+}
+
+#endif /* SIMD_X86 */
+
+
+/*
+ * Pick the kernels for this CPU.  Called once at startup.
+ */
+
+void
+rfbSimdInit()
+{
+    if (rfbSimdDisable) {
+	rfbLog("Vector pixel kernels disabled\n");
+	return;
+    }
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+	rfbSpanLength8 = SpanLength8Avx2;
+	rfbSpanLength16 = SpanLength16Avx2;
+	rfbSpanLength32 = SpanLength32Avx2;
+	rfbSpanTwoColors8 = SpanTwoColors8Avx2;
+	rfbSpanTwoColors16 = SpanTwoColors16Avx2;
+	rfbSpanTwoColors32 = SpanTwoColors32Avx2;
+	rfbShuffle32 = Shuffle32Avx2;
+	rfbGradientRow32 = GradientRow32Avx2;
+	rfbPixelDiffs32 = PixelDiffs32Sse2;	/* no faster in AVX2 */
+	rfbLog("Using AVX2 pixel kernels\n");
+    } else if (__builtin_cpu_supports("sse2")) {
+	rfbSpanLength8 = SpanLength8Sse2;
+	rfbSpanLength16 = SpanLength16Sse2;
+	rfbSpanLength32 = SpanLength32Sse2;
+	rfbSpanTwoColors8 = SpanTwoColors8Sse2;
+	rfbSpanTwoColors16 = SpanTwoColors16Sse2;
+	rfbSpanTwoColors32 = SpanTwoColors32Sse2;
+	rfbGradientRow32 = GradientRow32Sse2;
+	rfbPixelDiffs32 = PixelDiffs32Sse2;
+	if (__builtin_cpu_supports("ssse3")) {
+	    rfbShuffle32 = Shuffle32Ssse3;
+	    rfbLog("Using SSSE3 pixel kernels\n");
+	} else {
+	    rfbLog("Using SSE2 pixel kernels\n");
+	}
+    }
+#endif
+}
@@ -48,6 +48,25 @@
 #include <fcntl.h>
 #include <errno.h>
 
+/*
+ * On Linux the RFB sockets and the push timer are watched through a single
+ * epoll descriptor, which is the only one registered with the X server's
+ * select() in WaitForSomething().  Elsewhere each socket is an enabled
+ * device of its own and the push timer is an X server timer.
+ */
+
+#ifndef USE_EPOLL
+#ifdef linux
+#define USE_EPOLL 1
+#else
+#define USE_EPOLL 0
+#endif
+#endif
+#if USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #ifndef USE_LIBWRAP
 #define USE_LIBWRAP 0
 #endif
@@ -74,9 +93,21 @@ int udpSock = -1;
 Bool udpSockConnected = FALSE;
 static struct sockaddr_in udpRemoteAddr;
 
-static fd_set allFds;
+static fd_set allFds;		/* RFB sockets being watched */
 static int maxFd = 0;
 
+#if USE_EPOLL
+#define MAX_EPOLL_EVENTS 32
+static int epollFd = -1;
+static int pushTimerFd = -1;
+#else
+static OsTimerPtr pushTimer = NULL;
+#endif
+
+static void WatchSock(int sock);
+static void UnwatchSock(int sock);
+static void SetDontFragment(int sock);
+
 
 /*
  * rfbInitSockets sets up the TCP and UDP sockets to listen for RFB
@@ -93,6 +124,22 @@ rfbInitSockets()
 
     done = TRUE;
 
+    FD_ZERO(&allFds);
+
+#if USE_EPOLL
+    if ((epollFd = epoll_create(16)) < 0) {
+	rfbLogPerror("epoll_create");
+	exit(1);
+    }
+    if ((pushTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+	rfbLogPerror("timerfd_create");
+	exit(1);
+    }
+    WatchSock(pushTimerFd);
+    FD_CLR(pushTimerFd, &allFds);	/* not a client */
+    AddEnabledDevice(epollFd);
+#endif
+
     if (inetdSock != -1) {
 	const int one = 1;
 
@@ -107,10 +154,7 @@ rfbInitSockets()
 	    exit(1);
 	}
 
-    	AddEnabledDevice(inetdSock);
-    	FD_ZERO(&allFds);
-    	FD_SET(inetdSock, &allFds);
-    	maxFd = inetdSock;
+	WatchSock(inetdSock);
 	return;
     }
 
@@ -125,11 +169,7 @@ rfbInitSockets()
 	exit(1);
     }
 
-    AddEnabledDevice(rfbListenSock);
-
-    FD_ZERO(&allFds);
-    FD_SET(rfbListenSock, &allFds);
-    maxFd = rfbListenSock;
+    WatchSock(rfbListenSock);
 
     rfbLog("Creating UDP socket for pushing out data\n");
     if ((udpPushSock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
@@ -137,6 +177,8 @@ rfbInitSockets()
         exit(1);
     }
 
+    SetDontFragment(udpPushSock);
+
     /*
     if (udpPort != 0) {
 	rfbLog("rfbInitSockets: listening for input on UDP port %d\n",udpPort);
@@ -145,13 +187,97 @@ rfbInitSockets()
 	    rfbLogPerror("ListenOnUDPPort");
 	    exit(1);
 	}
-	AddEnabledDevice(udpSock);
-	FD_SET(udpSock, &allFds);
-	maxFd = max(udpSock,maxFd);
+	WatchSock(udpSock);
     }
     */
 }
 
+
+/*
+ * Start and stop watching a socket for input.
+ */
+
+static void
+WatchSock(sock)
+    int sock;
+{
+#if USE_EPOLL
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &ev) < 0)
+	rfbLogPerror("WatchSock: epoll_ctl");
+#else
+    AddEnabledDevice(sock);
+#endif
+    FD_SET(sock, &allFds);
+    maxFd = max(sock,maxFd);
+}
+
+static void
+UnwatchSock(sock)
+    int sock;
+{
+    /* A closed descriptor leaves the epoll set by itself. */
+#if !USE_EPOLL
+    RemoveEnabledDevice(sock);
+#endif
+    FD_CLR(sock, &allFds);
+}
+
+
+#if !USE_EPOLL
+static CARD32
+PushTimerCallback(timer, time, arg)
+    OsTimerPtr timer;
+    CARD32 time;
+    pointer arg;
+{
+    /* Returning from WaitForSomething() is enough: rfbCheckFds() is
+       called next and pushes. */
+    return 0;
+}
+#endif
+
+
+/*
+ * Make sure rfbCheckFds() runs again in delay microseconds, to push the
+ * next frame or paced datagram.  Any earlier request is replaced.  A
+ * negative delay cancels it.
+ */
+
+void
+rfbSetPushTimer(delay)
+    long delay;
+{
+#if USE_EPOLL
+    struct itimerspec its;
+
+    if (pushTimerFd < 0)
+	return;
+
+    memset(&its, 0, sizeof(its));
+    if (delay >= 0) {
+	if (delay == 0)
+	    delay = 1;		/* zero would disarm the timer */
+	its.it_value.tv_sec = delay / 1000000;
+	its.it_value.tv_nsec = (delay % 1000000) * 1000;
+    }
+    if (timerfd_settime(pushTimerFd, 0, &its, NULL) < 0)
+	rfbLogPerror("rfbSetPushTimer: timerfd_settime");
+#else
+    if (delay < 0) {
+	TimerCancel(pushTimer);
+	return;
+    }
+    /* X server timers count whole milliseconds. */
+    pushTimer = TimerSet(pushTimer, 0, (CARD32)((delay + 999) / 1000),
+			 PushTimerCallback, NULL);
+#endif
+}
+
 /*
  * rfbCheckFds is called from ProcessInputEvents to check for input on the RFB
  * socket(s).  If there is input to process, the appropriate function in the
@@ -164,6 +290,11 @@ rfbCheckFds()
 {
     int nfds;
     fd_set fds;
+#if USE_EPOLL
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    char expirations[8];		/* timerfd expiry count */
+    int i;
+#endif
     struct timeval tv;
     struct sockaddr_in addr;
     int addrlen = sizeof(addr);
@@ -180,10 +311,29 @@ rfbCheckFds()
     /* SERVER PUSH. */
     rfbServerPush();
 
+#if USE_EPOLL
+    nfds = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, 0);
+    if (nfds < 0) {
+	if (errno != EINTR)
+	    rfbLogPerror("rfbCheckFds: epoll_wait");
+	return;
+    }
+    FD_ZERO(&fds);
+    for (i = 0; i < nfds; i++) {
+	if (events[i].data.fd == pushTimerFd) {
+	    /* The push itself was done by rfbServerPush() above. */
+	    read(pushTimerFd, expirations, sizeof(expirations));
+	    nfds--;
+	    continue;
+	}
+	FD_SET(events[i].data.fd, &fds);
+    }
+#else
     memcpy((char *)&fds, (char *)&allFds, sizeof(fd_set));
     tv.tv_sec = 0;
     tv.tv_usec = 0;
     nfds = select(maxFd + 1, &fds, NULL, NULL, &tv);
+#endif
     if (nfds == 0) {
 	return;
     }
@@ -227,9 +377,7 @@ rfbCheckFds()
 
 	rfbLog("Got connection from client %s\n", inet_ntoa(addr.sin_addr));
 
-	AddEnabledDevice(sock);
-	FD_SET(sock, &allFds);
-	maxFd = max(sock,maxFd);
+	WatchSock(sock);
 
 	rfbNewClientConnection(sock, udpPushSock);
 
@@ -295,8 +443,7 @@ rfbCloseSock(sock)
     int sock;
 {
     close(sock);
-    RemoveEnabledDevice(sock);
-    FD_CLR(sock, &allFds);
+    UnwatchSock(sock);
     rfbClientConnectionGone(sock);
     if (sock == inetdSock)
 	GiveUp(0);
@@ -369,9 +516,7 @@ rfbConnect(host, port)
 	return -1;
     }
 
-    AddEnabledDevice(sock);
-    FD_SET(sock, &allFds);
-    maxFd = max(sock,maxFd);
+    WatchSock(sock);
 
     return sock;
 }
@@ -591,3 +736,82 @@ ListenOnUDPPort(port)
 
     return sock;
 }
+
+
+/*
+ * rfbConnectPushSock returns a UDP socket connected to a client's push
+ * address, or -1.  Datagrams on it need no address, and the kernel looks
+ * up the route once rather than for every datagram.
+ */
+
+int
+rfbConnectPushSock(host, port)
+    char *host;
+    int port;
+{
+    struct sockaddr_in addr;
+    int sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(host);
+    addr.sin_port = htons(port);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+	rfbLogPerror("rfbConnectPushSock: socket");
+	return -1;
+    }
+    SetDontFragment(sock);
+
+    /* Connecting a UDP socket sends nothing, it only picks the route. */
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	rfbLogPerror("rfbConnectPushSock: connect");
+	close(sock);
+	return -1;
+    }
+
+    return sock;
+}
+
+
+/*
+ * rfbSocketMtu returns the MTU of the path a connected UDP socket sends
+ * on, as the kernel currently knows it: the outgoing interface's MTU,
+ * lowered by any ICMP "fragmentation needed" seen for the address.
+ * Returns 0 if this cannot be found out.
+ */
+
+int
+rfbSocketMtu(sock)
+    int sock;
+{
+#if defined(IP_MTU)
+    int mtu;
+    int len = sizeof(mtu);
+
+    if (getsockopt(sock, IPPROTO_IP, IP_MTU, (char *)&mtu, &len) < 0)
+	return 0;
+    return mtu;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * Never let the kernel fragment a pushed datagram: one too big for the
+ * path is refused with EMSGSIZE instead.
+ */
+
+static void
+SetDontFragment(sock)
+    int sock;
+{
+#if defined(IP_MTU_DISCOVER)
+    int pmtud = IP_PMTUDISC_DO;
+
+    if (setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER,
+		   (char *)&pmtud, sizeof(pmtud)) < 0)
+	rfbLogPerror("setsockopt IP_MTU_DISCOVER");
+#endif
+}
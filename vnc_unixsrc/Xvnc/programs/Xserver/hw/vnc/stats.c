@@ -24,13 +24,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include "rfb.h"
 
 static char* encNames[] = {
     "raw", "copyRect", "RRE", "[encoding 3]", "CoRRE", "hextile",
-    "zlib", "tight", "[encoding 8]", "[encoding 9]"
+    "zlib", "tight", "[encoding 8]", "[encoding 9]", "[encoding 10]",
+    "[encoding 11]", "[encoding 12]", "[encoding 13]", "[encoding 14]",
+    "[encoding 15]", "ZRLE"
 };
 
+static char* tightCodecNames[TIGHT_CODECS] = { "zlib", "lz4" };
+
+/* Serve /metrics over HTTP.  Set by -metrics. */
+Bool rfbMetrics = FALSE;
+
+static void rfbPrintLatency(char *what, int *buckets);
+static void MetricsPrintf(char *format, ...);
+static void MetricsHeader(char *name, char *type, char *help);
+
 
 void
 rfbResetStats(rfbClientPtr cl)
@@ -50,6 +62,18 @@ rfbResetStats(rfbClientPtr cl)
     cl->rfbRawBytesEquivalent = 0;
     cl->rfbKeyEventsRcvd = 0;
     cl->rfbPointerEventsRcvd = 0;
+    memset(&cl->pushStats, 0, sizeof(rfbPushStats));
+    for (i = 0; i < PUSH_LATENESS_BUCKETS; i++)
+	cl->rfbPushLateness[i] = 0;
+    for (i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+	cl->rfbInputToPush[i] = 0;
+	cl->rfbInputToAck[i] = 0;
+    }
+    for (i = 0; i < TIGHT_CODECS; i++) {
+	cl->rfbTightCodecBytesIn[i] = 0;
+	cl->rfbTightCodecBytesOut[i] = 0;
+	cl->rfbTightCodecSeconds[i] = 0.0;
+    }
 }
 
 void
@@ -80,6 +104,107 @@ rfbPrintStats(rfbClientPtr cl)
 	    cl->rfbFramebufferUpdateMessagesSent, totalRectanglesSent,
 	    totalBytesSent);
 
+    /* Encode passes per frame: 1.0 means every damaged pixel went through
+       the encoder exactly once. */
+    if (cl->pushStats.rfbPushFramesSent != 0)
+	rfbLog("  push frames %d, datagrams %d, encode passes per frame %f\n",
+		cl->pushStats.rfbPushFramesSent, cl->pushStats.rfbPushDatagramsSent,
+		(double)cl->pushStats.rfbPushPixelsEncoded
+		/ (double)cl->pushStats.rfbPushPixelsDamaged);
+
+    if (cl->pushStats.rfbPushFramesSent != 0)
+	rfbLog("    bytes per frame %lu, bytes per datagram %lu\n",
+		cl->pushStats.rfbPushBytesSent / cl->pushStats.rfbPushFramesSent,
+		cl->pushStats.rfbPushDatagramsSent != 0 ?
+		cl->pushStats.rfbPushBytesSent / cl->pushStats.rfbPushDatagramsSent : 0);
+
+    if (cl->pushStats.rfbAckMessagesRcvd != 0)
+	rfbLog("    ack messages received %d, datagrams acked %d\n",
+		cl->pushStats.rfbAckMessagesRcvd, cl->pushStats.rfbDatagramsAcked);
+
+    if (cl->pushStats.rfbPushDatagramsRequeued != 0)
+	rfbLog("    datagrams requeued after timeout, NACK or overflow %d\n",
+		cl->pushStats.rfbPushDatagramsRequeued);
+
+    if (cl->pushStats.rfbNackMessagesRcvd != 0)
+	rfbLog("    NACK messages received %d, datagrams nacked %d, "
+		"frames pushed early %d\n",
+		cl->pushStats.rfbNackMessagesRcvd, cl->pushStats.rfbPushDatagramsNacked,
+		cl->pushStats.rfbNackPushes);
+
+    /* Requeued datagrams were lost, or at least not acked in time. */
+    if (cl->pushStats.rfbPushDatagramsSent != 0)
+	rfbLog("    datagram size %d, path MTU %d, loss rate %.2f%%\n",
+		cl->pushDatagramSize, cl->pathMtu,
+		100.0 * cl->pushStats.rfbPushDatagramsRequeued
+		/ cl->pushStats.rfbPushDatagramsSent);
+
+    if (cl->pushStats.rfbPushDatagramsSent != 0)
+	rfbLog("    datagrams fragmented %d, refused by the path MTU %d, "
+		"path MTU black holes %d\n",
+		cl->pushStats.rfbPushDatagramsFragmented, cl->pushStats.rfbPushMtuDrops,
+		cl->pushStats.rfbPushMtuBlackholes);
+
+    if (cl->pushStats.rfbPushParitySent != 0 || cl->pushStats.rfbPushDatagramsRecovered != 0)
+	rfbLog("    parity datagrams %d (%lu bytes), datagrams recovered by "
+		"the client %d\n",
+		cl->pushStats.rfbPushParitySent, cl->pushStats.rfbPushParityBytesSent,
+		cl->pushStats.rfbPushDatagramsRecovered);
+
+    if (cl->pushStats.rfbPacedDatagramsSent != 0)
+	rfbLog("    datagrams paced %d, last pacing rate %.0f bytes/s\n",
+		cl->pushStats.rfbPacedDatagramsSent, cl->paceRate);
+
+    if (cl->pushStats.rfbPushFramesSent != 0)
+	rfbLog("    send system calls %d, %.2f per frame, %.1f datagrams "
+		"per call\n",
+		cl->pushStats.rfbPushSendCalls,
+		(double)cl->pushStats.rfbPushSendCalls / cl->pushStats.rfbPushFramesSent,
+		cl->pushStats.rfbPushSendCalls ? ((double)(cl->pushStats.rfbPushDatagramsSent +
+						 cl->pushStats.rfbPushParitySent) /
+					cl->pushStats.rfbPushSendCalls) : 0.0);
+
+    if (cl->pushStats.rfbPushFramesSent != 0) {
+	cl->cc->printStats(cl);
+	rfbLog("      frames cut short by the frame budget %d\n",
+		cl->pushStats.rfbPushFramesCut);
+    }
+
+    if (cl->pushStats.rfbPushFramesSent != 0)
+	rfbLog("    encode time per frame %.2f ms\n",
+		cl->pushStats.rfbPushEncodeMicros / 1000.0 / cl->pushStats.rfbPushFramesSent);
+
+    if (cl->pushStats.rfbPushTilesParallel != 0)
+	rfbLog("    tiles encoded by the thread pool %d\n",
+		cl->pushStats.rfbPushTilesParallel);
+
+    /* Buckets are 0, 1, 2-3, 4-7, ... ms after the frame was due. */
+    if (cl->pushStats.rfbPushFramesSent != 0)
+	rfbLog("    push lateness (ms) 0:%d 1:%d 2:%d 4:%d 8:%d 16:%d 32:%d "
+		"64+:%d\n",
+		cl->rfbPushLateness[0], cl->rfbPushLateness[1],
+		cl->rfbPushLateness[2], cl->rfbPushLateness[3],
+		cl->rfbPushLateness[4], cl->rfbPushLateness[5],
+		cl->rfbPushLateness[6], cl->rfbPushLateness[7]);
+
+    /* From an input event arriving to the first frame drawn after it being
+       pushed, and to the client acking that frame, which is about when it
+       shows up on the client's screen plus half a round trip. */
+    if (cl->pushStats.rfbPushFramesSent != 0) {
+	rfbLog("    frames pushed early to answer input %d\n",
+		cl->pushStats.rfbInputPushes);
+	rfbPrintLatency("input to push", cl->rfbInputToPush);
+	rfbPrintLatency("input to ack", cl->rfbInputToAck);
+    }
+
+    if (cl->pushStats.rfbTileDiffPixelsSaved != 0)
+	rfbLog("  pixels found unchanged by tile diffing %lu\n",
+		cl->pushStats.rfbTileDiffPixelsSaved);
+
+    if (cl->pushStats.rfbScalePixelsSaved != 0)
+	rfbLog("  pixels left out by scaling down %lu\n",
+		cl->pushStats.rfbScalePixelsSaved);
+
     if (cl->rfbLastRectMarkersSent != 0)
 	rfbLog("    LastRect markers %d, bytes %d\n",
 		cl->rfbLastRectMarkersSent, cl->rfbLastRectBytesSent);
@@ -98,6 +223,20 @@ rfbPrintStats(rfbClientPtr cl)
 		   encNames[i], cl->rfbRectanglesSent[i], cl->rfbBytesSent[i]);
     }
 
+    /* Only data big enough to be compressed is counted. */
+    for (i = 0; i < TIGHT_CODECS; i++) {
+	if (cl->rfbTightCodecBytesIn[i] != 0)
+	    rfbLog("      tight %s bytes %lu -> %lu, ratio %.2f, %.1f ms CPU, "
+		   "%.1f MB/s\n", tightCodecNames[i],
+		   cl->rfbTightCodecBytesIn[i], cl->rfbTightCodecBytesOut[i],
+		   (double)cl->rfbTightCodecBytesIn[i]
+		   / cl->rfbTightCodecBytesOut[i],
+		   cl->rfbTightCodecSeconds[i] * 1000.0,
+		   cl->rfbTightCodecSeconds[i] > 0.0 ?
+		   cl->rfbTightCodecBytesIn[i] / 1e6
+		   / cl->rfbTightCodecSeconds[i] : 0.0);
+    }
+
     if ((totalBytesSent - cl->rfbBytesSent[rfbEncodingCopyRect]) != 0) {
 	rfbLog("  raw bytes equivalent %d, compression ratio %f\n",
 		cl->rfbRawBytesEquivalent,
@@ -109,3 +248,203 @@ rfbPrintStats(rfbClientPtr cl)
 			   cl->rfbLastRectBytesSent));
     }
 }
+
+
+/*
+ * Print an INPUT_LATENCY_BUCKETS histogram filled by rfbRecordLog2(),
+ * leaving out empty buckets.
+ */
+
+static void
+rfbPrintLatency(char *what, int *buckets)
+{
+    char buf[256];
+    int i, len = 0, total = 0;
+
+    for (i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+	total += buckets[i];
+	if (buckets[i] == 0)
+	    continue;
+	len += sprintf(&buf[len], " %d%s:%d",
+		       (i == 0) ? 0 : 1 << (i - 1),
+		       (i == INPUT_LATENCY_BUCKETS - 1) ? "+" : "", buckets[i]);
+    }
+    if (total != 0)
+	rfbLog("      %s (ms)%s\n", what, buf);
+}
+
+
+/*
+ * Write the counters of all clients to sock in the Prometheus text format,
+ * for httpd.c to serve as /metrics when -metrics is given.  The counters
+ * are the ones above, which the push path keeps up to date anyway, so
+ * scraping costs the server nothing until it happens.
+ */
+
+static int metricsSock;
+static char metricsBuf[4096];
+static int metricsLen;
+
+#define CLIENT_METRIC(name, fmt, value)				\
+    for (cl = rfbClientHead; cl; cl = cl->next)			\
+	MetricsPrintf("%s{client=\"%s\",sock=\"%d\"} " fmt "\n",	\
+		      name, cl->host, cl->sock, value)
+
+void
+rfbSendMetrics(int sock)
+{
+    rfbClientPtr cl;
+    int i, nClients = 0;
+
+    metricsSock = sock;
+    metricsLen = 0;
+
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	nClients++;
+    MetricsHeader("rfb_clients", "gauge", "Connected clients.");
+    MetricsPrintf("rfb_clients %d\n", nClients);
+
+    MetricsHeader("rfb_rects_sent_total", "counter",
+		  "Rectangles sent, by encoding.");
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	for (i = 0; i < MAX_ENCODINGS; i++)
+	    if (cl->rfbRectanglesSent[i] != 0)
+		MetricsPrintf("rfb_rects_sent_total{client=\"%s\",sock=\"%d\","
+			      "encoding=\"%s\"} %d\n", cl->host, cl->sock,
+			      encNames[i], cl->rfbRectanglesSent[i]);
+
+    MetricsHeader("rfb_bytes_sent_total", "counter",
+		  "Bytes of rectangles sent, by encoding.");
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	for (i = 0; i < MAX_ENCODINGS; i++)
+	    if (cl->rfbRectanglesSent[i] != 0)
+		MetricsPrintf("rfb_bytes_sent_total{client=\"%s\",sock=\"%d\","
+			      "encoding=\"%s\"} %d\n", cl->host, cl->sock,
+			      encNames[i], cl->rfbBytesSent[i]);
+
+    MetricsHeader("rfb_tight_codec_bytes_in_total", "counter",
+		  "Bytes given to tight encoding's compressor, by codec.");
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	for (i = 0; i < TIGHT_CODECS; i++)
+	    if (cl->rfbTightCodecBytesIn[i] != 0)
+		MetricsPrintf("rfb_tight_codec_bytes_in_total{client=\"%s\","
+			      "sock=\"%d\",codec=\"%s\"} %lu\n", cl->host,
+			      cl->sock, tightCodecNames[i],
+			      cl->rfbTightCodecBytesIn[i]);
+
+    MetricsHeader("rfb_tight_codec_bytes_out_total", "counter",
+		  "Bytes out of tight encoding's compressor, by codec.");
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	for (i = 0; i < TIGHT_CODECS; i++)
+	    if (cl->rfbTightCodecBytesIn[i] != 0)
+		MetricsPrintf("rfb_tight_codec_bytes_out_total{client=\"%s\","
+			      "sock=\"%d\",codec=\"%s\"} %lu\n", cl->host,
+			      cl->sock, tightCodecNames[i],
+			      cl->rfbTightCodecBytesOut[i]);
+
+    MetricsHeader("rfb_tight_codec_cpu_seconds_total", "counter",
+		  "CPU time spent in tight encoding's compressor, by codec.");
+    for (cl = rfbClientHead; cl; cl = cl->next)
+	for (i = 0; i < TIGHT_CODECS; i++)
+	    if (cl->rfbTightCodecBytesIn[i] != 0)
+		MetricsPrintf("rfb_tight_codec_cpu_seconds_total{client=\"%s\","
+			      "sock=\"%d\",codec=\"%s\"} %.6f\n", cl->host,
+			      cl->sock, tightCodecNames[i],
+			      cl->rfbTightCodecSeconds[i]);
+
+    MetricsHeader("rfb_push_frames_total", "counter", "Frames pushed.");
+    CLIENT_METRIC("rfb_push_frames_total", "%d", cl->pushStats.rfbPushFramesSent);
+
+    MetricsHeader("rfb_push_datagrams_sent_total", "counter",
+		  "Update datagrams pushed, parity not included.");
+    CLIENT_METRIC("rfb_push_datagrams_sent_total", "%d",
+		  cl->pushStats.rfbPushDatagramsSent);
+
+    MetricsHeader("rfb_push_bytes_sent_total", "counter",
+		  "Bytes of update datagrams pushed.");
+    CLIENT_METRIC("rfb_push_bytes_sent_total", "%lu", cl->pushStats.rfbPushBytesSent);
+
+    MetricsHeader("rfb_push_datagrams_acked_total", "counter",
+		  "Pushed datagrams acknowledged by the client.");
+    CLIENT_METRIC("rfb_push_datagrams_acked_total", "%d",
+		  cl->pushStats.rfbDatagramsAcked);
+
+    MetricsHeader("rfb_push_datagrams_retransmitted_total", "counter",
+		  "Pushed datagrams whose area was sent again after a "
+		  "timeout, NACK or overflow.");
+    CLIENT_METRIC("rfb_push_datagrams_retransmitted_total", "%d",
+		  cl->pushStats.rfbPushDatagramsRequeued);
+
+    MetricsHeader("rfb_push_datagrams_recovered_total", "counter",
+		  "Pushed datagrams the client rebuilt from parity.");
+    CLIENT_METRIC("rfb_push_datagrams_recovered_total", "%d",
+		  cl->pushStats.rfbPushDatagramsRecovered);
+
+    MetricsHeader("rfb_srtt_seconds", "gauge", "Smoothed round trip time.");
+    CLIENT_METRIC("rfb_srtt_seconds", "%.6f", cl->srtt / 1000.0);
+
+    MetricsHeader("rfb_rttvar_seconds", "gauge", "Round trip time variation.");
+    CLIENT_METRIC("rfb_rttvar_seconds", "%.6f", cl->rttvar / 1000.0);
+
+    MetricsHeader("rfb_sending_throughput_bytes_per_second", "gauge",
+		  "Bytes per second pushed, smoothed.");
+    CLIENT_METRIC("rfb_sending_throughput_bytes_per_second", "%.0f",
+		  cl->sendingThroughput);
+
+    MetricsHeader("rfb_receiving_throughput_bytes_per_second", "gauge",
+		  "Bytes per second the client acknowledged, smoothed.");
+    CLIENT_METRIC("rfb_receiving_throughput_bytes_per_second", "%.0f",
+		  cl->receivingThroughput);
+
+    MetricsHeader("rfb_quality_level", "gauge",
+		  "JPEG quality level of tight encoding, -1 for none.");
+    CLIENT_METRIC("rfb_quality_level", "%d", cl->tightQualityLevel);
+
+    MetricsHeader("rfb_push_interval_seconds", "gauge",
+		  "Time between pushed frames.");
+    CLIENT_METRIC("rfb_push_interval_seconds", "%.3f",
+		  cl->serverPushInterval / 1000.0);
+
+    MetricsHeader("rfb_encode_seconds_total", "counter",
+		  "Time spent encoding pushed frames.");
+    CLIENT_METRIC("rfb_encode_seconds_total", "%.6f",
+		  cl->pushStats.rfbPushEncodeMicros / 1000000.0);
+
+    if (metricsLen != 0)
+	WriteExact(metricsSock, metricsBuf, metricsLen);
+}
+
+
+static void
+MetricsHeader(char *name, char *type, char *help)
+{
+    MetricsPrintf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+/*
+ * Append a line to the metrics, writing them out when the buffer fills.
+ */
+
+static void
+MetricsPrintf(char *format, ...)
+{
+    char line[512];
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0)
+	return;
+    if (len >= sizeof(line))
+	len = sizeof(line) - 1;
+
+    if (metricsLen + len > sizeof(metricsBuf)) {
+	WriteExact(metricsSock, metricsBuf, metricsLen);
+	metricsLen = 0;
+    }
+    memcpy(&metricsBuf[metricsLen], line, len);
+    metricsLen += len;
+}
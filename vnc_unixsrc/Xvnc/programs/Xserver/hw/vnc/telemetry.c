@@ -0,0 +1,255 @@
+/*
+ * telemetry.c
+ *
+ * Timing records for input events and pushed datagrams, kept in memory
+ * and written to a file by a thread of their own.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * The dispatch thread appends records to a ring, and the telemetry thread
+ * writes them out once a second, so the push path does no I/O and takes
+ * no lock.  The ring has one producer and one consumer, each owning one
+ * index; a barrier orders a record before the index that publishes it.
+ * When the writer falls behind, new records are dropped and counted
+ * rather than holding up the server.
+ *
+ * The file is the magic "RFBTLM1\n" followed by TLM_RECORD_SIZE byte
+ * records in network byte order:
+ *
+ *	CARD8 kind, source (0 server, 1 viewer); CARD16 client;
+ *	CARD32 eventId, seqNum, frameSeqNum;
+ *	CARD32 timeHigh, timeLow (microseconds since the epoch);
+ *	CARD32 bytes, pad;
+ *
+ * client tells the server's clients apart: it is the client's socket,
+ * which is unique among the clients connected at any one time.  The
+ * viewer writes the same format with client 0, and analysis/telemetry.py
+ * reads both.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "rfb.h"
+
+/* File to write to, NULL for no telemetry.  Set by -telemetry. */
+char *rfbTelemetryFile = NULL;
+
+#define TLM_RING_SIZE 65536	/* records, must be a power of two */
+#define TLM_RECORD_SIZE 32
+#define TLM_FLUSH_INTERVAL 1000	/* ms */
+#define TLM_MAGIC "RFBTLM1\n"
+
+typedef struct {
+    CARD16 client;
+    CARD8 kind;
+    CARD32 eventId;
+    CARD32 seqNum;
+    CARD32 frameSeqNum;
+    unsigned long long time;
+    CARD32 bytes;
+} TelemetryRec;
+
+static TelemetryRec ring[TLM_RING_SIZE];
+static volatile unsigned int ringHead = 0;	/* written by the producer */
+static volatile unsigned int ringTail = 0;	/* written by the consumer */
+static unsigned long recordsDropped = 0;
+
+static Bool started = FALSE;
+static volatile Bool stopping = FALSE;
+static FILE *file = NULL;
+static pthread_t thread;
+
+static Bool TelemetryStart(void);
+static void *TelemetryThread(void *arg);
+static void TelemetryFlush(void);
+static void PutCard32(unsigned char *buf, CARD32 value);
+
+
+/*
+ * Append a record.  Only the dispatch thread may call this.  client is
+ * the client's socket.  seqNum and frameSeqNum are 0xffffffff for records
+ * that have none.
+ */
+
+void
+rfbTelemetryRecord(client, kind, eventId, seqNum, frameSeqNum, bytes)
+    int client;
+    int kind;
+    CARD32 eventId;
+    CARD32 seqNum;
+    CARD32 frameSeqNum;
+    int bytes;
+{
+    unsigned int head = ringHead;
+    TelemetryRec *rec;
+    struct timeval tv;
+
+    if (rfbTelemetryFile == NULL)
+	return;
+    if (!started && !TelemetryStart())
+	return;
+
+    if (head - ringTail >= TLM_RING_SIZE) {
+	recordsDropped++;
+	return;
+    }
+
+    gettimeofday(&tv, NULL);
+    rec = &ring[head & (TLM_RING_SIZE - 1)];
+    rec->client = (CARD16)client;
+    rec->kind = kind;
+    rec->eventId = eventId;
+    rec->seqNum = seqNum;
+    rec->frameSeqNum = frameSeqNum;
+    rec->time = (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+    rec->bytes = bytes;
+
+    __sync_synchronize();
+    ringHead = head + 1;
+}
+
+
+/*
+ * Write out what is left and stop the telemetry thread.  Called when the
+ * server exits.
+ */
+
+void
+rfbTelemetryClose()
+{
+    if (!started || file == NULL)
+	return;
+
+    stopping = TRUE;
+    pthread_join(thread, NULL);
+    fclose(file);
+    file = NULL;
+
+    if (recordsDropped != 0)
+	rfbLog("Telemetry: %lu records dropped, the writer fell behind\n",
+	       recordsDropped);
+}
+
+
+/*
+ * Open the file and start the thread, the first time a record comes in.
+ * On failure telemetry is turned off.
+ */
+
+static Bool
+TelemetryStart()
+{
+    sigset_t all, saved;
+    int err;
+
+    started = TRUE;
+
+    file = fopen(rfbTelemetryFile, "wb");
+    if (file == NULL) {
+	rfbLogPerror(rfbTelemetryFile);
+	rfbTelemetryFile = NULL;
+	return FALSE;
+    }
+    fwrite(TLM_MAGIC, 1, strlen(TLM_MAGIC), file);
+
+    /* Signals are for the dispatch thread, see rfbEncoderPoolSize(). */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    err = pthread_create(&thread, NULL, TelemetryThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (err != 0) {
+	rfbLogPerror("TelemetryStart: pthread_create");
+	fclose(file);
+	file = NULL;
+	rfbTelemetryFile = NULL;
+	return FALSE;
+    }
+
+    rfbLog("Writing telemetry to %s\n", rfbTelemetryFile);
+    return TRUE;
+}
+
+
+static void *
+TelemetryThread(arg)
+    void *arg;
+{
+    int waited;
+
+    while (!stopping) {
+	for (waited = 0; waited < TLM_FLUSH_INTERVAL && !stopping;
+	     waited += 100)
+	    usleep(100000);
+	TelemetryFlush();
+    }
+    return NULL;
+}
+
+
+/*
+ * Write the records published so far and hand their slots back.
+ */
+
+static void
+TelemetryFlush()
+{
+    unsigned char buf[TLM_RECORD_SIZE];
+    unsigned int tail = ringTail;
+    unsigned int head = ringHead;
+    TelemetryRec *rec;
+
+    __sync_synchronize();
+
+    for (; tail != head; tail++) {
+	rec = &ring[tail & (TLM_RING_SIZE - 1)];
+	memset(buf, 0, sizeof(buf));
+	buf[0] = rec->kind;
+	buf[1] = 0;			/* source: server */
+	buf[2] = (unsigned char)(rec->client >> 8);
+	buf[3] = (unsigned char)rec->client;
+	PutCard32(&buf[4], rec->eventId);
+	PutCard32(&buf[8], rec->seqNum);
+	PutCard32(&buf[12], rec->frameSeqNum);
+	PutCard32(&buf[16], (CARD32)(rec->time >> 32));
+	PutCard32(&buf[20], (CARD32)rec->time);
+	PutCard32(&buf[24], rec->bytes);
+	fwrite(buf, 1, sizeof(buf), file);
+    }
+    fflush(file);
+
+    __sync_synchronize();
+    ringTail = tail;
+}
+
+
+static void
+PutCard32(buf, value)
+    unsigned char *buf;
+    CARD32 value;
+{
+    buf[0] = (unsigned char)(value >> 24);
+    buf[1] = (unsigned char)(value >> 16);
+    buf[2] = (unsigned char)(value >> 8);
+    buf[3] = (unsigned char)value;
+}
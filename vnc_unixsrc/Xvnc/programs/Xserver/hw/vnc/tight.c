@@ -25,6 +25,7 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 #include "rfb.h"
 #include <jpeglib.h>
 
@@ -40,9 +41,6 @@
 /* May be set to TRUE with "-lazytight" Xvnc option. */
 Bool rfbTightDisableGradient = FALSE;
 
-/* This variable is set on every rfbSendRectEncodingTight() call. */
-static Bool usePixelFormat24;
-
 
 /* Compression level stuff. The following array contains various
    encoder parameters for each of 10 compression levels (0..9).
@@ -70,9 +68,6 @@ static TIGHT_CONF tightConf[10] = {
     { 65536, 2048,  32,  8192, 9, 9, 9, 6, 200, 500,  96, 80,   200,   500 }
 };
 
-static int compressLevel;
-static int qualityLevel;
-
 /* Stuff dealing with palettes. */
 
 typedef struct COLOR_LIST_s {
@@ -92,106 +87,205 @@ typedef struct PALETTE_s {
     COLOR_LIST list[256];
 } PALETTE;
 
-static int paletteNumColors, paletteMaxColors;
-static CARD32 monoBackground, monoForeground;
-static PALETTE palette;
+/*
+ * Everything the encoder changes while it works on a rectangle lives in
+ * an rfbTightContext, so several rectangles can be encoded at the same
+ * time as long as each uses its own context. Encoded data is appended to
+ * the context's output buffer rather than written into updateBuf.
+ */
+
+typedef struct rfbTightContext {
+    struct jpeg_destination_mgr jpegDstManager; /* must be first, see
+                                                   JpegInitDestination() */
+    Bool jpegError;
+    int jpegDstDataLen;
+
+    /* JPEG compressor, kept from one rectangle to the next. */
+    struct jpeg_compress_struct jpegCinfo;
+    struct jpeg_error_mgr jpegErr;
+    Bool jpegInited;
+    JSAMPROW *jpegRows;         /* rows handed to the compressor */
+    int jpegRowsSize;
+    CARD8 *jpegRowBuf;          /* one row converted to RGB */
+    int jpegRowBufSize;
+
+    /* These are set on every rectangle. */
+    char *fbMemory;             /* framebuffer the client is sent */
+    int fbStride;
+    int compressLevel;
+    int qualityLevel;
+    Bool usePixelFormat24;
+
+    int paletteNumColors, paletteMaxColors;
+    CARD32 monoBackground, monoForeground;
+    PALETTE palette;
+
+    /* Pointers to dynamically-allocated buffers. */
+
+    int tightBeforeBufSize;
+    char *tightBeforeBuf;
+
+    int tightAfterBufSize;
+    char *tightAfterBuf;
 
-/* Pointers to dynamically-allocated buffers. */
+    int *prevRowBuf;
 
-static int tightBeforeBufSize = 0;
-static char *tightBeforeBuf = NULL;
+    /* zlib streams in use: either the client's own (which persist across
+       updates) or the context's private set. */
+    z_stream *zsStruct;
+    Bool *zsActive;
+    int *zsLevel;
+    Bool resetStreams;          /* reset all streams before next use */
 
-static int tightAfterBufSize = 0;
-static char *tightAfterBuf = NULL;
+    z_stream ownZsStruct[4];
+    Bool ownZsActive[4];
+    int ownZsLevel[4];
 
-static int *prevRowBuf = NULL;
+    /* LZ4 in place of zlib, see TightSetupRect(). */
+    Bool useLz4;
+    int *lz4Table;
+
+    /* Compressor statistics, see rfbTightAddCodecStats(). */
+    unsigned long codecBytesIn[TIGHT_CODECS];
+    unsigned long codecBytesOut[TIGHT_CODECS];
+    double codecSeconds[TIGHT_CODECS];
+
+    /* Encoded output. */
+    char *outBuf;
+    int outLen, outSize;
+    int nRects;
+} rfbTightContext;
+
+/* Context used by rfbSendRectEncodingTight(). */
+static rfbTightContextPtr defaultContext = NULL;
 
 
 /* Prototypes for static functions. */
 
-static void FindBestSolidArea (int x, int y, int w, int h,
+static void FindBestSolidArea (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 colorValue, int *w_ptr, int *h_ptr);
-static void ExtendSolidArea   (int x, int y, int w, int h,
+static void ExtendSolidArea   (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 colorValue,
                                int *x_ptr, int *y_ptr, int *w_ptr, int *h_ptr);
-static Bool CheckSolidTile    (int x, int y, int w, int h,
+static Bool CheckSolidTile    (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 *colorPtr, Bool needSameColor);
-static Bool CheckSolidTile8   (int x, int y, int w, int h,
+static Bool CheckSolidTile8   (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 *colorPtr, Bool needSameColor);
-static Bool CheckSolidTile16  (int x, int y, int w, int h,
+static Bool CheckSolidTile16  (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 *colorPtr, Bool needSameColor);
-static Bool CheckSolidTile32  (int x, int y, int w, int h,
+static Bool CheckSolidTile32  (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h,
                                CARD32 *colorPtr, Bool needSameColor);
 
-static Bool SendRectSimple    (rfbClientPtr cl, int x, int y, int w, int h);
-static Bool SendSubrect       (rfbClientPtr cl, int x, int y, int w, int h);
-static Bool SendTightHeader   (rfbClientPtr cl, int x, int y, int w, int h);
-
-static Bool SendSolidRect     (rfbClientPtr cl);
-static Bool SendMonoRect      (rfbClientPtr cl, int w, int h);
-static Bool SendIndexedRect   (rfbClientPtr cl, int w, int h);
-static Bool SendFullColorRect (rfbClientPtr cl, int w, int h);
-static Bool SendGradientRect  (rfbClientPtr cl, int w, int h);
-
-static Bool CompressData(rfbClientPtr cl, int streamId, int dataLen,
+static Bool TightReserve(rfbTightContextPtr ctx, int len);
+static void TightSetupRect(rfbTightContextPtr ctx, rfbClientPtr cl);
+static Bool TightEncodeRect(rfbTightContextPtr ctx, rfbClientPtr cl,
+                            int x, int y, int w, int h);
+
+static Bool SendRectSimple    (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int x, int y, int w, int h);
+static Bool SendSubrect       (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int x, int y, int w, int h);
+static Bool SendTightHeader   (rfbTightContextPtr ctx,
+                               int x, int y, int w, int h);
+
+static Bool SendSolidRect     (rfbTightContextPtr ctx, rfbClientPtr cl);
+static Bool SendMonoRect      (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int w, int h);
+static Bool SendIndexedRect   (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int w, int h);
+static Bool SendFullColorRect (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int w, int h);
+static Bool SendGradientRect  (rfbTightContextPtr ctx, rfbClientPtr cl,
+                               int w, int h);
+
+static void TightPutBasicHeader(rfbTightContextPtr ctx, int streamId,
+                                int filterId);
+static Bool CompressData(rfbTightContextPtr ctx, int streamId, int dataLen,
                          int zlibLevel, int zlibStrategy);
-static Bool SendCompressedData(rfbClientPtr cl, int compressedLen);
+static int CompressZlib(rfbTightContextPtr ctx, int streamId, int dataLen,
+                        int zlibLevel, int zlibStrategy);
+static int CompressLz4(rfbTightContextPtr ctx, int dataLen);
+static double ThreadCpuSeconds(void);
+static Bool SendCompressedData(rfbTightContextPtr ctx, int compressedLen);
 
-static void FillPalette8(int count);
-static void FillPalette16(int count);
-static void FillPalette32(int count);
+static void FillPalette8(rfbTightContextPtr ctx, int count);
+static void FillPalette16(rfbTightContextPtr ctx, int count);
+static void FillPalette32(rfbTightContextPtr ctx, int count);
 
-static void PaletteReset(void);
-static int PaletteInsert(CARD32 rgb, int numPixels, int bpp);
+static void PaletteReset(rfbTightContextPtr ctx);
+static int PaletteInsert(rfbTightContextPtr ctx, CARD32 rgb, int numPixels,
+                         int bpp);
 
 static void Pack24(char *buf, rfbPixelFormat *fmt, int count);
 
-static void EncodeIndexedRect16(CARD8 *buf, int count);
-static void EncodeIndexedRect32(CARD8 *buf, int count);
-
-static void EncodeMonoRect8(CARD8 *buf, int w, int h);
-static void EncodeMonoRect16(CARD8 *buf, int w, int h);
-static void EncodeMonoRect32(CARD8 *buf, int w, int h);
-
-static void FilterGradient24(char *buf, rfbPixelFormat *fmt, int w, int h);
-static void FilterGradient16(CARD16 *buf, rfbPixelFormat *fmt, int w, int h);
-static void FilterGradient32(CARD32 *buf, rfbPixelFormat *fmt, int w, int h);
-
-static int DetectSmoothImage(rfbPixelFormat *fmt, int w, int h);
-static unsigned long DetectSmoothImage24(rfbPixelFormat *fmt, int w, int h);
-static unsigned long DetectSmoothImage16(rfbPixelFormat *fmt, int w, int h);
-static unsigned long DetectSmoothImage32(rfbPixelFormat *fmt, int w, int h);
-
-static Bool SendJpegRect(rfbClientPtr cl, int x, int y, int w, int h,
-                         int quality);
-static void PrepareRowForJpeg(CARD8 *dst, int x, int y, int count);
-static void PrepareRowForJpeg24(CARD8 *dst, int x, int y, int count);
-static void PrepareRowForJpeg16(CARD8 *dst, int x, int y, int count);
-static void PrepareRowForJpeg32(CARD8 *dst, int x, int y, int count);
+static void EncodeIndexedRect16(rfbTightContextPtr ctx, CARD8 *buf, int count);
+static void EncodeIndexedRect32(rfbTightContextPtr ctx, CARD8 *buf, int count);
+
+static void EncodeMonoRect8(rfbTightContextPtr ctx, CARD8 *buf, int w, int h);
+static void EncodeMonoRect16(rfbTightContextPtr ctx, CARD8 *buf, int w, int h);
+static void EncodeMonoRect32(rfbTightContextPtr ctx, CARD8 *buf, int w, int h);
+
+static void FilterGradient24(rfbTightContextPtr ctx, char *buf,
+                             rfbPixelFormat *fmt, int w, int h);
+static void FilterGradient16(rfbTightContextPtr ctx, CARD16 *buf,
+                             rfbPixelFormat *fmt, int w, int h);
+static void FilterGradientBytes32(rfbTightContextPtr ctx, CARD32 *buf,
+                                  rfbPixelFormat *fmt, CARD32 mask,
+                                  int w, int h);
+static void FilterGradient32(rfbTightContextPtr ctx, CARD32 *buf,
+                             rfbPixelFormat *fmt, int w, int h);
+
+static int DetectSmoothImage(rfbTightContextPtr ctx, rfbPixelFormat *fmt,
+                             int w, int h);
+static unsigned long DetectSmoothImage24(rfbTightContextPtr ctx,
+                                         rfbPixelFormat *fmt, int w, int h);
+static unsigned long DetectSmoothImage16(rfbTightContextPtr ctx,
+                                         rfbPixelFormat *fmt, int w, int h);
+static unsigned long DetectSmoothImage32(rfbTightContextPtr ctx,
+                                         rfbPixelFormat *fmt, int w, int h);
+static unsigned long DetectSmoothImageBytes32(rfbTightContextPtr ctx,
+                                              rfbPixelFormat *fmt,
+                                              int w, int h);
+static unsigned long SmoothImageError(int *diffStat, int pixelCount);
+static CARD32 ByteChannelMask(rfbPixelFormat *fmt);
+
+static J_COLOR_SPACE JpegFramebufferColorSpace(void);
+static int JpegByteOf(int shift);
+static Bool SendJpegRect(rfbTightContextPtr ctx, rfbClientPtr cl,
+                         int x, int y, int w, int h, int quality);
+static void PrepareRowForJpeg(rfbTightContextPtr ctx, CARD8 *dst,
+                              int x, int y, int count);
+static void PrepareRowForJpeg24(rfbTightContextPtr ctx, CARD8 *dst,
+                                int x, int y, int count);
+static void PrepareRowForJpeg16(rfbTightContextPtr ctx, CARD8 *dst,
+                                int x, int y, int count);
+static void PrepareRowForJpeg32(rfbTightContextPtr ctx, CARD8 *dst,
+                                int x, int y, int count);
 
 static void JpegInitDestination(j_compress_ptr cinfo);
 static boolean JpegEmptyOutputBuffer(j_compress_ptr cinfo);
 static void JpegTermDestination(j_compress_ptr cinfo);
-static void JpegSetDstManager(j_compress_ptr cinfo);
+static void JpegSetDstManager(rfbTightContextPtr ctx, j_compress_ptr cinfo);
 
-char compControl(cl)
-    rfbClientPtr cl;
+static char compControl(ctx)
+    rfbTightContextPtr ctx;
 {
-	if (handleNewBlock == 1) {
-		if (cl->zsActive[0] == TRUE) {
-			deflateReset (&(cl->zsStruct[0]));
-		}
-		if (cl->zsActive[1] == TRUE) {
-			deflateReset (&(cl->zsStruct[1]));
-		}
-		if (cl->zsActive[2] == TRUE) {
-			deflateReset (&(cl->zsStruct[2]));
-		}
-		if (cl->zsActive[3] == TRUE) {
-			deflateReset (&(cl->zsStruct[3]));
+	int i;
+
+	if (ctx->resetStreams) {
+		for (i = 0; i < 4; i++) {
+			if (ctx->zsActive[i] == TRUE) {
+				deflateReset (&(ctx->zsStruct[i]));
+			}
 		}
 
-		handleNewBlock = 0;
+		ctx->resetStreams = FALSE;
 		return rfbTightStreamReset;
 	}
 
@@ -228,39 +322,254 @@ rfbNumCodedRectsTight(cl, x, y, w, h)
     }
 }
 
+rfbTightContextPtr
+rfbTightNewContext()
+{
+    rfbTightContextPtr ctx;
+    int i;
+
+    ctx = (rfbTightContextPtr)xalloc(sizeof(rfbTightContext));
+    if (ctx == NULL)
+        return NULL;
+    memset(ctx, 0, sizeof(rfbTightContext));
+
+    for (i = 0; i < 4; i++)
+        ctx->ownZsActive[i] = FALSE;
+    ctx->zsStruct = ctx->ownZsStruct;
+    ctx->zsActive = ctx->ownZsActive;
+    ctx->zsLevel = ctx->ownZsLevel;
+
+    return ctx;
+}
+
+void
+rfbTightFreeContext(ctx)
+    rfbTightContextPtr ctx;
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (ctx->ownZsActive[i])
+            deflateEnd(&ctx->ownZsStruct[i]);
+    }
+    if (ctx->tightBeforeBuf != NULL)
+        xfree(ctx->tightBeforeBuf);
+    if (ctx->tightAfterBuf != NULL)
+        xfree(ctx->tightAfterBuf);
+    if (ctx->prevRowBuf != NULL)
+        xfree((char *)ctx->prevRowBuf);
+    if (ctx->outBuf != NULL)
+        xfree(ctx->outBuf);
+    if (ctx->lz4Table != NULL)
+        xfree((char *)ctx->lz4Table);
+    if (ctx->jpegInited)
+        jpeg_destroy_compress(&ctx->jpegCinfo);
+    if (ctx->jpegRows != NULL)
+        xfree((char *)ctx->jpegRows);
+    if (ctx->jpegRowBuf != NULL)
+        xfree((char *)ctx->jpegRowBuf);
+    xfree((char *)ctx);
+}
+
+/*
+ * Encode a rectangle onto the client's update stream, using the client's
+ * own zlib streams.
+ */
+
 Bool
 rfbSendRectEncodingTight(cl, x, y, w, h)
     rfbClientPtr cl;
     int x, y, w, h;
 {
-    int nMaxRows;
-    CARD32 colorValue;
-    int dx, dy, dw, dh;
-    int x_best, y_best, w_best, h_best;
-    char *fbptr;
+    rfbTightContextPtr ctx;
+    int i, portionLen;
+
+    if (defaultContext == NULL) {
+        defaultContext = rfbTightNewContext();
+        if (defaultContext == NULL)
+            return FALSE;
+    }
+    ctx = defaultContext;
+
+    ctx->zsStruct = cl->zsStruct;
+    ctx->zsActive = cl->zsActive;
+    ctx->zsLevel = cl->zsLevel;
+    ctx->resetStreams = handleNewBlock;
+    handleNewBlock = 0;
+    ctx->outLen = 0;
+    ctx->nRects = 0;
+
+    TightSetupRect(ctx, cl);
+    if (!TightEncodeRect(ctx, cl, x, y, w, h))
+        return FALSE;
+
+    cl->rfbRectanglesSent[rfbEncodingTight] += ctx->nRects;
+    cl->rfbBytesSent[rfbEncodingTight] += ctx->outLen;
+    rfbTightAddCodecStats(ctx, cl);
+
+    for (i = 0; i < ctx->outLen; i += portionLen) {
+        if (ublen == UPDATE_BUF_SIZE) {
+            if (!rfbSendUpdateBuf(cl) || ublen == UPDATE_BUF_SIZE)
+                return FALSE;
+        }
+        portionLen = ctx->outLen - i;
+        if (portionLen > UPDATE_BUF_SIZE - ublen)
+            portionLen = UPDATE_BUF_SIZE - ublen;
+        memcpy(&updateBuf[ublen], &ctx->outBuf[i], portionLen);
+        ublen += portionLen;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Encode a rectangle so that it can be decoded on its own: all zlib
+ * streams are reset before the first one is used. The encoded data is
+ * appended to the context's output buffer; rfbTightContextOutput() gives
+ * access to it. This may run on any thread as long as the framebuffer
+ * and the client's pixel format do not change meanwhile.
+ */
+
+Bool
+rfbTightEncodeTile(ctx, cl, x, y, w, h)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    ctx->zsStruct = ctx->ownZsStruct;
+    ctx->zsActive = ctx->ownZsActive;
+    ctx->zsLevel = ctx->ownZsLevel;
+    ctx->resetStreams = TRUE;
+
+    TightSetupRect(ctx, cl);
+    return TightEncodeRect(ctx, cl, x, y, w, h);
+}
+
+/*
+ * Return the output accumulated since the last rfbTightResetOutput() call
+ * and the number of rectangles it holds.
+ */
+
+char *
+rfbTightContextOutput(ctx, len, nRects)
+    rfbTightContextPtr ctx;
+    int *len;
+    int *nRects;
+{
+    *len = ctx->outLen;
+    *nRects = ctx->nRects;
+    return ctx->outBuf;
+}
+
+void
+rfbTightResetOutput(ctx)
+    rfbTightContextPtr ctx;
+{
+    ctx->outLen = 0;
+    ctx->nRects = 0;
+}
+
+/*
+ * Move the context's compressor statistics to the client's.  Contexts
+ * used on worker threads are only handed over once the threads are done.
+ */
+
+void
+rfbTightAddCodecStats(ctx, cl)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+{
+    int i;
+
+    for (i = 0; i < TIGHT_CODECS; i++) {
+        cl->rfbTightCodecBytesIn[i] += ctx->codecBytesIn[i];
+        cl->rfbTightCodecBytesOut[i] += ctx->codecBytesOut[i];
+        cl->rfbTightCodecSeconds[i] += ctx->codecSeconds[i];
+        ctx->codecBytesIn[i] = 0;
+        ctx->codecBytesOut[i] = 0;
+        ctx->codecSeconds[i] = 0.0;
+    }
+}
+
+/*
+ * Make room for len more bytes of output.
+ */
 
-    compressLevel = cl->tightCompressLevel;
-    qualityLevel = cl->tightQualityLevel;
+static Bool
+TightReserve(ctx, len)
+    rfbTightContextPtr ctx;
+    int len;
+{
+    int newSize;
+    char *newBuf;
+
+    if (ctx->outLen + len <= ctx->outSize)
+        return TRUE;
+
+    newSize = (ctx->outSize != 0) ? ctx->outSize : UPDATE_BUF_SIZE / 16;
+    while (newSize < ctx->outLen + len)
+        newSize *= 2;
+
+    if (ctx->outBuf == NULL)
+        newBuf = (char *)xalloc(newSize);
+    else
+        newBuf = (char *)xrealloc(ctx->outBuf, newSize);
+    if (newBuf == NULL)
+        return FALSE;
+
+    ctx->outBuf = newBuf;
+    ctx->outSize = newSize;
+    return TRUE;
+}
+
+static void
+TightSetupRect(ctx, cl)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+{
+    ctx->fbMemory = CLIENT_FB_MEMORY(cl);
+    ctx->fbStride = CLIENT_FB_STRIDE(cl);
+    ctx->compressLevel = cl->tightCompressLevel;
+    ctx->qualityLevel = cl->tightQualityLevel;
+
+    /* Pushed tiles start with fresh zlib streams, so deflate's history
+       buys them little, and level 0 asks for speed over size.  Use LZ4
+       for both if the client can take it. */
+    ctx->useLz4 = (cl->enableTightLz4 &&
+                   (cl->packing || ctx->compressLevel == 0));
 
     if ( cl->format.depth == 24 && cl->format.redMax == 0xFF &&
          cl->format.greenMax == 0xFF && cl->format.blueMax == 0xFF ) {
-        usePixelFormat24 = TRUE;
+        ctx->usePixelFormat24 = TRUE;
     } else {
-        usePixelFormat24 = FALSE;
+        ctx->usePixelFormat24 = FALSE;
     }
+}
+
+static Bool
+TightEncodeRect(ctx, cl, x, y, w, h)
+    rfbTightContextPtr ctx;
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    int nMaxRows;
+    CARD32 colorValue;
+    int dx, dy, dw, dh;
+    int x_best, y_best, w_best, h_best;
+    char *fbptr;
 
     if (!cl->enableLastRectEncoding || w * h < MIN_SPLIT_RECT_SIZE)
-        return SendRectSimple(cl, x, y, w, h);
+        return SendRectSimple(ctx, cl, x, y, w, h);
 
     /* Make sure we can write at least one pixel into tightBeforeBuf. */
 
-    if (tightBeforeBufSize < 4) {
-        tightBeforeBufSize = 4;
-        if (tightBeforeBuf == NULL)
-            tightBeforeBuf = (char *)xalloc(tightBeforeBufSize);
+    if (ctx->tightBeforeBufSize < 4) {
+        ctx->tightBeforeBufSize = 4;
+        if (ctx->tightBeforeBuf == NULL)
+            ctx->tightBeforeBuf = (char *)xalloc(ctx->tightBeforeBufSize);
         else
-            tightBeforeBuf = (char *)xrealloc(tightBeforeBuf,
-                                              tightBeforeBufSize);
+            ctx->tightBeforeBuf = (char *)xrealloc(ctx->tightBeforeBuf,
+                                                   ctx->tightBeforeBufSize);
     }
 
     /* Calculate maximum number of rows in one non-solid rectangle. */
@@ -268,8 +577,8 @@ rfbSendRectEncodingTight(cl, x, y, w, h)
     {
         int maxRectSize, maxRectWidth, nMaxWidth;
 
-        maxRectSize = tightConf[compressLevel].maxRectSize;
-        maxRectWidth = tightConf[compressLevel].maxRectWidth;
+        maxRectSize = tightConf[ctx->compressLevel].maxRectSize;
+        maxRectWidth = tightConf[ctx->compressLevel].maxRectWidth;
         nMaxWidth = (w > maxRectWidth) ? maxRectWidth : w;
         nMaxRows = maxRectSize / nMaxWidth;
     }
@@ -281,7 +590,7 @@ rfbSendRectEncodingTight(cl, x, y, w, h)
         /* If a rectangle becomes too large, send its upper part now. */
 
         if (dy - y >= nMaxRows) {
-            if (!SendRectSimple(cl, x, y, w, nMaxRows))
+            if (!SendRectSimple(ctx, cl, x, y, w, nMaxRows))
                 return 0;
             y += nMaxRows;
             h -= nMaxRows;
@@ -295,11 +604,11 @@ rfbSendRectEncodingTight(cl, x, y, w, h)
             dw = (dx + MAX_SPLIT_TILE_SIZE <= x + w) ?
                 MAX_SPLIT_TILE_SIZE : (x + w - dx);
 
-            if (CheckSolidTile(dx, dy, dw, dh, &colorValue, FALSE)) {
+            if (CheckSolidTile(ctx, dx, dy, dw, dh, &colorValue, FALSE)) {
 
                 /* Get dimensions of solid-color area. */
 
-                FindBestSolidArea(dx, dy, w - (dx - x), h - (dy - y),
+                FindBestSolidArea(ctx, dx, dy, w - (dx - x), h - (dy - y),
 				  colorValue, &w_best, &h_best);
 
                 /* Make sure a solid rectangle is large enough
@@ -312,44 +621,43 @@ rfbSendRectEncodingTight(cl, x, y, w, h)
                 /* Try to extend solid rectangle to maximum size. */
 
                 x_best = dx; y_best = dy;
-                ExtendSolidArea(x, y, w, h, colorValue,
+                ExtendSolidArea(ctx, x, y, w, h, colorValue,
                                 &x_best, &y_best, &w_best, &h_best);
 
                 /* Send rectangles at top and left to solid-color area. */
 
                 if ( y_best != y &&
-                     !SendRectSimple(cl, x, y, w, y_best-y) )
+                     !SendRectSimple(ctx, cl, x, y, w, y_best-y) )
                     return FALSE;
                 if ( x_best != x &&
-                     !rfbSendRectEncodingTight(cl, x, y_best,
-                                               x_best-x, h_best) )
+                     !TightEncodeRect(ctx, cl, x, y_best,
+                                      x_best-x, h_best) )
                     return FALSE;
 
                 /* Send solid-color rectangle. */
 
-                if (!SendTightHeader(cl, x_best, y_best, w_best, h_best))
+                if (!SendTightHeader(ctx, x_best, y_best, w_best, h_best))
                     return FALSE;
 
-                fbptr = (rfbScreen.pfbMemory +
-                         (rfbScreen.paddedWidthInBytes * y_best) +
+                fbptr = (ctx->fbMemory + (ctx->fbStride * y_best) +
                          (x_best * (rfbScreen.bitsPerPixel / 8)));
 
                 (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
-                                   &cl->format, fbptr, tightBeforeBuf,
-                                   rfbScreen.paddedWidthInBytes, 1, 1);
+                                   &cl->format, fbptr, ctx->tightBeforeBuf,
+                                   ctx->fbStride, 1, 1);
 
-                if (!SendSolidRect(cl))
+                if (!SendSolidRect(ctx, cl))
                     return FALSE;
 
                 /* Send remaining rectangles (at right and bottom). */
 
                 if ( x_best + w_best != x + w &&
-                     !rfbSendRectEncodingTight(cl, x_best+w_best, y_best,
-                                               w-(x_best-x)-w_best, h_best) )
+                     !TightEncodeRect(ctx, cl, x_best+w_best, y_best,
+                                      w-(x_best-x)-w_best, h_best) )
                     return FALSE;
                 if ( y_best + h_best != y + h &&
-                     !rfbSendRectEncodingTight(cl, x, y_best+h_best,
-                                               w, h-(y_best-y)-h_best) )
+                     !TightEncodeRect(ctx, cl, x, y_best+h_best,
+                                      w, h-(y_best-y)-h_best) )
                     return FALSE;
 
                 /* Return after all recursive calls are done. */
@@ -363,11 +671,12 @@ rfbSendRectEncodingTight(cl, x, y, w, h)
 
     /* No suitable solid-color rectangles found. */
 
-    return SendRectSimple(cl, x, y, w, h);
+    return SendRectSimple(ctx, cl, x, y, w, h);
 }
 
 static void
-FindBestSolidArea(x, y, w, h, colorValue, w_ptr, h_ptr)
+FindBestSolidArea(ctx, x, y, w, h, colorValue, w_ptr, h_ptr)
+    rfbTightContextPtr ctx;
     int x, y, w, h;
     CARD32 colorValue;
     int *w_ptr, *h_ptr;
@@ -385,13 +694,13 @@ FindBestSolidArea(x, y, w, h, colorValue, w_ptr, h_ptr)
         dw = (w_prev > MAX_SPLIT_TILE_SIZE) ?
             MAX_SPLIT_TILE_SIZE : w_prev;
 
-        if (!CheckSolidTile(x, dy, dw, dh, &colorValue, TRUE))
+        if (!CheckSolidTile(ctx, x, dy, dw, dh, &colorValue, TRUE))
             break;
 
         for (dx = x + dw; dx < x + w_prev;) {
             dw = (dx + MAX_SPLIT_TILE_SIZE <= x + w_prev) ?
                 MAX_SPLIT_TILE_SIZE : (x + w_prev - dx);
-            if (!CheckSolidTile(dx, dy, dw, dh, &colorValue, TRUE))
+            if (!CheckSolidTile(ctx, dx, dy, dw, dh, &colorValue, TRUE))
                 break;
 	    dx += dw;
         }
@@ -408,7 +717,8 @@ FindBestSolidArea(x, y, w, h, colorValue, w_ptr, h_ptr)
 }
 
 static void
-ExtendSolidArea(x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
+ExtendSolidArea(ctx, x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
+    rfbTightContextPtr ctx;
     int x, y, w, h;
     CARD32 colorValue;
     int *x_ptr, *y_ptr, *w_ptr, *h_ptr;
@@ -417,7 +727,7 @@ ExtendSolidArea(x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
 
     /* Try to extend the area upwards. */
     for ( cy = *y_ptr - 1;
-          cy >= y && CheckSolidTile(*x_ptr, cy, *w_ptr, 1, &colorValue, TRUE);
+          cy >= y && CheckSolidTile(ctx, *x_ptr, cy, *w_ptr, 1, &colorValue, TRUE);
           cy-- );
     *h_ptr += *y_ptr - (cy + 1);
     *y_ptr = cy + 1;
@@ -425,13 +735,13 @@ ExtendSolidArea(x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
     /* ... downwards. */
     for ( cy = *y_ptr + *h_ptr;
           cy < y + h &&
-              CheckSolidTile(*x_ptr, cy, *w_ptr, 1, &colorValue, TRUE);
+              CheckSolidTile(ctx, *x_ptr, cy, *w_ptr, 1, &colorValue, TRUE);
           cy++ );
     *h_ptr += cy - (*y_ptr + *h_ptr);
 
     /* ... to the left. */
     for ( cx = *x_ptr - 1;
-          cx >= x && CheckSolidTile(cx, *y_ptr, 1, *h_ptr, &colorValue, TRUE);
+          cx >= x && CheckSolidTile(ctx, cx, *y_ptr, 1, *h_ptr, &colorValue, TRUE);
           cx-- );
     *w_ptr += *x_ptr - (cx + 1);
     *x_ptr = cx + 1;
@@ -439,7 +749,7 @@ ExtendSolidArea(x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
     /* ... to the right. */
     for ( cx = *x_ptr + *w_ptr;
           cx < x + w &&
-              CheckSolidTile(cx, *y_ptr, 1, *h_ptr, &colorValue, TRUE);
+              CheckSolidTile(ctx, cx, *y_ptr, 1, *h_ptr, &colorValue, TRUE);
           cx++ );
     *w_ptr += cx - (*x_ptr + *w_ptr);
 }
@@ -452,46 +762,48 @@ ExtendSolidArea(x, y, w, h, colorValue, x_ptr, y_ptr, w_ptr, h_ptr)
  */
 
 static Bool
-CheckSolidTile(x, y, w, h, colorPtr, needSameColor)
+CheckSolidTile(ctx, x, y, w, h, colorPtr, needSameColor)
+    rfbTightContextPtr ctx;
     int x, y, w, h;
     CARD32 *colorPtr;
     Bool needSameColor;
 {
     switch(rfbServerFormat.bitsPerPixel) {
     case 32:
-        return CheckSolidTile32(x, y, w, h, colorPtr, needSameColor);
+        return CheckSolidTile32(ctx, x, y, w, h, colorPtr, needSameColor);
     case 16:
-        return CheckSolidTile16(x, y, w, h, colorPtr, needSameColor);
+        return CheckSolidTile16(ctx, x, y, w, h, colorPtr, needSameColor);
     default:
-        return CheckSolidTile8(x, y, w, h, colorPtr, needSameColor);
+        return CheckSolidTile8(ctx, x, y, w, h, colorPtr, needSameColor);
     }
 }
 
 #define DEFINE_CHECK_SOLID_FUNCTION(bpp)                                      \
                                                                               \
 static Bool                                                                   \
-CheckSolidTile##bpp(x, y, w, h, colorPtr, needSameColor)                      \
+CheckSolidTile##bpp(ctx, x, y, w, h, colorPtr, needSameColor)                 \
+    rfbTightContextPtr ctx;                                                   \
     int x, y;                                                                 \
     CARD32 *colorPtr;                                                         \
     Bool needSameColor;                                                       \
 {                                                                             \
     CARD##bpp *fbptr;                                                         \
     CARD##bpp colorValue;                                                     \
-    int dx, dy;                                                               \
+    int dy;                                                                   \
                                                                               \
     fbptr = (CARD##bpp *)                                                     \
-        &rfbScreen.pfbMemory[y * rfbScreen.paddedWidthInBytes + x * (bpp/8)]; \
+        &ctx->fbMemory[y * ctx->fbStride + x * (bpp/8)];                      \
                                                                               \
     colorValue = *fbptr;                                                      \
     if (needSameColor && (CARD32)colorValue != *colorPtr)                     \
         return FALSE;                                                         \
                                                                               \
+    /* ExtendSolidArea checks columns, one pixel wide, a row at a time. */   \
     for (dy = 0; dy < h; dy++) {                                              \
-        for (dx = 0; dx < w; dx++) {                                          \
-            if (colorValue != fbptr[dx])                                      \
-                return FALSE;                                                 \
-        }                                                                     \
-        fbptr = (CARD##bpp *)((CARD8 *)fbptr + rfbScreen.paddedWidthInBytes); \
+        if (w == 1 ? colorValue != *fbptr                                     \
+                   : rfbSpanLength##bpp(fbptr, w, colorValue) != w)           \
+            return FALSE;                                                     \
+        fbptr = (CARD##bpp *)((CARD8 *)fbptr + ctx->fbStride);                \
     }                                                                         \
                                                                               \
     *colorPtr = (CARD32)colorValue;                                           \
@@ -503,7 +815,8 @@ DEFINE_CHECK_SOLID_FUNCTION(16)
 DEFINE_CHECK_SOLID_FUNCTION(32)
 
 static Bool
-SendRectSimple(cl, x, y, w, h)
+SendRectSimple(ctx, cl, x, y, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int x, y, w, h;
 {
@@ -513,28 +826,30 @@ SendRectSimple(cl, x, y, w, h)
     int dx, dy;
     int rw, rh;
 
-    maxRectSize = tightConf[compressLevel].maxRectSize;
-    maxRectWidth = tightConf[compressLevel].maxRectWidth;
+    maxRectSize = tightConf[ctx->compressLevel].maxRectSize;
+    maxRectWidth = tightConf[ctx->compressLevel].maxRectWidth;
 
     maxBeforeSize = maxRectSize * (cl->format.bitsPerPixel / 8);
     maxAfterSize = maxBeforeSize + (maxBeforeSize + 99) / 100 + 12;
+    if (maxAfterSize < RFB_LZ4_BOUND(maxBeforeSize))
+        maxAfterSize = RFB_LZ4_BOUND(maxBeforeSize);
 
-    if (tightBeforeBufSize < maxBeforeSize) {
-        tightBeforeBufSize = maxBeforeSize;
-        if (tightBeforeBuf == NULL)
-            tightBeforeBuf = (char *)xalloc(tightBeforeBufSize);
+    if (ctx->tightBeforeBufSize < maxBeforeSize) {
+        ctx->tightBeforeBufSize = maxBeforeSize;
+        if (ctx->tightBeforeBuf == NULL)
+            ctx->tightBeforeBuf = (char *)xalloc(ctx->tightBeforeBufSize);
         else
-            tightBeforeBuf = (char *)xrealloc(tightBeforeBuf,
-                                              tightBeforeBufSize);
+            ctx->tightBeforeBuf = (char *)xrealloc(ctx->tightBeforeBuf,
+                                                   ctx->tightBeforeBufSize);
     }
 
-    if (tightAfterBufSize < maxAfterSize) {
-        tightAfterBufSize = maxAfterSize;
-        if (tightAfterBuf == NULL)
-            tightAfterBuf = (char *)xalloc(tightAfterBufSize);
+    if (ctx->tightAfterBufSize < maxAfterSize) {
+        ctx->tightAfterBufSize = maxAfterSize;
+        if (ctx->tightAfterBuf == NULL)
+            ctx->tightAfterBuf = (char *)xalloc(ctx->tightAfterBufSize);
         else
-            tightAfterBuf = (char *)xrealloc(tightAfterBuf,
-                                             tightAfterBufSize);
+            ctx->tightAfterBuf = (char *)xrealloc(ctx->tightAfterBuf,
+                                                  ctx->tightAfterBufSize);
     }
 
     if (w > maxRectWidth || w * h > maxRectSize) {
@@ -545,12 +860,12 @@ SendRectSimple(cl, x, y, w, h)
             for (dx = 0; dx < w; dx += maxRectWidth) {
                 rw = (dx + maxRectWidth < w) ? maxRectWidth : w - dx;
                 rh = (dy + subrectMaxHeight < h) ? subrectMaxHeight : h - dy;
-                if (!SendSubrect(cl, x+dx, y+dy, rw, rh))
+                if (!SendSubrect(ctx, cl, x+dx, y+dy, rw, rh))
                     return FALSE;
             }
         }
     } else {
-        if (!SendSubrect(cl, x, y, w, h))
+        if (!SendSubrect(ctx, cl, x, y, w, h))
             return FALSE;
     }
 
@@ -558,94 +873,86 @@ SendRectSimple(cl, x, y, w, h)
 }
 
 static Bool
-SendSubrect(cl, x, y, w, h)
+SendSubrect(ctx, cl, x, y, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int x, y, w, h;
 {
     char *fbptr;
     Bool success = FALSE;
 
-    /* (DO NOT) Send pending data if there is more than 128 bytes. */
-    /*
-		if (ublen > 128) {
-			if (!rfbSendUpdateBuf(cl))
-				return FALSE;
-		}
-    */
-
-    if (!SendTightHeader(cl, x, y, w, h))
+    if (!SendTightHeader(ctx, x, y, w, h))
         return FALSE;
 
-    fbptr = (rfbScreen.pfbMemory + (rfbScreen.paddedWidthInBytes * y)
+    fbptr = (ctx->fbMemory + (ctx->fbStride * y)
              + (x * (rfbScreen.bitsPerPixel / 8)));
 
     (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
-                       &cl->format, fbptr, tightBeforeBuf,
-                       rfbScreen.paddedWidthInBytes, w, h);
-
-    paletteMaxColors = w * h / tightConf[compressLevel].idxMaxColorsDivisor;
-    if ( paletteMaxColors < 2 &&
-         w * h >= tightConf[compressLevel].monoMinRectSize ) {
-        paletteMaxColors = 2;
+                       &cl->format, fbptr, ctx->tightBeforeBuf,
+                       ctx->fbStride, w, h);
+
+    ctx->paletteMaxColors =
+        w * h / tightConf[ctx->compressLevel].idxMaxColorsDivisor;
+    if ( ctx->paletteMaxColors < 2 &&
+         w * h >= tightConf[ctx->compressLevel].monoMinRectSize ) {
+        ctx->paletteMaxColors = 2;
     }
     switch (cl->format.bitsPerPixel) {
     case 8:
-        FillPalette8(w * h);
+        FillPalette8(ctx, w * h);
         break;
     case 16:
-        FillPalette16(w * h);
+        FillPalette16(ctx, w * h);
         break;
     default:
-        FillPalette32(w * h);
+        FillPalette32(ctx, w * h);
     }
 
-    switch (paletteNumColors) {
+    switch (ctx->paletteNumColors) {
     case 0:
         /* Truecolor image */
-        if (DetectSmoothImage(&cl->format, w, h)) {
-            if (qualityLevel != -1) {
-                success = SendJpegRect(cl, x, y, w, h,
-                                       tightConf[qualityLevel].jpegQuality);
+        if (DetectSmoothImage(ctx, &cl->format, w, h)) {
+            if (ctx->qualityLevel != -1) {
+                success = SendJpegRect(ctx, cl, x, y, w, h,
+                                       tightConf[ctx->qualityLevel].jpegQuality);
             } else {
-                success = SendGradientRect(cl, w, h);
+                success = SendGradientRect(ctx, cl, w, h);
             }
         } else {
-            success = SendFullColorRect(cl, w, h);
+            success = SendFullColorRect(ctx, cl, w, h);
         }
         break;
     case 1:
         /* Solid rectangle */
-        success = SendSolidRect(cl);
+        success = SendSolidRect(ctx, cl);
         break;
     case 2:
         /* Two-color rectangle */
-        success = SendMonoRect(cl, w, h);
+        success = SendMonoRect(ctx, cl, w, h);
         break;
     default:
         /* Up to 256 different colors */
-        if ( paletteNumColors > 96 &&
-             qualityLevel != -1 && qualityLevel <= 3 &&
-             DetectSmoothImage(&cl->format, w, h) ) {
-            success = SendJpegRect(cl, x, y, w, h,
-                                   tightConf[qualityLevel].jpegQuality);
+        if ( ctx->paletteNumColors > 96 &&
+             ctx->qualityLevel != -1 && ctx->qualityLevel <= 3 &&
+             DetectSmoothImage(ctx, &cl->format, w, h) ) {
+            success = SendJpegRect(ctx, cl, x, y, w, h,
+                                   tightConf[ctx->qualityLevel].jpegQuality);
         } else {
-            success = SendIndexedRect(cl, w, h);
+            success = SendIndexedRect(ctx, cl, w, h);
         }
     }
     return success;
 }
 
 static Bool
-SendTightHeader(cl, x, y, w, h)
-    rfbClientPtr cl;
+SendTightHeader(ctx, x, y, w, h)
+    rfbTightContextPtr ctx;
     int x, y, w, h;
 {
     rfbFramebufferUpdateRectHeader rect;
 
-    if (ublen + sz_rfbFramebufferUpdateRectHeader > UPDATE_BUF_SIZE) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    if (!TightReserve(ctx, sz_rfbFramebufferUpdateRectHeader))
+        return FALSE;
 
     rect.r.x = Swap16IfLE(x);
     rect.r.y = Swap16IfLE(y);
@@ -653,12 +960,11 @@ SendTightHeader(cl, x, y, w, h)
     rect.r.h = Swap16IfLE(h);
     rect.encoding = Swap32IfLE(rfbEncodingTight);
 
-    memcpy(&updateBuf[ublen], (char *)&rect,
+    memcpy(&ctx->outBuf[ctx->outLen], (char *)&rect,
            sz_rfbFramebufferUpdateRectHeader);
-    ublen += sz_rfbFramebufferUpdateRectHeader;
+    ctx->outLen += sz_rfbFramebufferUpdateRectHeader;
 
-    cl->rfbRectanglesSent[rfbEncodingTight]++;
-    cl->rfbBytesSent[rfbEncodingTight] += sz_rfbFramebufferUpdateRectHeader;
+    ctx->nRects++;
 
     return TRUE;
 }
@@ -668,243 +974,294 @@ SendTightHeader(cl, x, y, w, h)
  */
 
 static Bool
-SendSolidRect(cl)
+SendSolidRect(ctx, cl)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
 {
     int len;
 
-    if (usePixelFormat24) {
-        Pack24(tightBeforeBuf, &cl->format, 1);
+    if (ctx->usePixelFormat24) {
+        Pack24(ctx->tightBeforeBuf, &cl->format, 1);
         len = 3;
     } else
         len = cl->format.bitsPerPixel / 8;
 
-    if (ublen + 1 + len > UPDATE_BUF_SIZE) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
-
-    updateBuf[ublen++] = (char)(rfbTightFill << 4) | compControl(cl);
-    memcpy (&updateBuf[ublen], tightBeforeBuf, len);
-    ublen += len;
+    if (!TightReserve(ctx, 1 + len))
+        return FALSE;
 
-    cl->rfbBytesSent[rfbEncodingTight] += len + 1;
+    ctx->outBuf[ctx->outLen++] = (char)(rfbTightFill << 4) | compControl(ctx);
+    memcpy (&ctx->outBuf[ctx->outLen], ctx->tightBeforeBuf, len);
+    ctx->outLen += len;
 
     return TRUE;
 }
 
 static Bool
-SendMonoRect(cl, w, h)
+SendMonoRect(ctx, cl, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int w, h;
 {
     int streamId = 1;
     int paletteLen, dataLen;
+    char *buf;
 
-    if ( (ublen + TIGHT_MIN_TO_COMPRESS + 6 +
-          2 * cl->format.bitsPerPixel / 8) > UPDATE_BUF_SIZE ) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    if (!TightReserve(ctx, TIGHT_MIN_TO_COMPRESS + 6 +
+                      2 * cl->format.bitsPerPixel / 8))
+        return FALSE;
+    buf = ctx->outBuf;
 
     /* Prepare tight encoding header. */
     dataLen = (w + 7) / 8;
     dataLen *= h;
 
-    updateBuf[ublen++] = (streamId | rfbTightExplicitFilter) << 4 | compControl(cl);
-    updateBuf[ublen++] = rfbTightFilterPalette;
-    updateBuf[ublen++] = 1;
+    TightPutBasicHeader(ctx, streamId, rfbTightFilterPalette);
+    buf[ctx->outLen++] = 1;
 
     /* Prepare palette, convert image. */
     switch (cl->format.bitsPerPixel) {
 
     case 32:
-        EncodeMonoRect32((CARD8 *)tightBeforeBuf, w, h);
+        EncodeMonoRect32(ctx, (CARD8 *)ctx->tightBeforeBuf, w, h);
 
-        ((CARD32 *)tightAfterBuf)[0] = monoBackground;
-        ((CARD32 *)tightAfterBuf)[1] = monoForeground;
-        if (usePixelFormat24) {
-            Pack24(tightAfterBuf, &cl->format, 2);
+        ((CARD32 *)ctx->tightAfterBuf)[0] = ctx->monoBackground;
+        ((CARD32 *)ctx->tightAfterBuf)[1] = ctx->monoForeground;
+        if (ctx->usePixelFormat24) {
+            Pack24(ctx->tightAfterBuf, &cl->format, 2);
             paletteLen = 6;
         } else
             paletteLen = 8;
 
-        memcpy(&updateBuf[ublen], tightAfterBuf, paletteLen);
-        ublen += paletteLen;
-        cl->rfbBytesSent[rfbEncodingTight] += 3 + paletteLen;
+        memcpy(&buf[ctx->outLen], ctx->tightAfterBuf, paletteLen);
+        ctx->outLen += paletteLen;
         break;
 
     case 16:
-        EncodeMonoRect16((CARD8 *)tightBeforeBuf, w, h);
+        EncodeMonoRect16(ctx, (CARD8 *)ctx->tightBeforeBuf, w, h);
 
-        ((CARD16 *)tightAfterBuf)[0] = (CARD16)monoBackground;
-        ((CARD16 *)tightAfterBuf)[1] = (CARD16)monoForeground;
+        ((CARD16 *)ctx->tightAfterBuf)[0] = (CARD16)ctx->monoBackground;
+        ((CARD16 *)ctx->tightAfterBuf)[1] = (CARD16)ctx->monoForeground;
 
-        memcpy(&updateBuf[ublen], tightAfterBuf, 4);
-        ublen += 4;
-        cl->rfbBytesSent[rfbEncodingTight] += 7;
+        memcpy(&buf[ctx->outLen], ctx->tightAfterBuf, 4);
+        ctx->outLen += 4;
         break;
 
     default:
-        EncodeMonoRect8((CARD8 *)tightBeforeBuf, w, h);
+        EncodeMonoRect8(ctx, (CARD8 *)ctx->tightBeforeBuf, w, h);
 
-        updateBuf[ublen++] = (char)monoBackground;
-        updateBuf[ublen++] = (char)monoForeground;
-        cl->rfbBytesSent[rfbEncodingTight] += 5;
+        buf[ctx->outLen++] = (char)ctx->monoBackground;
+        buf[ctx->outLen++] = (char)ctx->monoForeground;
     }
 
-    return CompressData(cl, streamId, dataLen,
-                        tightConf[compressLevel].monoZlibLevel,
+    return CompressData(ctx, streamId, dataLen,
+                        tightConf[ctx->compressLevel].monoZlibLevel,
                         Z_DEFAULT_STRATEGY);
 }
 
 static Bool
-SendIndexedRect(cl, w, h)
+SendIndexedRect(ctx, cl, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int w, h;
 {
     int streamId = 2;
     int i, entryLen;
+    char *buf;
 
-    if ( (ublen + TIGHT_MIN_TO_COMPRESS + 6 +
-          paletteNumColors * cl->format.bitsPerPixel / 8) > UPDATE_BUF_SIZE ) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    if (!TightReserve(ctx, TIGHT_MIN_TO_COMPRESS + 6 +
+                      ctx->paletteNumColors * cl->format.bitsPerPixel / 8))
+        return FALSE;
+    buf = ctx->outBuf;
 
     /* Prepare tight encoding header. */
-    updateBuf[ublen++] = (streamId | rfbTightExplicitFilter) << 4 | compControl(cl);
-    updateBuf[ublen++] = rfbTightFilterPalette;
-    updateBuf[ublen++] = (char)(paletteNumColors - 1);
+    TightPutBasicHeader(ctx, streamId, rfbTightFilterPalette);
+    buf[ctx->outLen++] = (char)(ctx->paletteNumColors - 1);
 
     /* Prepare palette, convert image. */
     switch (cl->format.bitsPerPixel) {
 
     case 32:
-        EncodeIndexedRect32((CARD8 *)tightBeforeBuf, w * h);
+        EncodeIndexedRect32(ctx, (CARD8 *)ctx->tightBeforeBuf, w * h);
 
-        for (i = 0; i < paletteNumColors; i++) {
-            ((CARD32 *)tightAfterBuf)[i] =
-                palette.entry[i].listNode->rgb;
+        for (i = 0; i < ctx->paletteNumColors; i++) {
+            ((CARD32 *)ctx->tightAfterBuf)[i] =
+                ctx->palette.entry[i].listNode->rgb;
         }
-        if (usePixelFormat24) {
-            Pack24(tightAfterBuf, &cl->format, paletteNumColors);
+        if (ctx->usePixelFormat24) {
+            Pack24(ctx->tightAfterBuf, &cl->format, ctx->paletteNumColors);
             entryLen = 3;
         } else
             entryLen = 4;
 
-        memcpy(&updateBuf[ublen], tightAfterBuf, paletteNumColors * entryLen);
-        ublen += paletteNumColors * entryLen;
-        cl->rfbBytesSent[rfbEncodingTight] += 3 + paletteNumColors * entryLen;
+        memcpy(&buf[ctx->outLen], ctx->tightAfterBuf,
+               ctx->paletteNumColors * entryLen);
+        ctx->outLen += ctx->paletteNumColors * entryLen;
         break;
 
     case 16:
-        EncodeIndexedRect16((CARD8 *)tightBeforeBuf, w * h);
+        EncodeIndexedRect16(ctx, (CARD8 *)ctx->tightBeforeBuf, w * h);
 
-        for (i = 0; i < paletteNumColors; i++) {
-            ((CARD16 *)tightAfterBuf)[i] =
-                (CARD16)palette.entry[i].listNode->rgb;
+        for (i = 0; i < ctx->paletteNumColors; i++) {
+            ((CARD16 *)ctx->tightAfterBuf)[i] =
+                (CARD16)ctx->palette.entry[i].listNode->rgb;
         }
 
-        memcpy(&updateBuf[ublen], tightAfterBuf, paletteNumColors * 2);
-        ublen += paletteNumColors * 2;
-        cl->rfbBytesSent[rfbEncodingTight] += 3 + paletteNumColors * 2;
+        memcpy(&buf[ctx->outLen], ctx->tightAfterBuf,
+               ctx->paletteNumColors * 2);
+        ctx->outLen += ctx->paletteNumColors * 2;
         break;
 
     default:
         return FALSE;           /* Should never happen. */
     }
 
-    return CompressData(cl, streamId, w * h,
-                        tightConf[compressLevel].idxZlibLevel,
+    return CompressData(ctx, streamId, w * h,
+                        tightConf[ctx->compressLevel].idxZlibLevel,
                         Z_DEFAULT_STRATEGY);
 }
 
 static Bool
-SendFullColorRect(cl, w, h)
+SendFullColorRect(ctx, cl, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int w, h;
 {
     int streamId = 0;
     int len;
 
-    if (ublen + TIGHT_MIN_TO_COMPRESS + 1 > UPDATE_BUF_SIZE) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    if (!TightReserve(ctx, TIGHT_MIN_TO_COMPRESS + 2))
+        return FALSE;
 
-    updateBuf[ublen++] = 0x00 | compControl(cl);  /* stream id = 0, no flushing, no filter */
-    cl->rfbBytesSent[rfbEncodingTight]++;
+    TightPutBasicHeader(ctx, streamId, rfbTightFilterCopy);
 
-    if (usePixelFormat24) {
-        Pack24(tightBeforeBuf, &cl->format, w * h);
+    if (ctx->usePixelFormat24) {
+        Pack24(ctx->tightBeforeBuf, &cl->format, w * h);
         len = 3;
     } else
         len = cl->format.bitsPerPixel / 8;
 
-    return CompressData(cl, streamId, w * h * len,
-                        tightConf[compressLevel].rawZlibLevel,
+    return CompressData(ctx, streamId, w * h * len,
+                        tightConf[ctx->compressLevel].rawZlibLevel,
                         Z_DEFAULT_STRATEGY);
 }
 
 static Bool
-SendGradientRect(cl, w, h)
+SendGradientRect(ctx, cl, w, h)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int w, h;
 {
     int streamId = 3;
     int len;
+    CARD32 mask;
 
     if (cl->format.bitsPerPixel == 8)
-        return SendFullColorRect(cl, w, h);
+        return SendFullColorRect(ctx, cl, w, h);
 
-    if (ublen + TIGHT_MIN_TO_COMPRESS + 2 > UPDATE_BUF_SIZE) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    if (!TightReserve(ctx, TIGHT_MIN_TO_COMPRESS + 2))
+        return FALSE;
 
-    if (prevRowBuf == NULL)
-        prevRowBuf = (int *)xalloc(2048 * 3 * sizeof(int));
+    if (ctx->prevRowBuf == NULL)
+        ctx->prevRowBuf = (int *)xalloc(2048 * 3 * sizeof(int));
 
-    updateBuf[ublen++] = (streamId | rfbTightExplicitFilter) << 4 | compControl(cl);
-    updateBuf[ublen++] = rfbTightFilterGradient;
-    cl->rfbBytesSent[rfbEncodingTight] += 2;
+    TightPutBasicHeader(ctx, streamId, rfbTightFilterGradient);
 
-    if (usePixelFormat24) {
-        FilterGradient24(tightBeforeBuf, &cl->format, w, h);
+    if (ctx->usePixelFormat24) {
+        FilterGradient24(ctx, ctx->tightBeforeBuf, &cl->format, w, h);
         len = 3;
     } else if (cl->format.bitsPerPixel == 32) {
-        FilterGradient32((CARD32 *)tightBeforeBuf, &cl->format, w, h);
+        mask = ByteChannelMask(&cl->format);
+        if (mask != 0) {
+            FilterGradientBytes32(ctx, (CARD32 *)ctx->tightBeforeBuf,
+                                  &cl->format, mask, w, h);
+        } else {
+            FilterGradient32(ctx, (CARD32 *)ctx->tightBeforeBuf,
+                             &cl->format, w, h);
+        }
         len = 4;
     } else {
-        FilterGradient16((CARD16 *)tightBeforeBuf, &cl->format, w, h);
+        FilterGradient16(ctx, (CARD16 *)ctx->tightBeforeBuf, &cl->format, w, h);
         len = 2;
     }
 
-    return CompressData(cl, streamId, w * h * len,
-                        tightConf[compressLevel].gradientZlibLevel,
+    return CompressData(ctx, streamId, w * h * len,
+                        tightConf[ctx->compressLevel].gradientZlibLevel,
                         Z_FILTERED);
 }
 
+/*
+ * Write the compression control byte of a basic rectangle, and the filter
+ * id if there is one.  Rectangles without a filter keep the header they
+ * always had, so old clients see no change.
+ */
+
+static void
+TightPutBasicHeader(ctx, streamId, filterId)
+    rfbTightContextPtr ctx;
+    int streamId, filterId;
+{
+    if (ctx->useLz4) {
+        ctx->outBuf[ctx->outLen++] = (char)(rfbTightLz4 << 4) | compControl(ctx);
+        ctx->outBuf[ctx->outLen++] = (char)filterId;
+    } else if (filterId == rfbTightFilterCopy) {
+        ctx->outBuf[ctx->outLen++] = (char)(streamId << 4) | compControl(ctx);
+    } else {
+        ctx->outBuf[ctx->outLen++] =
+            (char)((streamId | rfbTightExplicitFilter) << 4) | compControl(ctx);
+        ctx->outBuf[ctx->outLen++] = (char)filterId;
+    }
+}
+
 static Bool
-CompressData(cl, streamId, dataLen, zlibLevel, zlibStrategy)
-    rfbClientPtr cl;
+CompressData(ctx, streamId, dataLen, zlibLevel, zlibStrategy)
+    rfbTightContextPtr ctx;
     int streamId, dataLen, zlibLevel, zlibStrategy;
 {
-    z_streamp pz;
-    int err;
+    int codec, compressedLen;
+    double start;
 
     if (dataLen < TIGHT_MIN_TO_COMPRESS) {
-        memcpy(&updateBuf[ublen], tightBeforeBuf, dataLen);
-        ublen += dataLen;
-        cl->rfbBytesSent[rfbEncodingTight] += dataLen;
+        memcpy(&ctx->outBuf[ctx->outLen], ctx->tightBeforeBuf, dataLen);
+        ctx->outLen += dataLen;
         return TRUE;
     }
 
-    pz = &cl->zsStruct[streamId];
+    start = ThreadCpuSeconds();
+    if (ctx->useLz4) {
+        codec = TIGHT_CODEC_LZ4;
+        compressedLen = CompressLz4(ctx, dataLen);
+    } else {
+        codec = TIGHT_CODEC_ZLIB;
+        compressedLen = CompressZlib(ctx, streamId, dataLen,
+                                     zlibLevel, zlibStrategy);
+    }
+    if (compressedLen < 0)
+        return FALSE;
+
+    ctx->codecSeconds[codec] += ThreadCpuSeconds() - start;
+    ctx->codecBytesIn[codec] += dataLen;
+    ctx->codecBytesOut[codec] += compressedLen;
+
+    return SendCompressedData(ctx, compressedLen);
+}
+
+/*
+ * Compress dataLen bytes of tightBeforeBuf into tightAfterBuf, returning
+ * the compressed length or -1.
+ */
+
+static int
+CompressZlib(ctx, streamId, dataLen, zlibLevel, zlibStrategy)
+    rfbTightContextPtr ctx;
+    int streamId, dataLen, zlibLevel, zlibStrategy;
+{
+    z_streamp pz;
+    int err;
+
+    pz = &ctx->zsStruct[streamId];
 
     /* Initialize compression stream if needed. */
-    if (!cl->zsActive[streamId]) {
+    if (!ctx->zsActive[streamId]) {
         pz->zalloc = Z_NULL;
         pz->zfree = Z_NULL;
         pz->opaque = Z_NULL;
@@ -912,67 +1269,93 @@ CompressData(cl, streamId, dataLen, zlibLevel, zlibStrategy)
         err = deflateInit2 (pz, zlibLevel, Z_DEFLATED, MAX_WBITS,
                             MAX_MEM_LEVEL, zlibStrategy);
         if (err != Z_OK)
-            return FALSE;
+            return -1;
 
-        cl->zsActive[streamId] = TRUE;
-        cl->zsLevel[streamId] = zlibLevel;
+        ctx->zsActive[streamId] = TRUE;
+        ctx->zsLevel[streamId] = zlibLevel;
     }
 
     /* Prepare buffer pointers. */
-    pz->next_in = (Bytef *)tightBeforeBuf;
+    pz->next_in = (Bytef *)ctx->tightBeforeBuf;
     pz->avail_in = dataLen;
-    pz->next_out = (Bytef *)tightAfterBuf;
-    pz->avail_out = tightAfterBufSize;
+    pz->next_out = (Bytef *)ctx->tightAfterBuf;
+    pz->avail_out = ctx->tightAfterBufSize;
 
     /* Change compression parameters if needed. */
-    if (zlibLevel != cl->zsLevel[streamId]) {
+    if (zlibLevel != ctx->zsLevel[streamId]) {
         if (deflateParams (pz, zlibLevel, zlibStrategy) != Z_OK) {
-            return FALSE;
+            return -1;
         }
-        cl->zsLevel[streamId] = zlibLevel;
+        ctx->zsLevel[streamId] = zlibLevel;
     }
 
     /* Actual compression. */
     if ( deflate (pz, Z_SYNC_FLUSH) != Z_OK ||
          pz->avail_in != 0 || pz->avail_out == 0 ) {
-        return FALSE;
+        return -1;
     }
 
-    return SendCompressedData(cl, tightAfterBufSize - pz->avail_out);
+    return ctx->tightAfterBufSize - pz->avail_out;
 }
 
-static Bool SendCompressedData(cl, compressedLen)
-    rfbClientPtr cl;
+static int
+CompressLz4(ctx, dataLen)
+    rfbTightContextPtr ctx;
+    int dataLen;
+{
+    if (RFB_LZ4_BOUND(dataLen) > ctx->tightAfterBufSize)
+        return -1;
+
+    if (ctx->lz4Table == NULL) {
+        ctx->lz4Table = (int *)xalloc(RFB_LZ4_HASH_SIZE * sizeof(int));
+        if (ctx->lz4Table == NULL)
+            return -1;
+    }
+
+    return rfbLz4Compress(ctx->tightBeforeBuf, dataLen, ctx->tightAfterBuf,
+                          ctx->lz4Table);
+}
+
+/*
+ * CPU time of the calling thread, so that compressors running on the
+ * encoder pool are not charged for time spent waiting.  Falls back to
+ * wall time where there is no such clock.
+ */
+
+static double
+ThreadCpuSeconds()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    return rfbTimeInMicros() / 1e6;
+}
+
+static Bool SendCompressedData(ctx, compressedLen)
+    rfbTightContextPtr ctx;
     int compressedLen;
 {
-    int i, portionLen;
+    char *buf;
 
-    updateBuf[ublen++] = compressedLen & 0x7F;
-    cl->rfbBytesSent[rfbEncodingTight]++;
+    if (!TightReserve(ctx, 3 + compressedLen))
+        return FALSE;
+    buf = ctx->outBuf;
+
+    buf[ctx->outLen++] = compressedLen & 0x7F;
     if (compressedLen > 0x7F) {
-        updateBuf[ublen-1] |= 0x80;
-        updateBuf[ublen++] = compressedLen >> 7 & 0x7F;
-        cl->rfbBytesSent[rfbEncodingTight]++;
+        buf[ctx->outLen-1] |= 0x80;
+        buf[ctx->outLen++] = compressedLen >> 7 & 0x7F;
         if (compressedLen > 0x3FFF) {
-            updateBuf[ublen-1] |= 0x80;
-            updateBuf[ublen++] = compressedLen >> 14 & 0xFF;
-            cl->rfbBytesSent[rfbEncodingTight]++;
+            buf[ctx->outLen-1] |= 0x80;
+            buf[ctx->outLen++] = compressedLen >> 14 & 0xFF;
         }
     }
 
-    portionLen = UPDATE_BUF_SIZE;
-    for (i = 0; i < compressedLen; i += portionLen) {
-        if (i + portionLen > compressedLen) {
-            portionLen = compressedLen - i;
-        }
-        if (ublen + portionLen > UPDATE_BUF_SIZE) {
-            if (!rfbSendUpdateBuf(cl))
-                return FALSE;
-        }
-        memcpy(&updateBuf[ublen], &tightAfterBuf[i], portionLen);
-        ublen += portionLen;
-    }
-    cl->rfbBytesSent[rfbEncodingTight] += compressedLen;
+    memcpy(&buf[ctx->outLen], ctx->tightAfterBuf, compressedLen);
+    ctx->outLen += compressedLen;
     return TRUE;
 }
 
@@ -981,110 +1364,99 @@ static Bool SendCompressedData(cl, compressedLen)
  */
 
 static void
-FillPalette8(count)
+FillPalette8(ctx, count)
+    rfbTightContextPtr ctx;
     int count;
 {
-    CARD8 *data = (CARD8 *)tightBeforeBuf;
+    CARD8 *data = (CARD8 *)ctx->tightBeforeBuf;
     CARD8 c0, c1;
-    int i, n0, n1;
+    int i, n, n0, n1;
 
-    paletteNumColors = 0;
+    ctx->paletteNumColors = 0;
 
     c0 = data[0];
-    for (i = 1; i < count && data[i] == c0; i++);
+    i = 1 + rfbSpanLength8(&data[1], count - 1, c0);
     if (i == count) {
-        paletteNumColors = 1;
+        ctx->paletteNumColors = 1;
         return;                 /* Solid rectangle */
     }
 
-    if (paletteMaxColors < 2)
+    if (ctx->paletteMaxColors < 2)
         return;
 
     n0 = i;
     c1 = data[i];
-    n1 = 0;
-    for (i++; i < count; i++) {
-        if (data[i] == c0) {
-            n0++;
-        } else if (data[i] == c1) {
-            n1++;
-        } else
-            break;
-    }
+    n = rfbSpanTwoColors8(&data[i + 1], count - i - 1, c0, c1, &n0);
+    n1 = n - (n0 - i);
+    i += 1 + n;
     if (i == count) {
         if (n0 > n1) {
-            monoBackground = (CARD32)c0;
-            monoForeground = (CARD32)c1;
+            ctx->monoBackground = (CARD32)c0;
+            ctx->monoForeground = (CARD32)c1;
         } else {
-            monoBackground = (CARD32)c1;
-            monoForeground = (CARD32)c0;
+            ctx->monoBackground = (CARD32)c1;
+            ctx->monoForeground = (CARD32)c0;
         }
-        paletteNumColors = 2;   /* Two colors */
+        ctx->paletteNumColors = 2;   /* Two colors */
     }
 }
 
 #define DEFINE_FILL_PALETTE_FUNCTION(bpp)                               \
                                                                         \
 static void                                                             \
-FillPalette##bpp(count)                                                 \
+FillPalette##bpp(ctx, count)                                            \
+    rfbTightContextPtr ctx;                                             \
     int count;                                                          \
 {                                                                       \
-    CARD##bpp *data = (CARD##bpp *)tightBeforeBuf;                      \
+    CARD##bpp *data = (CARD##bpp *)ctx->tightBeforeBuf;                 \
     CARD##bpp c0, c1, ci;                                               \
-    int i, n0, n1, ni;                                                  \
+    int i, n, n0, n1, ni;                                               \
                                                                         \
     c0 = data[0];                                                       \
-    for (i = 1; i < count && data[i] == c0; i++);                       \
+    i = 1 + rfbSpanLength##bpp(&data[1], count - 1, c0);                \
     if (i >= count) {                                                   \
-        paletteNumColors = 1;   /* Solid rectangle */                   \
+        ctx->paletteNumColors = 1;   /* Solid rectangle */              \
         return;                                                         \
     }                                                                   \
                                                                         \
-    if (paletteMaxColors < 2) {                                         \
-        paletteNumColors = 0;   /* Full-color encoding preferred */     \
+    if (ctx->paletteMaxColors < 2) {                                    \
+        ctx->paletteNumColors = 0;   /* Full-color encoding preferred */ \
         return;                                                         \
     }                                                                   \
                                                                         \
     n0 = i;                                                             \
     c1 = data[i];                                                       \
-    n1 = 0;                                                             \
-    for (i++; i < count; i++) {                                         \
-        ci = data[i];                                                   \
-        if (ci == c0) {                                                 \
-            n0++;                                                       \
-        } else if (ci == c1) {                                          \
-            n1++;                                                       \
-        } else                                                          \
-            break;                                                      \
-    }                                                                   \
+    n = rfbSpanTwoColors##bpp(&data[i + 1], count - i - 1, c0, c1, &n0); \
+    n1 = n - (n0 - i);                                                  \
+    i += 1 + n;                                                         \
     if (i >= count) {                                                   \
         if (n0 > n1) {                                                  \
-            monoBackground = (CARD32)c0;                                \
-            monoForeground = (CARD32)c1;                                \
+            ctx->monoBackground = (CARD32)c0;                           \
+            ctx->monoForeground = (CARD32)c1;                           \
         } else {                                                        \
-            monoBackground = (CARD32)c1;                                \
-            monoForeground = (CARD32)c0;                                \
+            ctx->monoBackground = (CARD32)c1;                           \
+            ctx->monoForeground = (CARD32)c0;                           \
         }                                                               \
-        paletteNumColors = 2;   /* Two colors */                        \
+        ctx->paletteNumColors = 2;   /* Two colors */                   \
         return;                                                         \
     }                                                                   \
                                                                         \
-    PaletteReset();                                                     \
-    PaletteInsert (c0, (CARD32)n0, bpp);                                \
-    PaletteInsert (c1, (CARD32)n1, bpp);                                \
+    PaletteReset(ctx);                                                  \
+    PaletteInsert (ctx, c0, (CARD32)n0, bpp);                           \
+    PaletteInsert (ctx, c1, (CARD32)n1, bpp);                           \
                                                                         \
-    ni = 1;                                                             \
-    for (i++; i < count; i++) {                                         \
-        if (data[i] == ci) {                                            \
-            ni++;                                                       \
-        } else {                                                        \
-            if (!PaletteInsert (ci, (CARD32)ni, bpp))                   \
-                return;                                                 \
-            ci = data[i];                                               \
-            ni = 1;                                                     \
-        }                                                               \
+    ci = data[i];                                                       \
+    for (i++; ; i++) {                                                  \
+        n = rfbSpanLength##bpp(&data[i], count - i, ci);                \
+        ni = 1 + n;                                                     \
+        i += n;                                                         \
+        if (i >= count)                                                 \
+            break;                                                      \
+        if (!PaletteInsert (ctx, ci, (CARD32)ni, bpp))                  \
+            return;                                                     \
+        ci = data[i];                                                   \
     }                                                                   \
-    PaletteInsert (ci, (CARD32)ni, bpp);                                \
+    PaletteInsert (ctx, ci, (CARD32)ni, bpp);                           \
 }
 
 DEFINE_FILL_PALETTE_FUNCTION(16)
@@ -1099,14 +1471,16 @@ DEFINE_FILL_PALETTE_FUNCTION(32)
 #define HASH_FUNC32(rgb) ((int)((((rgb) >> 16) + ((rgb) >> 8)) & 0xFF))
 
 static void
-PaletteReset(void)
+PaletteReset(ctx)
+    rfbTightContextPtr ctx;
 {
-    paletteNumColors = 0;
-    memset(palette.hash, 0, 256 * sizeof(COLOR_LIST *));
+    ctx->paletteNumColors = 0;
+    memset(ctx->palette.hash, 0, 256 * sizeof(COLOR_LIST *));
 }
 
 static int
-PaletteInsert(rgb, numPixels, bpp)
+PaletteInsert(ctx, rgb, numPixels, bpp)
+    rfbTightContextPtr ctx;
     CARD32 rgb;
     int numPixels;
     int bpp;
@@ -1117,58 +1491,58 @@ PaletteInsert(rgb, numPixels, bpp)
 
     hash_key = (bpp == 16) ? HASH_FUNC16(rgb) : HASH_FUNC32(rgb);
 
-    pnode = palette.hash[hash_key];
+    pnode = ctx->palette.hash[hash_key];
 
     while (pnode != NULL) {
         if (pnode->rgb == rgb) {
             /* Such palette entry already exists. */
             new_idx = idx = pnode->idx;
-            count = palette.entry[idx].numPixels + numPixels;
-            if (new_idx && palette.entry[new_idx-1].numPixels < count) {
+            count = ctx->palette.entry[idx].numPixels + numPixels;
+            if (new_idx && ctx->palette.entry[new_idx-1].numPixels < count) {
                 do {
-                    palette.entry[new_idx] = palette.entry[new_idx-1];
-                    palette.entry[new_idx].listNode->idx = new_idx;
+                    ctx->palette.entry[new_idx] = ctx->palette.entry[new_idx-1];
+                    ctx->palette.entry[new_idx].listNode->idx = new_idx;
                     new_idx--;
                 }
-                while (new_idx && palette.entry[new_idx-1].numPixels < count);
-                palette.entry[new_idx].listNode = pnode;
+                while (new_idx && ctx->palette.entry[new_idx-1].numPixels < count);
+                ctx->palette.entry[new_idx].listNode = pnode;
                 pnode->idx = new_idx;
             }
-            palette.entry[new_idx].numPixels = count;
-            return paletteNumColors;
+            ctx->palette.entry[new_idx].numPixels = count;
+            return ctx->paletteNumColors;
         }
         prev_pnode = pnode;
         pnode = pnode->next;
     }
 
     /* Check if palette is full. */
-    if (paletteNumColors == 256 || paletteNumColors == paletteMaxColors) {
-        paletteNumColors = 0;
+    if (ctx->paletteNumColors == 256 || ctx->paletteNumColors == ctx->paletteMaxColors) {
+        ctx->paletteNumColors = 0;
         return 0;
     }
 
     /* Move palette entries with lesser pixel counts. */
-    for ( idx = paletteNumColors;
-          idx > 0 && palette.entry[idx-1].numPixels < numPixels;
+    for ( idx = ctx->paletteNumColors;
+          idx > 0 && ctx->palette.entry[idx-1].numPixels < numPixels;
           idx-- ) {
-        palette.entry[idx] = palette.entry[idx-1];
-        palette.entry[idx].listNode->idx = idx;
+        ctx->palette.entry[idx] = ctx->palette.entry[idx-1];
+        ctx->palette.entry[idx].listNode->idx = idx;
     }
 
     /* Add new palette entry into the freed slot. */
-    pnode = &palette.list[paletteNumColors];
+    pnode = &ctx->palette.list[ctx->paletteNumColors];
     if (prev_pnode != NULL) {
         prev_pnode->next = pnode;
     } else {
-        palette.hash[hash_key] = pnode;
+        ctx->palette.hash[hash_key] = pnode;
     }
     pnode->next = NULL;
     pnode->idx = idx;
     pnode->rgb = rgb;
-    palette.entry[idx].listNode = pnode;
-    palette.entry[idx].numPixels = numPixels;
+    ctx->palette.entry[idx].listNode = pnode;
+    ctx->palette.entry[idx].numPixels = numPixels;
 
-    return (++paletteNumColors);
+    return (++ctx->paletteNumColors);
 }
 
 
@@ -1215,7 +1589,8 @@ static void Pack24(buf, fmt, count)
 #define DEFINE_IDX_ENCODE_FUNCTION(bpp)                                 \
                                                                         \
 static void                                                             \
-EncodeIndexedRect##bpp(buf, count)                                      \
+EncodeIndexedRect##bpp(ctx, buf, count)                                 \
+    rfbTightContextPtr ctx;                                             \
     CARD8 *buf;                                                         \
     int count;                                                          \
 {                                                                       \
@@ -1231,7 +1606,7 @@ EncodeIndexedRect##bpp(buf, count)                                      \
         while (count && *src == rgb) {                                  \
             rep++, src++, count--;                                      \
         }                                                               \
-        pnode = palette.hash[HASH_FUNC##bpp(rgb)];                      \
+        pnode = ctx->palette.hash[HASH_FUNC##bpp(rgb)];                 \
         while (pnode != NULL) {                                         \
             if ((CARD##bpp)pnode->rgb == rgb) {                         \
                 *buf++ = (CARD8)pnode->idx;                             \
@@ -1252,7 +1627,8 @@ DEFINE_IDX_ENCODE_FUNCTION(32)
 #define DEFINE_MONO_ENCODE_FUNCTION(bpp)                                \
                                                                         \
 static void                                                             \
-EncodeMonoRect##bpp(buf, w, h)                                          \
+EncodeMonoRect##bpp(ctx, buf, w, h)                                     \
+    rfbTightContextPtr ctx;                                             \
     CARD8 *buf;                                                         \
     int w, h;                                                           \
 {                                                                       \
@@ -1263,7 +1639,7 @@ EncodeMonoRect##bpp(buf, w, h)                                          \
     int x, y, bg_bits;                                                  \
                                                                         \
     ptr = (CARD##bpp *) buf;                                            \
-    bg = (CARD##bpp) monoBackground;                                    \
+    bg = (CARD##bpp) ctx->monoBackground;                               \
     aligned_width = w - w % 8;                                          \
                                                                         \
     for (y = 0; y < h; y++) {                                           \
@@ -1311,24 +1687,27 @@ DEFINE_MONO_ENCODE_FUNCTION(32)
  * ``Gradient'' filter for 24-bit color samples.
  * Should be called only when redMax, greenMax and blueMax are 255.
  * Color components assumed to be byte-aligned.
+ *
+ * Each row is filtered a whole 32-bit pixel at a time by
+ * rfbGradientRow32(), then the three color bytes of each pixel are
+ * picked out.
  */
 
 static void
-FilterGradient24(buf, fmt, w, h)
+FilterGradient24(ctx, buf, fmt, w, h)
+    rfbTightContextPtr ctx;
     char *buf;
     rfbPixelFormat *fmt;
     int w, h;
 {
-    CARD32 *buf32;
+    CARD32 *buf32, *prevRow;
     CARD32 pix32;
-    int *prevRowPtr;
     int shiftBits[3];
-    int pixHere[3], pixUpper[3], pixLeft[3], pixUpperLeft[3];
-    int prediction;
-    int x, y, c;
+    int x, y;
 
     buf32 = (CARD32 *)buf;
-    memset (prevRowBuf, 0, w * 3 * sizeof(int));
+    prevRow = (CARD32 *)ctx->prevRowBuf;
+    memset (prevRow, 0, w * sizeof(CARD32));
 
     if (!rfbServerFormat.bigEndian == !fmt->bigEndian) {
         shiftBits[0] = fmt->redShift;
@@ -1340,34 +1719,70 @@ FilterGradient24(buf, fmt, w, h)
         shiftBits[2] = 24 - fmt->blueShift;
     }
 
+    /* The three bytes written never catch up with the four read. */
     for (y = 0; y < h; y++) {
-        for (c = 0; c < 3; c++) {
-            pixUpper[c] = 0;
-            pixHere[c] = 0;
-        }
-        prevRowPtr = prevRowBuf;
+        rfbGradientRow32(buf32, prevRow, w, 0xFFFFFFFF);
         for (x = 0; x < w; x++) {
             pix32 = *buf32++;
-            for (c = 0; c < 3; c++) {
-                pixUpperLeft[c] = pixUpper[c];
-                pixLeft[c] = pixHere[c];
-                pixUpper[c] = *prevRowPtr;
-                pixHere[c] = (int)(pix32 >> shiftBits[c] & 0xFF);
-                *prevRowPtr++ = pixHere[c];
-
-                prediction = pixLeft[c] + pixUpper[c] - pixUpperLeft[c];
-                if (prediction < 0) {
-                    prediction = 0;
-                } else if (prediction > 0xFF) {
-                    prediction = 0xFF;
-                }
-                *buf++ = (char)(pixHere[c] - prediction);
-            }
+            *buf++ = (char)(pix32 >> shiftBits[0]);
+            *buf++ = (char)(pix32 >> shiftBits[1]);
+            *buf++ = (char)(pix32 >> shiftBits[2]);
         }
     }
 }
 
 
+/*
+ * ``Gradient'' filter for 32-bit pixels whose color components are
+ * 8 bits each and byte-aligned.  mask is from ByteChannelMask().
+ */
+
+static void
+FilterGradientBytes32(ctx, buf, fmt, mask, w, h)
+    rfbTightContextPtr ctx;
+    CARD32 *buf;
+    rfbPixelFormat *fmt;
+    CARD32 mask;
+    int w, h;
+{
+    CARD32 *prevRow;
+    int y;
+
+    prevRow = (CARD32 *)ctx->prevRowBuf;
+    memset (prevRow, 0, w * sizeof(CARD32));
+
+    for (y = 0; y < h; y++) {
+        rfbGradientRow32(buf, prevRow, w, mask);
+        buf += w;
+    }
+}
+
+/*
+ * The bits of a 32-bit pixel, as it lies in memory, that hold its color
+ * components, or 0 unless they are 8 bits each and byte-aligned.
+ */
+
+static CARD32
+ByteChannelMask(fmt)
+    rfbPixelFormat *fmt;
+{
+    CARD32 mask;
+
+    if ( fmt->redMax != 0xFF || fmt->greenMax != 0xFF ||
+         fmt->blueMax != 0xFF || fmt->redShift % 8 != 0 ||
+         fmt->greenShift % 8 != 0 || fmt->blueShift % 8 != 0 ) {
+        return 0;
+    }
+
+    mask = (CARD32)0xFF << fmt->redShift | (CARD32)0xFF << fmt->greenShift |
+        (CARD32)0xFF << fmt->blueShift;
+    if (!rfbServerFormat.bigEndian != !fmt->bigEndian) {
+        mask = Swap32(mask);
+    }
+    return mask;
+}
+
+
 /*
  * ``Gradient'' filter for other color depths.
  */
@@ -1375,7 +1790,8 @@ FilterGradient24(buf, fmt, w, h)
 #define DEFINE_GRADIENT_FILTER_FUNCTION(bpp)                             \
                                                                          \
 static void                                                              \
-FilterGradient##bpp(buf, fmt, w, h)                                      \
+FilterGradient##bpp(ctx, buf, fmt, w, h)                                 \
+    rfbTightContextPtr ctx;                                              \
     CARD##bpp *buf;                                                      \
     rfbPixelFormat *fmt;                                                 \
     int w, h;                                                            \
@@ -1388,7 +1804,7 @@ FilterGradient##bpp(buf, fmt, w, h)                                      \
     int prediction;                                                      \
     int x, y, c;                                                         \
                                                                          \
-    memset (prevRowBuf, 0, w * 3 * sizeof(int));                         \
+    memset (ctx->prevRowBuf, 0, w * 3 * sizeof(int));                    \
                                                                          \
     endianMismatch = (!rfbServerFormat.bigEndian != !fmt->bigEndian);    \
                                                                          \
@@ -1404,7 +1820,7 @@ FilterGradient##bpp(buf, fmt, w, h)                                      \
             pixUpper[c] = 0;                                             \
             pixHere[c] = 0;                                              \
         }                                                                \
-        prevRowPtr = prevRowBuf;                                         \
+        prevRowPtr = ctx->prevRowBuf;                                    \
         for (x = 0; x < w; x++) {                                        \
             pix = *buf;                                                  \
             if (endianMismatch) {                                        \
@@ -1446,12 +1862,13 @@ DEFINE_GRADIENT_FILTER_FUNCTION(32)
 
 #define JPEG_MIN_RECT_SIZE  4096
 
-#define DETECT_SUBROW_WIDTH    7
+#define DETECT_SUBROW_WIDTH    7    /* as rfbPixelDiffs32() assumes */
 #define DETECT_MIN_WIDTH       8
 #define DETECT_MIN_HEIGHT      8
 
 static int
-DetectSmoothImage (fmt, w, h)
+DetectSmoothImage (ctx, fmt, w, h)
+    rfbTightContextPtr ctx;
     rfbPixelFormat *fmt;
     int w, h;
 {
@@ -1462,38 +1879,41 @@ DetectSmoothImage (fmt, w, h)
         return 0;
     }
 
-    if (qualityLevel != -1) {
+    if (ctx->qualityLevel != -1) {
         if (w * h < JPEG_MIN_RECT_SIZE) {
             return 0;
         }
     } else {
         if ( rfbTightDisableGradient ||
-             w * h < tightConf[compressLevel].gradientMinRectSize ) {
+             w * h < tightConf[ctx->compressLevel].gradientMinRectSize ) {
             return 0;
         }
     }
 
     if (fmt->bitsPerPixel == 32) {
-        if (usePixelFormat24) {
-            avgError = DetectSmoothImage24(fmt, w, h);
-            if (qualityLevel != -1) {
-                return (avgError < tightConf[qualityLevel].jpegThreshold24);
+        if (ctx->usePixelFormat24) {
+            avgError = DetectSmoothImage24(ctx, fmt, w, h);
+            if (ctx->qualityLevel != -1) {
+                return (avgError < tightConf[ctx->qualityLevel].jpegThreshold24);
             }
-            return (avgError < tightConf[compressLevel].gradientThreshold24);
+            return (avgError < tightConf[ctx->compressLevel].gradientThreshold24);
+        } else if (ByteChannelMask(fmt) != 0) {
+            avgError = DetectSmoothImageBytes32(ctx, fmt, w, h);
         } else {
-            avgError = DetectSmoothImage32(fmt, w, h);
+            avgError = DetectSmoothImage32(ctx, fmt, w, h);
         }
     } else {
-        avgError = DetectSmoothImage16(fmt, w, h);
+        avgError = DetectSmoothImage16(ctx, fmt, w, h);
     }
-    if (qualityLevel != -1) {
-        return (avgError < tightConf[qualityLevel].jpegThreshold);
+    if (ctx->qualityLevel != -1) {
+        return (avgError < tightConf[ctx->qualityLevel].jpegThreshold);
     }
-    return (avgError < tightConf[compressLevel].gradientThreshold);
+    return (avgError < tightConf[ctx->compressLevel].gradientThreshold);
 }
 
 static unsigned long
-DetectSmoothImage24 (fmt, w, h)
+DetectSmoothImage24 (ctx, fmt, w, h)
+    rfbTightContextPtr ctx;
     rfbPixelFormat *fmt;
     int w, h;
 {
@@ -1501,7 +1921,8 @@ DetectSmoothImage24 (fmt, w, h)
     int x, y, d, dx, c;
     int diffStat[256];
     int pixelCount = 0;
-    int pix, left[3];
+    CARD32 diffs[DETECT_SUBROW_WIDTH + 1];
+    CARD8 *diff;
     unsigned long avgError;
 
     /* If client is big-endian, color samples begin from the second
@@ -1513,14 +1934,12 @@ DetectSmoothImage24 (fmt, w, h)
     y = 0, x = 0;
     while (y < h && x < w) {
         for (d = 0; d < h - y && d < w - x - DETECT_SUBROW_WIDTH; d++) {
-            for (c = 0; c < 3; c++) {
-                left[c] = (int)tightBeforeBuf[((y+d)*w+x+d)*4+off+c] & 0xFF;
-            }
-            for (dx = 1; dx <= DETECT_SUBROW_WIDTH; dx++) {
+            rfbPixelDiffs32(diffs,
+                            &((CARD32 *)ctx->tightBeforeBuf)[(y+d)*w+x+d]);
+            for (dx = 0; dx < DETECT_SUBROW_WIDTH; dx++) {
+                diff = (CARD8 *)&diffs[dx];
                 for (c = 0; c < 3; c++) {
-                    pix = (int)tightBeforeBuf[((y+d)*w+x+d+dx)*4+off+c] & 0xFF;
-                    diffStat[abs(pix - left[c])]++;
-                    left[c] = pix;
+                    diffStat[diff[off+c]]++;
                 }
                 pixelCount++;
             }
@@ -1554,7 +1973,8 @@ DetectSmoothImage24 (fmt, w, h)
 #define DEFINE_DETECT_FUNCTION(bpp)                                          \
                                                                              \
 static unsigned long                                                         \
-DetectSmoothImage##bpp (fmt, w, h)                                           \
+DetectSmoothImage##bpp (ctx, fmt, w, h)                                      \
+    rfbTightContextPtr ctx;                                                  \
     rfbPixelFormat *fmt;                                                     \
     int w, h;                                                                \
 {                                                                            \
@@ -1565,7 +1985,6 @@ DetectSmoothImage##bpp (fmt, w, h)                                           \
     int diffStat[256];                                                       \
     int pixelCount = 0;                                                      \
     int sample, sum, left[3];                                                \
-    unsigned long avgError;                                                  \
                                                                              \
     endianMismatch = (!rfbServerFormat.bigEndian != !fmt->bigEndian);        \
                                                                              \
@@ -1581,7 +2000,7 @@ DetectSmoothImage##bpp (fmt, w, h)                                           \
     y = 0, x = 0;                                                            \
     while (y < h && x < w) {                                                 \
         for (d = 0; d < h - y && d < w - x - DETECT_SUBROW_WIDTH; d++) {     \
-            pix = ((CARD##bpp *)tightBeforeBuf)[(y+d)*w+x+d];                \
+            pix = ((CARD##bpp *)ctx->tightBeforeBuf)[(y+d)*w+x+d];           \
             if (endianMismatch) {                                            \
                 pix = Swap##bpp(pix);                                        \
             }                                                                \
@@ -1589,7 +2008,7 @@ DetectSmoothImage##bpp (fmt, w, h)                                           \
                 left[c] = (int)(pix >> shiftBits[c] & maxColor[c]);          \
             }                                                                \
             for (dx = 1; dx <= DETECT_SUBROW_WIDTH; dx++) {                  \
-                pix = ((CARD##bpp *)tightBeforeBuf)[(y+d)*w+x+d+dx];         \
+                pix = ((CARD##bpp *)ctx->tightBeforeBuf)[(y+d)*w+x+d+dx];    \
                 if (endianMismatch) {                                        \
                     pix = Swap##bpp(pix);                                    \
                 }                                                            \
@@ -1614,100 +2033,249 @@ DetectSmoothImage##bpp (fmt, w, h)                                           \
         }                                                                    \
     }                                                                        \
                                                                              \
-    if ((diffStat[0] + diffStat[1]) * 100 / pixelCount >= 90)                \
-        return 0;                                                            \
-                                                                             \
-    avgError = 0;                                                            \
-    for (c = 1; c < 8; c++) {                                                \
-        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);     \
-        if (diffStat[c] == 0 || diffStat[c] > diffStat[c-1] * 2)             \
-            return 0;                                                        \
-    }                                                                        \
-    for (; c < 256; c++) {                                                   \
-        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);     \
-    }                                                                        \
-    avgError /= (pixelCount - diffStat[0]);                                  \
-                                                                             \
-    return avgError;                                                         \
+    return SmoothImageError(diffStat, pixelCount);                           \
 }
 
 DEFINE_DETECT_FUNCTION(16)
 DEFINE_DETECT_FUNCTION(32)
 
+/*
+ * The same for 32-bit pixels with 8-bit byte-aligned color components,
+ * taking the differences of a whole sub-row at once.
+ */
+
+static unsigned long
+DetectSmoothImageBytes32 (ctx, fmt, w, h)
+    rfbTightContextPtr ctx;
+    rfbPixelFormat *fmt;
+    int w, h;
+{
+    Bool endianMismatch;
+    CARD32 diffs[DETECT_SUBROW_WIDTH + 1];
+    CARD32 diff;
+    int shiftBits[3];
+    int x, y, d, dx;
+    int diffStat[256];
+    int pixelCount = 0;
+    int sum;
+
+    endianMismatch = (!rfbServerFormat.bigEndian != !fmt->bigEndian);
+
+    shiftBits[0] = fmt->redShift;
+    shiftBits[1] = fmt->greenShift;
+    shiftBits[2] = fmt->blueShift;
+
+    memset(diffStat, 0, 256*sizeof(int));
+
+    y = 0, x = 0;
+    while (y < h && x < w) {
+        for (d = 0; d < h - y && d < w - x - DETECT_SUBROW_WIDTH; d++) {
+            rfbPixelDiffs32(diffs,
+                            &((CARD32 *)ctx->tightBeforeBuf)[(y+d)*w+x+d]);
+            for (dx = 0; dx < DETECT_SUBROW_WIDTH; dx++) {
+                diff = diffs[dx];
+                if (endianMismatch) {
+                    diff = Swap32(diff);
+                }
+                sum = (int)(diff >> shiftBits[0] & 0xFF) +
+                    (int)(diff >> shiftBits[1] & 0xFF) +
+                    (int)(diff >> shiftBits[2] & 0xFF);
+                if (sum > 255)
+                    sum = 255;
+                diffStat[sum]++;
+                pixelCount++;
+            }
+        }
+        if (w > h) {
+            x += h;
+            y = 0;
+        } else {
+            x = 0;
+            y += w;
+        }
+    }
+
+    return SmoothImageError(diffStat, pixelCount);
+}
 
 /*
- * JPEG compression stuff.
+ * Average error of a rectangle from its histogram of summed differences
+ * between neighbouring pixels, or 0 if it does not look smooth.
  */
 
-static struct jpeg_destination_mgr jpegDstManager;
-static Bool jpegError;
-static int jpegDstDataLen;
+static unsigned long
+SmoothImageError(diffStat, pixelCount)
+    int *diffStat;
+    int pixelCount;
+{
+    unsigned long avgError;
+    int c;
+
+    if ((diffStat[0] + diffStat[1]) * 100 / pixelCount >= 90)
+        return 0;
+
+    avgError = 0;
+    for (c = 1; c < 8; c++) {
+        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);
+        if (diffStat[c] == 0 || diffStat[c] > diffStat[c-1] * 2)
+            return 0;
+    }
+    for (; c < 256; c++) {
+        avgError += (unsigned long)diffStat[c] * (unsigned long)(c * c);
+    }
+    avgError /= (pixelCount - diffStat[0]);
+
+    return avgError;
+}
+
+
+/*
+ * JPEG compression stuff.
+ *
+ * Each context keeps its compressor, so an encoding thread sets libjpeg
+ * up once rather than for every rectangle.  When libjpeg-turbo can read
+ * the framebuffer's own 32-bit layout (the JCS_EXT_ colour spaces), all
+ * rows of the rectangle go to it straight from the framebuffer;
+ * otherwise each row is converted to RGB first.
+ */
 
 static Bool
-SendJpegRect(cl, x, y, w, h, quality)
+SendJpegRect(ctx, cl, x, y, w, h, quality)
+    rfbTightContextPtr ctx;
     rfbClientPtr cl;
     int x, y, w, h;
     int quality;
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    CARD8 *srcBuf;
+    j_compress_ptr cinfo = &ctx->jpegCinfo;
+    J_COLOR_SPACE colorSpace;
     JSAMPROW rowPointer[1];
     int dy;
 
     if (rfbServerFormat.bitsPerPixel == 8)
-        return SendFullColorRect(cl, w, h);
+        return SendFullColorRect(ctx, cl, w, h);
 
-    srcBuf = (CARD8 *)xalloc(w * 3);
-    if (srcBuf == NULL) {
-        return SendFullColorRect(cl, w, h);
-    }
-    rowPointer[0] = srcBuf;
+    colorSpace = JpegFramebufferColorSpace();
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
+    if (colorSpace != JCS_UNKNOWN && ctx->jpegRowsSize < h) {
+        if (ctx->jpegRows != NULL)
+            xfree((char *)ctx->jpegRows);
+        ctx->jpegRows = (JSAMPROW *)xalloc(h * sizeof(JSAMPROW));
+        ctx->jpegRowsSize = (ctx->jpegRows != NULL) ? h : 0;
+        if (ctx->jpegRows == NULL)
+            return SendFullColorRect(ctx, cl, w, h);
+    }
+    if (colorSpace == JCS_UNKNOWN && ctx->jpegRowBufSize < w * 3) {
+        if (ctx->jpegRowBuf != NULL)
+            xfree((char *)ctx->jpegRowBuf);
+        ctx->jpegRowBuf = (CARD8 *)xalloc(w * 3);
+        ctx->jpegRowBufSize = (ctx->jpegRowBuf != NULL) ? w * 3 : 0;
+        if (ctx->jpegRowBuf == NULL)
+            return SendFullColorRect(ctx, cl, w, h);
+    }
 
-    cinfo.image_width = w;
-    cinfo.image_height = h;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
+    if (!ctx->jpegInited) {
+        cinfo->err = jpeg_std_error(&ctx->jpegErr);
+        jpeg_create_compress(cinfo);
+        JpegSetDstManager(ctx, cinfo);
+        ctx->jpegInited = TRUE;
+    }
 
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo->image_width = w;
+    cinfo->image_height = h;
+    if (colorSpace != JCS_UNKNOWN) {
+        cinfo->input_components = 4;
+        cinfo->in_color_space = colorSpace;
+    } else {
+        cinfo->input_components = 3;
+        cinfo->in_color_space = JCS_RGB;
+    }
 
-    JpegSetDstManager (&cinfo);
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, quality, TRUE);
+    /* Quality never goes above 80 here, where the fast DCT loses
+       nothing visible. */
+    cinfo->dct_method = JDCT_IFAST;
 
-    jpeg_start_compress(&cinfo, TRUE);
+    jpeg_start_compress(cinfo, TRUE);
 
-    for (dy = 0; dy < h; dy++) {
-        PrepareRowForJpeg(srcBuf, x, y + dy, w);
-        jpeg_write_scanlines(&cinfo, rowPointer, 1);
-        if (jpegError)
-            break;
+    if (colorSpace != JCS_UNKNOWN) {
+        for (dy = 0; dy < h; dy++) {
+            ctx->jpegRows[dy] = (JSAMPROW)
+                &ctx->fbMemory[(y + dy) * ctx->fbStride + x * 4];
+        }
+        jpeg_write_scanlines(cinfo, ctx->jpegRows, h);
+    } else {
+        rowPointer[0] = ctx->jpegRowBuf;
+        for (dy = 0; dy < h; dy++) {
+            PrepareRowForJpeg(ctx, ctx->jpegRowBuf, x, y + dy, w);
+            jpeg_write_scanlines(cinfo, rowPointer, 1);
+            if (ctx->jpegError)
+                break;
+        }
     }
 
-    if (!jpegError)
-        jpeg_finish_compress(&cinfo);
+    if (!ctx->jpegError)
+        jpeg_finish_compress(cinfo);
+    else
+        jpeg_abort_compress(cinfo);
 
-    jpeg_destroy_compress(&cinfo);
-    xfree((char *)srcBuf);
+    if (ctx->jpegError)
+        return SendFullColorRect(ctx, cl, w, h);
 
-    if (jpegError)
-        return SendFullColorRect(cl, w, h);
+    if (!TightReserve(ctx, 1))
+        return FALSE;
 
-    if (ublen + TIGHT_MIN_TO_COMPRESS + 1 > UPDATE_BUF_SIZE) {
-        if (!rfbSendUpdateBuf(cl))
-            return FALSE;
-    }
+    ctx->outBuf[ctx->outLen++] = (char)(rfbTightJpeg << 4) | compControl(ctx);
+
+    return SendCompressedData(ctx, ctx->jpegDstDataLen);
+}
+
+/*
+ * The libjpeg-turbo colour space the framebuffer's pixels are in, or
+ * JCS_UNKNOWN if there is none.
+ */
 
-    updateBuf[ublen++] = (char)(rfbTightJpeg << 4) | compControl(cl);
-    cl->rfbBytesSent[rfbEncodingTight]++;
+static J_COLOR_SPACE
+JpegFramebufferColorSpace()
+{
+#ifdef JCS_EXTENSIONS
+    int r, g, b;
+
+    if (rfbServerFormat.bitsPerPixel != 32 ||
+        rfbServerFormat.redMax != 0xFF || rfbServerFormat.greenMax != 0xFF ||
+        rfbServerFormat.blueMax != 0xFF)
+        return JCS_UNKNOWN;
+
+    r = JpegByteOf(rfbServerFormat.redShift);
+    g = JpegByteOf(rfbServerFormat.greenShift);
+    b = JpegByteOf(rfbServerFormat.blueShift);
+
+    if (r == 0 && g == 1 && b == 2)
+        return JCS_EXT_RGBX;
+    if (b == 0 && g == 1 && r == 2)
+        return JCS_EXT_BGRX;
+    if (r == 1 && g == 2 && b == 3)
+        return JCS_EXT_XRGB;
+    if (b == 1 && g == 2 && r == 3)
+        return JCS_EXT_XBGR;
+#endif
+    return JCS_UNKNOWN;
+}
 
-    return SendCompressedData(cl, jpegDstDataLen);
+/* Which byte of a framebuffer pixel in memory holds the 8 bits at shift. */
+
+static int
+JpegByteOf(shift)
+    int shift;
+{
+    if (shift % 8 != 0)
+        return -1;
+    return (rfbServerFormat.bigEndian ? 3 - shift / 8 : shift / 8);
 }
 
 static void
-PrepareRowForJpeg(dst, x, y, count)
+PrepareRowForJpeg(ctx, dst, x, y, count)
+    rfbTightContextPtr ctx;
     CARD8 *dst;
     int x, y, count;
 {
@@ -1715,18 +2283,19 @@ PrepareRowForJpeg(dst, x, y, count)
         if ( rfbServerFormat.redMax == 0xFF &&
              rfbServerFormat.greenMax == 0xFF &&
              rfbServerFormat.blueMax == 0xFF ) {
-            PrepareRowForJpeg24(dst, x, y, count);
+            PrepareRowForJpeg24(ctx, dst, x, y, count);
         } else {
-            PrepareRowForJpeg32(dst, x, y, count);
+            PrepareRowForJpeg32(ctx, dst, x, y, count);
         }
     } else {
         /* 16 bpp assumed. */
-        PrepareRowForJpeg16(dst, x, y, count);
+        PrepareRowForJpeg16(ctx, dst, x, y, count);
     }
 }
 
 static void
-PrepareRowForJpeg24(dst, x, y, count)
+PrepareRowForJpeg24(ctx, dst, x, y, count)
+    rfbTightContextPtr ctx;
     CARD8 *dst;
     int x, y, count;
 {
@@ -1734,7 +2303,7 @@ PrepareRowForJpeg24(dst, x, y, count)
     CARD32 pix;
 
     fbptr = (CARD32 *)
-        &rfbScreen.pfbMemory[y * rfbScreen.paddedWidthInBytes + x * 4];
+        &ctx->fbMemory[y * ctx->fbStride + x * 4];
 
     while (count--) {
         pix = *fbptr++;
@@ -1747,7 +2316,8 @@ PrepareRowForJpeg24(dst, x, y, count)
 #define DEFINE_JPEG_GET_ROW_FUNCTION(bpp)                                   \
                                                                             \
 static void                                                                 \
-PrepareRowForJpeg##bpp(dst, x, y, count)                                    \
+PrepareRowForJpeg##bpp(ctx, dst, x, y, count)                               \
+    rfbTightContextPtr ctx;                                                 \
     CARD8 *dst;                                                             \
     int x, y, count;                                                        \
 {                                                                           \
@@ -1756,8 +2326,7 @@ PrepareRowForJpeg##bpp(dst, x, y, count)                                    \
     int inRed, inGreen, inBlue;                                             \
                                                                             \
     fbptr = (CARD##bpp *)                                                   \
-        &rfbScreen.pfbMemory[y * rfbScreen.paddedWidthInBytes +             \
-                             x * (bpp / 8)];                                \
+        &ctx->fbMemory[y * ctx->fbStride + x * (bpp / 8)];                  \
                                                                             \
     while (count--) {                                                       \
         pix = *fbptr++;                                                     \
@@ -1788,17 +2357,21 @@ DEFINE_JPEG_GET_ROW_FUNCTION(32)
 static void
 JpegInitDestination(j_compress_ptr cinfo)
 {
-    jpegError = FALSE;
-    jpegDstManager.next_output_byte = (JOCTET *)tightAfterBuf;
-    jpegDstManager.free_in_buffer = (size_t)tightAfterBufSize;
+    rfbTightContextPtr ctx = (rfbTightContextPtr)cinfo->dest;
+
+    ctx->jpegError = FALSE;
+    ctx->jpegDstManager.next_output_byte = (JOCTET *)ctx->tightAfterBuf;
+    ctx->jpegDstManager.free_in_buffer = (size_t)ctx->tightAfterBufSize;
 }
 
 static boolean
 JpegEmptyOutputBuffer(j_compress_ptr cinfo)
 {
-    jpegError = TRUE;
-    jpegDstManager.next_output_byte = (JOCTET *)tightAfterBuf;
-    jpegDstManager.free_in_buffer = (size_t)tightAfterBufSize;
+    rfbTightContextPtr ctx = (rfbTightContextPtr)cinfo->dest;
+
+    ctx->jpegError = TRUE;
+    ctx->jpegDstManager.next_output_byte = (JOCTET *)ctx->tightAfterBuf;
+    ctx->jpegDstManager.free_in_buffer = (size_t)ctx->tightAfterBufSize;
 
     return TRUE;
 }
@@ -1806,15 +2379,19 @@ JpegEmptyOutputBuffer(j_compress_ptr cinfo)
 static void
 JpegTermDestination(j_compress_ptr cinfo)
 {
-    jpegDstDataLen = tightAfterBufSize - jpegDstManager.free_in_buffer;
+    rfbTightContextPtr ctx = (rfbTightContextPtr)cinfo->dest;
+
+    ctx->jpegDstDataLen =
+        ctx->tightAfterBufSize - ctx->jpegDstManager.free_in_buffer;
 }
 
 static void
-JpegSetDstManager(j_compress_ptr cinfo)
+JpegSetDstManager(ctx, cinfo)
+    rfbTightContextPtr ctx;
+    j_compress_ptr cinfo;
 {
-    jpegDstManager.init_destination = JpegInitDestination;
-    jpegDstManager.empty_output_buffer = JpegEmptyOutputBuffer;
-    jpegDstManager.term_destination = JpegTermDestination;
-    cinfo->dest = &jpegDstManager;
+    ctx->jpegDstManager.init_destination = JpegInitDestination;
+    ctx->jpegDstManager.empty_output_buffer = JpegEmptyOutputBuffer;
+    ctx->jpegDstManager.term_destination = JpegTermDestination;
+    cinfo->dest = &ctx->jpegDstManager;
 }
-
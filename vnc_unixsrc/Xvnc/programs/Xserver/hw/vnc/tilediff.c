@@ -0,0 +1,256 @@
+/*
+ * tilediff.c
+ *
+ * Removing unchanged parts of the framebuffer from a client's update by
+ * comparing hashes of fixed-size tiles.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * The drawing wrappers in draw.c report every pixel an X request touches,
+ * even when it is painted with the colour it already had.  With tile
+ * diffing enabled each client keeps one hash per TILEDIFF_SIZE square
+ * tile of the framebuffer, describing the pixels the client was last
+ * sent.  Tiles whose current hash is the same are dropped from the region
+ * before it is encoded.
+ *
+ * A stored hash is only meaningful while the client really holds those
+ * pixels, so it is cleared (set to zero) whenever that may not be true:
+ * when a pushed datagram is given up on, when a CopyRect is sent into the
+ * tile, when part of the tile stays pending, and when the client asks for
+ * a non-incremental update.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+Bool rfbTileDiff = FALSE;
+
+#define TILES_X ((rfbScreen.width + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE)
+#define TILES_Y ((rfbScreen.height + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE)
+
+#define HASH_PRIME1 0x01000193
+#define HASH_PRIME2 0x9E3779B1
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+static xRectangle *unchangedRects = NULL;
+static int unchangedRectsSize = 0;
+
+static void TileHash(int x, int y, int w, int h, CARD32 *hash);
+
+
+/*
+ * Subtract from region every tile whose pixels are the same as when the
+ * client was last sent them, and remember the current hash of every other
+ * tile the region touches.
+ */
+
+void
+rfbTileDiffSubtract(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    BoxPtr ext;
+    BoxRec tile;
+    RegionPtr unchanged;
+    CARD32 hash[2], *stored;
+    int tx, ty, tx1, ty1, tx2, ty2;
+    int nRects = 0;
+    unsigned long area;
+
+    if (!rfbTileDiff || !REGION_NOTEMPTY(pScreen, region))
+	return;
+
+    if (cl->tileHash == NULL) {
+	cl->tileHash = (CARD32 *)xalloc(TILES_X * TILES_Y * 2 *
+					sizeof(CARD32));
+	if (cl->tileHash == NULL) {
+	    rfbLog("rfbTileDiffSubtract: out of memory\n");
+	    return;
+	}
+	memset(cl->tileHash, 0, TILES_X * TILES_Y * 2 * sizeof(CARD32));
+    }
+
+    if (unchangedRectsSize < TILES_X * TILES_Y) {
+	if (unchangedRects != NULL)
+	    xfree((char *)unchangedRects);
+	unchangedRects = (xRectangle *)xalloc(TILES_X * TILES_Y *
+					      sizeof(xRectangle));
+	if (unchangedRects == NULL) {
+	    unchangedRectsSize = 0;
+	    rfbLog("rfbTileDiffSubtract: out of memory\n");
+	    return;
+	}
+	unchangedRectsSize = TILES_X * TILES_Y;
+    }
+
+    ext = REGION_EXTENTS(pScreen, region);
+    tx1 = ext->x1 / TILEDIFF_SIZE;
+    ty1 = ext->y1 / TILEDIFF_SIZE;
+    tx2 = (ext->x2 + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE;
+    ty2 = (ext->y2 + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE;
+    if (tx2 > TILES_X)
+	tx2 = TILES_X;
+    if (ty2 > TILES_Y)
+	ty2 = TILES_Y;
+
+    for (ty = ty1; ty < ty2; ty++) {
+	tile.y1 = ty * TILEDIFF_SIZE;
+	tile.y2 = tile.y1 + TILEDIFF_SIZE;
+	if (tile.y2 > rfbScreen.height)
+	    tile.y2 = rfbScreen.height;
+
+	for (tx = tx1; tx < tx2; tx++) {
+	    tile.x1 = tx * TILEDIFF_SIZE;
+	    tile.x2 = tile.x1 + TILEDIFF_SIZE;
+	    if (tile.x2 > rfbScreen.width)
+		tile.x2 = rfbScreen.width;
+
+	    if (RECT_IN_REGION(pScreen, region, &tile) == rgnOUT)
+		continue;
+
+	    TileHash(tile.x1, tile.y1, tile.x2 - tile.x1, tile.y2 - tile.y1,
+		     hash);
+	    stored = &cl->tileHash[(ty * TILES_X + tx) * 2];
+
+	    if (stored[0] == hash[0] && stored[1] == hash[1]) {
+		unchangedRects[nRects].x = tile.x1;
+		unchangedRects[nRects].y = tile.y1;
+		unchangedRects[nRects].width = tile.x2 - tile.x1;
+		unchangedRects[nRects].height = tile.y2 - tile.y1;
+		nRects++;
+	    } else {
+		stored[0] = hash[0];
+		stored[1] = hash[1];
+	    }
+	}
+    }
+
+    if (nRects == 0)
+	return;
+
+    /* Tiles were collected row by row, each row sharing y and height. */
+    unchanged = RECTS_TO_REGION(pScreen, nRects, unchangedRects, CT_YXBANDED);
+    area = rfbRegionArea(region);
+    REGION_SUBTRACT(pScreen, region, region, unchanged);
+    REGION_DESTROY(pScreen, unchanged);
+
+    cl->pushStats.rfbTileDiffPixelsSaved += area - rfbRegionArea(region);
+}
+
+
+/*
+ * Forget the hashes of all tiles touched by region: the client's copy of
+ * those pixels is not known any more.
+ */
+
+void
+rfbTileDiffInvalidate(cl, region)
+    rfbClientPtr cl;
+    RegionPtr region;
+{
+    ScreenPtr pScreen = screenInfo.screens[0];
+    BoxPtr pbox;
+    int i, tx, ty, tx1, ty1, tx2, ty2;
+
+    if (cl->tileHash == NULL)
+	return;
+
+    for (i = 0; i < REGION_NUM_RECTS(region); i++) {
+	pbox = &REGION_RECTS(region)[i];
+	tx1 = pbox->x1 / TILEDIFF_SIZE;
+	ty1 = pbox->y1 / TILEDIFF_SIZE;
+	tx2 = (pbox->x2 + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE;
+	ty2 = (pbox->y2 + TILEDIFF_SIZE - 1) / TILEDIFF_SIZE;
+	if (tx2 > TILES_X)
+	    tx2 = TILES_X;
+	if (ty2 > TILES_Y)
+	    ty2 = TILES_Y;
+
+	for (ty = ty1; ty < ty2; ty++) {
+	    for (tx = tx1; tx < tx2; tx++) {
+		cl->tileHash[(ty * TILES_X + tx) * 2] = 0;
+		cl->tileHash[(ty * TILES_X + tx) * 2 + 1] = 0;
+	    }
+	}
+    }
+}
+
+
+void
+rfbTileDiffFree(cl)
+    rfbClientPtr cl;
+{
+    if (cl->tileHash != NULL) {
+	xfree((char *)cl->tileHash);
+	cl->tileHash = NULL;
+    }
+}
+
+
+/*
+ * Hash a rectangle of the framebuffer into two 32-bit values.  Each row
+ * is read as 32-bit words split over four independent lanes, two per
+ * multiplier, so the inner loop has no dependency between lanes and the
+ * compiler can keep them in one vector register.  The first word of hash
+ * is never zero, as zero marks an unknown tile.
+ */
+
+static void
+TileHash(x, y, w, h, hash)
+    int x, y, w, h;
+    CARD32 *hash;
+{
+    CARD32 a0 = 0x811C9DC5, a1 = 0x811C9DC5;
+    CARD32 b0 = 0x2545F491, b1 = 0x2545F491;
+    CARD32 *p;
+    CARD8 *row, *tail;
+    int rowBytes = w * (rfbScreen.bitsPerPixel / 8);
+    int nWords = rowBytes / 4;
+    int dy, i;
+
+    row = (CARD8 *)(rfbScreen.pfbMemory + rfbScreen.paddedWidthInBytes * y
+		    + x * (rfbScreen.bitsPerPixel / 8));
+
+    for (dy = 0; dy < h; dy++) {
+	p = (CARD32 *)row;
+
+	for (i = 0; i + 2 <= nWords; i += 2) {
+	    a0 = (a0 ^ p[i]) * HASH_PRIME1;
+	    b0 = (b0 ^ p[i]) * HASH_PRIME2;
+	    a1 = (a1 ^ p[i+1]) * HASH_PRIME1;
+	    b1 = (b1 ^ p[i+1]) * HASH_PRIME2;
+	}
+	if (i < nWords) {
+	    a0 = (a0 ^ p[i]) * HASH_PRIME1;
+	    b0 = (b0 ^ p[i]) * HASH_PRIME2;
+	}
+	for (tail = (CARD8 *)&p[nWords]; tail < row + rowBytes; tail++) {
+	    a1 = (a1 ^ *tail) * HASH_PRIME1;
+	    b1 = (b1 ^ *tail) * HASH_PRIME2;
+	}
+
+	row += rfbScreen.paddedWidthInBytes;
+    }
+
+    hash[0] = (a0 ^ ROTL32(a1, 16)) | 1;
+    hash[1] = b0 ^ ROTL32(b1, 16);
+}
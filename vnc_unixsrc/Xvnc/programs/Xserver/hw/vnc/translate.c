@@ -26,6 +26,9 @@
 
 static void PrintPixelFormat(rfbPixelFormat *pf);
 static Bool rfbSetClientColourMapBGR233();
+static Bool rfbInitShuffleTable(char **table, rfbPixelFormat *in,
+				rfbPixelFormat *out);
+static int ShuffleByte(rfbPixelFormat *pf, int shift);
 
 Bool rfbEconomicTranslate = FALSE;
 
@@ -175,6 +178,26 @@ rfbTranslateNone(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
 }
 
 
+/*
+ * rfbTranslateShuffle32 is used between 32-bit true colour formats with
+ * 8-bit red, green and blue in whole bytes, where translating only moves
+ * bytes around.  The table is the shuffle made by rfbInitShuffleTable.
+ */
+
+static void
+rfbTranslateShuffle32(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+		      char *iptr, char *optr, int bytesBetweenInputLines,
+		      int width, int height)
+{
+    while (height > 0) {
+	(*rfbShuffle32)((CARD8 *)optr, (CARD8 *)iptr, width, (CARD8 *)table);
+	iptr += bytesBetweenInputLines;
+	optr += width * 4;
+	height--;
+    }
+}
+
+
 /*
  * rfbSetTranslateFunction sets the translation function.
  */
@@ -284,6 +307,17 @@ rfbSetTranslateFunction(cl)
 	return TRUE;
     }
 
+    if (rfbShuffle32 != NULL &&
+	rfbInitShuffleTable(&cl->translateLookupTable,
+			    &rfbServerFormat, &cl->format)) {
+
+	/* only the byte order differs */
+
+	rfbLog("  translating by moving bytes\n");
+	cl->translateFn = rfbTranslateShuffle32;
+	return TRUE;
+    }
+
     if ((rfbServerFormat.bitsPerPixel < 16) ||
 	(!rfbEconomicTranslate && (rfbServerFormat.bitsPerPixel == 16))) {
 
@@ -315,6 +349,60 @@ rfbSetTranslateFunction(cl)
 
 
 
+/*
+ * rfbInitShuffleTable sets up the shuffle for rfbTranslateShuffle32 and
+ * returns TRUE, if the formats are ones it can translate between.  The
+ * result is the same as the RGB tables would give, padding bytes zero.
+ */
+
+static Bool
+rfbInitShuffleTable(char **table, rfbPixelFormat *in, rfbPixelFormat *out)
+{
+    CARD8 *shuffle;
+    int i;
+
+    if (in->bitsPerPixel != 32 || out->bitsPerPixel != 32 ||
+	in->redMax != 255 || in->greenMax != 255 || in->blueMax != 255 ||
+	out->redMax != 255 || out->greenMax != 255 || out->blueMax != 255 ||
+	ShuffleByte(in, in->redShift) < 0 ||
+	ShuffleByte(in, in->greenShift) < 0 ||
+	ShuffleByte(in, in->blueShift) < 0 ||
+	ShuffleByte(out, out->redShift) < 0 ||
+	ShuffleByte(out, out->greenShift) < 0 ||
+	ShuffleByte(out, out->blueShift) < 0)
+	return FALSE;
+
+    if (*table) free(*table);
+    *table = (char *)malloc(16);
+    shuffle = (CARD8 *)*table;
+
+    memset(shuffle, 0x80, 4);
+    shuffle[ShuffleByte(out, out->redShift)] = ShuffleByte(in, in->redShift);
+    shuffle[ShuffleByte(out, out->greenShift)] =
+	ShuffleByte(in, in->greenShift);
+    shuffle[ShuffleByte(out, out->blueShift)] =
+	ShuffleByte(in, in->blueShift);
+
+    for (i = 4; i < 16; i++)
+	shuffle[i] = (shuffle[i - 4] & 0x80) ? 0x80 : shuffle[i - 4] + 4;
+
+    return TRUE;
+}
+
+/*
+ * Which byte of a 32-bit pixel in memory holds the 8 bits at shift, or -1
+ * if they are not a whole byte.
+ */
+
+static int
+ShuffleByte(rfbPixelFormat *pf, int shift)
+{
+    if (shift % 8 != 0 || shift > 24)
+	return -1;
+    return (pf->bigEndian ? 3 - shift / 8 : shift / 8);
+}
+
+
 /*
  * rfbSetClientColourMapBGR233 sets the client's colour map so that it's
  * just like an 8-bit BGR233 true colour client.
@@ -63,7 +63,8 @@ rfbSendOneRectEncodingZlib(cl, x, y, w, h)
     int deflateResult;
     int previousOut;
     int i;
-    char *fbptr = (rfbScreen.pfbMemory + (rfbScreen.paddedWidthInBytes * y)
+    Bool inPlace;
+    char *fbptr = (CLIENT_FB_MEMORY(cl) + (CLIENT_FB_STRIDE(cl) * y)
     	   + (x * (rfbScreen.bitsPerPixel / 8)));
 
     int maxRawSize;
@@ -121,11 +122,15 @@ rfbSendOneRectEncodingZlib(cl, x, y, w, h)
     }
 
     /* 
-     * Convert pixel data to client format.
+     * Convert pixel data to client format.  If it is in the client's
+     * format already, the rows are compressed where they are instead.
      */
-    (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
-		       &cl->format, fbptr, zlibBeforeBuf,
-		       rfbScreen.paddedWidthInBytes, w, h);
+    inPlace = (cl->translateFn == rfbTranslateNone);
+    if (!inPlace) {
+	(*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
+			   &cl->format, fbptr, zlibBeforeBuf,
+			   CLIENT_FB_STRIDE(cl), w, h);
+    }
 
     cl->compStream.next_in = ( Bytef * )zlibBeforeBuf;
     cl->compStream.avail_in = w * h * (cl->format.bitsPerPixel / 8);
@@ -156,14 +161,33 @@ rfbSendOneRectEncodingZlib(cl, x, y, w, h)
 
     previousOut = cl->compStream.total_out;
 
-    /* Perform the compression here. */
-    deflateResult = deflate( &(cl->compStream), Z_SYNC_FLUSH );
+    /* Perform the compression here.  deflate's output does not depend on
+       how its input is split up, so both ways give the same bytes.  Input
+       left over means the output buffer filled up, which the worst case
+       size above should rule out. */
+    if (inPlace) {
+	deflateResult = Z_OK;
+	for (i = 0; i < h && deflateResult == Z_OK; i++) {
+	    cl->compStream.next_in =
+		( Bytef * )(fbptr + i * CLIENT_FB_STRIDE(cl));
+	    cl->compStream.avail_in = w * (cl->format.bitsPerPixel / 8);
+	    deflateResult = deflate( &(cl->compStream),
+				     (i == h - 1) ? Z_SYNC_FLUSH : Z_NO_FLUSH );
+	    if (deflateResult == Z_OK && cl->compStream.avail_in != 0)
+		deflateResult = Z_BUF_ERROR;
+	}
+    } else {
+	deflateResult = deflate( &(cl->compStream), Z_SYNC_FLUSH );
+	if (deflateResult == Z_OK && cl->compStream.avail_in != 0)
+	    deflateResult = Z_BUF_ERROR;
+    }
 
     /* Find the total size of the resulting compressed data. */
     zlibAfterBufLen = cl->compStream.total_out - previousOut;
 
     if ( deflateResult != Z_OK ) {
-        rfbLog("zlib deflation error: %s\n", cl->compStream.msg);
+        rfbLog("zlib deflation error: %s\n",
+	       cl->compStream.msg ? cl->compStream.msg : "output full");
         return FALSE;
     }
 
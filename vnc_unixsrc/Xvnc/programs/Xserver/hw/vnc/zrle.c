@@ -0,0 +1,607 @@
+/*
+ * zrle.c
+ *
+ * Routines to implement ZRLE encoding: 64x64 tiles, each sent solid, as
+ * packed palette indices, run-length encoded or raw, and all of it
+ * compressed with zlib.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/*
+ * ZRLE looks at each pixel once or twice and never tries a JPEG or a
+ * gradient filter, so it costs much less per pixel than Tight, and on
+ * text and flat user interface it compresses about as well.
+ *
+ * Each tile is scanned once for its runs and its palette, and then sent
+ * in whichever subencoding comes out smallest.  The sizes compared are
+ * exact, so a tile is never larger than its raw pixels and a subencoding
+ * byte.
+ *
+ * Over the connection the zlib stream runs on from one rectangle to the
+ * next and is never ended, as the protocol requires.  Pushed rectangles
+ * (cl->packing) use the encoding context's own stream, reset for every
+ * one and compressed as a complete stream (Z_FINISH), so that a datagram
+ * can be decoded whatever was lost before it.  The viewer decodes
+ * datagrams with an inflater of their own, which starts afresh whenever
+ * a stream ends.
+ */
+
+#include <stdio.h>
+#include "rfb.h"
+
+#define ZRLE_MAX_PALETTE 127	/* the most palette RLE can index */
+#define ZRLE_MAX_PACKED 16	/* the most packed palette can index */
+#define ZRLE_HASH_SIZE 256	/* must be a power of two */
+#define ZRLE_HASH(pix) (((pix) ^ ((pix) >> 7) ^ ((pix) >> 13) ^ \
+			 ((pix) >> 22)) & (ZRLE_HASH_SIZE - 1))
+
+/*
+ * Everything the encoder changes while it works on a rectangle lives in
+ * an rfbZrleContext, as Tight's does in an rfbTightContext, so pushed
+ * tiles can be encoded on the encoder pool with a context per worker.
+ * Encoded rectangles, headers included, are appended to the context's
+ * output buffer rather than written into updateBuf.
+ */
+
+typedef struct rfbZrleContext {
+    /* The tiles of the rectangle being encoded, before deflate. */
+    int beforeBufSize;
+    char *beforeBuf;
+    int beforeBufLen;
+
+    /* One tile in the client's format. */
+    CARD32 tile[rfbZRLETileWidth * rfbZRLETileHeight];
+
+    /* Bytes of a pixel sent as a CPIXEL, and the first of them in memory. */
+    int cpixelBytes;
+    int cpixelOffset;
+
+    /* Colours of the current tile, ZRLE_MAX_PALETTE + 1 of them if too
+       many. */
+    struct {
+	int size;
+	CARD32 colours[ZRLE_MAX_PALETTE];
+	unsigned char slots[ZRLE_HASH_SIZE];	/* index + 1, 0 if free */
+    } palette;
+
+    /* Stream for rectangles that must decode on their own, reset for each
+       of them. */
+    z_stream ownStream;
+    Bool ownStreamInited;
+
+    /* Encoded output. */
+    char *outBuf;
+    int outLen, outSize;
+    int nRects;
+} rfbZrleContext;
+
+/* Context used by rfbSendRectEncodingZRLE(). */
+static rfbZrleContextPtr defaultContext = NULL;
+
+static Bool ZrleEncodeRect(rfbZrleContextPtr ctx, rfbClientPtr cl,
+			   int x, int y, int w, int h, Bool selfContained);
+static Bool ZrleReserve(rfbZrleContextPtr ctx, int len);
+static void ZrleSetCPixel(rfbZrleContextPtr ctx, rfbClientPtr cl);
+static void PaletteReset(rfbZrleContextPtr ctx);
+static void PaletteAdd(rfbZrleContextPtr ctx, CARD32 pix);
+static int PaletteIndex(rfbZrleContextPtr ctx, CARD32 pix);
+static void PutRunLength(rfbZrleContextPtr ctx, int len);
+static void ZrleEncodeTile8(rfbZrleContextPtr ctx, CARD8 *data, int w, int h);
+static void ZrleEncodeTile16(rfbZrleContextPtr ctx, CARD16 *data,
+			     int w, int h);
+static void ZrleEncodeTile32(rfbZrleContextPtr ctx, CARD32 *data,
+			     int w, int h);
+
+
+rfbZrleContextPtr
+rfbZrleNewContext()
+{
+    rfbZrleContextPtr ctx;
+
+    ctx = (rfbZrleContextPtr)xalloc(sizeof(rfbZrleContext));
+    if (ctx == NULL)
+	return NULL;
+    memset(ctx, 0, sizeof(rfbZrleContext));
+    ctx->ownStreamInited = FALSE;
+    return ctx;
+}
+
+void
+rfbZrleFreeContext(ctx)
+    rfbZrleContextPtr ctx;
+{
+    if (ctx->ownStreamInited)
+	deflateEnd(&ctx->ownStream);
+    if (ctx->beforeBuf != NULL)
+	xfree(ctx->beforeBuf);
+    if (ctx->outBuf != NULL)
+	xfree(ctx->outBuf);
+    xfree((char *)ctx);
+}
+
+
+/*
+ * rfbSendRectEncodingZRLE - send a given rectangle using ZRLE encoding.
+ */
+
+Bool
+rfbSendRectEncodingZRLE(cl, x, y, w, h)
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    rfbZrleContextPtr ctx;
+    int i, portionLen;
+
+    if (defaultContext == NULL) {
+	defaultContext = rfbZrleNewContext();
+	if (defaultContext == NULL)
+	    return FALSE;
+    }
+    ctx = defaultContext;
+    ctx->outLen = 0;
+    ctx->nRects = 0;
+
+    /* Pushed rectangles go in datagrams, any of which may be lost. */
+    handleNewBlock = 0;
+    if (!ZrleEncodeRect(ctx, cl, x, y, w, h, cl->packing))
+	return FALSE;
+
+    cl->rfbRectanglesSent[rfbEncodingZRLE] += ctx->nRects;
+    cl->rfbBytesSent[rfbEncodingZRLE] += ctx->outLen;
+
+    for (i = 0; i < ctx->outLen; i += portionLen) {
+	if (ublen == UPDATE_BUF_SIZE) {
+	    if (!rfbSendUpdateBuf(cl) || ublen == UPDATE_BUF_SIZE)
+		return FALSE;
+	}
+	portionLen = ctx->outLen - i;
+	if (portionLen > UPDATE_BUF_SIZE - ublen)
+	    portionLen = UPDATE_BUF_SIZE - ublen;
+	memcpy(&updateBuf[ublen], &ctx->outBuf[i], portionLen);
+	ublen += portionLen;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Encode a rectangle so that it can be decoded on its own, with the
+ * context's stream reset and finished.  The rectangle, header included,
+ * is appended to the context's output; rfbZrleContextOutput() gives
+ * access to it.  This may run on any thread as long as the framebuffer
+ * and the client's pixel format do not change meanwhile.
+ */
+
+Bool
+rfbZrleEncodeTile(ctx, cl, x, y, w, h)
+    rfbZrleContextPtr ctx;
+    rfbClientPtr cl;
+    int x, y, w, h;
+{
+    return ZrleEncodeRect(ctx, cl, x, y, w, h, TRUE);
+}
+
+/*
+ * Return the output accumulated since the last rfbZrleResetOutput() call
+ * and the number of rectangles it holds.
+ */
+
+char *
+rfbZrleContextOutput(ctx, len, nRects)
+    rfbZrleContextPtr ctx;
+    int *len;
+    int *nRects;
+{
+    *len = ctx->outLen;
+    *nRects = ctx->nRects;
+    return ctx->outBuf;
+}
+
+void
+rfbZrleResetOutput(ctx)
+    rfbZrleContextPtr ctx;
+{
+    ctx->outLen = 0;
+    ctx->nRects = 0;
+}
+
+/*
+ * Append one rectangle to the context's output.  Over the connection it
+ * continues the client's stream; a self-contained one gets the context's
+ * own stream, reset and finished.
+ */
+
+static Bool
+ZrleEncodeRect(ctx, cl, x, y, w, h, selfContained)
+    rfbZrleContextPtr ctx;
+    rfbClientPtr cl;
+    int x, y, w, h;
+    Bool selfContained;
+{
+    rfbFramebufferUpdateRectHeader rect;
+    rfbZRLEHeader hdr;
+    int maxRawSize, maxCompSize;
+    int tx, ty, tw, th;
+    z_stream *zs;
+    Bool *zsInited;
+    int flush, deflateResult, previousOut, compLen, start;
+    char *fbptr;
+
+    /* At worst every tile is raw, a subencoding byte and its pixels. */
+    maxRawSize = (w * h * (cl->format.bitsPerPixel / 8)
+		  + ((w + rfbZRLETileWidth - 1) / rfbZRLETileWidth)
+		  * ((h + rfbZRLETileHeight - 1) / rfbZRLETileHeight));
+
+    if (ctx->beforeBufSize < maxRawSize) {
+	ctx->beforeBufSize = maxRawSize;
+	if (ctx->beforeBuf == NULL)
+	    ctx->beforeBuf = (char *)xalloc(ctx->beforeBufSize);
+	else
+	    ctx->beforeBuf = (char *)xrealloc(ctx->beforeBuf,
+					      ctx->beforeBufSize);
+    }
+
+    /* Room for deflate's worst case, its header and its trailer. */
+    maxCompSize = maxRawSize + ((maxRawSize + 99) / 100) + 18;
+
+    if (ctx->beforeBuf == NULL ||
+	!ZrleReserve(ctx, (sz_rfbFramebufferUpdateRectHeader
+			   + sz_rfbZRLEHeader + maxCompSize))) {
+	rfbLog("rfbSendRectEncodingZRLE: out of memory\n");
+	return FALSE;
+    }
+
+    ZrleSetCPixel(ctx, cl);
+    ctx->beforeBufLen = 0;
+
+    for (ty = y; ty < y + h; ty += rfbZRLETileHeight) {
+	th = y + h - ty;
+	if (th > rfbZRLETileHeight)
+	    th = rfbZRLETileHeight;
+
+	for (tx = x; tx < x + w; tx += rfbZRLETileWidth) {
+	    tw = x + w - tx;
+	    if (tw > rfbZRLETileWidth)
+		tw = rfbZRLETileWidth;
+
+	    fbptr = (CLIENT_FB_MEMORY(cl) + (CLIENT_FB_STRIDE(cl) * ty)
+		     + (tx * (rfbScreen.bitsPerPixel / 8)));
+
+	    (*cl->translateFn)(cl->translateLookupTable, &rfbServerFormat,
+			       &cl->format, fbptr, (char *)ctx->tile,
+			       CLIENT_FB_STRIDE(cl), tw, th);
+
+	    switch (cl->format.bitsPerPixel) {
+	    case 8:
+		ZrleEncodeTile8(ctx, (CARD8 *)ctx->tile, tw, th);
+		break;
+	    case 16:
+		ZrleEncodeTile16(ctx, (CARD16 *)ctx->tile, tw, th);
+		break;
+	    case 32:
+		ZrleEncodeTile32(ctx, (CARD32 *)ctx->tile, tw, th);
+		break;
+	    }
+	}
+    }
+
+    if (selfContained) {
+	zs = &ctx->ownStream;
+	zsInited = &ctx->ownStreamInited;
+	flush = Z_FINISH;
+    } else {
+	zs = &cl->zrleStream;
+	zsInited = &cl->zrleStreamInited;
+	flush = Z_SYNC_FLUSH;
+    }
+
+    if (!*zsInited) {
+	zs->zalloc = Z_NULL;
+	zs->zfree = Z_NULL;
+	zs->opaque = Z_NULL;
+	if (deflateInit(zs, cl->zlibCompressLevel) != Z_OK) {
+	    rfbLog("zrle deflateInit error: %s\n", zs->msg);
+	    return FALSE;
+	}
+	*zsInited = TRUE;
+    } else if (flush == Z_FINISH) {
+	deflateReset(zs);
+    }
+
+    start = ctx->outLen;
+
+    zs->next_in = (Bytef *)ctx->beforeBuf;
+    zs->avail_in = ctx->beforeBufLen;
+    zs->next_out = (Bytef *)&ctx->outBuf[start
+					 + sz_rfbFramebufferUpdateRectHeader
+					 + sz_rfbZRLEHeader];
+    zs->avail_out = maxCompSize;
+    zs->data_type = Z_BINARY;
+
+    previousOut = zs->total_out;
+    deflateResult = deflate(zs, flush);
+    compLen = zs->total_out - previousOut;
+
+    if (deflateResult != (flush == Z_FINISH ? Z_STREAM_END : Z_OK)) {
+	rfbLog("zrle deflation error: %s\n",
+	       zs->msg ? zs->msg : "output full");
+	return FALSE;
+    }
+
+    rect.r.x = Swap16IfLE(x);
+    rect.r.y = Swap16IfLE(y);
+    rect.r.w = Swap16IfLE(w);
+    rect.r.h = Swap16IfLE(h);
+    rect.encoding = Swap32IfLE(rfbEncodingZRLE);
+    memcpy(&ctx->outBuf[start], (char *)&rect,
+	   sz_rfbFramebufferUpdateRectHeader);
+
+    hdr.length = Swap32IfLE(compLen);
+    memcpy(&ctx->outBuf[start + sz_rfbFramebufferUpdateRectHeader],
+	   (char *)&hdr, sz_rfbZRLEHeader);
+
+    ctx->outLen = (start + sz_rfbFramebufferUpdateRectHeader
+		   + sz_rfbZRLEHeader + compLen);
+    ctx->nRects++;
+    return TRUE;
+}
+
+/*
+ * Make room for len more bytes of output.
+ */
+
+static Bool
+ZrleReserve(ctx, len)
+    rfbZrleContextPtr ctx;
+    int len;
+{
+    int newSize;
+    char *newBuf;
+
+    if (ctx->outLen + len <= ctx->outSize)
+	return TRUE;
+
+    newSize = (ctx->outSize != 0) ? ctx->outSize : UPDATE_BUF_SIZE / 16;
+    while (newSize < ctx->outLen + len)
+	newSize *= 2;
+
+    if (ctx->outBuf == NULL)
+	newBuf = (char *)xalloc(newSize);
+    else
+	newBuf = (char *)xrealloc(ctx->outBuf, newSize);
+    if (newBuf == NULL)
+	return FALSE;
+
+    ctx->outBuf = newBuf;
+    ctx->outSize = newSize;
+    return TRUE;
+}
+
+
+/*
+ * Work out how much of each pixel goes into a CPIXEL for this client.
+ */
+
+static void
+ZrleSetCPixel(ctx, cl)
+    rfbZrleContextPtr ctx;
+    rfbClientPtr cl;
+{
+    CARD32 colourBits;
+
+    ctx->cpixelBytes = cl->format.bitsPerPixel / 8;
+    ctx->cpixelOffset = 0;
+
+    if (cl->format.bitsPerPixel != 32 || !cl->format.trueColour ||
+	cl->format.depth > 24)
+	return;
+
+    colourBits = (((CARD32)cl->format.redMax << cl->format.redShift) |
+		  ((CARD32)cl->format.greenMax << cl->format.greenShift) |
+		  ((CARD32)cl->format.blueMax << cl->format.blueShift));
+
+    if ((colourBits & 0xff000000) == 0) {
+	ctx->cpixelBytes = 3;
+	ctx->cpixelOffset = (cl->format.bigEndian ? 1 : 0);
+    } else if ((colourBits & 0x000000ff) == 0) {
+	ctx->cpixelBytes = 3;
+	ctx->cpixelOffset = (cl->format.bigEndian ? 0 : 1);
+    }
+}
+
+
+static void
+PaletteReset(ctx)
+    rfbZrleContextPtr ctx;
+{
+    ctx->palette.size = 0;
+    memset(ctx->palette.slots, 0, sizeof(ctx->palette.slots));
+}
+
+static void
+PaletteAdd(ctx, pix)
+    rfbZrleContextPtr ctx;
+    CARD32 pix;
+{
+    int h;
+
+    if (ctx->palette.size > ZRLE_MAX_PALETTE)
+	return;
+
+    for (h = ZRLE_HASH(pix); ctx->palette.slots[h] != 0;
+	 h = (h + 1) & (ZRLE_HASH_SIZE - 1)) {
+	if (ctx->palette.colours[ctx->palette.slots[h] - 1] == pix)
+	    return;
+    }
+
+    if (ctx->palette.size == ZRLE_MAX_PALETTE) {
+	ctx->palette.size++;
+	return;
+    }
+    ctx->palette.colours[ctx->palette.size++] = pix;
+    ctx->palette.slots[h] = ctx->palette.size;
+}
+
+static int
+PaletteIndex(ctx, pix)
+    rfbZrleContextPtr ctx;
+    CARD32 pix;
+{
+    int h;
+
+    for (h = ZRLE_HASH(pix); ctx->palette.slots[h] != 0;
+	 h = (h + 1) & (ZRLE_HASH_SIZE - 1)) {
+	if (ctx->palette.colours[ctx->palette.slots[h] - 1] == pix)
+	    return ctx->palette.slots[h] - 1;
+    }
+    return -1;
+}
+
+static void
+PutRunLength(ctx, len)
+    rfbZrleContextPtr ctx;
+    int len;
+{
+    len--;
+    while (len >= 255) {
+	ctx->beforeBuf[ctx->beforeBufLen++] = (char)255;
+	len -= 255;
+    }
+    ctx->beforeBuf[ctx->beforeBufLen++] = (char)len;
+}
+
+
+/*
+ * ZrleEncodeTile8/16/32 append one tile, w*h pixels in the client's
+ * format, to ctx->beforeBuf.
+ */
+
+#define PUT_BYTE(b) (ctx->beforeBuf[ctx->beforeBufLen++] = (char)(b))
+
+#define PUT_CPIXEL(bpp, pix)						\
+{									\
+    CARD##bpp _px = (CARD##bpp)(pix);					\
+    memcpy(&ctx->beforeBuf[ctx->beforeBufLen],				\
+	   (char *)&_px + ctx->cpixelOffset, cpixelBytes);		\
+    ctx->beforeBufLen += cpixelBytes;					\
+}
+
+#define DEFINE_ZRLE_TILE(bpp)						      \
+									      \
+static void								      \
+ZrleEncodeTile##bpp(ctx, data, w, h)					      \
+    rfbZrleContextPtr ctx;						      \
+    CARD##bpp *data;							      \
+    int w, h;								      \
+{									      \
+    CARD##bpp *end = data + w * h;					      \
+    CARD##bpp *run, *p;							      \
+    int runs = 0, singles = 0, extraLengthBytes = 0;			      \
+    int rawSize, plainRleSize, paletteRleSize, packedSize;		      \
+    int cpixelBytes = ctx->cpixelBytes, nColours;			      \
+    int subencoding, bitsPerIndex, bits, nbits, i, x, y;		      \
+									      \
+    PaletteReset(ctx);							      \
+    for (run = data; run < end; run = p) {				      \
+	for (p = run + 1; p < end && *p == *run; p++)			      \
+	    ;								      \
+	if (p - run == 1) {						      \
+	    singles++;							      \
+	} else {							      \
+	    runs++;							      \
+	    extraLengthBytes += (p - run - 1) / 255;			      \
+	}								      \
+	PaletteAdd(ctx, *run);						      \
+    }									      \
+									      \
+    nColours = ctx->palette.size;					      \
+    if (nColours == 1) {						      \
+	PUT_BYTE(1);							      \
+	PUT_CPIXEL(bpp, data[0]);					      \
+	return;								      \
+    }									      \
+									      \
+    bitsPerIndex = (nColours <= 2 ? 1 : nColours <= 4 ? 2 : 4);		      \
+									      \
+    rawSize = cpixelBytes * w * h;					      \
+    plainRleSize = (cpixelBytes + 1) * (runs + singles) + extraLengthBytes;   \
+    paletteRleSize = (cpixelBytes * nColours + 2 * runs + singles	      \
+		      + extraLengthBytes);				      \
+    packedSize = (cpixelBytes * nColours				      \
+		  + (w * bitsPerIndex + 7) / 8 * h);			      \
+									      \
+    subencoding = 0;							      \
+    if (plainRleSize < rawSize) {					      \
+	subencoding = 128;						      \
+	rawSize = plainRleSize;						      \
+    }									      \
+    if (nColours <= ZRLE_MAX_PALETTE && paletteRleSize < rawSize) {	      \
+	subencoding = 128 + nColours;					      \
+	rawSize = paletteRleSize;					      \
+    }									      \
+    if (nColours <= ZRLE_MAX_PACKED && packedSize <= rawSize) {		      \
+	subencoding = nColours;						      \
+    }									      \
+									      \
+    PUT_BYTE(subencoding);						      \
+    if (subencoding != 0 && subencoding != 128) {			      \
+	for (i = 0; i < nColours; i++)					      \
+	    PUT_CPIXEL(bpp, ctx->palette.colours[i]);			      \
+    }									      \
+									      \
+    if (subencoding == 0) {						      \
+	for (p = data; p < end; p++)					      \
+	    PUT_CPIXEL(bpp, *p);					      \
+    } else if (subencoding < 128) {					      \
+	p = data;							      \
+	for (y = 0; y < h; y++) {					      \
+	    bits = 0;							      \
+	    nbits = 0;							      \
+	    for (x = 0; x < w; x++) {					      \
+		bits = (bits << bitsPerIndex) | PaletteIndex(ctx, *p++);      \
+		nbits += bitsPerIndex;					      \
+		if (nbits == 8) {					      \
+		    PUT_BYTE(bits);					      \
+		    bits = 0;						      \
+		    nbits = 0;						      \
+		}							      \
+	    }								      \
+	    if (nbits != 0)						      \
+		PUT_BYTE(bits << (8 - nbits));				      \
+	}								      \
+    } else {								      \
+	for (run = data; run < end; run = p) {				      \
+	    for (p = run + 1; p < end && *p == *run; p++)		      \
+		;							      \
+	    if (subencoding == 128) {					      \
+		PUT_CPIXEL(bpp, *run);					      \
+		PutRunLength(ctx, p - run);				      \
+	    } else if (p - run == 1) {					      \
+		PUT_BYTE(PaletteIndex(ctx, *run));			      \
+	    } else {							      \
+		PUT_BYTE(PaletteIndex(ctx, *run) | 128);		      \
+		PutRunLength(ctx, p - run);				      \
+	    }								      \
+	}								      \
+    }									      \
+}
+
+DEFINE_ZRLE_TILE(8)
+DEFINE_ZRLE_TILE(16)
+DEFINE_ZRLE_TILE(32)
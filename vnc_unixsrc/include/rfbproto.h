@@ -386,6 +386,8 @@ typedef struct _rfbInteractionCapsMsg {
 #define rfbBell 2
 #define rfbServerCutText 3
 
+#define rfbFecParity 150		/* pushed over UDP only */
+
 #define rfbFileListData 130
 #define rfbFileDownloadData 131
 #define rfbFileUploadCancel 132
@@ -409,6 +411,9 @@ typedef struct _rfbInteractionCapsMsg {
 #define rfbClientCutText 6
 
 #define rfbFramebufferUpdateAck 7
+#define rfbFramebufferUpdateSack 8
+#define rfbSetScale 9
+#define rfbFramebufferUpdateNack 10
 
 #define rfbFileListRequest 130
 #define rfbFileDownloadRequest 131
@@ -419,6 +424,8 @@ typedef struct _rfbInteractionCapsMsg {
 #define rfbFileCreateDirRequest 136
 
 /* signatures for non-standard messages */
+#define sig_rfbSetScale "SETSCALE"
+#define sig_rfbFramebufferUpdateNack "PUSHNACK"
 #define sig_rfbFileListRequest "FTC_LSRQ"
 #define sig_rfbFileDownloadRequest "FTC_DNRQ"
 #define sig_rfbFileUploadRequest "FTC_UPRQ"
@@ -482,6 +489,10 @@ typedef struct _rfbInteractionCapsMsg {
 #define rfbEncodingLastRect        0xFFFFFF20
 #define rfbEncodingNewFBSize       0xFFFFFF21
 
+#define rfbEncodingFecParity       0xFFFFFF30
+#define rfbEncodingTightLz4        0xFFFFFF31
+#define rfbEncodingServerPush      0xFFFFFF32
+
 #define rfbEncodingQualityLevel0   0xFFFFFFE0
 #define rfbEncodingQualityLevel1   0xFFFFFFE1
 #define rfbEncodingQualityLevel2   0xFFFFFFE2
@@ -500,6 +511,9 @@ typedef struct _rfbInteractionCapsMsg {
 #define sig_rfbEncodingPointerPos      "POINTPOS"
 #define sig_rfbEncodingLastRect        "LASTRECT"
 #define sig_rfbEncodingNewFBSize       "NEWFBSIZ"
+#define sig_rfbEncodingFecParity       "FECPARIT"
+#define sig_rfbEncodingTightLz4        "TIGHTLZ4"
+#define sig_rfbEncodingServerPush      "SRVRPUSH"
 #define sig_rfbEncodingQualityLevel0   "JPEGQLVL"
 
 
@@ -662,6 +676,38 @@ typedef struct _rfbZlibHeader {
 #define sz_rfbZlibHeader 4
 
 
+/*- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ * ZRLE - zlib run-length Encoding.  An rfbZRLEHeader giving the number of
+ * bytes to follow, then the zlib compressed data.  Uncompressed, the data
+ * is the rectangle's 64x64 tiles, left to right and top to bottom, each
+ * one a subencoding byte followed by:
+ *
+ *   0        raw CPIXELs
+ *   1        a single CPIXEL, the colour of the whole tile
+ *   2-16     a palette of that many CPIXELs, then the palette indices
+ *            packed 1, 2 or 4 bits to a pixel, most significant bits
+ *            first, each row padded to a whole byte
+ *   128      plain RLE: runs, each a CPIXEL and a run length
+ *   130-255  palette RLE: a palette of (subencoding - 128) CPIXELs, then
+ *            runs, each a palette index (with bit 7 set) and a run length,
+ *            or a single pixel given by its index alone
+ *
+ * Run lengths are sent as (length - 1) in bytes of 255 followed by one
+ * byte less than 255.  A CPIXEL is a pixel in the client's format, except
+ * that with 32 bits per pixel, true colour and all the colour bits in the
+ * least or most significant three bytes, only those three bytes are sent.
+ */
+
+typedef struct _rfbZRLEHeader {
+    CARD32 length;
+} rfbZRLEHeader;
+
+#define sz_rfbZRLEHeader 4
+
+#define rfbZRLETileWidth 64
+#define rfbZRLETileHeight 64
+
+
 /*- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  * Tight Encoding.
  *
@@ -674,8 +720,9 @@ typedef struct _rfbZlibHeader {
  *   bit 3:    if 1, then compression stream 3 should be reset;
  *   bits 7-4: if 1000 (0x08), then the compression type is "fill",
  *             if 1001 (0x09), then the compression type is "jpeg",
+ *             if 1010 (0x0A), then the compression type is "lz4",
  *             if 0xxx, then the compression type is "basic",
- *             values greater than 1001 are not valid.
+ *             values greater than 1010 are not valid.
  *
  * If the compression type is "basic", then bits 6..4 of the
  * compression control byte (those xxx in 0xxx) specify the following:
@@ -767,6 +814,17 @@ typedef struct _rfbZlibHeader {
  * Data size is compactly represented in one, two or three bytes, just like
  * in the "jpeg" compression method (see above).
  *
+ *-- The "lz4" compression type may only be used with clients listing
+ * rfbEncodingTightLz4 among their encodings. It is the "basic" type with
+ * two differences: the "filter id" byte is always present, and the pixel
+ * data is compressed as a single LZ4 block (the format produced by
+ * LZ4_compress_default()) instead of going through a zlib stream. As
+ * with "basic", data less than 12 bytes long is sent as is; otherwise
+ * the data size in compact representation precedes the block, which
+ * decompresses to exactly the filtered data size. An LZ4 block does not
+ * depend on earlier ones, so there is no stream to reset, but the reset
+ * bits still apply to the zlib streams.
+ *
  *-- NOTE 1. If the color depth is 24, and all three color components are
  * 8-bit wide, then one pixel in Tight encoding is always represented by
  * three bytes, where the first byte is red component, the second byte is
@@ -792,7 +850,8 @@ typedef struct _rfbZlibHeader {
 #define rfbTightExplicitFilter         0x04
 #define rfbTightFill                   0x08
 #define rfbTightJpeg                   0x09
-#define rfbTightMaxSubencoding         0x09
+#define rfbTightLz4                    0x0A
+#define rfbTightMaxSubencoding         0x0A
 
 /* Filters to improve compression efficiency */
 #define rfbTightFilterCopy             0x00
@@ -909,6 +968,27 @@ typedef struct _rfbServerCutTextMsg {
 
 #define sz_rfbServerCutTextMsg 8
 
+/*-----------------------------------------------------------------------------
+ * FecParity - lets the client rebuild one lost datagram out of a group of
+ * pushed datagrams.  Only sent to clients listing rfbEncodingFecParity.
+ *
+ * The group is the count datagrams with seqNums firstSeqNum to firstSeqNum +
+ * count - 1, all from the same frame.  The message is followed by the XOR of
+ * those datagrams, each padded with zeros to the length of the longest one.
+ * XORing it with all but one of them gives the missing datagram, and
+ * lengthXor, the XOR of their lengths, gives its length.
+ */
+
+typedef struct _rfbFecParityMsg {
+    CARD8 type;			/* always rfbFecParity */
+    CARD8 count;
+    CARD16 lengthXor;
+    CARD32 firstSeqNum;
+    /* followed by char parity[] */
+} rfbFecParityMsg;
+
+#define sz_rfbFecParityMsg 8
+
 /*-----------------------------------------------------------------------------
  * FileListData
  */
@@ -977,6 +1057,7 @@ typedef union _rfbServerToClientMsg {
     rfbSetColourMapEntriesMsg scme;
     rfbBellMsg b;
     rfbServerCutTextMsg sct;
+    rfbFecParityMsg fp;
     rfbFileListDataMsg fld;
     rfbFileDownloadDataMsg fdd;
     rfbFileUploadCancelMsg fuc;
@@ -1149,6 +1230,63 @@ typedef struct _rfbFramebufferUpdateAckMsg {
 
 #define sz_rfbFramebufferUpdateAckMsg 8
 
+/*-----------------------------------------------------------------------------
+ * FramebufferUpdateSack - acknowledges a batch of pushed datagrams. Bit i of
+ * the bitmap (least significant first) acknowledges seqNum baseSeqNum + i.
+ * ackDelay is how long, in milliseconds, the client held the ack for the
+ * highest acknowledged seqNum before sending this message.  recovered is
+ * the number of acknowledged datagrams the client had to rebuild from
+ * FecParity, so that the server can tell how many were really lost.
+ */
+
+typedef struct _rfbFramebufferUpdateSackMsg {
+    CARD8 type;			/* always rfbFramebufferUpdateSack */
+    CARD8 recovered;
+    CARD16 ackDelay;
+    CARD32 baseSeqNum;
+    CARD32 bitmap;
+} rfbFramebufferUpdateSackMsg;
+
+#define sz_rfbFramebufferUpdateSackMsg 12
+
+/*-----------------------------------------------------------------------------
+ * FramebufferUpdateNack - reports pushed datagrams that the client found
+ * missing from a gap in the seqNums it received.  Bit i of the bitmap
+ * stands for seqNum baseSeqNum + i.  The server sends their areas again
+ * without waiting for its retransmit timeout.  Only sent if the server
+ * lists sig_rfbFramebufferUpdateNack among its client message
+ * capabilities.
+ */
+
+typedef struct _rfbFramebufferUpdateNackMsg {
+    CARD8 type;			/* always rfbFramebufferUpdateNack */
+    CARD8 pad1;
+    CARD16 pad2;
+    CARD32 baseSeqNum;
+    CARD32 bitmap;
+} rfbFramebufferUpdateNackMsg;
+
+#define sz_rfbFramebufferUpdateNackMsg 12
+
+/*-----------------------------------------------------------------------------
+ * SetScale - asks the server to send the framebuffer reduced by an integer
+ * factor (1 to rfbMaxScale, 1 meaning full size).  Only sent if the server
+ * lists sig_rfbSetScale among its client message capabilities, and only
+ * honoured for true colour clients that accept NewFBSize.  The server
+ * answers with a NewFBSize rectangle giving the reduced size; from then on
+ * all rectangles and pointer events are in reduced coordinates.
+ */
+
+typedef struct _rfbSetScaleMsg {
+    CARD8 type;			/* always rfbSetScale */
+    CARD8 scale;
+    CARD16 pad;
+} rfbSetScaleMsg;
+
+#define sz_rfbSetScaleMsg 4
+
+#define rfbMaxScale 8
+
 /*-----------------------------------------------------------------------------
  * FileListRequest
  */
@@ -1259,6 +1397,9 @@ typedef union _rfbClientToServerMsg {
     rfbPointerEventMsg pe;
     rfbClientCutTextMsg cct;
     rfbFramebufferUpdateAckMsg fua;
+    rfbFramebufferUpdateSackMsg fusa;
+    rfbSetScaleMsg ss;
+    rfbFramebufferUpdateNackMsg funa;
     rfbFileListRequestMsg flr;
     rfbFileDownloadRequestMsg fdr;
     rfbFileUploadRequestMsg fupr;
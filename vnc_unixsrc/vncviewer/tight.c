@@ -151,8 +151,8 @@ HandleTightBPP (int rx, int ry, int rw, int rh)
   }
 #endif
 
-  /* Quit on unsupported subencoding value. */
-  if (comp_ctl > rfbTightMaxSubencoding) {
+  /* Quit on unsupported subencoding value. LZ4 is never asked for. */
+  if (comp_ctl > rfbTightMaxSubencoding || comp_ctl == rfbTightLz4) {
     fprintf(stderr, "Tight encoding: bad subencoding value received.\n");
     return False;
   }